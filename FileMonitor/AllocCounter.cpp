@@ -0,0 +1,127 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "AllocCounter.h"
+
+#ifdef FILEMON_COUNT_ALLOCS
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <new>
+
+// The calling thread's allocation count.
+static __thread uint64_t numAllocs_s = 0;
+
+//-----------------------------------------------------------------------------
+// Allocate memory, counting the allocation against the calling thread.
+
+static void * countedAlloc(size_t size)
+{
+    numAllocs_s += 1;
+    return malloc(size != 0 ? size : 1);
+}
+
+//-----------------------------------------------------------------------------
+
+void * operator new(size_t size)
+{
+    void * p = countedAlloc(size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+//-----------------------------------------------------------------------------
+
+void * operator new[](size_t size)
+{
+    void * p = countedAlloc(size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+//-----------------------------------------------------------------------------
+
+void * operator new(size_t size, std::nothrow_t const &) throw()
+{
+    return countedAlloc(size);
+}
+
+//-----------------------------------------------------------------------------
+
+void * operator new[](size_t size, std::nothrow_t const &) throw()
+{
+    return countedAlloc(size);
+}
+
+//-----------------------------------------------------------------------------
+
+void operator delete(void * p) throw()
+{
+    free(p);
+}
+
+//-----------------------------------------------------------------------------
+
+void operator delete[](void * p) throw()
+{
+    free(p);
+}
+
+//-----------------------------------------------------------------------------
+
+uint64_t getThreadAllocCount()
+{
+    return numAllocs_s;
+}
+
+//-----------------------------------------------------------------------------
+
+AllocCheck_t::AllocCheck_t(char const * what, uint64_t & numRuns)
+    : what_pm(what),
+      count_m(numAllocs_s),
+      isArmed_m(++numRuns > FILEMON_ALLOC_WARMUP_RUNS)
+{}
+
+//-----------------------------------------------------------------------------
+
+AllocCheck_t::~AllocCheck_t()
+{
+    if (isArmed_m && numAllocs_s != count_m) {
+        fprintf(stderr, "Error: %llu heap allocations while %s\n", (unsigned long long) (numAllocs_s - count_m), what_pm);
+        abort();
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+AllocExempt_t::AllocExempt_t()
+    : count_m(numAllocs_s)
+{}
+
+//-----------------------------------------------------------------------------
+
+AllocExempt_t::~AllocExempt_t()
+{
+    numAllocs_s = count_m;
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef __INC_AllocCounter_H
+#define __INC_AllocCounter_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+
+// Allocation counting, for checking that the steady state event path doesn't touch the heap. A build with FILEMON_COUNT_ALLOCS defined replaces the global operator new and delete with versions that count each thread's allocations, and arms the checks below; in a normal build they compile to nothing.
+
+// The number of times a check's scope is run before the check is armed, so that the buffers and pools have grown to their working sizes.
+#ifndef FILEMON_ALLOC_WARMUP_RUNS
+#define FILEMON_ALLOC_WARMUP_RUNS 16
+#endif
+
+#ifdef FILEMON_COUNT_ALLOCS
+
+// Returns the number of heap allocations that the calling thread has made.
+uint64_t getThreadAllocCount();
+
+// This class checks that the calling thread makes no heap allocations during the scope of an instance, once the scope has been run FILEMON_ALLOC_WARMUP_RUNS times. If it does, the process is terminated with an error, so that a replay of events under a counting build fails loudly.
+class AllocCheck_t
+{
+private:
+
+    char const * what_pm;
+    uint64_t count_m;
+    bool isArmed_m;
+
+public:
+
+    // Constructor. The run count is the caller's own count of runs of the scope.
+    AllocCheck_t(char const * what, uint64_t & numRuns);
+
+    // Destructor. Checks the count.
+    ~AllocCheck_t();
+
+private:
+
+    // Not copyable.
+    AllocCheck_t(AllocCheck_t const &);
+    AllocCheck_t & operator=(AllocCheck_t const &);
+};
+
+// This class exempts the allocations made by the calling thread during the scope of an instance from the checks, for work that allocates by design, such as remembering a path that hasn't been seen before.
+class AllocExempt_t
+{
+private:
+
+    uint64_t count_m;
+
+public:
+
+    // Constructor.
+    AllocExempt_t();
+
+    // Destructor. Takes the scope's allocations back off the count.
+    ~AllocExempt_t();
+
+private:
+
+    // Not copyable.
+    AllocExempt_t(AllocExempt_t const &);
+    AllocExempt_t & operator=(AllocExempt_t const &);
+};
+
+#else
+
+class AllocCheck_t
+{
+public:
+
+    AllocCheck_t(char const *, uint64_t &) {}
+};
+
+class AllocExempt_t
+{
+public:
+
+    AllocExempt_t() {}
+};
+
+#endif
+
+#endif // __INC_AllocCounter_H
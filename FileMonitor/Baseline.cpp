@@ -0,0 +1,428 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "AllocCounter.h"
+#include "Baseline.h"
+#include "JournalFormat.h"
+#include "Mirror.h"
+#include "MutexLocker.h"
+
+size_t const BaselineScanner_t::MAX_CHANGED;
+size_t const BaselineScanner_t::MAX_LOCKED_RESTATS;
+int const BaselineScanner_t::MAX_ROUNDS;
+size_t const BaselineScanner_t::MAX_WRITE_SIZE;
+
+//-----------------------------------------------------------------------------
+// Collects the keys of a set of paths.
+
+struct PathCollector_t
+{
+    std::vector<std::string> * paths_pm;
+    void operator()(std::string const & path) const { paths_pm->push_back(path); }
+};
+
+//-----------------------------------------------------------------------------
+
+BaselineScanner_t::BaselineScanner_t(int numThreads, pthread_mutex_t * mutex_p, OutputSink_t * sink, FormatterPool_t * pool)
+    : mutex_pm(mutex_p),
+      sink_pm(sink),
+      pool_pm(pool),
+      numQueued_m(0),
+      numStarted_m(0)
+{
+    pthread_mutex_init(&mutex_m, NULL);
+    pthread_cond_init(&workCond_m, NULL);
+
+    for (int i = 0; i < numThreads; ++i) {
+        Deque_t * deque_p = new Deque_t;
+        pthread_mutex_init(&deque_p->mutex_m, NULL);
+        deques_m.push_back(deque_p);
+    }
+
+    for (int i = 0; i < numThreads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, threadEntry, this) != 0) {
+            perror(NULL);
+            exit(1);
+        }
+        threads_m.push_back(thread);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void BaselineScanner_t::scan(std::string const & root)
+{
+    Job_t * job_p = new Job_t;
+    job_p->root_m = root;
+    job_p->numPending_m = 0;
+    job_p->numEntries_m = 1;
+    job_p->numRounds_m = 0;
+    job_p->isIncomplete_m = false;
+    jobs_m.push_back(job_p);
+
+    // The start line is written with the event mutex held, so that every event after it is one that the scan may have missed. It goes straight to the sink even with a formatter pool, since the scan's entries do too, and must follow it; the events from before it that the pool writes after it are then just redundant.
+    std::string out = "SNAPSHOT-BEGIN: " + root + "\n";
+    appendEntry(root, out);
+    sink_pm->writeMessage(out.data(), out.size());
+
+    // A root that isn't a directory just fails to open, and the scan finishes.
+    push(jobs_m.size() % deques_m.size(), job_p, root);
+}
+
+//-----------------------------------------------------------------------------
+
+void BaselineScanner_t::addEvent(EventView_t const & event)
+{
+    if (jobs_m.empty()) {
+        return;
+    }
+
+    if (event.getBaseType() == FSE_EVENTS_DROPPED) {
+        for (size_t j = 0; j < jobs_m.size(); ++j) {
+            jobs_m[j]->isIncomplete_m = true;
+        }
+        return;
+    }
+
+    int numPaths = 0;
+    for (int i = 0; i < event.numArgs_m && numPaths < 2; ++i) {
+        EventArg_t const & arg = event.args_am[i];
+        if (!arg.isPath()) {
+            continue;
+        }
+
+        // The destination of a rename, and both paths of an exchange, may be directories with contents that no event mentions.
+        size_t len = arg.pathLen();
+        bool isReplaced = (event.getBaseType() == FSE_RENAME && numPaths == 1) || event.getBaseType() == FSE_EXCHANGE;
+        numPaths += 1;
+
+        for (size_t j = 0; j < jobs_m.size(); ++j) {
+            Job_t * job_p = jobs_m[j];
+            if (!isPathUnder(arg.data_m, len, job_p->root_m)) {
+                continue;
+            }
+            FlatHashSet_t<std::string, StrHashTraits_t> & paths = isReplaced ? job_p->replaced_m : job_p->changed_m;
+            if (paths.contains(StrRef_t(arg.data_m, len))) {
+                continue;
+            }
+            if (job_p->changed_m.size() + job_p->replaced_m.size() >= MAX_CHANGED) {
+                job_p->isIncomplete_m = true;
+                continue;
+            }
+
+            // Remembering a new path allocates by design.
+            AllocExempt_t allocExempt;
+            paths.insert(std::string(arg.data_m, len));
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void BaselineScanner_t::appendStats(std::string & out, char const * prefix)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    char line [256];
+    snprintf(line, sizeof(line), "%s%lu scans in progress, %lld directories queued\n", prefix, (unsigned long) jobs_m.size(), (long long) numQueued_m);
+    out += line;
+}
+
+//-----------------------------------------------------------------------------
+
+void * BaselineScanner_t::threadEntry(void * arg)
+{
+    ((BaselineScanner_t *) arg)->run();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void BaselineScanner_t::run()
+{
+    size_t self;
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        self = numStarted_m++;
+    }
+
+    std::string out;
+    Dir_t dir;
+    while (true) {
+        if (!pop(self, dir)) {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            while (numQueued_m <= 0) {
+                MUTEX_COND_WAIT(&workCond_m);
+            }
+            continue;
+        }
+
+        read(self, dir, out);
+
+        bool isDone;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            dir.job_pm->numPending_m -= 1;
+            isDone = dir.job_pm->numPending_m == 0;
+        }
+        if (isDone) {
+            finish(self, dir.job_pm);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void BaselineScanner_t::push(size_t self, Job_t * job_p, std::string const & path)
+{
+    // The scan mustn't look finished while the directory is in transit.
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        job_p->numPending_m += 1;
+    }
+
+    Dir_t dir;
+    dir.job_pm = job_p;
+    dir.path_m = path;
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&deques_m[self]->mutex_m);
+        deques_m[self]->dirs_m.push_back(dir);
+    }
+
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    numQueued_m += 1;
+    pthread_cond_signal(&workCond_m);
+}
+
+//-----------------------------------------------------------------------------
+
+bool BaselineScanner_t::pop(size_t self, Dir_t & dir)
+{
+    bool isFound = false;
+    for (size_t i = 0; i < deques_m.size() && !isFound; ++i) {
+        Deque_t * deque_p = deques_m[(self + i) % deques_m.size()];
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&deque_p->mutex_m);
+        if (deque_p->dirs_m.empty()) {
+            continue;
+        }
+
+        // The newest directory is taken from the thread's own deque, and the oldest is stolen from another's.
+        if (i == 0) {
+            dir.job_pm = deque_p->dirs_m.back().job_pm;
+            dir.path_m.swap(deque_p->dirs_m.back().path_m);
+            deque_p->dirs_m.pop_back();
+        }
+        else {
+            dir.job_pm = deque_p->dirs_m.front().job_pm;
+            dir.path_m.swap(deque_p->dirs_m.front().path_m);
+            deque_p->dirs_m.pop_front();
+        }
+        isFound = true;
+    }
+
+    if (isFound) {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        numQueued_m -= 1;
+    }
+    return isFound;
+}
+
+//-----------------------------------------------------------------------------
+
+void BaselineScanner_t::read(size_t self, Dir_t const & dir, std::string & out)
+{
+    int fd = open(dir.path_m.c_str(), O_RDONLY | O_DIRECTORY);
+    if (fd < 0) {
+        return;
+    }
+    DIR * dirp = fdopendir(fd);
+    if (dirp == NULL) {
+        close(fd);
+        return;
+    }
+
+    // The entries are stat'ed relative to the directory, so the kernel doesn't look up the whole path again for each one.
+    out.clear();
+    uint64_t numEntries = 0;
+    uint32_t numUnwritten = 0;
+    std::string path;
+    MirrorAttrs_t attrs;
+    struct dirent * entry;
+    while ((entry = readdir(dirp)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        struct stat st;
+        if (fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            continue;
+        }
+
+        path.assign(dir.path_m);
+        if (path != "/") {
+            path += '/';
+        }
+        path += entry->d_name;
+        setMirrorAttrs(attrs, st);
+        appendMirrorAttrs("SNAP: ", attrs, path.data(), path.size(), out);
+        numEntries += 1;
+        numUnwritten += 1;
+
+        if (S_ISDIR(st.st_mode)) {
+            push(self, dir.job_pm, path);
+        }
+
+        if (out.size() >= MAX_WRITE_SIZE) {
+            sink_pm->writeWhenRoom(out.data(), out.size(), numUnwritten, dir.path_m.data(), dir.path_m.size());
+            out.clear();
+            numUnwritten = 0;
+        }
+    }
+    closedir(dirp);
+
+    if (!out.empty()) {
+        sink_pm->writeWhenRoom(out.data(), out.size(), numUnwritten, dir.path_m.data(), dir.path_m.size());
+    }
+
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    dir.job_pm->numEntries_m += numEntries;
+}
+
+//-----------------------------------------------------------------------------
+
+void BaselineScanner_t::finish(size_t self, Job_t * job_p)
+{
+    std::string out;
+    std::vector<std::string> paths;
+    PathCollector_t collector = { &paths };
+
+    while (true) {
+        bool isReplaced = false;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(mutex_pm);
+            paths.clear();
+
+            if (!job_p->replaced_m.empty() && job_p->numRounds_m < MAX_ROUNDS) {
+                job_p->replaced_m.forEach(collector);
+                job_p->replaced_m.clear();
+                isReplaced = true;
+            }
+            else if (job_p->changed_m.size() > MAX_LOCKED_RESTATS && job_p->numRounds_m < MAX_ROUNDS) {
+                job_p->changed_m.forEach(collector);
+                job_p->changed_m.clear();
+            }
+            else {
+                // The last of the changed paths are re-stat'ed with the event mutex held. The output mustn't wait for the consumer here, since that would hold up the events, nor be dropped, since it ends the snapshot. If the rounds ran out with more paths still changing than can be stat'ed without stalling the events, none of them are, and the snapshot is incomplete.
+                if (job_p->changed_m.size() > MAX_LOCKED_RESTATS) {
+                    job_p->isIncomplete_m = true;
+                }
+                else {
+                    job_p->changed_m.forEach(collector);
+                }
+                job_p->isIncomplete_m = job_p->isIncomplete_m || !job_p->replaced_m.empty();
+                std::sort(paths.begin(), paths.end());
+                out.clear();
+                for (size_t i = 0; i < paths.size(); ++i) {
+                    appendEntry(paths[i], out);
+                }
+
+                uint64_t numEntries;
+                {
+                    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+                    numEntries = job_p->numEntries_m + paths.size();
+                }
+                char buf [64];
+                snprintf(buf, sizeof(buf), " %llu entries%s\n", (unsigned long long) numEntries, job_p->isIncomplete_m ? ", incomplete" : "");
+                out += "SNAPSHOT-END: " + job_p->root_m + buf;
+                if (pool_pm != NULL) {
+                    pool_pm->writeMessage(out.data(), out.size());
+                }
+                else {
+                    sink_pm->writeMessage(out.data(), out.size());
+                }
+
+                jobs_m.erase(std::find(jobs_m.begin(), jobs_m.end(), job_p));
+                delete job_p;
+                return;
+            }
+
+            job_p->numRounds_m += 1;
+        }
+
+        // While there are many changed paths they are re-stat'ed without the event mutex, in rounds, since more events keep arriving.
+        std::sort(paths.begin(), paths.end());
+        out.clear();
+        std::vector<std::string> dirs;
+        for (size_t i = 0; i < paths.size(); ++i) {
+            if (appendEntry(paths[i], out) && isReplaced) {
+                dirs.push_back(paths[i]);
+            }
+        }
+        sink_pm->writeWhenRoom(out.data(), out.size(), (uint32_t) paths.size(), job_p->root_m.data(), job_p->root_m.size());
+
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            job_p->numEntries_m += paths.size();
+        }
+
+        // A replaced directory is scanned, and the scan finishes again once it has been read. They are only queued once their own lines are written, since the end line may follow straight after. The extra pending count keeps the first one from finishing the scan while the others are queued.
+        if (dirs.empty()) {
+            continue;
+        }
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            job_p->numPending_m += 1;
+        }
+        for (size_t i = 0; i < dirs.size(); ++i) {
+            push(self, job_p, dirs[i]);
+        }
+        bool isDone;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            job_p->numPending_m -= 1;
+            isDone = job_p->numPending_m == 0;
+        }
+        if (!isDone) {
+            return;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool BaselineScanner_t::appendEntry(std::string const & path, std::string & out)
+{
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0) {
+        out += "SNAP-GONE: " + path + "\n";
+        return false;
+    }
+
+    MirrorAttrs_t attrs;
+    setMirrorAttrs(attrs, st);
+    appendMirrorAttrs("SNAP: ", attrs, path.data(), path.size(), out);
+    return S_ISDIR(st.st_mode);
+}
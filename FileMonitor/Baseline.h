@@ -0,0 +1,141 @@
+#ifndef __INC_Baseline_H
+#define __INC_Baseline_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <deque>
+#include <string>
+#include <vector>
+
+#include "EventView.h"
+#include "FlatHashSet.h"
+#include "FormatterPool.h"
+#include "OutputSink.h"
+
+// This class writes a baseline snapshot of newly monitored trees to the output, so that consumers get the initial state of a tree as well as the changes to it, without walking it themselves. The snapshot is framed by "SNAPSHOT-BEGIN: <root>" and "SNAPSHOT-END: <root> <n> entries" lines, with a "SNAP: <type> ino=<n> size=<n> mtime=<secs> <path>" line for every file and directory, in the same form as the mirror's replies.
+//
+// The trees are read by a pool of threads. Each thread keeps its own deque of directories: it pushes the subdirectories it finds onto the back and pops from the back, so it works depth first through a subtree, and a thread that runs out of work steals from the front of another's deque, which is where the biggest subtrees are. Each directory is read through its own descriptor, with every entry stat'ed relative to it, and its entries are written to the output in runs of up to 64 KiB; the threads wait for room in the output rather than dropping entries.
+//
+// The events that arrive while a tree is being scanned are written out as usual, and their paths are remembered. When the scan is done the remembered paths are stat'ed again and written out, as "SNAP-GONE: <path>" if they no longer exist, and a directory that was renamed or exchanged into the tree is scanned. The last of these are done with the event mutex held, so that no event can come between the stat and the output. The start and end lines are written as messages, which are never dropped and never wait for the consumer. If the events are formatted on a pool of threads, the end line and the last entries are sequenced after the output of the events that came before them, so the guarantee holds there too. A path can therefore appear more than once in a snapshot; the last line for a path is the one that holds. If the kernel drops events during a scan, or too many paths change, or they keep changing faster than the rounds of re-stat'ing catch up, the end line says "incomplete".
+class BaselineScanner_t
+{
+private:
+
+    // A tree being scanned.
+    struct Job_t
+    {
+        std::string root_m;
+        size_t numPending_m;  // Directories queued or being read. Protected by mutex_m.
+        uint64_t numEntries_m; // Protected by mutex_m
+        int numRounds_m;      // Rounds of re-stat'ing. Only used by the thread that finishes a scan.
+
+        // The paths that events changed during the scan, and those that were renamed or exchanged into it. Protected by the event mutex.
+        FlatHashSet_t<std::string, StrHashTraits_t> changed_m;
+        FlatHashSet_t<std::string, StrHashTraits_t> replaced_m;
+        bool isIncomplete_m;
+    };
+
+    // A directory waiting to be read.
+    struct Dir_t
+    {
+        Job_t * job_pm;
+        std::string path_m;
+    };
+
+    // A scan thread's own deque of directories.
+    struct Deque_t
+    {
+        pthread_mutex_t mutex_m;
+        std::deque<Dir_t> dirs_m;
+    };
+
+    // The most changed paths to remember during a scan. Beyond this the snapshot is incomplete.
+    static size_t const MAX_CHANGED = 1024 * 1024;
+
+    // The most changed paths to re-stat with the event mutex held. Until there are this few, they are re-stat'ed without it, in rounds. If there are still more after the last round, the snapshot is incomplete.
+    static size_t const MAX_LOCKED_RESTATS = 1024;
+
+    // The most rounds of re-stat'ing and rescanning before settling for what there is.
+    static int const MAX_ROUNDS = 8;
+
+    // The largest run of entries written at once.
+    static size_t const MAX_WRITE_SIZE = 64 * 1024;
+
+    // The event mutex, which the reader thread holds while processing events. Protects the jobs.
+    pthread_mutex_t * mutex_pm;
+    std::vector<Job_t *> jobs_m;
+
+    OutputSink_t * sink_pm;
+    FormatterPool_t * pool_pm;
+
+    // Protects the queued directory count and the jobs' directory counts.
+    pthread_mutex_t mutex_m;
+    pthread_cond_t workCond_m;
+    int64_t numQueued_m;
+    size_t numStarted_m;
+
+    std::vector<Deque_t *> deques_m;
+    std::vector<pthread_t> threads_m;
+
+public:
+
+    // Constructor. Starts the scan threads. The formatter pool, if there is one, is the one that formats the events.
+    BaselineScanner_t(int numThreads, pthread_mutex_t * mutex_p, OutputSink_t * sink, FormatterPool_t * pool);
+
+    // Starts a scan of a tree. Must be called with the event mutex held.
+    void scan(std::string const & root);
+
+    // Remembers the paths of an event that are under a tree being scanned. Must be called with the event mutex held.
+    void addEvent(EventView_t const & event);
+
+    // Appends the number of scans in progress on a single line. Must be called with the event mutex held.
+    void appendStats(std::string & out, char const * prefix);
+
+private:
+
+    // The scan thread entry function.
+    static void * threadEntry(void * arg);
+
+    // The scan thread loop.
+    void run();
+
+    // Queues a directory on a thread's deque.
+    void push(size_t self, Job_t * job_p, std::string const & path);
+
+    // Takes a directory from a thread's own deque, or else steals one from another thread. Returns false if there are none.
+    bool pop(size_t self, Dir_t & dir);
+
+    // Reads a directory, writing out its entries and queueing its subdirectories.
+    void read(size_t self, Dir_t const & dir, std::string & out);
+
+    // Re-stats the paths that changed during a scan and writes the end line, once all of its directories have been read. Directories that were renamed or exchanged into the tree are queued instead, and the scan is finished once they have been read.
+    void finish(size_t self, Job_t * job_p);
+
+    // Stats a path and appends its snapshot line. Returns true if it is a directory.
+    static bool appendEntry(std::string const & path, std::string & out);
+
+    // Not copyable.
+    BaselineScanner_t(BaselineScanner_t const &);
+    BaselineScanner_t & operator=(BaselineScanner_t const &);
+};
+
+#endif // __INC_Baseline_H
@@ -0,0 +1,377 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <CommonCrypto/CommonDigest.h>
+
+#include "ContentHash.h"
+#include "fsevents.h"
+#include "MutexLocker.h"
+
+uint32_t const ContentHasher_t::NUM_SLOTS;
+uint32_t const ContentHasher_t::NO_SLOT;
+size_t const ContentHasher_t::MAX_CACHED;
+size_t const ContentHasher_t::READ_SIZE;
+
+//-----------------------------------------------------------------------------
+
+ContentHasher_t::ContentHasher_t(int numThreads, OutputSink_t * sink, FormatterPool_t * pool)
+    : sink_pm(sink),
+      pool_pm(pool),
+      slots_apm(new Slot_t [NUM_SLOTS]),
+      index_m(2 * NUM_SLOTS, NO_SLOT),
+      numQueued_m(0),
+      numCoalesced_m(0),
+      numDropped_m(0),
+      numHashed_m(0),
+      numUnchanged_m(0),
+      numSkipped_m(0)
+{
+    pthread_mutex_init(&mutex_m, NULL);
+    pthread_cond_init(&workCond_m, NULL);
+
+    // Every slot is in at most one place in each queue, so they never grow.
+    free_m.reserve(NUM_SLOTS);
+    for (uint32_t slot = NUM_SLOTS; slot > 0; --slot) {
+        free_m.push_back(slot - 1);
+    }
+    pending_m.reserve(NUM_SLOTS);
+    queue_m.reserve(NUM_SLOTS);
+
+    for (int i = 0; i < numThreads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, threadEntry, this) != 0) {
+            perror(NULL);
+            exit(1);
+        }
+        threads_m.push_back(thread);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool ContentHasher_t::setPatterns(std::vector<PathPattern_t> const & patterns, std::string & error)
+{
+    return filter_m.compile(patterns, error);
+}
+
+//-----------------------------------------------------------------------------
+
+void ContentHasher_t::addEvent(EventView_t const & event, uint32_t matchMask)
+{
+    // A file renamed into place, as an atomic save does, has new contents under its destination path, which is the second.
+    int type = event.getBaseType();
+    int hashedPath;
+    if (type == FSE_CREATE_FILE || type == FSE_CONTENT_MODIFIED) {
+        hashedPath = 0;
+    }
+    else if (type == FSE_RENAME) {
+        hashedPath = 1;
+    }
+    else {
+        return;
+    }
+
+    int numPaths = 0;
+    for (int i = 0; i < event.numArgs_m; ++i) {
+        EventArg_t const & arg = event.args_am[i];
+        if (!arg.isPath()) {
+            continue;
+        }
+        if (numPaths++ != hashedPath) {
+            continue;
+        }
+
+        size_t len = arg.pathLen();
+        if ((matchMask & (1u << i)) == 0 || !filter_m.isPassed(arg.data_m, len)) {
+            return;
+        }
+
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        uint64_t hash = StrHashTraits_t::hash(StrRef_t(arg.data_m, len));
+        uint32_t slot = findSlot(arg.data_m, len, hash);
+        if (slot != NO_SLOT) {
+            numCoalesced_m++;
+            if (slots_apm[slot].state_m == SLOT_HASHING) {
+                slots_apm[slot].state_m = SLOT_CHANGED_PENDING;
+                pending_m.push_back(slot);
+            }
+        }
+        else if (free_m.empty() || len >= sizeof(slots_apm[0].path_am)) {
+            numDropped_m++;
+        }
+        else {
+            slot = free_m.back();
+            free_m.pop_back();
+            Slot_t & s = slots_apm[slot];
+            memcpy(s.path_am, arg.data_m, len);
+            s.path_am[len] = '\0';
+            s.len_m = (uint32_t) len;
+            s.hash_m = hash;
+            s.state_m = SLOT_PENDING;
+            insertSlot(slot);
+            pending_m.push_back(slot);
+        }
+        return;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void ContentHasher_t::flush()
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    if (pending_m.empty()) {
+        return;
+    }
+
+    // A path that changed again while it was being hashed is queued by the thread hashing it once it is done.
+    while (!pending_m.empty()) {
+        uint32_t slot = pending_m.front();
+        pending_m.pop_front();
+        Slot_t & s = slots_apm[slot];
+        if (s.state_m == SLOT_PENDING) {
+            s.state_m = SLOT_QUEUED;
+            queue_m.push_back(slot);
+            numQueued_m++;
+        }
+        else if (s.state_m == SLOT_CHANGED_PENDING) {
+            s.state_m = SLOT_CHANGED;
+        }
+    }
+    pthread_cond_broadcast(&workCond_m);
+}
+
+//-----------------------------------------------------------------------------
+
+void ContentHasher_t::appendStats(std::string & out, char const * prefix)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    char line [512];
+    snprintf(line, sizeof(line), "%s%lu threads, %lu queued, %llu files queued, %llu coalesced, %llu dropped, %llu hashed, %llu unchanged, %llu skipped\n",
+            prefix, (unsigned long) threads_m.size(), (unsigned long) queue_m.size(), (unsigned long long) numQueued_m, (unsigned long long) numCoalesced_m,
+            (unsigned long long) numDropped_m, (unsigned long long) numHashed_m, (unsigned long long) numUnchanged_m, (unsigned long long) numSkipped_m);
+    out += line;
+}
+
+//-----------------------------------------------------------------------------
+
+void * ContentHasher_t::threadEntry(void * arg)
+{
+    ((ContentHasher_t *) arg)->run();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void ContentHasher_t::run()
+{
+    std::vector<char> buf(READ_SIZE);
+    std::string path;
+    std::string out;
+    while (true) {
+        uint32_t slot;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            while (queue_m.empty()) {
+                MUTEX_COND_WAIT(&workCond_m);
+            }
+            slot = queue_m.front();
+            queue_m.pop_front();
+            slots_apm[slot].state_m = SLOT_HASHING;
+            path.assign(slots_apm[slot].path_am, slots_apm[slot].len_m);
+        }
+
+        out.clear();
+        hash(path, &buf[0], out);
+
+        // The output is written at the consumer's pace, which holds up only this thread. The event that queued the path was flushed after its batch was sequenced, so waiting for the batches sequenced so far puts the line after the event.
+        if (!out.empty()) {
+            if (pool_pm != NULL) {
+                pool_pm->waitForSequenced();
+            }
+            size_t dirLen = path.rfind('/');
+            sink_pm->writeWhenRoom(out.data(), out.size(), 1, path.data(), dirLen == std::string::npos ? 0 : dirLen);
+        }
+
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        Slot_t & s = slots_apm[slot];
+        if (s.state_m == SLOT_CHANGED) {
+            s.state_m = SLOT_QUEUED;
+            queue_m.push_back(slot);
+            numQueued_m++;
+            pthread_cond_signal(&workCond_m);
+        }
+        else if (s.state_m == SLOT_CHANGED_PENDING) {
+            // It is still waiting to be flushed, which queues it again.
+            s.state_m = SLOT_PENDING;
+        }
+        else {
+            eraseSlot(slot);
+            s.state_m = SLOT_FREE;
+            free_m.push_back(slot);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+uint32_t ContentHasher_t::findSlot(char const * path, size_t len, uint64_t hash) const
+{
+    size_t mask = index_m.size() - 1;
+    for (size_t i = hash & mask; index_m[i] != NO_SLOT; i = (i + 1) & mask) {
+        Slot_t const & s = slots_apm[index_m[i]];
+        if (s.hash_m == hash && s.len_m == len && memcmp(s.path_am, path, len) == 0) {
+            return index_m[i];
+        }
+    }
+    return NO_SLOT;
+}
+
+//-----------------------------------------------------------------------------
+
+void ContentHasher_t::insertSlot(uint32_t slot)
+{
+    // The index has twice as many entries as there are slots, so there is always an empty one.
+    size_t mask = index_m.size() - 1;
+    size_t i = slots_apm[slot].hash_m & mask;
+    while (index_m[i] != NO_SLOT) {
+        i = (i + 1) & mask;
+    }
+    index_m[i] = slot;
+}
+
+//-----------------------------------------------------------------------------
+
+void ContentHasher_t::eraseSlot(uint32_t slot)
+{
+    size_t mask = index_m.size() - 1;
+    size_t i = slots_apm[slot].hash_m & mask;
+    while (index_m[i] != slot) {
+        i = (i + 1) & mask;
+    }
+    index_m[i] = NO_SLOT;
+
+    // Reinsert the rest of the run, since a probe for any of them could otherwise stop at the new gap.
+    for (i = (i + 1) & mask; index_m[i] != NO_SLOT; i = (i + 1) & mask) {
+        uint32_t moved = index_m[i];
+        index_m[i] = NO_SLOT;
+        insertSlot(moved);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void ContentHasher_t::hash(std::string const & path, char * buf, std::string & out)
+{
+    // Only regular files are hashed. Opening without following links or blocking keeps a path that has just been replaced by something else from being read.
+    struct stat st;
+    if (lstat(path.c_str(), &st) != 0 || !S_ISREG(st.st_mode)) {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        numSkipped_m++;
+        return;
+    }
+
+    FileState_t state;
+    setFileState(state, st);
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        std::map<std::string, FileState_t>::iterator iter = cache_m.find(path);
+        if (iter != cache_m.end() && memcmp(&iter->second, &state, sizeof(state)) == 0) {
+            numUnchanged_m++;
+            return;
+        }
+    }
+
+    int fd = open(path.c_str(), O_RDONLY | O_NOFOLLOW | O_NONBLOCK);
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        numSkipped_m++;
+        return;
+    }
+    setFileState(state, st);
+
+    CC_SHA256_CTX ctx;
+    CC_SHA256_Init(&ctx);
+    bool isRead = true;
+    while (true) {
+        ssize_t len = read(fd, buf, READ_SIZE);
+        if (len < 0) {
+            isRead = false;
+            break;
+        }
+        if (len == 0) {
+            break;
+        }
+        CC_SHA256_Update(&ctx, buf, (CC_LONG) len);
+    }
+    unsigned char digest [CC_SHA256_DIGEST_LENGTH];
+    CC_SHA256_Final(digest, &ctx);
+
+    // A file that was written meanwhile has had another event, which hashes it again.
+    FileState_t after;
+    isRead = isRead && fstat(fd, &st) == 0;
+    close(fd);
+    setFileState(after, st);
+    if (!isRead || memcmp(&after, &state, sizeof(state)) != 0) {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        numSkipped_m++;
+        return;
+    }
+
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        if (cache_m.size() >= MAX_CACHED) {
+            cache_m.clear();
+        }
+        cache_m[path] = state;
+        numHashed_m++;
+    }
+
+    static char const HEX_DIGITS [] = "0123456789abcdef";
+    char hex [2 * CC_SHA256_DIGEST_LENGTH + 1];
+    for (int i = 0; i < CC_SHA256_DIGEST_LENGTH; ++i) {
+        hex[2 * i] = HEX_DIGITS[digest[i] >> 4];
+        hex[2 * i + 1] = HEX_DIGITS[digest[i] & 0x0f];
+    }
+    hex[2 * CC_SHA256_DIGEST_LENGTH] = '\0';
+
+    char line [256];
+    snprintf(line, sizeof(line), "HASH: sha256=%s ino=%llu size=%llu mtime=%lld ", hex,
+             (unsigned long long) state.inode_m, (unsigned long long) state.size_m, (long long) state.mtimeSecs_m);
+    out += line;
+    out += path;
+    out += "\n";
+}
+
+//-----------------------------------------------------------------------------
+
+void ContentHasher_t::setFileState(FileState_t & state, struct stat const & st)
+{
+    memset(&state, 0, sizeof(state));
+    state.inode_m = st.st_ino;
+    state.size_m = st.st_size;
+    state.mtimeSecs_m = st.st_mtimespec.tv_sec;
+    state.mtimeNsecs_m = st.st_mtimespec.tv_nsec;
+}
@@ -0,0 +1,158 @@
+#ifndef __INC_ContentHash_H
+#define __INC_ContentHash_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "EventView.h"
+#include "FlatHashSet.h"
+#include "FormatterPool.h"
+#include "OutputSink.h"
+#include "PathFilter.h"
+#include "RingQueue.h"
+
+// This class follows the matched file creations, content changes and renames into place with a hash of the file's new contents, for integrity monitoring, as "HASH: sha256=<hex> ino=<n> size=<n> mtime=<secs> <path>" lines after the events. The files are hashed by a pool of threads, so the events themselves are never held up.
+//
+// Each path waiting for or being hashed has a slot in a fixed pool, found through an index of its own, so adding the paths of events doesn't allocate. A path has one slot however many events it gets before a thread takes it, so a burst of writes to a file is hashed once. A path that changes while it is being hashed is queued again once the hash is done, rather than being hashed by two threads at once. When every slot is taken, further paths are dropped and counted.
+//
+// The paths added while processing a read of events are only handed to the threads by flush(), once the read's events are in the output, and with a formatter pool a thread waits for the batches sequenced by then to be written before writing its line, so that a HASH line always follows the event that caused it. A file is read in large sequential reads rather than mapped, since a file that is truncated while it is mapped faults the reader. A file with the same inode, size and mtime as when it was last hashed isn't read again, and a file that changes while it is being read isn't reported, since it will be hashed again.
+class ContentHasher_t
+{
+private:
+
+    // A file's attributes when it was last hashed.
+    struct FileState_t
+    {
+        uint64_t inode_m;
+        uint64_t size_m;
+        int64_t mtimeSecs_m;
+        int64_t mtimeNsecs_m;
+    };
+
+    // The states of a slot.
+    enum SlotState_t
+    {
+        SLOT_FREE,
+        SLOT_PENDING,           // Added since the last flush()
+        SLOT_QUEUED,            // Waiting for a thread
+        SLOT_HASHING,           // Being hashed
+        SLOT_CHANGED_PENDING,   // Being hashed, and changed again since the last flush()
+        SLOT_CHANGED            // Being hashed, and to be queued again once it is done
+    };
+
+    // A path waiting for or being hashed.
+    struct Slot_t
+    {
+        uint64_t hash_m;
+        uint32_t len_m;
+        uint32_t state_m;
+        char path_am [PATH_MAX];
+    };
+
+    // The most paths waiting for or being hashed.
+    static uint32_t const NUM_SLOTS = 4096;
+
+    // An empty entry in the index.
+    static uint32_t const NO_SLOT = 0xffffffff;
+
+    // The most files whose attributes are remembered. Beyond this they are all forgotten, which costs each one an extra read.
+    static size_t const MAX_CACHED = 256 * 1024;
+
+    // The size of each read of a file.
+    static size_t const READ_SIZE = 1024 * 1024;
+
+    // The paths to hash. Protected by the event mutex, which the reader thread holds while processing events.
+    PathFilter_t filter_m;
+
+    OutputSink_t * sink_pm;
+    FormatterPool_t * pool_pm;
+
+    // Protects the slots, the index, the queues, the cache and the counters. The index is open addressed, with linear probing, and holds the slot numbers of the paths in use. The slots are allocated without being initialized, so only the pages of the slots that are used are ever touched.
+    pthread_mutex_t mutex_m;
+    pthread_cond_t workCond_m;
+    Slot_t * slots_apm;
+    std::vector<uint32_t> index_m;
+    std::vector<uint32_t> free_m;
+    RingQueue_t<uint32_t> pending_m;    // The slots that changed since the last flush().
+    RingQueue_t<uint32_t> queue_m;      // The slots waiting for a thread.
+    std::map<std::string, FileState_t> cache_m;
+    uint64_t numQueued_m;
+    uint64_t numCoalesced_m;
+    uint64_t numDropped_m;
+    uint64_t numHashed_m;
+    uint64_t numUnchanged_m;
+    uint64_t numSkipped_m;
+
+    std::vector<pthread_t> threads_m;
+
+public:
+
+    // Constructor. Starts the hashing threads. The lines are written to the sink after the batches of the formatter pool, if there is one.
+    ContentHasher_t(int numThreads, OutputSink_t * sink, FormatterPool_t * pool);
+
+    // Sets the include and exclude patterns of the paths to hash, all of them if there are none. Returns false and sets an error message if they don't compile, leaving the current ones. Must be called with the event mutex held.
+    bool setPatterns(std::vector<PathPattern_t> const & patterns, std::string & error);
+
+    // Adds the matched path of an event that changes a file's contents, to be hashed once it is flushed. Must be called with the event mutex held.
+    void addEvent(EventView_t const & event, uint32_t matchMask);
+
+    // Hands the paths added since the last flush to the hashing threads. Must be called with the event mutex held, after the events that added them have been written or sequenced.
+    void flush();
+
+    // Appends the queue length and the counters on a single line.
+    void appendStats(std::string & out, char const * prefix);
+
+private:
+
+    // The hashing thread entry function.
+    static void * threadEntry(void * arg);
+
+    // The hashing thread loop.
+    void run();
+
+    // Returns the slot of a path, or NO_SLOT. Must be called with mutex_m held.
+    uint32_t findSlot(char const * path, size_t len, uint64_t hash) const;
+
+    // Adds a slot to the index. Must be called with mutex_m held.
+    void insertSlot(uint32_t slot);
+
+    // Removes a slot from the index, moving back the entries after it that would otherwise no longer be found. Must be called with mutex_m held.
+    void eraseSlot(uint32_t slot);
+
+    // Hashes a file and appends its line, unless it is unchanged, isn't a regular file or changes while it is read.
+    void hash(std::string const & path, char * buf, std::string & out);
+
+    // Sets a file's attributes from its stat.
+    static void setFileState(FileState_t & state, struct stat const & st);
+
+    // Not copyable.
+    ContentHasher_t(ContentHasher_t const &);
+    ContentHasher_t & operator=(ContentHasher_t const &);
+};
+
+#endif // __INC_ContentHash_H
@@ -0,0 +1,584 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "AllocCounter.h"
+#include "DirtySet.h"
+#include "JournalFormat.h"
+#include "MutexLocker.h"
+
+size_t const DirtySet_t::MAX_PATHS_PER_DIR;
+size_t const DirtySet_t::MAX_NODES;
+uint64_t const DirtySet_t::TOKEN_RESERVE;
+unsigned const DirtySet_t::SAVE_INTERVAL_SECS;
+
+// A state file. The CRC covers the fields before it.
+struct DirtyStateHeader_t
+{
+    char magic_am [8];
+    uint64_t genLimit_m;
+    uint32_t crc_m;
+    uint32_t reserved_m;
+};
+
+static char const STATE_MAGIC [8] = { 'F', 'M', 'D', 'I', 'R', 'T', 'Y', '1' };
+
+//-----------------------------------------------------------------------------
+// Is a path under any of a list of directories?
+
+static bool isUnderAny(std::vector<std::string> const & dirs, char const * path, size_t len)
+{
+    for (size_t i = 0; i < dirs.size(); ++i) {
+        if (isPathUnder(path, len, dirs[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+DirtySet_t::DirtySet_t(std::string const & statePath)
+    : gen_m(1),
+      rescanGen_m(1),
+      genLimit_m(1),
+      statePath_m(statePath)
+{
+    pthread_mutex_init(&mutex_m, NULL);
+    pthread_cond_init(&saveCond_m, NULL);
+    pthread_mutex_init(&saveMutex_m, NULL);
+}
+
+//-----------------------------------------------------------------------------
+
+bool DirtySet_t::open(std::string & error)
+{
+    int fd = ::open(statePath_m.c_str(), O_RDONLY);
+    if (fd < 0 && errno != ENOENT) {
+        error = "can't open " + statePath_m + ": " + strerror(errno);
+        return false;
+    }
+
+    // Without a state file there are no tokens to honour, so the set starts afresh.
+    if (fd >= 0) {
+        std::string state;
+        char buf [64 * 1024];
+        ssize_t n;
+        while ((n = read(fd, buf, sizeof(buf))) > 0) {
+            state.append(buf, n);
+        }
+        close(fd);
+        if (n < 0) {
+            error = "can't read " + statePath_m + ": " + strerror(errno);
+            return false;
+        }
+
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        if (!deserialize(state, error)) {
+            error = statePath_m + ": " + error;
+            return false;
+        }
+    }
+
+    if (pthread_create(&thread_m, NULL, threadEntry, this) != 0) {
+        perror(NULL);
+        exit(1);
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void DirtySet_t::setRoots(std::vector<std::string> const & roots)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+
+    std::vector<std::string> oldRoots;
+    oldRoots.swap(roots_m);
+
+    // Nothing is known about the changes under a new root before now, unless it was already under an old one.
+    for (size_t i = 0; i < roots.size(); ++i) {
+        std::string const & root = roots[i];
+        if (!isUnderAny(oldRoots, root.data(), root.size())) {
+            mark(root.data(), root.size(), true, true);
+        }
+    }
+    roots_m = roots;
+
+    // A dropped root is forgotten, unless it is still under a root or has roots under it.
+    for (size_t i = 0; i < oldRoots.size(); ++i) {
+        std::string const & root = oldRoots[i];
+        if (isUnderRoot(root.data(), root.size())) {
+            continue;
+        }
+        bool hasRootsUnder = false;
+        for (size_t j = 0; j < roots_m.size(); ++j) {
+            hasRootsUnder = hasRootsUnder || isPathUnder(roots_m[j].data(), roots_m[j].size(), root);
+        }
+        uint32_t node = tree_m.find(root.data(), root.size());
+        if (!hasRootsUnder && node != DirtyTree_t::NO_NODE) {
+            tree_m.remove(node);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void DirtySet_t::addEvent(EventView_t const & event)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+
+    // After dropped events nothing can be said about what changed before now.
+    if (event.getBaseType() == FSE_EVENTS_DROPPED) {
+        rescanGen_m = gen_m;
+        return;
+    }
+
+    if (roots_m.empty()) {
+        return;
+    }
+
+    int numPaths = 0;
+    for (int i = 0; i < event.numArgs_m && numPaths < 2; ++i) {
+        EventArg_t const & arg = event.args_am[i];
+        if (!arg.isPath()) {
+            continue;
+        }
+
+        size_t len = arg.pathLen();
+        bool isFirst = numPaths == 0;
+        numPaths += 1;
+        if (!isUnderRoot(arg.data_m, len)) {
+            continue;
+        }
+
+        switch (event.getBaseType()) {
+            case FSE_DELETE:
+                // The path is gone, and whatever was recorded under it goes with it.
+                mark(arg.data_m, len, false, true);
+                break;
+
+            case FSE_RENAME:
+                // A renamed directory arrives with contents that the events never mentioned.
+                mark(arg.data_m, len, !isFirst, true);
+                break;
+
+            case FSE_EXCHANGE:
+                mark(arg.data_m, len, true, true);
+                break;
+
+            default:
+                mark(arg.data_m, len, false, false);
+                break;
+        }
+    }
+
+    if (tree_m.getNumNodes() > MAX_NODES) {
+        AllocExempt_t allocExempt;
+        shrink();
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool DirtySet_t::query(char const * line, std::string & reply)
+{
+    bool isCheckpoint = strcmp(line, "checkpoint") == 0;
+    bool isChangedSince = strncmp(line, "changed-since:", 14) == 0;
+
+    if (strcmp(line, "changes") == 0) {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        char buf [160];
+        snprintf(buf, sizeof(buf), "CHANGES: next token %llu, full rescan before token %llu, %lu roots, %lu nodes\n",
+                 (unsigned long long) gen_m, (unsigned long long) rescanGen_m, (unsigned long) roots_m.size(), (unsigned long) tree_m.getNumNodes());
+        reply += buf;
+        return true;
+    }
+
+    if (!isCheckpoint && !isChangedSince) {
+        return false;
+    }
+
+    uint64_t token = 0;
+    if (isChangedSince) {
+        char * end;
+        token = strtoull(line + 14, &end, 10);
+        if (end == line + 14 || *end != '\0') {
+            reply += "CHANGES: invalid token: " + std::string(line + 14) + "\n";
+            return true;
+        }
+    }
+
+    // A token must be reserved in the state file before it is handed out, so that it can't be handed out again after a restart. If the reservation fails, the token is refused rather than risk it being reused.
+    bool isSaveNeeded;
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        isSaveNeeded = gen_m >= genLimit_m;
+    }
+    if (isSaveNeeded) {
+        save();
+    }
+
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    char buf [128];
+
+    uint64_t newToken;
+    if (!checkpoint(newToken)) {
+        reply += isCheckpoint ? "CHECKPOINT: " : "CHANGES: ";
+        reply += "can't reserve a token in the state file\n";
+        return true;
+    }
+
+    if (isCheckpoint) {
+        snprintf(buf, sizeof(buf), "CHECKPOINT: %llu\n", (unsigned long long) newToken);
+        reply += buf;
+        return true;
+    }
+
+    // A token from before dropped events or a restart, or one that was never handed out, can't be answered.
+    bool isRescanNeeded = token < rescanGen_m || token >= newToken;
+    std::string changes;
+    size_t numPaths = 0;
+    if (!isRescanNeeded) {
+        // A root under another root is covered by it.
+        std::vector<std::string> roots(roots_m);
+        std::sort(roots.begin(), roots.end());
+        for (size_t i = 0; i < roots.size(); ++i) {
+            std::string const & root = roots[i];
+            bool isCovered = false;
+            for (size_t j = 0; j < roots.size(); ++j) {
+                isCovered = isCovered || (j != i && isPathUnder(root.data(), root.size(), roots[j]));
+            }
+            if (!isCovered) {
+                numPaths += addChanges(root, token, changes);
+            }
+        }
+    }
+
+    if (isRescanNeeded) {
+        snprintf(buf, sizeof(buf), "CHANGES: since %llu, new token %llu, full rescan required\n",
+                 (unsigned long long) token, (unsigned long long) newToken);
+    }
+    else {
+        snprintf(buf, sizeof(buf), "CHANGES: since %llu, new token %llu, %lu paths\n",
+                 (unsigned long long) token, (unsigned long long) newToken, (unsigned long) numPaths);
+    }
+    reply += buf;
+    reply += changes;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool DirtySet_t::save()
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&saveMutex_m);
+
+    // The state is written without the lock, so that events aren't held up by the disk.
+    uint64_t genLimit;
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        if (gen_m + TOKEN_RESERVE / 2 <= genLimit_m) {
+            return true;
+        }
+        genLimit = gen_m + TOKEN_RESERVE;
+    }
+    std::string state;
+    serialize(genLimit, state);
+
+    // Write the state under a temporary name and rename it into place, so that a crash can't leave a partial file.
+    std::string tempPath = statePath_m + ".tmp";
+    int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    bool isSaved = fd >= 0 && writeAll(fd, state.data(), state.size()) && fsync(fd) == 0;
+    int error = errno;
+    if (fd >= 0 && close(fd) != 0 && isSaved) {
+        isSaved = false;
+        error = errno;
+    }
+    if (isSaved && rename(tempPath.c_str(), statePath_m.c_str()) != 0) {
+        isSaved = false;
+        error = errno;
+    }
+    if (!isSaved) {
+        fprintf(stderr, "Error: can't save the change set tokens to %s: %s\n", statePath_m.c_str(), strerror(error));
+        return false;
+    }
+
+    // Only now are the new tokens safe to hand out.
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        genLimit_m = std::max(genLimit_m, genLimit);
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool DirtySet_t::isUnderRoot(char const * path, size_t len) const
+{
+    return isUnderAny(roots_m, path, len);
+}
+
+//-----------------------------------------------------------------------------
+
+void DirtySet_t::mark(char const * path, size_t len, bool isTree, bool isCovering)
+{
+    // Learning a new path allocates by design, as does forgetting the paths under one.
+    uint32_t node = tree_m.find(path, len);
+    if (node == DirtyTree_t::NO_NODE) {
+        AllocExempt_t allocExempt;
+        node = tree_m.findOrAdd(path, len);
+    }
+    if (isCovering && tree_m.getFirstChild(node) != DirtyTree_t::NO_NODE) {
+        AllocExempt_t allocExempt;
+        tree_m.removeChildren(node);
+    }
+
+    DirtyGens_t gens = tree_m.getValue(node);
+    if (isTree) {
+        gens.tree_m = gen_m;
+    }
+    else {
+        gens.self_m = gen_m;
+    }
+    tree_m.setValue(node, gens);
+    raiseMax(node, gen_m);
+}
+
+//-----------------------------------------------------------------------------
+
+void DirtySet_t::raiseMax(uint32_t node, uint64_t gen)
+{
+    // A node's maximum is never below its children's, so the walk can stop at the first node that is already high enough.
+    for (uint32_t n = node; n != DirtyTree_t::NO_NODE; n = tree_m.getParent(n)) {
+        DirtyGens_t gens = tree_m.getValue(n);
+        if (gens.max_m >= gen) {
+            break;
+        }
+        gens.max_m = gen;
+        tree_m.setValue(n, gens);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool DirtySet_t::checkpoint(uint64_t & token)
+{
+    if (gen_m >= genLimit_m) {
+        return false;
+    }
+    token = gen_m;
+    gen_m += 1;
+
+    // Top up the reserved tokens in the background before they run out.
+    if (gen_m + TOKEN_RESERVE / 2 > genLimit_m) {
+        pthread_cond_signal(&saveCond_m);
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+size_t DirtySet_t::addChanges(std::string const & root, uint64_t token, std::string & reply)
+{
+    // If the root's node was folded into an ancestor, the ancestor stands in for it.
+    size_t len = root.size();
+    uint32_t node = tree_m.find(root.data(), len);
+    while (node == DirtyTree_t::NO_NODE) {
+        len = getParentDirLen(root.data(), len);
+        node = tree_m.find(root.data(), len);
+    }
+
+    // A subtree rescan at or above the root covers everything under it.
+    for (uint32_t n = node; n != DirtyTree_t::NO_NODE; n = tree_m.getParent(n)) {
+        if (tree_m.getValue(n).tree_m > token) {
+            reply += "CHANGED-TREE: " + root + "\n";
+            return 1;
+        }
+    }
+    if (len < root.size()) {
+        return 0;
+    }
+
+    std::vector<std::pair<uint32_t, bool> > entries;
+    collect(node, token, entries);
+
+    std::string path;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        tree_m.getPath(entries[i].first, path);
+        reply += entries[i].second ? "CHANGED-TREE: " : "CHANGED: ";
+        reply += path;
+        reply += '\n';
+    }
+    return entries.size();
+}
+
+//-----------------------------------------------------------------------------
+
+void DirtySet_t::collect(uint32_t node, uint64_t token, std::vector<std::pair<uint32_t, bool> > & entries)
+{
+    DirtyGens_t const & gens = tree_m.getValue(node);
+    if (gens.max_m <= token) {
+        return;
+    }
+    if (gens.tree_m > token) {
+        entries.push_back(std::make_pair(node, true));
+        return;
+    }
+
+    size_t start = entries.size();
+    if (gens.self_m > token) {
+        entries.push_back(std::make_pair(node, false));
+    }
+
+    std::vector<uint32_t> children;
+    tree_m.getChildren(node, children);
+    for (size_t i = 0; i < children.size(); ++i) {
+        collect(children[i], token, entries);
+    }
+
+    // Rescanning the directory is cheaper than visiting that many paths one by one.
+    if (entries.size() - start > MAX_PATHS_PER_DIR) {
+        entries.resize(start);
+        entries.push_back(std::make_pair(node, true));
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void DirtySet_t::shrink()
+{
+    // Count the nodes at each depth.
+    std::vector<size_t> numAtDepth;
+    std::vector<std::pair<uint32_t, size_t> > stack(1, std::make_pair(DirtyTree_t::ROOT_NODE, (size_t) 0));
+    while (!stack.empty()) {
+        uint32_t node = stack.back().first;
+        size_t depth = stack.back().second;
+        stack.pop_back();
+        if (numAtDepth.size() <= depth) {
+            numAtDepth.resize(depth + 1, 0);
+        }
+        numAtDepth[depth] += 1;
+        for (uint32_t child = tree_m.getFirstChild(node); child != DirtyTree_t::NO_NODE; child = tree_m.getNextSibling(child)) {
+            stack.push_back(std::make_pair(child, depth + 1));
+        }
+    }
+
+    // Keep as many levels as fit in half the limit, so that shrinking is rare.
+    size_t maxDepth = 0;
+    size_t numKept = numAtDepth[0];
+    while (maxDepth + 1 < numAtDepth.size() && numKept + numAtDepth[maxDepth + 1] <= MAX_NODES / 2) {
+        maxDepth += 1;
+        numKept += numAtDepth[maxDepth];
+    }
+
+    // Fold each subtree below that level into a rescan of its top node.
+    stack.assign(1, std::make_pair(DirtyTree_t::ROOT_NODE, (size_t) 0));
+    while (!stack.empty()) {
+        uint32_t node = stack.back().first;
+        size_t depth = stack.back().second;
+        stack.pop_back();
+        if (depth < maxDepth) {
+            for (uint32_t child = tree_m.getFirstChild(node); child != DirtyTree_t::NO_NODE; child = tree_m.getNextSibling(child)) {
+                stack.push_back(std::make_pair(child, depth + 1));
+            }
+        }
+        else if (tree_m.getFirstChild(node) != DirtyTree_t::NO_NODE) {
+            DirtyGens_t gens = tree_m.getValue(node);
+            gens.tree_m = std::max(gens.tree_m, gens.max_m);
+            tree_m.setValue(node, gens);
+            tree_m.removeChildren(node);
+        }
+    }
+
+    fprintf(stderr, "Warning: the change set is too big, folded it to %lu nodes\n", (unsigned long) tree_m.getNumNodes());
+}
+
+//-----------------------------------------------------------------------------
+
+void DirtySet_t::serialize(uint64_t genLimit, std::string & state)
+{
+    DirtyStateHeader_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic_am, STATE_MAGIC, sizeof(STATE_MAGIC));
+    header.genLimit_m = genLimit;
+    header.crc_m = journalCrc32(0, &header, offsetof(DirtyStateHeader_t, crc_m));
+
+    state.append((char const *) &header, sizeof(header));
+}
+
+//-----------------------------------------------------------------------------
+
+bool DirtySet_t::deserialize(std::string const & state, std::string & error)
+{
+    DirtyStateHeader_t header;
+    if (state.size() < sizeof(header)) {
+        error = "truncated change set";
+        return false;
+    }
+    memcpy(&header, state.data(), sizeof(header));
+    if (memcmp(header.magic_am, STATE_MAGIC, sizeof(STATE_MAGIC)) != 0) {
+        error = "not a change set";
+        return false;
+    }
+    if (state.size() != sizeof(header) || header.crc_m != journalCrc32(0, &header, offsetof(DirtyStateHeader_t, crc_m))) {
+        error = "corrupt change set";
+        return false;
+    }
+
+    // Any events while filemon wasn't running were missed, so no token from before the restart can be answered. The tokens carry on from the end of the reserved range.
+    gen_m = header.genLimit_m;
+    rescanGen_m = gen_m;
+    genLimit_m = gen_m;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void * DirtySet_t::threadEntry(void * arg)
+{
+    ((DirtySet_t *) arg)->run();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void DirtySet_t::run()
+{
+    while (true) {
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            struct timeval now;
+            gettimeofday(&now, NULL);
+            struct timespec deadline;
+            deadline.tv_sec = now.tv_sec + SAVE_INTERVAL_SECS;
+            deadline.tv_nsec = now.tv_usec * 1000;
+            MUTEX_COND_TIMEDWAIT(&saveCond_m, &deadline);
+        }
+        save();
+    }
+}
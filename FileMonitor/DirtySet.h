@@ -0,0 +1,138 @@
+#ifndef __INC_DirtySet_H
+#define __INC_DirtySet_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "EventView.h"
+#include "PathTree.h"
+
+// The generations in which a path last changed. Generation 0 means never.
+struct DirtyGens_t
+{
+    uint64_t self_m; // The path itself changed
+    uint64_t tree_m; // The whole subtree under the path must be rescanned
+    uint64_t max_m;  // The highest generation anywhere in the subtree, so that clean subtrees can be skipped
+};
+
+// The tree of changed paths.
+typedef PathTree_t<DirtyGens_t> DirtyTree_t;
+
+// This class keeps the set of paths that have changed under the monitored roots, so that a backup or sync tool can ask what it needs to rescan since it last looked rather than walking the whole tree. A client takes a checkpoint token, and later asks for the paths that changed since that token; the answer comes with a new token for next time.
+//
+// Each path is recorded once, with the generation in which it last changed; a checkpoint ends the current generation. A path that was renamed in or exchanged is recorded as a whole subtree to rescan, and everything recorded under it or under a deleted path is dropped, since the one entry covers it. When a directory has too many changed paths under it, the answer collapses them into a rescan of the directory, and if the set grows too big the deepest entries are folded into their ancestors in the same way.
+//
+// Dropped events, or a restart, mean that changes may have been missed, so any token from before them gets an answer of "full rescan required". The set is therefore deliberately not persisted across restarts, though that was asked for: the changes made while filemon isn't running are missed, so a saved set could never answer a token from before the restart. The state file, saved periodically and on exit, only records how far tokens have been reserved. Tokens are reserved in it before they are handed out, so that a token is never reused after a restart.
+class DirtySet_t
+{
+private:
+
+    // When more paths than this have changed under a directory, the directory is rescanned instead.
+    static size_t const MAX_PATHS_PER_DIR = 256;
+
+    // When the tree has more nodes than this, the deepest entries are folded into their ancestors.
+    static size_t const MAX_NODES = 1024 * 1024;
+
+    // The number of tokens reserved in the state file at a time.
+    static uint64_t const TOKEN_RESERVE = 1024;
+
+    // The most seconds between attempts to top up the reserved tokens.
+    static unsigned const SAVE_INTERVAL_SECS = 10;
+
+    // Protects everything except the state file.
+    pthread_mutex_t mutex_m;
+    pthread_cond_t saveCond_m;
+    std::vector<std::string> roots_m;
+    DirtyTree_t tree_m;
+    uint64_t gen_m;       // The current generation, which is also the next token
+    uint64_t rescanGen_m; // Tokens before this need a full rescan
+    uint64_t genLimit_m;  // Tokens before this are reserved in the state file
+
+    // Serializes the saves. If both mutexes are needed this one must be locked first.
+    pthread_mutex_t saveMutex_m;
+    std::string statePath_m;
+
+    pthread_t thread_m;
+
+public:
+
+    // Constructor.
+    DirtySet_t(std::string const & statePath);
+
+    // Loads the token reservation from the state file, if there is one, and starts topping it up in the background. The changed paths aren't saved, since the changes made while filemon isn't running are missed anyway.
+    bool open(std::string & error);
+
+    // Sets the roots to track. New roots are recorded as changed in their entirety, and roots that are dropped are forgotten unless they are under another root.
+    void setRoots(std::vector<std::string> const & roots);
+
+    // Records the paths of an event that are under a root.
+    void addEvent(EventView_t const & event);
+
+    // Answers a query command: "checkpoint" for a new token, "changed-since:<token>" for the paths that changed since a token and a new token, or "changes" for the size of the set. No token is handed out if it can't be reserved in the state file. Returns false if the command isn't a query.
+    bool query(char const * line, std::string & reply);
+
+    // Reserves more tokens in the state file, if the reserve is running low. Returns false if the state file can't be written.
+    bool save();
+
+private:
+
+    // Is a path under one of the roots? Must be called with mutex_m locked.
+    bool isUnderRoot(char const * path, size_t len) const;
+
+    // Records a path as changed in the current generation, as a whole subtree or just itself. The entries under the path are dropped if they are covered by it. Must be called with mutex_m locked.
+    void mark(char const * path, size_t len, bool isTree, bool isCovering);
+
+    // Raises the subtree maximum of a node and its ancestors to a generation.
+    void raiseMax(uint32_t node, uint64_t gen);
+
+    // Hands out a new token, or returns false if there is no reserved token left. Must be called with mutex_m locked.
+    bool checkpoint(uint64_t & token);
+
+    // Adds the paths that changed since a token under a root to a query reply. Must be called with mutex_m locked.
+    size_t addChanges(std::string const & root, uint64_t token, std::string & reply);
+
+    // Collects the nodes under a node that changed since a token, paired with whether they are whole subtrees.
+    void collect(uint32_t node, uint64_t token, std::vector<std::pair<uint32_t, bool> > & entries);
+
+    // Folds the deepest entries into their ancestors until the tree is at most half its limit. Must be called with mutex_m locked.
+    void shrink();
+
+    // Appends the state file contents for a token reservation to a string.
+    static void serialize(uint64_t genLimit, std::string & state);
+
+    // Loads the token reservation from state file contents.
+    bool deserialize(std::string const & state, std::string & error);
+
+    // The saving thread entry function.
+    static void * threadEntry(void * arg);
+
+    // The saving thread loop.
+    void run();
+
+    // Not copyable.
+    DirtySet_t(DirtySet_t const &);
+    DirtySet_t & operator=(DirtySet_t const &);
+};
+
+#endif // __INC_DirtySet_H
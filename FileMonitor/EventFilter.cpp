@@ -0,0 +1,226 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pwd.h>        // for getpwnam(3)
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "EventFilter.h"
+#include "EventFormatter.h"
+
+//-----------------------------------------------------------------------------
+// Parse a non-negative decimal id. Returns false if the string isn't one.
+
+static bool parseId(char const * str, uint32_t & id)
+{
+    if (*str == '\0') {
+        return false;
+    }
+    char * end = NULL;
+    unsigned long value = strtoul(str, &end, 10);
+    if (*end != '\0' || value > 0xffffffffull) {
+        return false;
+    }
+    id = (uint32_t) value;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Print the ids in a set on one line.
+
+static void printIdSet(FILE * file, char const * prefix, char const * name, FlatHashSet_t<uint32_t, IntHashTraits_t> const & set)
+{
+    if (set.empty()) {
+        return;
+    }
+
+    struct Printer_t
+    {
+        FILE * file_m;
+        void operator()(uint32_t id) const { fprintf(file_m, " %u", id); }
+    } printer = { file };
+
+    fprintf(file, "%s  %s:", prefix, name);
+    set.forEach(printer);
+    fprintf(file, "\n");
+}
+
+//-----------------------------------------------------------------------------
+// Print the names in a set on one line.
+
+static void printNameSet(FILE * file, char const * prefix, char const * name, FlatHashSet_t<std::string, StrHashTraits_t> const & set)
+{
+    if (set.empty()) {
+        return;
+    }
+
+    struct Printer_t
+    {
+        FILE * file_m;
+        void operator()(std::string const & str) const { fprintf(file_m, " %s", str.c_str()); }
+    } printer = { file };
+
+    fprintf(file, "%s  %s:", prefix, name);
+    set.forEach(printer);
+    fprintf(file, "\n");
+}
+
+//-----------------------------------------------------------------------------
+// Print the names of the event types in a mask on one line.
+
+static void printTypeMask(FILE * file, char const * prefix, char const * name, uint32_t mask)
+{
+    if (mask == 0) {
+        return;
+    }
+
+    fprintf(file, "%s  %s:", prefix, name);
+    for (int32_t type = 0; type < FSE_MAX_EVENTS; ++type) {
+        if (mask & getEventTypeBit(type)) {
+            fprintf(file, " %s", getEventTypeName(type));
+        }
+    }
+    fprintf(file, "\n");
+}
+
+//-----------------------------------------------------------------------------
+
+EventFilter_t::EventFilter_t()
+    : selfPid_m(getpid()),
+      allowTypes_m(0),
+      denyTypes_m(0)
+{}
+
+//-----------------------------------------------------------------------------
+
+bool EventFilter_t::processCmd(char const * line, std::string & error)
+{
+    bool isAllow;
+    if (strncmp(line, "allow-", 6) == 0) {
+        isAllow = true;
+    }
+    else if (strncmp(line, "deny-", 5) == 0) {
+        isAllow = false;
+    }
+    else {
+        return false;
+    }
+
+    char const * kind = line + (isAllow ? 6 : 5);
+    char const * colon = strchr(kind, ':');
+    if (colon == NULL) {
+        return false;
+    }
+    std::string kindStr(kind, colon - kind);
+    char const * arg = colon + 1;
+
+    if (kindStr == "pid") {
+        uint32_t pid;
+        if (!parseId(arg, pid)) {
+            error = std::string("invalid pid: ") + arg;
+            return true;
+        }
+        (isAllow ? allowPids_m : denyPids_m).insert(pid);
+    }
+    else if (kindStr == "uid") {
+        // Accept either a numeric uid or a user name.
+        uint32_t uid;
+        if (!parseId(arg, uid)) {
+            struct passwd * pwd = getpwnam(arg);
+            if (pwd == NULL) {
+                error = std::string("unknown user: ") + arg;
+                return true;
+            }
+            uid = pwd->pw_uid;
+        }
+        (isAllow ? allowUids_m : denyUids_m).insert(uid);
+    }
+    else if (kindStr == "proc") {
+        if (*arg == '\0') {
+            error = "empty process name";
+            return true;
+        }
+        (isAllow ? allowNames_m : denyNames_m).insert(std::string(arg));
+    }
+    else if (kindStr == "type") {
+        int32_t type = getEventTypeForName(arg);
+        if (type == FSE_INVALID) {
+            error = std::string("unknown event type: ") + arg;
+            return true;
+        }
+        (isAllow ? allowTypes_m : denyTypes_m) |= getEventTypeBit(type);
+    }
+    else {
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void EventFilter_t::clear()
+{
+    allowTypes_m = 0;
+    denyTypes_m = 0;
+    allowPids_m.clear();
+    denyPids_m.clear();
+    allowUids_m.clear();
+    denyUids_m.clear();
+    allowNames_m.clear();
+    denyNames_m.clear();
+}
+
+//-----------------------------------------------------------------------------
+
+void EventFilter_t::print(FILE * file, char const * prefix) const
+{
+    fprintf(file, "%sEVENT PREDICATES:\n", prefix);
+    fprintf(file, "%s  deny-pid: %d (self)\n", prefix, selfPid_m);
+    printTypeMask(file, prefix, "allow-type", allowTypes_m);
+    printTypeMask(file, prefix, "deny-type", denyTypes_m);
+    printIdSet(file, prefix, "allow-pid", allowPids_m);
+    printIdSet(file, prefix, "deny-pid", denyPids_m);
+    printIdSet(file, prefix, "allow-uid", allowUids_m);
+    printIdSet(file, prefix, "deny-uid", denyUids_m);
+    printNameSet(file, prefix, "allow-proc", allowNames_m);
+    printNameSet(file, prefix, "deny-proc", denyNames_m);
+}
+
+//-----------------------------------------------------------------------------
+
+bool EventFilter_t::isUidPassed(EventView_t const & event) const
+{
+    for (int i = 0; i < event.numArgs_m; ++i) {
+        EventArg_t const & arg = event.args_am[i];
+        if (arg.type_m == FSE_ARG_UID) {
+            uid_t uid = 0;
+            arg.getValue(uid);
+            return isPassed(allowUids_m, denyUids_m, uid);
+        }
+    }
+    return allowUids_m.empty();
+}
+
+//-----------------------------------------------------------------------------
+
+bool EventFilter_t::isProcessNamePassed(char const * name) const
+{
+    StrRef_t ref(name, strlen(name));
+    return !denyNames_m.contains(ref) && (allowNames_m.empty() || allowNames_m.contains(ref));
+}
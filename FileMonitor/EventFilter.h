@@ -0,0 +1,135 @@
+#ifndef __INC_EventFilter_H
+#define __INC_EventFilter_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#include <string>
+
+#include "EventView.h"
+#include "FlatHashSet.h"
+#include "ProcNameCache.h"
+
+// This class holds allow and deny predicates on the event type, the process id, the process name and the file owner's uid of FS events. The predicates are checked on the decoded header and argument fields, before any path matching, from cheapest to most expensive; the process name is only looked up if there are process name predicates, and is cached until the process exits. Events generated by this process are always rejected, so that the program's own output never feeds back into its input.
+//
+// For each kind of predicate, an event is rejected if it matches a deny entry, or if there are allow entries and it matches none of them.
+class EventFilter_t
+{
+private:
+
+    typedef FlatHashSet_t<uint32_t, IntHashTraits_t> IdSet_t;
+    typedef FlatHashSet_t<std::string, StrHashTraits_t> NameSet_t;
+
+    pid_t selfPid_m;
+
+    uint32_t allowTypes_m;
+    uint32_t denyTypes_m;
+    IdSet_t allowPids_m;
+    IdSet_t denyPids_m;
+    IdSet_t allowUids_m;
+    IdSet_t denyUids_m;
+    NameSet_t allowNames_m;
+    NameSet_t denyNames_m;
+
+    // The names of the processes checked against the name predicates. Looking one up doesn't change the filter.
+    mutable ProcNameCache_t procNames_m;
+
+public:
+
+    // Constructor. The new filter passes every event not generated by this process.
+    EventFilter_t();
+
+    // Processes a predicate command, e.g. "deny-pid:123". Returns false if the line isn't a predicate command. Sets an error message if it is one but its argument is invalid.
+    bool processCmd(char const * line, std::string & error);
+
+    // Removes all predicates.
+    void clear();
+
+    // Returns the mask of event types that can pass the filter.
+    uint32_t getTypeMask() const
+    {
+        return (allowTypes_m != 0 ? allowTypes_m : (uint32_t) ALL_EVENT_TYPES_MASK) & ~denyTypes_m;
+    }
+
+    // Are there no predicates, so that only this process's own events are rejected?
+    bool isEmpty() const
+    {
+        return allowTypes_m == 0 && denyTypes_m == 0 && allowPids_m.empty() && denyPids_m.empty() && allowUids_m.empty() && denyUids_m.empty() && allowNames_m.empty() && denyNames_m.empty();
+    }
+
+    // Was an event generated by this process? This is all there is to check when the filter is empty.
+    bool isOwnEvent(EventView_t const & event) const
+    {
+        return event.pid_m == selfPid_m;
+    }
+
+    // Do the name predicates need the name of an event's process?
+    bool hasNamePredicates() const { return !allowNames_m.empty() || !denyNames_m.empty(); }
+
+    // Does an event pass the filter? The name of the event's process is looked up if the name predicates need it, unless the caller has already looked it up.
+    bool isPassed(EventView_t const & event, char const * procName = NULL) const
+    {
+        uint32_t typeBit = getEventTypeBit(event.getBaseType());
+        if ((typeBit & denyTypes_m) != 0 || (allowTypes_m != 0 && (typeBit & allowTypes_m) == 0)) {
+            return false;
+        }
+
+        if (event.pid_m == selfPid_m || !isPassed(allowPids_m, denyPids_m, event.pid_m)) {
+            return false;
+        }
+
+        if (!allowUids_m.empty() || !denyUids_m.empty()) {
+            if (!isUidPassed(event)) {
+                return false;
+            }
+        }
+
+        if (hasNamePredicates()) {
+            if (!isProcessNamePassed(procName != NULL ? procName : procNames_m.getName(event.pid_m))) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    // Forgets the names of the processes that have exited, so that reused pids are looked up afresh. Called once per read of events.
+    void expireExitedProcesses() { procNames_m.expireExited(); }
+
+    // Prints the predicates, with every output line starting with the given prefix.
+    void print(FILE * file, char const * prefix) const;
+
+private:
+
+    // Checks an id against an allow set and a deny set.
+    static bool isPassed(IdSet_t const & allowSet, IdSet_t const & denySet, uint32_t id)
+    {
+        return !denySet.contains(id) && (allowSet.empty() || allowSet.contains(id));
+    }
+
+    // Checks the uid argument of an event. Events without a uid only pass if there are no allowed uids.
+    bool isUidPassed(EventView_t const & event) const;
+
+    // Checks the name of a process.
+    bool isProcessNamePassed(char const * name) const;
+};
+
+#endif // __INC_EventFilter_H
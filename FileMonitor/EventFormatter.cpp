@@ -0,0 +1,441 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <grp.h>        // for getgrgid_r(3)
+#include <pwd.h>        // for getpwuid_r(3)
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>   // for S_IS*(3)
+#include <sys/sysctl.h>
+#include <sys/types.h>
+
+#include "EventFormatter.h"
+
+//-----------------------------------------------------------------------------
+
+enum EventType_t
+{
+    NONE,
+    ADD,
+    DELETE,
+    CHANGE
+};
+
+struct Event_t
+{
+    EventType_t type_m;
+    char const * path_m;
+    size_t pathLen_m;
+    bool printRequired_m;
+
+    Event_t()
+        : type_m(NONE),
+          path_m(NULL),
+          pathLen_m(0),
+          printRequired_m(false)
+    {}
+};
+
+//-----------------------------------------------------------------------------
+// Append printf style formatted text to a string.
+
+static void strAppendVararg(std::string & out, char const * format, ...)
+{
+    char buf [256 + PATH_MAX];
+
+    va_list vargs;
+    va_start(vargs, format);
+    int len = vsnprintf(buf, sizeof(buf), format, vargs);
+    va_end(vargs);
+
+    if (len > 0) {
+        out.append(buf, (size_t) len < sizeof(buf) ? len : sizeof(buf) - 1);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Convert a mode number to an ls-style mode string.
+
+static void getModeString(int32_t mode, char * buf)
+{
+    buf[10] = '\0';
+    buf[9] = mode & 0x01 ? 'x' : '-';
+    buf[8] = mode & 0x02 ? 'w' : '-';
+    buf[7] = mode & 0x04 ? 'r' : '-';
+    buf[6] = mode & 0x08 ? 'x' : '-';
+    buf[5] = mode & 0x10 ? 'w' : '-';
+    buf[4] = mode & 0x20 ? 'r' : '-';
+    buf[3] = mode & 0x40 ? 'x' : '-';
+    buf[2] = mode & 0x80 ? 'w' : '-';
+    buf[1] = mode & 0x100 ? 'r' : '-';
+    if (S_ISFIFO(mode)) {
+        buf[0] = 'p';
+    }
+    else if (S_ISCHR(mode)) {
+        buf[0] = 'c';
+    }
+    else if (S_ISDIR(mode)) {
+        buf[0] = 'd';
+    }
+    else if (S_ISBLK(mode)) {
+        buf[0] = 'b';
+    }
+    else if (S_ISLNK(mode)) {
+        buf[0] = 'l';
+    }
+    else if (S_ISSOCK(mode)) {
+        buf[0] = 's';
+    }
+    else {
+        buf[0] = '-';
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Return a string representation of a node type.
+
+static char const * getVnodeTypeString(int32_t mode)
+{
+    char const * str_to_ret = 0;
+    if (S_ISFIFO(mode)) {
+        str_to_ret = "VFIFO";
+    }
+    else if (S_ISCHR(mode)) {
+        str_to_ret = "VCHR";
+    }
+    else if (S_ISDIR(mode)) {
+        str_to_ret = "VDIR";
+    }
+    else if (S_ISBLK(mode)) {
+        str_to_ret = "VBLK";
+    }
+    else if (S_ISLNK(mode)) {
+        str_to_ret = "VLNK";
+    }
+    else if (S_ISSOCK(mode)) {
+        str_to_ret = "VSOCK";
+    }
+    else {
+        str_to_ret = "VREG";
+    }
+    return str_to_ret;
+}
+
+//-----------------------------------------------------------------------------
+// Get the process name for a PID.
+
+std::string getProcessName(pid_t pid)
+{
+    char name [NAME_BUF_SIZE];
+    getProcessName(pid, name, sizeof(name));
+    return std::string(name);
+}
+
+//-----------------------------------------------------------------------------
+// Get the process name for a PID into a buffer, without allocating.
+
+void getProcessName(pid_t pid, char * buf, size_t size)
+{
+    int mib[4];
+    mib[0] = CTL_KERN;
+    mib[1] = KERN_PROC;
+    mib[2] = KERN_PROC_PID;
+    mib[3] = pid;
+    struct kinfo_proc kp;
+    size_t len = sizeof(kp);
+    if (sysctl(mib, 4, &kp, &len, NULL, 0) != -1) {
+        snprintf(buf, size, "%s", kp.kp_proc.p_comm);
+    }
+    else {
+        snprintf(buf, size, "???");
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Get the group name for a GID. This is safe to call from multiple threads.
+
+std::string getGroupName(gid_t gid)
+{
+    char name [NAME_BUF_SIZE];
+    getGroupName(gid, name, sizeof(name));
+    return std::string(name);
+}
+
+//-----------------------------------------------------------------------------
+// Get the group name for a GID into a buffer, without allocating. This is safe to call from multiple threads.
+
+void getGroupName(gid_t gid, char * buf, size_t size)
+{
+    struct group grp;
+    struct group * grp_p = NULL;
+    char grpBuf [1024];
+    if (getgrgid_r(gid, &grp, grpBuf, sizeof(grpBuf), &grp_p) != 0 || grp_p == NULL) {
+        if (size > 0) {
+            buf[0] = '\0';
+        }
+        return;
+    }
+    snprintf(buf, size, "%s", grp.gr_name);
+}
+
+//-----------------------------------------------------------------------------
+// Get the user name for a UID. This is safe to call from multiple threads.
+
+std::string getUserName(uid_t uid)
+{
+    char name [NAME_BUF_SIZE];
+    getUserName(uid, name, sizeof(name));
+    return std::string(name);
+}
+
+//-----------------------------------------------------------------------------
+// Get the user name for a UID into a buffer, without allocating. This is safe to call from multiple threads.
+
+void getUserName(uid_t uid, char * buf, size_t size)
+{
+    struct passwd pwd;
+    struct passwd * pwd_p = NULL;
+    char pwdBuf [1024];
+    if (getpwuid_r(uid, &pwd, pwdBuf, sizeof(pwdBuf), &pwd_p) != 0 || pwd_p == NULL) {
+        if (size > 0) {
+            buf[0] = '\0';
+        }
+        return;
+    }
+    snprintf(buf, size, "%s", pwd.pw_name);
+}
+
+//-----------------------------------------------------------------------------
+
+EventFormatter_t::EventFormatter_t(bool isXml)
+    : isXml_m(isXml)
+{}
+
+//-----------------------------------------------------------------------------
+
+void EventFormatter_t::formatTerse(EventView_t const & event, uint32_t matchMask, char const * processName, std::string & out)
+{
+    enum { MAX_NUM_EVENTS = 2 };
+    Event_t events[MAX_NUM_EVENTS];
+
+    switch (event.getBaseType()) {
+        case FSE_CREATE_FILE:
+        case FSE_CREATE_DIR:
+            events[0].type_m = ADD;
+            break;
+        case FSE_DELETE:
+            events[0].type_m = DELETE;
+            break;
+        case FSE_STAT_CHANGED:
+        case FSE_FINDER_INFO_CHANGED:
+        case FSE_CHOWN:
+            events[0].type_m = CHANGE;
+            break;
+        case FSE_EXCHANGE:
+            events[0].type_m = CHANGE;
+            events[1].type_m = CHANGE;
+            break;
+        case FSE_RENAME:
+            events[0].type_m = DELETE;
+            events[1].type_m = ADD;
+            break;
+        case FSE_INVALID:
+        default:
+            break;
+    }
+
+    int eventIndex = 0;
+    for (int i = 0; i < event.numArgs_m && eventIndex < MAX_NUM_EVENTS; ++i) {
+        EventArg_t const & arg = event.args_am[i];
+        if (arg.isPath()) {
+            events[eventIndex].path_m = arg.data_m;
+            events[eventIndex].pathLen_m = arg.pathLen();
+            events[eventIndex].printRequired_m = (matchMask & (1u << i)) != 0;
+            eventIndex += 1;
+        }
+    }
+
+    for (int i = 0; i < MAX_NUM_EVENTS; ++i) {
+        if (events[i].printRequired_m) {
+            int pathLen = (int) events[i].pathLen_m;
+            switch (events[i].type_m) {
+                case ADD:
+                    strAppendVararg(out, "ADD:%.*s - pid %d (%s)\n", pathLen, events[i].path_m, event.pid_m, processName);
+                    break;
+                case DELETE:
+                    strAppendVararg(out, "DEL:%.*s - pid %d (%s)\n", pathLen, events[i].path_m, event.pid_m, processName);
+                    break;
+                case CHANGE:
+                    strAppendVararg(out, "CHG:%.*s - pid %d (%s)\n", pathLen, events[i].path_m, event.pid_m, processName);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void EventFormatter_t::formatXml(EventView_t const & event, int64_t eventNumber, char const * processName, std::string & out)
+{
+    XmlStrBuilder_t & xml = xml_m;
+    xml.clear();
+
+    switch (event.getBaseType()) {
+        case FSE_CREATE_FILE:
+            xml.pushTag("create-file");
+            break;
+        case FSE_DELETE:
+            xml.pushTag("delete");
+            break;
+        case FSE_STAT_CHANGED:
+            xml.pushTag("stat-changed");
+            break;
+        case FSE_RENAME:
+            xml.pushTag("rename");
+            break;
+        case FSE_CONTENT_MODIFIED:
+            xml.pushTag("content-modified");
+            break;
+        case FSE_EXCHANGE:
+            xml.pushTag("exchange");
+            break;
+        case FSE_FINDER_INFO_CHANGED:
+            xml.pushTag("finder-info-changed");
+            break;
+        case FSE_CREATE_DIR:
+            xml.pushTag("create-dir");
+            break;
+        case FSE_CHOWN:
+            xml.pushTag("chown");
+            break;
+        case FSE_INVALID:
+        default:
+            xml.pushTag("invalid");
+            break;
+    }
+
+    xml.addTagAndVararg("eventNumber", "%lld", eventNumber);
+
+    xml.pushTag("process");
+    xml.addTagAndVararg("id", "%d", event.pid_m);
+    xml.addTagAndValue("name", processName, strlen(processName));
+    xml.popTag();
+
+    for (int i = 0; i < event.numArgs_m; ++i) {
+        EventArg_t const & arg = event.args_am[i];
+
+        switch (arg.type_m) {
+            case FSE_ARG_VNODE: {
+                xml.addTagAndValue("vnode", arg.data_m, arg.pathLen());
+                break;
+            }
+            case FSE_ARG_STRING: {
+                xml.addTagAndValue("string", arg.data_m, arg.pathLen());
+                break;
+            }
+            case FSE_ARG_PATH: { // not in kernel
+                xml.addTagAndValue("path", arg.data_m, arg.pathLen());
+                break;
+            }
+            case FSE_ARG_INT32: {
+                int32_t value = 0;
+                arg.getValue(value);
+                xml.addTagAndVararg("int32", "%d", value);
+                break;
+            }
+            case FSE_ARG_INT64: { // not supported in kernel yet
+                int64_t value = 0;
+                arg.getValue(value);
+                xml.addTagAndVararg("int64", "%lld", value);
+                break;
+            }
+            case FSE_ARG_RAW: {
+                xml.pushTag("raw");
+                xml.addTagAndVararg("length", "%d", arg.len_m);
+                xml.popTag();
+                break;
+            }
+            case FSE_ARG_INO: {
+                ino_t value = 0;
+                arg.getValue(value);
+                xml.addTagAndVararg("inode", "%d", value);
+                break;
+            }
+            case FSE_ARG_UID: {
+                uid_t uid = 0;
+                arg.getValue(uid);
+
+                xml.pushTag("uid");
+                xml.addTagAndVararg("int", "%d", uid);
+                char name [NAME_BUF_SIZE];
+                getUserName(uid, name, sizeof(name));
+                xml.addTagAndValue("name", name, strlen(name));
+                xml.popTag();
+                break;
+            }
+            case FSE_ARG_DEV: {
+                dev_t device = 0;
+                arg.getValue(device);
+
+                xml.pushTag("device");
+                xml.addTagAndVararg("value", "0x%08x", device);
+                xml.addTagAndVararg("major", "%d", (device >> 24) & 0xff);
+                xml.addTagAndVararg("minor", "%d", device & 0xffffff);
+                xml.popTag();
+                break;
+            }
+            case FSE_ARG_MODE: {
+                int32_t mode = 0;
+                arg.getValue(mode);
+                char modeStr [16];
+                getModeString(mode, modeStr);
+                char const * vnodeType = getVnodeTypeString(mode);
+
+                xml.pushTag("mode");
+                xml.addTagAndVararg("int", "0x%x", mode);
+                xml.addTagAndVararg("vnode-type", "%s", vnodeType);
+                xml.addTagAndVararg("str", "%s", modeStr);
+                xml.popTag();
+                break;
+            }
+            case FSE_ARG_GID: {
+                gid_t gid = 0;
+                arg.getValue(gid);
+
+                xml.pushTag("gid");
+                xml.addTagAndVararg("int", "%d", gid);
+                char name [NAME_BUF_SIZE];
+                getGroupName(gid, name, sizeof(name));
+                xml.addTagAndValue("name", name, strlen(name));
+                xml.popTag();
+                break;
+            }
+            default: {
+                xml.addTagAndVararg("unknown-arg", "%d", arg.len_m);
+                break;
+            }
+        }
+    }
+
+    xml.addTagAndVararg("done", "0x%x", FSE_ARG_DONE);
+    xml.popTag();
+
+    out += xml.str();
+}
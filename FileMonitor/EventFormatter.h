@@ -0,0 +1,103 @@
+#ifndef __INC_EventFormatter_H
+#define __INC_EventFormatter_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+
+#include "EventView.h"
+#include "XmlStrBuilder.h"
+
+// The size of a buffer big enough for any process, user or group name.
+enum { NAME_BUF_SIZE = 256 };
+
+// Get the process name for a PID.
+std::string getProcessName(pid_t pid);
+
+// Get the process name for a PID into a buffer, without allocating. Names that don't fit are truncated.
+void getProcessName(pid_t pid, char * buf, size_t size);
+
+// Get the group name for a GID. This is safe to call from multiple threads.
+std::string getGroupName(gid_t gid);
+
+// Get the group name for a GID into a buffer, without allocating. This is safe to call from multiple threads.
+void getGroupName(gid_t gid, char * buf, size_t size);
+
+// Get the user name for a UID. This is safe to call from multiple threads.
+std::string getUserName(uid_t uid);
+
+// Get the user name for a UID into a buffer, without allocating. This is safe to call from multiple threads.
+void getUserName(uid_t uid, char * buf, size_t size);
+
+// This class formats matched FS events in one of the output formats, appending the text to a string. Each instance keeps its own serializer buffers, so separate instances can be used concurrently from separate threads.
+class EventFormatter_t
+{
+private:
+
+    bool isXml_m;
+    XmlStrBuilder_t xml_m;
+
+public:
+
+    // Constructor.
+    EventFormatter_t(bool isXml);
+
+    // Formats an event, appending the output to a string. The match mask has the bit for each argument index set if that argument is a monitored path; the terse format only prints the monitored paths. The process name is looked up from the event's pid, unless it is given, e.g. for an event from the journal whose process may be long gone.
+    void format(EventView_t const & event, uint32_t matchMask, int64_t eventNumber, std::string & out, char const * processName = NULL)
+    {
+        if (isXml_m) {
+            formatAs<true>(event, matchMask, eventNumber, out, processName);
+        }
+        else {
+            formatAs<false>(event, matchMask, eventNumber, out, processName);
+        }
+    }
+
+    // Formats an event in a format chosen at compile time, for callers that have already chosen the format for a loop over many events.
+    template <bool IS_XML>
+    void formatAs(EventView_t const & event, uint32_t matchMask, int64_t eventNumber, std::string & out, char const * processName = NULL)
+    {
+        // The name is looked up into a buffer on the stack, so that formatting an event doesn't allocate.
+        char name [NAME_BUF_SIZE];
+        if (processName == NULL) {
+            getProcessName(event.pid_m, name, sizeof(name));
+            processName = name;
+        }
+
+        if (IS_XML) {
+            formatXml(event, eventNumber, processName, out);
+        }
+        else {
+            formatTerse(event, matchMask, processName, out);
+        }
+    }
+
+private:
+
+    // Formats an event in the terse format.
+    void formatTerse(EventView_t const & event, uint32_t matchMask, char const * processName, std::string & out);
+
+    // Formats an event in the XML format.
+    void formatXml(EventView_t const & event, int64_t eventNumber, char const * processName, std::string & out);
+};
+
+#endif // __INC_EventFormatter_H
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "EventReader.h"
+
+size_t const EventReader_t::MIN_CAPACITY;
+
+//-----------------------------------------------------------------------------
+
+EventReader_t::EventReader_t(int fd, size_t capacity)
+    : fd_m(fd),
+      buf_pm(NULL),
+      capacity_m(capacity < MIN_CAPACITY ? MIN_CAPACITY : capacity),
+      size_m(0)
+{
+    // Anonymous memory is only committed as it is touched, so a large buffer costs nothing until the kernel has that much data queued.
+    void * p = mmap(NULL, capacity_m, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0);
+    if (p == MAP_FAILED) {
+        perror(NULL);
+        exit(1);
+    }
+    buf_pm = (char *) p;
+}
+
+//-----------------------------------------------------------------------------
+
+EventReader_t::~EventReader_t()
+{
+    munmap(buf_pm, capacity_m);
+}
+
+//-----------------------------------------------------------------------------
+
+ssize_t EventReader_t::read()
+{
+    // A carried over event can only fill the buffer if the data is corrupt, since the buffer is much larger than any event. Drop it rather than spin without making progress.
+    if (size_m == capacity_m) {
+        size_m = 0;
+    }
+
+    ssize_t n;
+    do {
+        n = ::read(fd_m, buf_pm + size_m, capacity_m - size_m);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0) {
+        size_m += n;
+    }
+    return n;
+}
+
+//-----------------------------------------------------------------------------
+
+void EventReader_t::reset(int fd)
+{
+    fd_m = fd;
+    size_m = 0;
+}
+
+//-----------------------------------------------------------------------------
+
+void EventReader_t::consume(size_t size)
+{
+    if (size >= size_m) {
+        size_m = 0;
+        return;
+    }
+
+    memmove(buf_pm, buf_pm + size, size_m - size);
+    size_m -= size;
+}
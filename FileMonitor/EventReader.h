@@ -0,0 +1,70 @@
+#ifndef __INC_EventReader_H
+#define __INC_EventReader_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// This class reads FS event data from a file descriptor into a large, mmap-backed buffer. Any incomplete event at the end of a read is carried over to the front of the buffer and completed by the next read, so events that straddle read() boundaries are stitched back together before they are decoded.
+class EventReader_t
+{
+private:
+
+    int fd_m;
+    char * buf_pm;
+    size_t capacity_m;
+    size_t size_m;
+
+public:
+
+    // The smallest buffer allowed. This is comfortably larger than the largest possible event, so that there is always room to complete a carried over event.
+    static size_t const MIN_CAPACITY = 64 * 1024;
+
+    // Constructor. The capacity is rounded up to MIN_CAPACITY.
+    EventReader_t(int fd, size_t capacity);
+
+    // Destructor.
+    ~EventReader_t();
+
+    // Reads more event data from the file descriptor, appending it to any carried over data. Returns the number of bytes read, 0 at end of file, or -1 on error.
+    ssize_t read();
+
+    // Returns the buffered event data, starting with any carried over bytes.
+    char const * getData() const { return buf_pm; }
+
+    // Returns the number of bytes of buffered event data.
+    size_t getSize() const { return size_m; }
+
+    // Returns the size of the buffer, after rounding up.
+    size_t getCapacity() const { return capacity_m; }
+
+    // Switches to reading from a different file descriptor, discarding any carried over data from the old one.
+    void reset(int fd);
+
+    // Discards the given number of bytes of complete events from the front of the buffer, moving the remaining incomplete event (if any) to the front.
+    void consume(size_t size);
+
+private:
+
+    // Not copyable.
+    EventReader_t(EventReader_t const &);
+    EventReader_t & operator=(EventReader_t const &);
+};
+
+#endif // __INC_EventReader_H
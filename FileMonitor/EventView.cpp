@@ -0,0 +1,149 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "EventView.h"
+
+//-----------------------------------------------------------------------------
+
+// The names of the basic event types, indexed by type.
+static char const * const eventTypeNames_s [FSE_MAX_EVENTS] =
+{
+    "create-file",
+    "delete",
+    "stat-changed",
+    "rename",
+    "content-modified",
+    "exchange",
+    "finder-info-changed",
+    "create-dir",
+    "chown",
+    "xattr-modified",
+    "xattr-removed"
+};
+
+//-----------------------------------------------------------------------------
+
+char const * getEventTypeName(int32_t type)
+{
+    return type >= 0 && type < FSE_MAX_EVENTS ? eventTypeNames_s[type] : NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+int32_t getEventTypeForName(char const * name)
+{
+    for (int32_t type = 0; type < FSE_MAX_EVENTS; ++type) {
+        if (strcmp(name, eventTypeNames_s[type]) == 0) {
+            return type;
+        }
+    }
+    return FSE_INVALID;
+}
+
+//-----------------------------------------------------------------------------
+
+bool parseEventTypeList(char const * list, uint32_t & mask)
+{
+    mask = 0;
+    while (true) {
+        char const * end = strchr(list, ',');
+        size_t len = end != NULL ? end - list : strlen(list);
+
+        char name [32];
+        if (len == 0 || len >= sizeof(name)) {
+            return false;
+        }
+        memcpy(name, list, len);
+        name[len] = '\0';
+
+        if (strcmp(name, "all") == 0) {
+            mask |= ALL_EVENT_TYPES_MASK;
+        }
+        else {
+            int32_t type = getEventTypeForName(name);
+            if (type == FSE_INVALID) {
+                return false;
+            }
+            mask |= getEventTypeBit(type);
+        }
+
+        if (end == NULL) {
+            return true;
+        }
+        list = end + 1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+EventIterator_t::EventIterator_t(char const * buf, size_t size)
+    : buf_pm(buf),
+      size_m(size),
+      pos_m(0),
+      isTruncated_m(false)
+{}
+
+//-----------------------------------------------------------------------------
+
+bool EventIterator_t::next(EventView_t & event)
+{
+    if (pos_m >= size_m) {
+        return false;
+    }
+
+    // Decode into a local position so that an incomplete event leaves the iterator at the start of that event.
+    size_t pos = pos_m;
+
+    event.numArgs_m = 0;
+    if (!read(pos, event.type_m) || !read(pos, event.pid_m)) {
+        isTruncated_m = true;
+        return false;
+    }
+
+    while (true) {
+        uint16_t argtype;
+        if (!read(pos, argtype)) {
+            isTruncated_m = true;
+            return false;
+        }
+
+        if (argtype == FSE_ARG_DONE) {
+            break;
+        }
+
+        uint16_t arglen;
+        if (!read(pos, arglen) || size_m - pos < arglen) {
+            isTruncated_m = true;
+            return false;
+        }
+
+        if (event.numArgs_m < EventView_t::MAX_ARGS) {
+            EventArg_t & arg = event.args_am[event.numArgs_m];
+            arg.type_m = argtype;
+            arg.len_m = arglen;
+            arg.data_m = buf_pm + pos;
+            event.numArgs_m += 1;
+        }
+
+        pos += arglen;
+    }
+
+    event.data_m = buf_pm + pos_m;
+    event.size_m = pos - pos_m;
+    pos_m = pos;
+    return true;
+}
@@ -0,0 +1,156 @@
+#ifndef __INC_EventView_H
+#define __INC_EventView_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "fsevents.h"
+
+// A view of a single argument of a FS event. The data points into the buffer that the event was decoded from, so the view is only valid as long as that buffer is.
+struct EventArg_t
+{
+    uint16_t type_m;
+    uint16_t len_m;
+    char const * data_m;
+
+    // Is this argument a path string?
+    bool isPath() const
+    {
+        return type_m == FSE_ARG_VNODE || type_m == FSE_ARG_STRING || type_m == FSE_ARG_PATH;
+    }
+
+    // Returns the length of a path argument, not including the terminating NUL. The length never exceeds the argument's data length, even if the kernel didn't terminate the string.
+    size_t pathLen() const
+    {
+        return strnlen(data_m, len_m);
+    }
+
+    // Copies a fixed size value out of the argument data, returning false if the argument is too short to hold it.
+    template <typename Value_t>
+    bool getValue(Value_t & value) const
+    {
+        if (len_m < sizeof(Value_t)) {
+            return false;
+        }
+        memcpy(&value, data_m, sizeof(Value_t));
+        return true;
+    }
+};
+
+// A view of a single FS event, decoded in place from the kernel's byte layout. No data is copied.
+struct EventView_t
+{
+    // The kernel sends at most FSE_MAX_ARGS arguments per event; allow some slack for extended info.
+    enum { MAX_ARGS = FSE_MAX_ARGS + 4 };
+
+    int32_t type_m;
+    pid_t pid_m;
+
+    // The decoded arguments. Any arguments beyond MAX_ARGS are skipped over but not recorded.
+    int numArgs_m;
+    EventArg_t args_am [MAX_ARGS];
+
+    // The raw bytes of the whole event, including the header and the terminating FSE_ARG_DONE.
+    char const * data_m;
+    size_t size_m;
+
+    // Returns the basic event type, without any extended info flags.
+    int32_t getBaseType() const
+    {
+        return type_m & FSE_TYPE_MASK;
+    }
+};
+
+// Returns the bit for a basic event type in an event type mask, or 0 for types that have no bit.
+inline uint32_t getEventTypeBit(int32_t type)
+{
+    return type >= 0 && type < FSE_MAX_EVENTS ? 1u << type : 0;
+}
+
+// A mask with the bits of all the basic event types set.
+enum { ALL_EVENT_TYPES_MASK = (1u << FSE_MAX_EVENTS) - 1 };
+
+// The event types monitored when a path is added without a type list. The xattr events are too noisy to be of interest by default.
+enum { DEFAULT_EVENT_TYPES_MASK = ALL_EVENT_TYPES_MASK & ~((1u << FSE_XATTR_MODIFIED) | (1u << FSE_XATTR_REMOVED)) };
+
+// Returns the name of a basic event type, e.g. "create-file", or NULL if the type is unknown.
+char const * getEventTypeName(int32_t type);
+
+// Returns the basic event type with a name, or FSE_INVALID if there is no such type.
+int32_t getEventTypeForName(char const * name);
+
+// Parses a comma separated list of event type names, e.g. "create-file,delete", into an event type mask. The name "all" stands for every type. Returns false if a name is unknown.
+bool parseEventTypeList(char const * list, uint32_t & mask);
+
+// This class walks a buffer of FS events as read from the fsevents device, decoding each event into an EventView_t. Every read is bounds checked against the buffer, so a truncated or corrupt buffer stops the iteration instead of walking off the end.
+//
+// Event structure in memory:
+//
+//   event type: 4 bytes
+//   event pid:  sizeof(pid_t) (4 on darwin) bytes
+//   arg:
+//     argtype:  2 bytes
+//     arglen:   2 bytes
+//     argdata:  arglen bytes
+//   arg:
+//     ...
+//   lastarg:
+//     argtype:  2 bytes = 0xb33f
+class EventIterator_t
+{
+private:
+
+    char const * buf_pm;
+    size_t size_m;
+    size_t pos_m;
+    bool isTruncated_m;
+
+public:
+
+    // Constructor.
+    EventIterator_t(char const * buf, size_t size);
+
+    // Decodes the next event in the buffer. Returns false when there are no more complete events.
+    bool next(EventView_t & event);
+
+    // Returns the number of bytes of complete events decoded so far.
+    size_t getConsumed() const { return pos_m; }
+
+    // Returns true if the iteration stopped on an incomplete event at the end of the buffer.
+    bool isTruncated() const { return isTruncated_m; }
+
+private:
+
+    // Copies a fixed size value out of the buffer at a position, advancing the position. Returns false if the value would extend past the end of the buffer.
+    template <typename Value_t>
+    bool read(size_t & pos, Value_t & value) const
+    {
+        if (size_m - pos < sizeof(Value_t)) {
+            return false;
+        }
+        memcpy(&value, buf_pm + pos, sizeof(Value_t));
+        pos += sizeof(Value_t);
+        return true;
+    }
+};
+
+#endif // __INC_EventView_H
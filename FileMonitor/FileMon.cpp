@@ -16,69 +16,129 @@
  */
 
 #include <ctype.h>      // isalnum
+#include <errno.h>
 #include <fcntl.h>
-#include <grp.h>        // for getgrgid(3)
 #include <pthread.h>
-#include <pwd.h>        // for getpwuid(3)
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/ioctl.h>
-#include <sys/sysctl.h>
+#include <sys/select.h>
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/uio.h>
-#include <sys/stat.h>   // for S_IS*(3)
 #include <unistd.h>
 
 #include <iostream>
 #include <list>
-#include <sstream>
+#include <map>
 #include <set>
-#include <stack>
 #include <string>
 #include <vector>
 
+#include "Baseline.h"
+#include "AllocCounter.h"
+#include "ContentHash.h"
+#include "DirtySet.h"
+#include "EventFilter.h"
+#include "EventFormatter.h"
+#include "EventReader.h"
+#include "EventView.h"
+#include "FlightRecorder.h"
+#include "FormatterPool.h"
 #include "fsevents.h"
+#include "Journal.h"
+#include "Merge.h"
+#include "Mirror.h"
 #include "MutexLocker.h"
-#include "XmlStrBuilder.h"
-
-//-----------------------------------------------------------------------------
-
-enum EventType_t
-{
-    NONE,
-    ADD,
-    DELETE,
-    CHANGE
-};
-
-struct Event_t
-{
-    EventType_t type_m;
-    char * path_m;
-    bool printRequired_m;
-
-    Event_t()
-        : type_m(NONE),
-          path_m(NULL),
-          printRequired_m(false)
-    {}
-};
+#include "OutputSink.h"
+#include "PathFilter.h"
+#include "Query.h"
+#include "Rollup.h"
+#include "Sampler.h"
+#include "ShmRing.h"
+#include "SubscriberServer.h"
+#include "TopN.h"
 
 //-----------------------------------------------------------------------------
 
 static bool isDebug_s = false;
 static bool isOutputInXml_s = false;
+static size_t readBufSize_s = 1024 * 1024;
+static int numFormatThreads_s = 0;
+static size_t topCount_s = 0;
+static unsigned reportIntervalSecs_s = 1;
+static unsigned windowSecs_s = 10;
+static size_t rollupDepth_s = 0;
+static RollupFormat_t rollupFormat_s = ROLLUP_TEXT;
+static JournalConfig_t journalConfig_s;
+static char const * socketPath_s = NULL;
+static char const * ringName_s = NULL;
+static size_t ringSize_s = 16 * 1024 * 1024;
+static char const * recorderPath_s = NULL;
+static size_t recorderSize_s = 64 * 1024 * 1024;
+static bool isMirrorEnabled_s = false;
+static char const * changeStatePath_s = NULL;
+static int numBaselineThreads_s = 0;
+static int numHashThreads_s = 0;
+static bool isSamplingEnabled_s = false;
+static char const * replayPath_s = NULL;
+static unsigned numReplayPasses_s = 1;
+static int replayFd_s = -1;
+static char const * recordPath_s = NULL;
+static int recordFd_s = -1;
+static OutputPolicy_t outputPolicy_s = OUTPUT_DROP_NEWEST;
+static size_t outputQueueSize_s = 64 * 1024 * 1024;
 static int64_t eventCounter_s = 0;
 static pthread_mutex_t mutex_s = PTHREAD_MUTEX_INITIALIZER;
 
-typedef std::set<std::string> PathSet_t;
+// A monitored path, and the mask of event types of interest under it.
+struct MonPath_t
+{
+    std::string path_m;
+    uint32_t typeMask_m;
+
+    MonPath_t(std::string const & path, uint32_t typeMask)
+        : path_m(path),
+          typeMask_m(typeMask)
+    {}
+};
+
+typedef std::map<std::string, uint32_t> PathSet_t;
 static PathSet_t monPathSet_s; // Protected by mutex_s
 
-typedef std::vector<std::string> PathVec_t;
+typedef std::vector<MonPath_t> PathVec_t;
 static PathVec_t monPathVec_s; // Protected by mutex_s
 
+// The event types that the worker thread should ask the kernel for. When this changes the stdin thread writes to the wakeup pipe, so that the worker re-clones its fsevents FD.
+static uint32_t kernelTypeMask_s = 0; // Protected by mutex_s
+static int wakeupPipe_as [2] = { -1, -1 };
+
+typedef std::set<PathPattern_t> PatternSet_t;
+static PatternSet_t filterPatternSet_s; // Protected by mutex_s
+static PatternSet_t hashPatternSet_s; // Protected by mutex_s
+
+static PathFilter_t pathFilter_s; // Protected by mutex_s
+
+static EventFilter_t eventFilter_s; // Protected by mutex_s
+
+static EventFormatter_t * formatter_s = NULL; // Protected by mutex_s
+static FormatterPool_t * formatterPool_s = NULL;
+static OutputSink_t * outputSink_s = NULL;
+static TopN_t * topN_s = NULL;
+static Rollup_t * rollup_s = NULL;
+static Journal_t * journal_s = NULL;
+static SubscriberServer_t * server_s = NULL; // Protected by mutex_s
+static Mirror_t * mirror_s = NULL;
+static DirtySet_t * dirtySet_s = NULL;
+static BaselineScanner_t * baseline_s = NULL;
+static bool isBaselineStarted_s = false; // Protected by mutex_s
+static Sampler_t * sampler_s = NULL; // Protected by mutex_s
+static ShmRing_t * ring_s = NULL; // Protected by mutex_s
+static ShmRing_t * recorder_s = NULL; // Protected by mutex_s
+static ContentHasher_t * hasher_s = NULL; // Protected by mutex_s
+
 //-----------------------------------------------------------------------------
 // Terminate the process with an optional error message.
 
@@ -89,61 +149,28 @@ static void terminate()
 }
 
 //-----------------------------------------------------------------------------
-// Replace all substrings in a string with a new substring.
-
-static std::string strReplaceAll(std::string const & in, std::string const & oldSubStr, std::string const & newSubStr)
-{
-    size_t oldSubStrSize = oldSubStr.length();
-
-    std::string s(in);
-    std::stack<size_t> positions;
-
-    for (size_t pos = s.find(oldSubStr); pos != std::string::npos; pos = s.find(oldSubStr, pos + oldSubStr.length())) {
-        positions.push(pos);
-    }
-
-    while (!positions.empty()) {
-        size_t pos = positions.top();
-        positions.pop();
-        s.replace(pos, oldSubStrSize, newSubStr);
-    }
-
-    return s;
-}
-
-//-----------------------------------------------------------------------------
-// Add escapes to a string to make it safe to be included as content in XML.
-
-static std::string strMakeXmlSafe(std::string const & str)
-{
-    std::string s = strReplaceAll(str, "&", "&amp;");
-    s = strReplaceAll(s, "<", "&lt;");
-    s = strReplaceAll(s, ">", "&gt;");
-    return s;
-}
-
-//-----------------------------------------------------------------------------
-// Is a specified file system path under on eof the monitored paths?
+// Is a specified file system path under on eof the monitored paths, for a given event type? The path need not be NUL terminated. The debug output is compiled in or out.
 
-static bool isMonitoredPath(std::string const & testPath)
+template <bool IS_DEBUG>
+static bool isMonitoredPath(char const * testPath, size_t testPathLen, uint32_t typeBit)
 {
-    if (isDebug_s) {
-        printf("DBG: isMonitoredPath( %s )\n", testPath.c_str());
+    if (IS_DEBUG) {
+        printf("DBG: isMonitoredPath( %.*s )\n", (int) testPathLen, testPath);
     }
 
     for (PathVec_t::const_iterator iter = monPathVec_s.begin(); iter != monPathVec_s.end(); ++iter) {
-        std::string const & monPath = *iter;
-        if (monPath.size() <= testPath.size()) {
-            if (testPath.compare(0, monPath.size(), monPath) == 0) {
+        std::string const & monPath = iter->path_m;
+        if ((iter->typeMask_m & typeBit) != 0 && monPath.size() <= testPathLen) {
+            if (memcmp(testPath, monPath.data(), monPath.size()) == 0) {
                 // The monPath matches the prefix of the testPath.  There are now two possibilities: (1) the monPath is a file, in which  case the match must be exact; or (2) the monPath is for a directory, in which case the match must either be exact, or the next char in the testPath must be a slash.
-                if (monPath.size() == testPath.size()) {
-                    if (isDebug_s) {
+                if (monPath.size() == testPathLen) {
+                    if (IS_DEBUG) {
                         printf("DBG:   Matched exact: %s\n", monPath.c_str());
                     }
                     return true;
                 }
                 else if (testPath[monPath.size()] == '/') {
-                    if (isDebug_s) {
+                    if (IS_DEBUG) {
                         printf("DBG:   Matched parent dir: %s\n", monPath.c_str());
                     }
                     return true;
@@ -151,128 +178,18 @@ static bool isMonitoredPath(std::string const & testPath)
             }
         }
 
-        if (isDebug_s) {
+        if (IS_DEBUG) {
             printf("DBG:   No match against %s\n", monPath.c_str());
         }
     }
 
-    if (isDebug_s) {
+    if (IS_DEBUG) {
         printf("DBG:   No match against %ld monitored paths\n", monPathVec_s.size());
     }
 
     return false;
 }
 
-//-----------------------------------------------------------------------------
-// Convert a mode number to an ls-style mode string.
-
-static void getModeString(int32_t mode, char * buf)
-{
-    buf[10] = '\0';
-    buf[9] = mode & 0x01 ? 'x' : '-';
-    buf[8] = mode & 0x02 ? 'w' : '-';
-    buf[7] = mode & 0x04 ? 'r' : '-';
-    buf[6] = mode & 0x08 ? 'x' : '-';
-    buf[5] = mode & 0x10 ? 'w' : '-';
-    buf[4] = mode & 0x20 ? 'r' : '-';
-    buf[3] = mode & 0x40 ? 'x' : '-';
-    buf[2] = mode & 0x80 ? 'w' : '-';
-    buf[1] = mode & 0x100 ? 'r' : '-';
-    if (S_ISFIFO(mode)) {
-        buf[0] = 'p';
-    }
-    else if (S_ISCHR(mode)) {
-        buf[0] = 'c';
-    }
-    else if (S_ISDIR(mode)) {
-        buf[0] = 'd';
-    }
-    else if (S_ISBLK(mode)) {
-        buf[0] = 'b';
-    }
-    else if (S_ISLNK(mode)) {
-        buf[0] = 'l';
-    }
-    else if (S_ISSOCK(mode)) {
-        buf[0] = 's';
-    }
-    else {
-        buf[0] = '-';
-    }
-}
-
-//-----------------------------------------------------------------------------
-// Return a string representation of a node type.
-
-static char const * getVnodeTypeString(int32_t mode)
-{
-    char const * str_to_ret = 0;
-    if (S_ISFIFO(mode)) {
-        str_to_ret = "VFIFO";
-    }
-    else if (S_ISCHR(mode)) {
-        str_to_ret = "VCHR";
-    }
-    else if (S_ISDIR(mode)) {
-        str_to_ret = "VDIR";
-    }
-    else if (S_ISBLK(mode)) {
-        str_to_ret = "VBLK";
-    }
-    else if (S_ISLNK(mode)) {
-        str_to_ret = "VLNK";
-    }
-    else if (S_ISSOCK(mode)) {
-        str_to_ret = "VSOCK";
-    }
-    else {
-        str_to_ret = "VREG";
-    }
-    return str_to_ret;
-}
-
-//-----------------------------------------------------------------------------
-// Get the process name for a PID.
-
-static std::string getProcessName(pid_t pid)
-{
-    int mib[4];
-    mib[0] = CTL_KERN;
-    mib[1] = KERN_PROC;
-    mib[2] = KERN_PROC_PID;
-    mib[3] = pid;
-    struct kinfo_proc kp;
-    size_t len = sizeof(kp);
-    if (sysctl(mib, 4, &kp, &len, NULL, 0) != -1) {
-        return std::string(kp.kp_proc.p_comm);
-    }
-    return std::string("???");
-}
-
-//-----------------------------------------------------------------------------
-// Get the group name for a GID.
-
-std::string getGroupName(gid_t gid)
-{
-    struct group * grp = getgrgid(gid);
-    if (grp == NULL) {
-        return std::string();
-    }
-    return std::string(grp->gr_name);
-}
-
-//-----------------------------------------------------------------------------
-// Get the user name for a UID.
-
-std::string getUserName(uid_t uid)
-{
-    struct passwd * pwd = getpwuid(uid);
-    if (pwd == NULL) {
-        return std::string();
-    }
-    return std::string(pwd->pw_name);
-}
-
 //-----------------------------------------------------------------------------
 // Print this programs help info.
 
@@ -287,20 +204,98 @@ static void printUsage()
             "    http://www.gnu.org/licenses/quick-guide-gplv3.html\n"
             "for further details.\n");
     fprintf(stderr, "\n");
-    fprintf(stderr, "Usage: filemon [-dhx] [dirpath ...]\n");
+    fprintf(stderr, "Usage: filemon [-adhlmx] [-b kbytes] [-j threads] [-t n [-w secs]]\n"
+            "               [-r depth [-o format]] [-i secs] [-J journal]\n"
+            "               [-S socket] [-q policy[,MiB]] [-c statefile]\n"
+            "               [-B threads] [-R name[,MiB]] [-F file[,MiB]]\n"
+            "               [-H threads] [-P file[,passes]] [-W file]\n"
+            "               [dirpath ...]\n"
+            "       filemon query -J dir [query options]\n"
+            "       filemon merge [merge options] [name=]dir ...\n"
+            "       filemon dump [-x] file\n");
     fprintf(stderr, "\n");
+    fprintf(stderr, "  -a :   report a deterministic sample of the paths while the events\n");
+    fprintf(stderr, "         come faster than they can be output\n");
+    fprintf(stderr, "  -B :   print a snapshot of each newly monitored tree, scanned on\n");
+    fprintf(stderr, "         a pool of threads, ahead of its events\n");
+    fprintf(stderr, "  -b :   size of the event read buffer in KiB (default 1024)\n");
+    fprintf(stderr, "  -c :   keep the set of changed paths for changed-since queries,\n");
+    fprintf(stderr, "         with its tokens reserved in a state file\n");
     fprintf(stderr, "  -d :   print debug info\n");
+    fprintf(stderr, "  -F :   also keep the most recent matched events in a flight recorder\n");
+    fprintf(stderr, "         file of the given size (default 64 MiB), dumped on SIGUSR1\n");
+    fprintf(stderr, "  -H :   follow changes to files with a hash of their contents, computed\n");
+    fprintf(stderr, "         on a pool of threads\n");
     fprintf(stderr, "  -h :   print help\n");
+    fprintf(stderr, "  -i :   report interval in seconds for -t and -r (default 1)\n");
+    fprintf(stderr, "  -J :   also append the matched events to a journal, given as\n");
+    fprintf(stderr, "         dir[,segment=MiB][,max-size=MiB][,max-age=hours][,fsync=secs]\n");
+    fprintf(stderr, "  -j :   format events on a pool of threads, preserving event order\n");
+    fprintf(stderr, "  -l :   collect lock contention statistics\n");
+    fprintf(stderr, "  -m :   keep an in-memory mirror of the monitored trees\n");
+    fprintf(stderr, "  -o :   rollup output format: text, json or binary (default text)\n");
+    fprintf(stderr, "  -P :   replay raw fsevents data recorded with -W instead of reading\n");
+    fprintf(stderr, "         the kernel's, a number of times (default 1), then print the\n");
+    fprintf(stderr, "         event rate to stderr and exit\n");
+    fprintf(stderr, "  -q :   what to do with events when stdout falls behind: block,\n");
+    fprintf(stderr, "         drop-newest, drop-oldest or summarize, and the most MiB\n");
+    fprintf(stderr, "         of output to queue (default drop-newest,64)\n");
+    fprintf(stderr, "  -R :   also publish the matched events into a shared memory ring,\n");
+    fprintf(stderr, "         e.g. /filemon, of the given size (default 16 MiB)\n");
+    fprintf(stderr, "  -r :   print per directory event counts, rolled up at a depth\n");
+    fprintf(stderr, "         below the root, every interval, instead of the events\n");
+    fprintf(stderr, "  -S :   also serve events to subscribers on a Unix socket\n");
+    fprintf(stderr, "  -t :   print the top n processes, directories and paths by event\n");
+    fprintf(stderr, "         count every interval, instead of the individual events\n");
+    fprintf(stderr, "  -W :   record the raw fsevents data read from the kernel to a file\n");
+    fprintf(stderr, "  -w :   sliding window in seconds covered by -t (default 10)\n");
     fprintf(stderr, "  -x :   print output in XML form\n");
     fprintf(stderr, "\n");
+    fprintf(stderr, "Run \"filemon query -h\" for the journal query options, and\n");
+    fprintf(stderr, "\"filemon merge -h\" for the options to merge several journals, and\n");
+    fprintf(stderr, "\"filemon dump -h\" to print a flight recorder file.\n");
+    fprintf(stderr, "\n");
     fprintf(stderr, "Zero or more directory paths can be specified to be monitored.\n");
     fprintf(stderr, "Once the program is running, additional commands can be input\n");
     fprintf(stderr, "through stdin.\n");
     fprintf(stderr, "\n");
     fprintf(stderr, "Interactive stdin commands:\n");
     fprintf(stderr, "  add:<path>  - Add a monitored path\n");
+    fprintf(stderr, "  add:<types>:<path>\n");
+    fprintf(stderr, "              - Add a monitored path for a comma separated list\n");
+    fprintf(stderr, "                of event types, e.g. add:create-file,delete:/tmp\n");
     fprintf(stderr, "  del:<path>  - Delete a monitored path\n");
     fprintf(stderr, "  clr         - Clear all monitored paths\n");
+    fprintf(stderr, "  include:<glob>    - Only report paths matching a glob\n");
+    fprintf(stderr, "  exclude:<glob>    - Don't report paths matching a glob\n");
+    fprintf(stderr, "  include-re:<re>   - Only report paths matching a regex\n");
+    fprintf(stderr, "  exclude-re:<re>   - Don't report paths matching a regex\n");
+    fprintf(stderr, "  allow-pid:<pid>   - Only report events from a process id\n");
+    fprintf(stderr, "  deny-pid:<pid>    - Don't report events from a process id\n");
+    fprintf(stderr, "  allow-proc:<name> - Only report events from a process name\n");
+    fprintf(stderr, "  deny-proc:<name>  - Don't report events from a process name\n");
+    fprintf(stderr, "  allow-uid:<uid>   - Only report events on files owned by a user\n");
+    fprintf(stderr, "  deny-uid:<uid>    - Don't report events on files owned by a user\n");
+    fprintf(stderr, "  allow-type:<type> - Only report events of a type, e.g. create-file\n");
+    fprintf(stderr, "  deny-type:<type>  - Don't report events of a type\n");
+    fprintf(stderr, "  clr-filters       - Clear all patterns and event predicates\n");
+    fprintf(stderr, "  hash:<glob>       - Only hash files matching a glob (requires -H)\n");
+    fprintf(stderr, "  no-hash:<glob>    - Don't hash files matching a glob\n");
+    fprintf(stderr, "  clr-hash          - Clear the hashing patterns\n");
+    fprintf(stderr, "  lck         - Print lock contention statistics (requires -l)\n");
+    fprintf(stderr, "  out         - Print the output queue's policy and counters, and\n");
+    fprintf(stderr, "                the sampling rate\n");
+    fprintf(stderr, "  stat:<path> - Print a mirrored path's type, inode, size and mtime\n");
+    fprintf(stderr, "  ls:<path>   - Print the same for a mirrored directory's entries\n");
+    fprintf(stderr, "  mirror      - Print the size of the mirror\n");
+    fprintf(stderr, "  checkpoint  - Print a token for changed-since (requires -c)\n");
+    fprintf(stderr, "  changed-since:<token>\n");
+    fprintf(stderr, "              - Print the paths to rescan for the changes since\n");
+    fprintf(stderr, "                a token, and a new token\n");
+    fprintf(stderr, "  changes     - Print the size of the change set\n");
+    fprintf(stderr, "  baseline    - Print the number of snapshots in progress\n");
+    fprintf(stderr, "  dump        - Print the events in the flight recorder (requires -F)\n");
+    fprintf(stderr, "  hashing     - Print the content hashing queue and counters\n");
     fprintf(stderr, "  die         - Terminate the program\n");
 }
 
@@ -314,15 +309,167 @@ static int processOptions(int argc, char *argv[])
     bool isError = false;
 
     char c;
-    while ((c = getopt(argc, argv, "dhx")) != -1) {
+    while ((c = getopt(argc, argv, "aB:b:c:dF:H:hi:J:j:lmo:P:q:R:r:S:t:W:w:x")) != -1) {
         switch (c) {
+            case 'a':
+                isSamplingEnabled_s = true;
+                break;
+            case 'B':
+                numBaselineThreads_s = atoi(optarg);
+                if (numBaselineThreads_s <= 0) {
+                    fprintf(stderr, "Invalid number of baseline threads: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 'H':
+                numHashThreads_s = atoi(optarg);
+                if (numHashThreads_s <= 0) {
+                    fprintf(stderr, "Invalid number of hashing threads: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 'b':
+                readBufSize_s = strtoul(optarg, NULL, 10) * 1024;
+                if (readBufSize_s == 0) {
+                    fprintf(stderr, "Invalid read buffer size: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 'c':
+                changeStatePath_s = optarg;
+                break;
             case 'd':
                 isDebug_s = true;
                 break;
+            case 'F': {
+                // The flight recorder is given as "path[,MiB]".
+                char * comma = strchr(optarg, ',');
+                if (comma != NULL) {
+                    *comma = '\0';
+                    recorderSize_s = strtoul(comma + 1, NULL, 10) * 1024 * 1024;
+                }
+                recorderPath_s = optarg;
+                if (recorderSize_s == 0) {
+                    fprintf(stderr, "Invalid flight recorder: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            }
             case 'h':
                 printUsage();
                 exit(0);
                 break;
+            case 'i':
+                reportIntervalSecs_s = strtoul(optarg, NULL, 10);
+                if (reportIntervalSecs_s == 0) {
+                    fprintf(stderr, "Invalid report interval: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 'J': {
+                std::string error;
+                if (!journalConfig_s.parse(optarg, error)) {
+                    fprintf(stderr, "Invalid journal: %s\n", error.c_str());
+                    isError = true;
+                }
+                break;
+            }
+            case 'j':
+                numFormatThreads_s = atoi(optarg);
+                if (numFormatThreads_s < 0) {
+                    fprintf(stderr, "Invalid number of format threads: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 'l':
+                MutexLocker_t::setStatsEnabled(true);
+                break;
+            case 'm':
+                isMirrorEnabled_s = true;
+                break;
+            case 'o':
+                if (strcmp(optarg, "text") == 0) {
+                    rollupFormat_s = ROLLUP_TEXT;
+                }
+                else if (strcmp(optarg, "json") == 0) {
+                    rollupFormat_s = ROLLUP_JSON;
+                }
+                else if (strcmp(optarg, "binary") == 0) {
+                    rollupFormat_s = ROLLUP_BINARY;
+                }
+                else {
+                    fprintf(stderr, "Invalid rollup format: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 'P': {
+                // The replay is given as "path[,passes]".
+                char * comma = strchr(optarg, ',');
+                if (comma != NULL) {
+                    *comma = '\0';
+                    numReplayPasses_s = strtoul(comma + 1, NULL, 10);
+                }
+                replayPath_s = optarg;
+                if (numReplayPasses_s == 0) {
+                    fprintf(stderr, "Invalid replay: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            }
+            case 'q': {
+                std::string policy(optarg);
+                size_t comma = policy.find(',');
+                if (comma != std::string::npos) {
+                    outputQueueSize_s = strtoul(policy.c_str() + comma + 1, NULL, 10) * 1024 * 1024;
+                    policy.erase(comma);
+                }
+                if (!parseOutputPolicy(policy.c_str(), outputPolicy_s) || outputQueueSize_s == 0) {
+                    fprintf(stderr, "Invalid output policy: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            }
+            case 'R': {
+                // The ring is given as "name[,MiB]".
+                char * comma = strchr(optarg, ',');
+                if (comma != NULL) {
+                    *comma = '\0';
+                    ringSize_s = strtoul(comma + 1, NULL, 10) * 1024 * 1024;
+                }
+                ringName_s = optarg;
+                if (ringName_s[0] != '/' || ringSize_s == 0) {
+                    fprintf(stderr, "Invalid shared memory ring: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            }
+            case 'r':
+                rollupDepth_s = strtoul(optarg, NULL, 10);
+                if (rollupDepth_s == 0) {
+                    fprintf(stderr, "Invalid rollup depth: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 'S':
+                socketPath_s = optarg;
+                break;
+            case 't':
+                topCount_s = strtoul(optarg, NULL, 10);
+                if (topCount_s == 0) {
+                    fprintf(stderr, "Invalid top count: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 'W':
+                recordPath_s = optarg;
+                break;
+            case 'w':
+                windowSecs_s = strtoul(optarg, NULL, 10);
+                if (windowSecs_s == 0) {
+                    fprintf(stderr, "Invalid window: %s\n", optarg);
+                    isError = true;
+                }
+                break;
             case 'x':
                 isOutputInXml_s = true;
                 break;
@@ -333,6 +480,23 @@ static int processOptions(int argc, char *argv[])
         }
     }
 
+    if (numBaselineThreads_s > 0 && (topCount_s > 0 || rollupDepth_s > 0)) {
+        fprintf(stderr, "A baseline can't be printed with -t or -r\n");
+        isError = true;
+    }
+    if (numHashThreads_s > 0 && (topCount_s > 0 || rollupDepth_s > 0)) {
+        fprintf(stderr, "Content hashes can't be printed with -t or -r\n");
+        isError = true;
+    }
+    if (isSamplingEnabled_s && (topCount_s > 0 || rollupDepth_s > 0)) {
+        fprintf(stderr, "Events can't be sampled with -t or -r\n");
+        isError = true;
+    }
+    if (replayPath_s != NULL && recordPath_s != NULL) {
+        fprintf(stderr, "A replay can't be recorded\n");
+        isError = true;
+    }
+
     if (isError) {
         printUsage();
         exit(1);
@@ -352,6 +516,79 @@ static void eraseTrailingChar(char * s, char c)
     }
 }
 
+//-----------------------------------------------------------------------------
+// Push the union of the event types of interest down into the kernel, so that it doesn't even queue the others. Only the types that can pass the event predicates are of interest. Must be called with mutex_s held.
+
+static void updateKernelTypeMask()
+{
+    uint32_t kernelTypeMask = 0;
+    for (PathVec_t::iterator iter = monPathVec_s.begin(); iter != monPathVec_s.end(); ++iter) {
+        kernelTypeMask |= iter->typeMask_m;
+    }
+    kernelTypeMask &= eventFilter_s.getTypeMask();
+    if (server_s != NULL) {
+        kernelTypeMask |= server_s->getTypeMask();
+    }
+
+    // The mirror, the change set and the baseline scans need every event that can change a file's existence, type, size or modification time, whatever the predicates.
+    if ((mirror_s != NULL || dirtySet_s != NULL || baseline_s != NULL) && !monPathVec_s.empty()) {
+        kernelTypeMask |= DEFAULT_EVENT_TYPES_MASK;
+    }
+
+    if (kernelTypeMask != kernelTypeMask_s) {
+        kernelTypeMask_s = kernelTypeMask;
+        if (wakeupPipe_as[1] >= 0) {
+            char c = 0;
+            write(wakeupPipe_as[1], &c, 1);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Set the roots of the mirror and the change set to the monitored paths. Must be called with mutex_s held.
+
+static void updateTrackedRoots()
+{
+    std::vector<std::string> roots;
+    for (PathVec_t::iterator iter = monPathVec_s.begin(); iter != monPathVec_s.end(); ++iter) {
+        roots.push_back(iter->path_m.empty() ? std::string("/") : iter->path_m);
+    }
+    if (mirror_s != NULL) {
+        mirror_s->setRoots(roots);
+    }
+    if (dirtySet_s != NULL) {
+        dirtySet_s->setRoots(roots);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Write the reply to a command after the events output so far, through the formatter pool or the output sink, so that it doesn't wait for the consumer or interleave with the events. The aggregating modes have no sink, and print it. Must be called with mutex_s held.
+
+static void writeReply(std::string const & reply)
+{
+    if (reply.empty()) {
+        return;
+    }
+
+    if (formatterPool_s != NULL) {
+        formatterPool_s->writeMessage(reply.data(), reply.size());
+    }
+    else if (outputSink_s != NULL) {
+        outputSink_s->writeMessage(reply.data(), reply.size());
+    }
+    else {
+        fputs(reply.c_str(), stdout);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Answer a query command from the mirror or the change set.
+
+static bool answerQuery(char const * line, std::string & reply)
+{
+    return (mirror_s != NULL && mirror_s->query(line, reply)) || (dirtySet_s != NULL && dirtySet_s->query(line, reply));
+}
+
 //-----------------------------------------------------------------------------
 // Process an input command string.
 
@@ -365,9 +602,26 @@ static void processInputCmd(char * line)
 
     // Update the monitor path set.
     if (strncmp(line, "add:", 4) == 0) {
+        // The path may be preceded by a list of event types, e.g. "add:create-file,delete:/var/spool". Paths are absolute, so anything not starting with a slash is a type list.
         char * path = line + 4;
+        uint32_t typeMask = DEFAULT_EVENT_TYPES_MASK;
+        char * colon = strchr(path, ':');
+        if (path[0] != '/' && colon != NULL) {
+            *colon = '\0';
+            if (!parseEventTypeList(path, typeMask)) {
+                fprintf(stderr, "Error: invalid event type list: %s\n", path);
+                typeMask = 0;
+            }
+            path = colon + 1;
+        }
         eraseTrailingChar(path, '/');
-        monPathSet_s.insert(std::string(path));
+        if (typeMask != 0) {
+            // A newly monitored tree gets a snapshot, once the worker is reading events, so that none of its changes are missed.
+            if (isBaselineStarted_s && monPathSet_s.count(std::string(path)) == 0) {
+                baseline_s->scan(path[0] == '\0' ? std::string("/") : std::string(path));
+            }
+            monPathSet_s[std::string(path)] = typeMask;
+        }
     }
     else if (strncmp(line, "del:", 4) == 0) {
         char * path = line + 4;
@@ -377,28 +631,157 @@ static void processInputCmd(char * line)
     else if (strcmp(line, "clr") == 0) {
         monPathSet_s.clear();
     }
+
+    // Update the event predicates.
+    std::string predicateError;
+    if (eventFilter_s.processCmd(line, predicateError)) {
+        if (!predicateError.empty()) {
+            fprintf(stderr, "Error: %s\n", predicateError.c_str());
+        }
+    }
+
+    // Update the include/exclude pattern set, keeping the old set in case the new one doesn't compile.
+    PatternSet_t oldPatternSet(filterPatternSet_s);
+    PatternSet_t oldHashPatternSet(hashPatternSet_s);
+    bool isFilterChanged = false;
+    bool isHashChanged = false;
+    std::string queryReply;
+    if (strncmp(line, "include:", 8) == 0) {
+        isFilterChanged = filterPatternSet_s.insert(PathPattern_t(line + 8, false, false)).second;
+    }
+    else if (strncmp(line, "exclude:", 8) == 0) {
+        isFilterChanged = filterPatternSet_s.insert(PathPattern_t(line + 8, true, false)).second;
+    }
+    else if (strncmp(line, "include-re:", 11) == 0) {
+        isFilterChanged = filterPatternSet_s.insert(PathPattern_t(line + 11, false, true)).second;
+    }
+    else if (strncmp(line, "exclude-re:", 11) == 0) {
+        isFilterChanged = filterPatternSet_s.insert(PathPattern_t(line + 11, true, true)).second;
+    }
+    else if (strcmp(line, "clr-filters") == 0) {
+        isFilterChanged = !filterPatternSet_s.empty();
+        filterPatternSet_s.clear();
+        eventFilter_s.clear();
+    }
+    else if (strncmp(line, "hash:", 5) == 0) {
+        isHashChanged = hashPatternSet_s.insert(PathPattern_t(line + 5, false, false)).second;
+    }
+    else if (strncmp(line, "no-hash:", 8) == 0) {
+        isHashChanged = hashPatternSet_s.insert(PathPattern_t(line + 8, true, false)).second;
+    }
+    else if (strcmp(line, "clr-hash") == 0) {
+        isHashChanged = !hashPatternSet_s.empty();
+        hashPatternSet_s.clear();
+    }
+    else if (strcmp(line, "lck") == 0) {
+        MutexLocker_t::appendStats(queryReply, "LCK: ");
+        writeReply(queryReply);
+    }
+    else if (strcmp(line, "out") == 0) {
+        if (outputSink_s != NULL) {
+            outputSink_s->appendStats(queryReply, "OUT: ", "stdout");
+        }
+        if (sampler_s != NULL) {
+            sampler_s->appendStats(queryReply, "SAMPLING: ");
+        }
+        if (ring_s != NULL) {
+            ring_s->appendStats(queryReply, "RING: ");
+        }
+        if (recorder_s != NULL) {
+            recorder_s->appendStats(queryReply, "RECORDER: ");
+        }
+        writeReply(queryReply);
+    }
+    else if (strcmp(line, "baseline") == 0) {
+        if (baseline_s != NULL) {
+            baseline_s->appendStats(queryReply, "BASELINE: ");
+        }
+        writeReply(queryReply);
+    }
+    else if (strcmp(line, "hashing") == 0) {
+        if (hasher_s != NULL) {
+            hasher_s->appendStats(queryReply, "HASHING: ");
+        }
+        writeReply(queryReply);
+    }
+    else if (answerQuery(line, queryReply)) {
+        writeReply(queryReply);
+    }
     else if (strcmp(line, "die") == 0) {
         if (isDebug_s) {
             printf("DBG: Terminating\n");
         }
+        if (MutexLocker_t::isStatsEnabled()) {
+            MutexLocker_t::appendStats(queryReply, "LCK: ");
+            writeReply(queryReply);
+        }
+        if (formatterPool_s != NULL) {
+            formatterPool_s->drain();
+        }
+        if (outputSink_s != NULL) {
+            outputSink_s->drain();
+        }
+        if (dirtySet_s != NULL) {
+            dirtySet_s->save();
+        }
+        if (ring_s != NULL) {
+            ring_s->close();
+        }
+        if (recorder_s != NULL) {
+            recorder_s->close();
+        }
+        if (journal_s != NULL) {
+            journal_s->close();
+        }
         exit(0);
     }
 
     // Regenerate the monitored path vector using the new monitored path set.
     monPathVec_s.clear();
     for (PathSet_t::iterator iter = monPathSet_s.begin(); iter != monPathSet_s.end(); ++iter) {
-        monPathVec_s.push_back(*iter);
+        monPathVec_s.push_back(MonPath_t(iter->first, iter->second));
+    }
+
+    // The mirror and the change set follow the monitored paths.
+    updateTrackedRoots();
+
+    // Regenerate the path filter using the new pattern set. If the new set doesn't compile then the previous set and filter stay in effect.
+    if (isFilterChanged) {
+        std::vector<PathPattern_t> patterns(filterPatternSet_s.begin(), filterPatternSet_s.end());
+        std::string error;
+        if (!pathFilter_s.compile(patterns, error)) {
+            fprintf(stderr, "Error: %s\n", error.c_str());
+            filterPatternSet_s.swap(oldPatternSet);
+        }
     }
 
+    // Likewise for the hashing patterns.
+    if (isHashChanged && hasher_s != NULL) {
+        std::vector<PathPattern_t> patterns(hashPatternSet_s.begin(), hashPatternSet_s.end());
+        std::string error;
+        if (!hasher_s->setPatterns(patterns, error)) {
+            fprintf(stderr, "Error: %s\n", error.c_str());
+            hashPatternSet_s.swap(oldHashPatternSet);
+        }
+    }
+
+    updateKernelTypeMask();
+
     if (isDebug_s) {
         printf("DBG: MONITORED PATH SET:\n");
         for (PathSet_t::iterator iter = monPathSet_s.begin(); iter != monPathSet_s.end(); ++iter) {
-            printf("DBG:   - %s\n", iter->c_str());
+            printf("DBG:   - %s (types 0x%03x)\n", iter->first.c_str(), iter->second);
         }
         printf("DBG: MONITORED PATH VECTOR:\n");
         for (PathVec_t::iterator iter = monPathVec_s.begin(); iter != monPathVec_s.end(); ++iter) {
-            printf("DBG:   - %s\n", iter->c_str());
+            printf("DBG:   - %s (types 0x%03x)\n", iter->path_m.c_str(), iter->typeMask_m);
+        }
+        printf("DBG: FILTER PATTERN SET (%ld DFAs, %ld states):\n", pathFilter_s.getNumDfas(), pathFilter_s.getNumStates());
+        for (PatternSet_t::iterator iter = filterPatternSet_s.begin(); iter != filterPatternSet_s.end(); ++iter) {
+            printf("DBG:   - %s%s:%s\n", iter->isExclude_m ? "exclude" : "include", iter->isRegex_m ? "-re" : "", iter->text_m.c_str());
         }
+        eventFilter_s.print(stdout, "DBG: ");
+        printf("DBG: KERNEL EVENT TYPES: 0x%03x\n", kernelTypeMask_s);
     }
 
     if (isDebug_s) {
@@ -407,324 +790,252 @@ static void processInputCmd(char * line)
 }
 
 //-----------------------------------------------------------------------------
-// Process a FS event and output information about it in the terse format.
+// Match the path arguments of a FS event against the monitored paths that are interested in the event's type, and then the include/exclude filter, if there are any patterns. Returns a mask with the bit for each argument index set if that argument is a monitored path that passes the filter, so zero means the event is not of interest.
 
-static void processEventTerse(char * buf, size_t size)
+template <bool IS_DEBUG, bool IS_FILTERED>
+static uint32_t matchEvent(EventView_t const & event)
 {
-    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+    uint32_t typeBit = getEventTypeBit(event.getBaseType());
+    uint32_t matchMask = 0;
+    for (int i = 0; i < event.numArgs_m; ++i) {
+        EventArg_t const & arg = event.args_am[i];
+        if (arg.isPath()) {
+            size_t pathLen = arg.pathLen();
+            if (isMonitoredPath<IS_DEBUG>(arg.data_m, pathLen, typeBit) && (!IS_FILTERED || pathFilter_s.isPassed(arg.data_m, pathLen))) {
+                matchMask |= 1u << i;
+            }
+        }
+    }
+    return matchMask;
+}
 
-    /* Event structure in memory:
-     *
-     *   event type: 4 bytes
-     *   event pid:  sizeof(pid_t) (4 on darwin) bytes
-     *   arg:
-     *     argtype:  2 bytes
-     *     arglen:   2 bytes
-     *     argdata:  arglen bytes
-     *   arg:
-     *     ...
-     *   lastarg:
-     *     argtype:  2 bytes = 0xb33f
-     */
-    int pos = 0;
-    while (pos < size) {
-        eventCounter_s++;
+//-----------------------------------------------------------------------------
+// The output stages of the event pipeline, one of which is chosen at startup. Each takes the matched events that pass the predicates and the path filter, and says whether it is subject to sampling. Must be called with mutex_s held.
 
-        enum { MAX_NUM_EVENTS = 2 };
-        Event_t events[MAX_NUM_EVENTS];
-        int eventIndex = 0;
+// Formats each event on the reader thread, in the terse or the XML format, and writes it to the output sink.
+template <bool IS_XML>
+struct InlineOutput_t
+{
+    static bool const IS_SAMPLED = true;
 
-        int32_t eventType = *((int32_t *)((char *)buf + pos));
-        pos += 4;
+    static void emit(EventView_t const & event, uint32_t matchMask, FormatBatch_t *, std::string & out)
+    {
+        out.clear();
+        formatter_s->formatAs<IS_XML>(event, matchMask, eventCounter_s, out);
+        outputSink_s->write(event, matchMask, out.data(), out.size());
+    }
+};
 
-        switch (eventType) {
-            case FSE_CREATE_FILE:
-            case FSE_CREATE_DIR:
-                events[0].type_m = ADD;
-                break;
-            case FSE_DELETE:
-                events[0].type_m = DELETE;
-                break;
-            case FSE_STAT_CHANGED:
-            case FSE_FINDER_INFO_CHANGED:
-            case FSE_CHOWN:
-                events[0].type_m = CHANGE;
-                break;
-            case FSE_EXCHANGE:
-                events[0].type_m = CHANGE;
-                events[1].type_m = CHANGE;
-                break;
-            case FSE_RENAME:
-                events[0].type_m = DELETE;
-                events[1].type_m = ADD;
-                break;
-            case FSE_INVALID:
-            default:
-                break;
+// Copies each event into a batch for the pool of formatter threads.
+struct PooledOutput_t
+{
+    static bool const IS_SAMPLED = true;
+
+    static void emit(EventView_t const & event, uint32_t matchMask, FormatBatch_t * batch_p, std::string &)
+    {
+        batch_p->addEvent(event, matchMask, eventCounter_s);
+    }
+};
+
+// Counts each event in the top-N summaries and the rollup, which replace the output of individual events.
+struct AggregateOutput_t
+{
+    static bool const IS_SAMPLED = false;
+
+    static void emit(EventView_t const & event, uint32_t matchMask, FormatBatch_t *, std::string &)
+    {
+        if (topN_s != NULL) {
+            topN_s->addEvent(event, matchMask);
         }
+        if (rollup_s != NULL) {
+            rollup_s->addEvent(event, matchMask);
+        }
+    }
+};
 
-        pid_t pid = *((pid_t *) (buf + pos));
-        pos += sizeof(pid_t);
-        
-        std::string processName = getProcessName(pid);
+//-----------------------------------------------------------------------------
+// The loop over the events of a read, specialized at compile time on the output stage, the debug level, whether there are any event predicates or path patterns, and whether there are any consumers besides the output (the subscribers, the mirror, the change set, the baseline scans, the journal, the shared memory ring, the flight recorder, the content hashing and the sampler), so that the loop makes no checks of modes that can't apply. Must be called with mutex_s held.
 
-        while (true) {
-            u_int16_t argtype = *((u_int16_t *)(buf + pos));
-            pos += 2;
+template <typename Output_t, bool IS_DEBUG, bool IS_FILTERED, bool HAS_EXTRAS>
+static void processEventLoop(EventIterator_t & iter, FormatBatch_t * batch_p, uint64_t timeUsec, std::string & out)
+{
+    EventView_t event;
+    while (iter.next(event)) {
+        eventCounter_s++;
 
-            if (argtype == FSE_ARG_DONE) {
-                break;
+        if (HAS_EXTRAS) {
+            // The subscribers have their own paths and predicates.
+            if (server_s != NULL) {
+                server_s->dispatch(event, eventCounter_s);
             }
 
-            u_int16_t arglen = *((u_int16_t *)(buf + pos));
-            pos += 2;
-
-            switch (argtype) {
-                case FSE_ARG_VNODE:
-                case FSE_ARG_STRING:
-                case FSE_ARG_PATH:
-                    if (eventIndex < MAX_NUM_EVENTS) {
-                        events[eventIndex].path_m = buf + pos;
-                        events[eventIndex].printRequired_m = isMonitoredPath(std::string(buf + pos));
-                        eventIndex += 1;
-                    }
-                    break;
-                default:
-                    break;
+            // The mirror and the change set have to see every event under their roots, whatever the predicates.
+            if (mirror_s != NULL) {
+                mirror_s->addEvent(event);
+            }
+            if (dirtySet_s != NULL) {
+                dirtySet_s->addEvent(event);
             }
+            if (baseline_s != NULL) {
+                baseline_s->addEvent(event);
+            }
+        }
 
-            pos += arglen;
-        }
-
-        for (int i = 0; i < MAX_NUM_EVENTS; ++i) {
-            if (events[i].printRequired_m) {
-                switch (events[i].type_m) {
-                    case ADD:
-                        printf("ADD:%s - pid %d (%s)\n", events[i].path_m, pid, processName.c_str());
-                        break;
-                    case DELETE:
-                        printf("DEL:%s - pid %d (%s)\n", events[i].path_m, pid, processName.c_str());
-                        break;
-                    case CHANGE:
-                        printf("CHG:%s - pid %d (%s)\n", events[i].path_m, pid, processName.c_str());
-                        break;
-                    default:
-                        break;
-                }
+        // The event predicates only look at header and argument fields, so they are checked before the more expensive path matching. Without any, only this process's own events are rejected.
+        if (IS_FILTERED ? !eventFilter_s.isPassed(event) : eventFilter_s.isOwnEvent(event)) {
+            continue;
+        }
+
+        uint32_t matchMask = matchEvent<IS_DEBUG, IS_FILTERED>(event);
+        if (matchMask == 0) {
+            continue;
+        }
+
+        if (HAS_EXTRAS) {
+            if (journal_s != NULL) {
+                journal_s->append(event, timeUsec);
+            }
+            if (ring_s != NULL) {
+                ring_s->publish(event, matchMask, eventCounter_s, timeUsec);
+            }
+            if (recorder_s != NULL) {
+                recorder_s->publish(event, matchMask, eventCounter_s, timeUsec);
             }
         }
+
+        // Under overload only a sample of the paths is formatted, so that detail is lost predictably rather than at random. The aggregating modes count every event.
+        if (!HAS_EXTRAS || !Output_t::IS_SAMPLED || sampler_s == NULL || sampler_s->isSampled(event, matchMask)) {
+            Output_t::emit(event, matchMask, batch_p, out);
+        }
+
+        // A file is hashed whether or not its event was sampled, and its HASH line follows the event.
+        if (HAS_EXTRAS && hasher_s != NULL) {
+            hasher_s->addEvent(event, matchMask);
+        }
     }
 }
 
 //-----------------------------------------------------------------------------
-// Process a FS event and output information about it in the XML format.
+// The event loop specializations for the output stage, debug level and consumers chosen at startup, indexed by whether there are any event predicates or path patterns, which can change at any time.
 
-static void processEventAsXml(char * buf, size_t size)
-{
-    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+typedef void (*EventLoop_t)(EventIterator_t & iter, FormatBatch_t * batch_p, uint64_t timeUsec, std::string & out);
+static EventLoop_t eventLoops_as [2] = { NULL, NULL };
 
-    /* Event structure in memory:
-     *
-     *   event type: 4 bytes
-     *   event pid:  sizeof(pid_t) (4 on darwin) bytes
-     *   arg:
-     *     argtype:  2 bytes
-     *     arglen:   2 bytes
-     *     argdata:  arglen bytes
-     *   arg:
-     *     ...
-     *   lastarg:
-     *     argtype:  2 bytes = 0xb33f
-     */
-    int pos = 0;
-
-    XmlStrBuilder_t xml;
-
-    while (pos < size) {
-        eventCounter_s++;
+//-----------------------------------------------------------------------------
+// Choose the event loop specializations for an output stage, given the debug level and whether there are any consumers besides the output. Must be called before the worker thread is started.
 
-        bool shouldPrint = false;
-        xml.clear();
+template <typename Output_t>
+static void setEventLoops(bool isDebug, bool hasExtras)
+{
+    if (isDebug) {
+        eventLoops_as[0] = hasExtras ? processEventLoop<Output_t, true, false, true> : processEventLoop<Output_t, true, false, false>;
+        eventLoops_as[1] = hasExtras ? processEventLoop<Output_t, true, true, true> : processEventLoop<Output_t, true, true, false>;
+    }
+    else {
+        eventLoops_as[0] = hasExtras ? processEventLoop<Output_t, false, false, true> : processEventLoop<Output_t, false, false, false>;
+        eventLoops_as[1] = hasExtras ? processEventLoop<Output_t, false, true, true> : processEventLoop<Output_t, false, true, false>;
+    }
 
-        int32_t eventType = *((int32_t *)((char *)buf + pos));
-        pos += 4;
+#ifdef FILEMON_GENERIC_EVENT_LOOP
+    // Make every check, whatever the modes, to measure what the specializations save.
+    eventLoops_as[0] = eventLoops_as[1] = isDebug ? processEventLoop<Output_t, true, true, true> : processEventLoop<Output_t, false, true, true>;
+#endif
+}
 
-        switch (eventType) {
-            case FSE_CREATE_FILE:
-                xml.pushTag("create-file");
-                break;
-            case FSE_DELETE:
-                xml.pushTag("delete");
-                break;
-            case FSE_STAT_CHANGED:
-                xml.pushTag("stat-changed");
-                break;
-            case FSE_RENAME:
-                xml.pushTag("rename");
-                break;
-            case FSE_CONTENT_MODIFIED:
-                xml.pushTag("content-modified");
-                break;
-            case FSE_EXCHANGE:
-                xml.pushTag("exchange");
-                break;
-            case FSE_FINDER_INFO_CHANGED:
-                xml.pushTag("finder-info-changed");
-                break;
-            case FSE_CREATE_DIR:
-                xml.pushTag("create-dir");
-                break;
-            case FSE_CHOWN:
-                xml.pushTag("chown");
-                break;
-            case FSE_INVALID:
-            default:
-                xml.pushTag("invalid");
-                break;
-        }
+//-----------------------------------------------------------------------------
+// Process a buffer of FS events, outputting information about the monitored ones in the selected output format. Each event is decoded in place and checked against the event predicates and the monitored paths first, so unmatched events cost no more than a walk over their headers and path arguments. If there is a formatter pool the matched events are copied into a batch and formatted on the pool's threads, otherwise they are formatted inline. Either way the output goes through the output sink, so a stalled stdout doesn't stop the reader unless the output policy is to block. The events are processed by the specialized event loop for the current modes. Returns the number of bytes of complete events processed; any remaining bytes are the start of an incomplete event.
 
-        xml.addTagAndVararg("eventNumber", "%lld", eventCounter_s);
+static size_t processEvents(char const * buf, size_t size)
+{
+    // Once warm, processing a read of events mustn't allocate. Only the reader thread gets here.
+    static uint64_t numRuns = 0;
+    AllocCheck_t allocCheck("processing events", numRuns);
 
-        pid_t pid = *((pid_t *) (buf + pos));
-        pos += sizeof(pid_t);
+    FormatBatch_t * batch_p = formatterPool_s != NULL ? formatterPool_s->allocBatch() : NULL;
+    size_t consumed = 0;
 
-        xml.pushTag("process");
-        xml.addTagAndVararg("id", "%d", pid);
-        xml.addTagAndValue("name", strMakeXmlSafe(getProcessName(pid)));
-        xml.popTag();
+    // All the events of one read are journaled and published with the same time.
+    uint64_t timeUsec = journal_s != NULL || ring_s != NULL || recorder_s != NULL || sampler_s != NULL ? getTimeUsec() : 0;
 
-        while (true) {
-            u_int16_t argtype = *((u_int16_t *)(buf + pos));
-            pos += 2;
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
 
-            if (argtype == FSE_ARG_DONE) {
-                xml.addTagAndVararg("done", "0x%x", argtype);
-                break;
+        // Reused across events to avoid reallocating. Protected by mutex_s.
+        static std::string out;
+
+        // The sampling rate is adjusted once per read. A read that fills half the buffer or more means that the kernel probably has more events queued. With a formatter pool, the note is sequenced after the events already in the pool, ahead of this read's.
+        if (sampler_s != NULL && sampler_s->update(outputSink_s->getFillPercent(), size * 2 >= readBufSize_s, timeUsec, out)) {
+            if (formatterPool_s != NULL) {
+                formatterPool_s->writeMessage(out.data(), out.size());
+            }
+            else {
+                outputSink_s->writeMessage(out.data(), out.size());
             }
+        }
 
-            u_int16_t arglen = *((u_int16_t *)(buf + pos));
-            pos += 2;
+        eventFilter_s.expireExitedProcesses();
+        if (server_s != NULL) {
+            server_s->expireExitedProcesses();
+        }
+        if (recorder_s != NULL) {
+            recorder_s->expireExitedProcesses();
+        }
+        if (journal_s != NULL) {
+            journal_s->expireExitedProcesses();
+        }
 
-            switch (argtype) {
-                case FSE_ARG_VNODE: {
-                    std::string path(buf + pos);
-                    shouldPrint = shouldPrint || isMonitoredPath(path);
+        EventIterator_t iter(buf, size);
+        bool isFiltered = !eventFilter_s.isEmpty() || !pathFilter_s.isEmpty();
+        eventLoops_as[isFiltered ? 1 : 0](iter, batch_p, timeUsec, out);
 
-                    xml.addTagAndValue("vnode", strMakeXmlSafe(path));
-                    break;
-                }
-                case FSE_ARG_STRING: {
-                    std::string path(buf + pos);
-                    shouldPrint = shouldPrint || isMonitoredPath(path);
+        if (server_s != NULL) {
+            server_s->flush();
+        }
 
-                    xml.addTagAndValue("string", strMakeXmlSafe(path));
-                    break;
-                }
-                case FSE_ARG_PATH: { // not in kernel
-                    std::string path(buf + pos);
-                    shouldPrint = shouldPrint || isMonitoredPath(path);
+        if (iter.isTruncated() && isDebug_s) {
+            printf("DBG: Carrying over %ld bytes of incomplete event data\n", size - iter.getConsumed());
+        }
 
-                    xml.addTagAndValue("path", strMakeXmlSafe(path));
-                    break;
-                }
-                case FSE_ARG_INT32: {
-                    int32_t value = *((int32_t *)(buf + pos));
-                    xml.addTagAndVararg("int32", "%d", value);
-                    break;
-                }
-                case FSE_ARG_INT64: { // not supported in kernel yet
-                    int64_t value = *((int64_t *)(buf + pos));
-                    xml.addTagAndVararg("int64", "%lld", value);
-                    break;
-                }
-                case FSE_ARG_RAW: {
-                    xml.pushTag("raw");
-                    xml.addTagAndVararg("length", "%d", arglen);
-                    xml.popTag();
-                    break;
-                }
-                case FSE_ARG_INO: {
-                    ino_t value = *((ino_t *)(buf + pos));
-                    xml.addTagAndVararg("inode", "%d", value);
-                    break;
-                }
-                case FSE_ARG_UID: {
-                    uid_t uid = *((uid_t *)(buf + pos));
+        consumed = iter.getConsumed();
 
-                    xml.pushTag("uid");
-                    xml.addTagAndVararg("int", "%d", uid);
-                    xml.addTagAndValue("name", strMakeXmlSafe(getUserName(uid)));
-                    xml.popTag();
-                    break;
-                }
-                case FSE_ARG_DEV: {
-                    dev_t device = *((dev_t *) (buf + pos));
-
-                    xml.pushTag("device");
-                    xml.addTagAndVararg("value", "0x%08x", device);
-                    xml.addTagAndVararg("major", "%d", (device >> 24) & 0xff);
-                    xml.addTagAndVararg("minor", "%d", device & 0xffffff);
-                    xml.popTag();
-                    break;
-                }
-                case FSE_ARG_MODE: {
-                    int32_t mode = *((int32_t *)(buf + pos));
-                    char modeStr [16];
-                    getModeString(mode, modeStr);
-                    char const * vnodeType = getVnodeTypeString(mode);
-
-                    xml.pushTag("mode");
-                    xml.addTagAndVararg("int", "0x%x", mode);
-                    xml.addTagAndVararg("vnode-type", "%s", vnodeType);
-                    xml.addTagAndVararg("str", "%s", modeStr);
-                    xml.popTag();
-                    break;
-                }
-                case FSE_ARG_GID: {
-                    gid_t gid = *((gid_t *)(buf + pos));
+        // The batch takes its place in the output while the events can't be overtaken by any other output.
+        if (batch_p != NULL && !batch_p->isEmpty()) {
+            formatterPool_s->sequence(batch_p);
+        }
 
-                    xml.pushTag("gid");
-                    xml.addTagAndVararg("int", "%d", gid);
-                    xml.addTagAndValue("name", strMakeXmlSafe(getGroupName(gid)));
-                    xml.popTag();
-                    break;
-                }
-                default: {
-                    xml.addTagAndVararg("unknown-arg", "%d", arglen);
-                    break;
-                }
-            }
-            pos += arglen;
+        // The files are hashed once their events are in the output, so that their HASH lines can't overtake them.
+        if (hasher_s != NULL) {
+            hasher_s->flush();
         }
+    }
 
-        xml.popTag();
+    if (journal_s != NULL) {
+        journal_s->flush();
+    }
 
-        if (shouldPrint) {
-            printf("%s", xml.str().c_str());
+    // Submit outside of the lock, since submitting blocks while the pool is backed up.
+    if (batch_p != NULL) {
+        if (batch_p->isEmpty()) {
+            formatterPool_s->freeBatch(batch_p);
+        }
+        else {
+            formatterPool_s->submit(batch_p);
         }
     }
+
+    return consumed;
 }
 
 //-----------------------------------------------------------------------------
-// The pthread worker entry function.
+// Clone an fsevents FD that reports the event types in a mask.
 
-static void * workerThreadEntry(void * arg)
+static int cloneFsEventsFd(uint32_t typeMask)
 {
-    char buf [8192];
-
     // Build the list of event types, specifying whether we care about them or not.
     int8_t eventList [FSE_MAX_EVENTS];
-    eventList[FSE_CREATE_FILE]         = FSE_REPORT;
-    eventList[FSE_DELETE]              = FSE_REPORT;
-    eventList[FSE_STAT_CHANGED]        = FSE_REPORT;
-    eventList[FSE_RENAME]              = FSE_REPORT;
-    eventList[FSE_CONTENT_MODIFIED]    = FSE_REPORT;
-    eventList[FSE_EXCHANGE]            = FSE_REPORT;
-    eventList[FSE_FINDER_INFO_CHANGED] = FSE_REPORT;
-    eventList[FSE_CREATE_DIR]          = FSE_REPORT;
-    eventList[FSE_CHOWN]               = FSE_REPORT;
-    eventList[FSE_XATTR_MODIFIED]      = FSE_IGNORE;
-    eventList[FSE_XATTR_REMOVED]       = FSE_IGNORE;
+    for (int32_t type = 0; type < FSE_MAX_EVENTS; ++type) {
+        eventList[type] = (typeMask & getEventTypeBit(type)) != 0 ? FSE_REPORT : FSE_IGNORE;
+    }
 
     // Open the fsevents device to a temporary FD.  This will be used to talk to the device so we can clone the FD while configuring event monitoring parameters.
     int tempfd = open("/dev/fsevents", 0, O_RDONLY);
@@ -747,18 +1058,217 @@ static void * workerThreadEntry(void * arg)
     // Now that we have the real FD we can close the temp FD.
     close(tempfd);
 
+    return fd;
+}
+
+//-----------------------------------------------------------------------------
+// Wait until either the fsevents FD or the wakeup pipe is readable. Returns true if the fsevents FD is readable.
+
+static bool waitForEvents(int fd, bool & isWoken)
+{
+    int maxfd = fd > wakeupPipe_as[0] ? fd : wakeupPipe_as[0];
+
+    // Note that select(2) is used rather than poll(2), since poll doesn't support devices on Darwin.
+    while (true) {
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(fd, &readfds);
+        FD_SET(wakeupPipe_as[0], &readfds);
+
+        if (select(maxfd + 1, &readfds, NULL, NULL, NULL) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            terminate();
+        }
+
+        if (FD_ISSET(wakeupPipe_as[0], &readfds)) {
+            char buf [64];
+            read(wakeupPipe_as[0], buf, sizeof(buf));
+            isWoken = true;
+        }
+
+        return FD_ISSET(fd, &readfds);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Process whatever events are already queued on an fsevents FD, without blocking.
+
+static void drainFsEventsFd(EventReader_t & reader, int fd)
+{
+    while (true) {
+        fd_set readfds;
+        FD_ZERO(&readfds);
+        FD_SET(fd, &readfds);
+        struct timeval timeout = { 0, 0 };
+        if (select(fd + 1, &readfds, NULL, NULL, &timeout) <= 0 || reader.read() <= 0) {
+            return;
+        }
+        reader.consume(processEvents(reader.getData(), reader.getSize()));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Appends the bytes of the last read to the recording, so that it can be replayed with -P. A failed write stops the recording rather than the monitoring.
+
+static void recordEvents(EventReader_t const & reader, size_t numRead)
+{
+    if (!writeAll(recordFd_s, reader.getData() + reader.getSize() - numRead, numRead)) {
+        fprintf(stderr, "Error: can't write the recording to %s: %s\n", recordPath_s, strerror(errno));
+        close(recordFd_s);
+        recordFd_s = -1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Reports the rate at which a replay's events were processed, once their output has been written, and exits.
+
+static void finishReplay(uint64_t startUsec)
+{
+    if (formatterPool_s != NULL) {
+        formatterPool_s->drain();
+    }
+    if (outputSink_s != NULL) {
+        outputSink_s->drain();
+    }
+
+    double secs = (getTimeUsec() - startUsec) / 1e6;
+    int64_t numEvents;
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+        numEvents = eventCounter_s;
+    }
+    fprintf(stderr, "REPLAY: %u passes, %lld events in %.3f secs, %.0f events/s\n", numReplayPasses_s, (long long) numEvents, secs, secs > 0 ? numEvents / secs : 0.0);
+
+    char cmd[] = "die";
+    processInputCmd(cmd);
+}
+
+//-----------------------------------------------------------------------------
+// Prints the events in the flight recorder. Only the copy is made under mutex_s, so the events keep flowing while they are formatted.
+
+static void dumpRecorder()
+{
+    std::vector<char> records;
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+        recorder_s->snapshot(records);
+    }
+
+    EventFormatter_t formatter(isOutputInXml_s);
+    std::string out;
+    formatRecorderRecords(recorderPath_s, records, formatter, isOutputInXml_s, out);
+
+    // The aggregating modes have no output sink, and write to stdout directly.
+    if (outputSink_s != NULL) {
+        outputSink_s->writeMessage(out.data(), out.size());
+    }
+    else {
+        fwrite(out.data(), 1, out.size(), stdout);
+        fflush(stdout);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// The pthread entry function of the thread that dumps the flight recorder on SIGUSR1, which every other thread has blocked.
+
+static void * signalThreadEntry(void *)
+{
+    sigset_t sigs;
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGUSR1);
+    for (;;) {
+        int sig;
+        if (sigwait(&sigs, &sig) == 0 && sig == SIGUSR1) {
+            dumpRecorder();
+        }
+    }
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+// The pthread worker entry function.
+
+static void * workerThreadEntry(void * arg)
+{
+    uint32_t typeMask;
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+        typeMask = kernelTypeMask_s;
+    }
+    int fd = replayFd_s >= 0 ? replayFd_s : cloneFsEventsFd(typeMask);
+
+    // The trees monitored from the start are scanned once the FD is cloned, so that every change during the scans is seen.
+    if (baseline_s != NULL) {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+        for (PathVec_t::iterator iter = monPathVec_s.begin(); iter != monPathVec_s.end(); ++iter) {
+            baseline_s->scan(iter->path_m.empty() ? std::string("/") : iter->path_m);
+        }
+        isBaselineStarted_s = true;
+    }
+
     // Print to stderr that we started. This MUST print to stderr because that the is the stream on which the program that exec'ed this thread will be listening.
     fprintf(stderr, "STARTED\n");
 
-    // Spin on the FD reading event data. Note that we must read at least 2048 bytes at a time on this fd, to get data. Also we must read quickly! Newer events can be lost in the internal kernel event buffer if we take too long on an earlier. To this end the bigger the buffer the better:fewer calls to read().
-    size_t n;
-    while ((n = read(fd, buf, sizeof(buf))) > 0) {
-        if (isOutputInXml_s) {
-            processEventAsXml(buf, n);
+    // Spin on the FD reading event data. Note that we must read at least 2048 bytes at a time on this fd, to get data. Also we must read quickly! Newer events can be lost in the internal kernel event buffer if we take too long on an earlier. To this end the bigger the buffer the better:fewer calls to read(). The reader carries any incomplete trailing event over to the next read.
+    EventReader_t reader(fd, readBufSize_s);
+
+    // The reader rounds the buffer size up, and the sampler needs the real size to tell full reads.
+    readBufSize_s = reader.getCapacity();
+
+    uint64_t startUsec = getTimeUsec();
+    unsigned pass = 1;
+    while (true) {
+        bool isWoken = false;
+        if (waitForEvents(fd, isWoken)) {
+            ssize_t numRead = reader.read();
+            if (numRead <= 0) {
+                // A replay starts over from the beginning of the recording until it has made all its passes.
+                if (replayFd_s < 0 || numRead < 0 || pass == numReplayPasses_s) {
+                    break;
+                }
+                ++pass;
+                lseek(fd, 0, SEEK_SET);
+                reader.reset(fd);
+                continue;
+            }
+            if (recordFd_s >= 0) {
+                recordEvents(reader, numRead);
+            }
+            reader.consume(processEvents(reader.getData(), reader.getSize()));
         }
-        else {
-            processEventTerse(buf, n);
+
+        // A replay has no kernel FD to re-clone.
+        if (!isWoken || replayFd_s >= 0) {
+            continue;
+        }
+
+        uint32_t newTypeMask;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+            newTypeMask = kernelTypeMask_s;
+        }
+        if (newTypeMask == typeMask) {
+            continue;
         }
+
+        // The set of event types of interest changed, so re-clone the FD. The new FD is cloned before the old one is drained and closed, so that no events are lost in the switch over; at worst a few events that are queued on both are reported twice.
+        int newFd = cloneFsEventsFd(newTypeMask);
+        drainFsEventsFd(reader, fd);
+        close(fd);
+
+        if (isDebug_s) {
+            printf("DBG: Re-cloned fsevents FD for event types 0x%03x\n", newTypeMask);
+        }
+
+        fd = newFd;
+        typeMask = newTypeMask;
+        reader.reset(fd);
+    }
+
+    if (replayFd_s >= 0) {
+        finishReplay(startUsec);
     }
 
     return NULL;
@@ -768,12 +1278,40 @@ static void * workerThreadEntry(void * arg)
 
 int main(int argc, char *argv[])
 {
+    // The query subcommand only reads the journal, and doesn't monitor anything.
+    if (argc > 1 && strcmp(argv[1], "query") == 0) {
+        return runQuery(argc - 1, argv + 1);
+    }
+
+    // The merge subcommand only reads journals too.
+    if (argc > 1 && strcmp(argv[1], "merge") == 0) {
+        return runMerge(argc - 1, argv + 1);
+    }
+
+    // The dump subcommand prints a flight recorder file, e.g. one left by a crashed filemon.
+    if (argc > 1 && strcmp(argv[1], "dump") == 0) {
+        return runDump(argc - 1, argv + 1);
+    }
+
     // Set line buffering for stdout.
     setvbuf(stdout, NULL, _IOLBF, 0);
 
+    // Create the pipe used to wake up the worker thread when the event types of interest change.
+    if (pipe(wakeupPipe_as) != 0) {
+        terminate();
+    }
+
     // Handle command line options.
     int argIndex = processOptions(argc, argv);
 
+    // SIGUSR1 dumps the flight recorder on a thread of its own, so it is blocked before any other thread is created, which inherit the mask.
+    if (recorderPath_s != NULL) {
+        sigset_t sigs;
+        sigemptyset(&sigs);
+        sigaddset(&sigs, SIGUSR1);
+        pthread_sigmask(SIG_BLOCK, &sigs, NULL);
+    }
+
     // Add all paths that were provided as command line arguments.
     if (argIndex != -1) {
         for (; argIndex < argc; ++argIndex) {
@@ -784,12 +1322,28 @@ int main(int argc, char *argv[])
         }
     }
 
-    // Check that we have the proper permissions to run.
+    // Open the recording to replay, or to record to.
+    if (replayPath_s != NULL) {
+        replayFd_s = open(replayPath_s, O_RDONLY);
+        if (replayFd_s < 0) {
+            fprintf(stderr, "Error: can't open the replay %s: %s\n", replayPath_s, strerror(errno));
+            return -1;
+        }
+    }
+    if (recordPath_s != NULL) {
+        recordFd_s = open(recordPath_s, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+        if (recordFd_s < 0) {
+            fprintf(stderr, "Error: can't open the recording %s: %s\n", recordPath_s, strerror(errno));
+            return -1;
+        }
+    }
+
+    // Check that we have the proper permissions to run. A replay doesn't read the fsevents device.
     uid_t uid = getuid();
     uid_t euid = geteuid();
     std::string uname = getUserName(uid);
     std::string euname = getUserName(euid);
-    if (euid != 0) {
+    if (euid != 0 && replayFd_s < 0) {
         fprintf(stderr, "Error: filemon must run with root permissions\n"
                 "uid = %d (%s), effective uid = %d (%s)\n", uid, uname.c_str(), euid, euname.c_str());
         return -1;
@@ -799,6 +1353,132 @@ int main(int argc, char *argv[])
         printf("DBG: uid = %d (%s), effective uid = %d (%s)\n", uid, uname.c_str(), euid, euname.c_str());
     }
 
+    // Start mirroring the monitored trees.
+    if (isMirrorEnabled_s) {
+        Mirror_t * mirror_p = new Mirror_t();
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+        mirror_s = mirror_p;
+        updateTrackedRoots();
+        updateKernelTypeMask();
+    }
+
+    // Start keeping the set of changed paths, carrying on from the saved set.
+    if (changeStatePath_s != NULL) {
+        DirtySet_t * dirtySet_p = new DirtySet_t(changeStatePath_s);
+        std::string error;
+        if (!dirtySet_p->open(error)) {
+            fprintf(stderr, "Error: %s\n", error.c_str());
+            return -1;
+        }
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+        dirtySet_s = dirtySet_p;
+        updateTrackedRoots();
+        updateKernelTypeMask();
+    }
+
+    // Start serving subscribers. Writing to a client that has gone away must not kill the daemon.
+    if (socketPath_s != NULL) {
+        signal(SIGPIPE, SIG_IGN);
+        SubscriberServer_t * server_p = new SubscriberServer_t(&mutex_s, updateKernelTypeMask, answerQuery);
+        std::string error;
+        if (!server_p->open(socketPath_s, error)) {
+            fprintf(stderr, "Error: %s\n", error.c_str());
+            return -1;
+        }
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+        server_s = server_p;
+    }
+
+    // Open the journal.
+    if (!journalConfig_s.dir_m.empty()) {
+        journal_s = new Journal_t(journalConfig_s);
+        std::string error;
+        if (!journal_s->open(error)) {
+            fprintf(stderr, "Error: %s\n", error.c_str());
+            return -1;
+        }
+    }
+
+    // Create the shared memory ring.
+    if (ringName_s != NULL) {
+        ring_s = new ShmRing_t;
+        std::string error;
+        if (!ring_s->open(ringName_s, ringSize_s, error)) {
+            fprintf(stderr, "Error: %s\n", error.c_str());
+            return -1;
+        }
+    }
+
+    // Open the flight recorder, carrying on after the events of a previous run.
+    if (recorderPath_s != NULL) {
+        recorder_s = new ShmRing_t;
+        std::string error;
+        if (!recorder_s->openFile(recorderPath_s, recorderSize_s, error)) {
+            fprintf(stderr, "Error: %s\n", error.c_str());
+            return -1;
+        }
+    }
+
+    // Create the aggregators, or else the output sink and the event formatter or the pool of formatter threads.
+    if (topCount_s > 0 || rollupDepth_s > 0) {
+        if (topCount_s > 0) {
+            // The window is a whole number of report intervals.
+            size_t numIntervals = (windowSecs_s + reportIntervalSecs_s - 1) / reportIntervalSecs_s;
+            topN_s = new TopN_t(topCount_s, reportIntervalSecs_s, numIntervals, stdout);
+        }
+        if (rollupDepth_s > 0) {
+            rollup_s = new Rollup_t(rollupDepth_s, reportIntervalSecs_s, rollupFormat_s, stdout);
+        }
+    }
+    else {
+        outputSink_s = new OutputSink_t(STDOUT_FILENO, outputQueueSize_s, outputPolicy_s);
+        if (numFormatThreads_s > 0) {
+            formatterPool_s = new FormatterPool_t(numFormatThreads_s, isOutputInXml_s, outputSink_s);
+        }
+        else {
+            formatter_s = new EventFormatter_t(isOutputInXml_s);
+        }
+        if (isSamplingEnabled_s) {
+            Sampler_t * sampler_p = new Sampler_t();
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+            sampler_s = sampler_p;
+        }
+        if (numBaselineThreads_s > 0) {
+            BaselineScanner_t * baseline_p = new BaselineScanner_t(numBaselineThreads_s, &mutex_s, outputSink_s, formatterPool_s);
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+            baseline_s = baseline_p;
+            updateKernelTypeMask();
+        }
+        if (numHashThreads_s > 0) {
+            ContentHasher_t * hasher_p = new ContentHasher_t(numHashThreads_s, outputSink_s, formatterPool_s);
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+            hasher_s = hasher_p;
+        }
+    }
+
+    // Choose the specialized event loops for the output stage and consumers.
+    bool hasExtras = server_s != NULL || mirror_s != NULL || dirtySet_s != NULL || baseline_s != NULL || journal_s != NULL || ring_s != NULL || recorder_s != NULL || hasher_s != NULL || sampler_s != NULL;
+    if (topN_s != NULL || rollup_s != NULL) {
+        setEventLoops<AggregateOutput_t>(isDebug_s, hasExtras);
+    }
+    else if (formatterPool_s != NULL) {
+        setEventLoops<PooledOutput_t>(isDebug_s, hasExtras);
+    }
+    else if (isOutputInXml_s) {
+        setEventLoops<InlineOutput_t<true> >(isDebug_s, hasExtras);
+    }
+    else {
+        setEventLoops<InlineOutput_t<false> >(isDebug_s, hasExtras);
+    }
+
+    // Create a thread to dump the flight recorder on SIGUSR1.
+    if (recorder_s != NULL) {
+        pthread_t signalThread;
+        if (pthread_create(&signalThread, NULL, signalThreadEntry, NULL) != 0) {
+            terminate();
+        }
+    }
+
     // Create a worker thread to handle the processing of fsevents info.
     pthread_t worker;
     if (pthread_create(&worker, NULL, workerThreadEntry, NULL) != 0) {
@@ -810,8 +1490,36 @@ int main(int argc, char *argv[])
     while (fgets(buf, sizeof(buf), stdin) != NULL) {
         // Eliminate trailing newlines.
         eraseTrailingChar(buf, '\n');
+
+        // The flight recorder is formatted without holding mutex_s, which processInputCmd() holds throughout.
+        if (recorder_s != NULL && strcmp(buf, "dump") == 0) {
+            dumpRecorder();
+            continue;
+        }
         processInputCmd(buf);
     }
 
+    // A daemon carries on serving its subscribers after stdin is closed, and a replay carries on to its end.
+    if (server_s != NULL || replayFd_s >= 0) {
+        pthread_join(worker, NULL);
+    }
+
+    if (formatterPool_s != NULL) {
+        formatterPool_s->drain();
+    }
+    if (outputSink_s != NULL) {
+        outputSink_s->drain();
+    }
+    if (dirtySet_s != NULL) {
+        dirtySet_s->save();
+    }
+    if (recorder_s != NULL) {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_s);
+        recorder_s->close();
+    }
+    if (journal_s != NULL) {
+        journal_s->close();
+    }
+
     return 0;
 }
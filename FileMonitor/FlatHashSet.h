@@ -0,0 +1,224 @@
+#ifndef __INC_FlatHashSet_H
+#define __INC_FlatHashSet_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+// A string that is not necessarily NUL terminated, used to look up strings without copying them.
+struct StrRef_t
+{
+    char const * data_m;
+    size_t len_m;
+
+    StrRef_t(char const * data, size_t len)
+        : data_m(data),
+          len_m(len)
+    {}
+};
+
+// Hashing and equality for integer keys.
+struct IntHashTraits_t
+{
+    static uint64_t hash(uint64_t key)
+    {
+        // The finalizer from MurmurHash3, so that sequential keys spread over the table.
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdull;
+        key ^= key >> 33;
+        key *= 0xc4ceb9fe1a85ec53ull;
+        key ^= key >> 33;
+        return key;
+    }
+
+    static bool isEqual(uint64_t key, uint64_t probe)
+    {
+        return key == probe;
+    }
+};
+
+// Hashing and equality for string keys. Strings can be looked up by StrRef_t without constructing a std::string.
+struct StrHashTraits_t
+{
+    static uint64_t hash(StrRef_t const & str)
+    {
+        // FNV-1a.
+        uint64_t h = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i < str.len_m; ++i) {
+            h ^= (uint8_t) str.data_m[i];
+            h *= 0x100000001b3ull;
+        }
+        return h;
+    }
+
+    static uint64_t hash(std::string const & str)
+    {
+        return hash(StrRef_t(str.data(), str.size()));
+    }
+
+    static bool isEqual(std::string const & key, StrRef_t const & probe)
+    {
+        return key.size() == probe.len_m && memcmp(key.data(), probe.data_m, probe.len_m) == 0;
+    }
+
+    static bool isEqual(std::string const & key, std::string const & probe)
+    {
+        return key == probe;
+    }
+};
+
+// This class is a set stored in a single flat array using open addressing with linear probing. Lookups touch one or two cache lines and never allocate, which makes it suitable for checks on every event. The table size is a power of two and is kept at most half full.
+template <typename Key_t, typename Traits_t>
+class FlatHashSet_t
+{
+private:
+
+    std::vector<Key_t> keys_m;
+    std::vector<uint8_t> isUsed_m;
+    size_t size_m;
+    size_t mask_m;
+
+public:
+
+    // Constructor.
+    FlatHashSet_t()
+        : size_m(0),
+          mask_m(0)
+    {}
+
+    // Returns the number of keys in the set.
+    size_t size() const { return size_m; }
+
+    // Returns true if the set has no keys.
+    bool empty() const { return size_m == 0; }
+
+    // Removes all keys.
+    void clear()
+    {
+        keys_m.clear();
+        isUsed_m.clear();
+        size_m = 0;
+        mask_m = 0;
+    }
+
+    // Adds a key. Returns false if the key was already in the set.
+    bool insert(Key_t const & key)
+    {
+        if ((size_m + 1) * 2 > keys_m.size()) {
+            grow();
+        }
+
+        size_t i = Traits_t::hash(key) & mask_m;
+        while (isUsed_m[i]) {
+            if (Traits_t::isEqual(keys_m[i], key)) {
+                return false;
+            }
+            i = (i + 1) & mask_m;
+        }
+
+        keys_m[i] = key;
+        isUsed_m[i] = 1;
+        size_m += 1;
+        return true;
+    }
+
+    // Removes a key. Returns false if the key wasn't in the set.
+    bool erase(Key_t const & key)
+    {
+        if (size_m == 0) {
+            return false;
+        }
+
+        size_t i = Traits_t::hash(key) & mask_m;
+        while (isUsed_m[i]) {
+            if (Traits_t::isEqual(keys_m[i], key)) {
+                // Linear probing can't leave holes in a probe sequence, so reinsert the rest of the cluster.
+                isUsed_m[i] = 0;
+                size_m -= 1;
+                for (size_t j = (i + 1) & mask_m; isUsed_m[j]; j = (j + 1) & mask_m) {
+                    Key_t moved = keys_m[j];
+                    isUsed_m[j] = 0;
+                    size_m -= 1;
+                    insert(moved);
+                }
+                return true;
+            }
+            i = (i + 1) & mask_m;
+        }
+        return false;
+    }
+
+    // Is a key in the set? The probe may be any type that the traits can hash and compare against a key.
+    template <typename Probe_t>
+    bool contains(Probe_t const & probe) const
+    {
+        if (size_m == 0) {
+            return false;
+        }
+
+        size_t i = Traits_t::hash(probe) & mask_m;
+        while (isUsed_m[i]) {
+            if (Traits_t::isEqual(keys_m[i], probe)) {
+                return true;
+            }
+            i = (i + 1) & mask_m;
+        }
+        return false;
+    }
+
+    // Calls a function for every key in the set, in no particular order.
+    template <typename Func_t>
+    void forEach(Func_t func) const
+    {
+        for (size_t i = 0; i < keys_m.size(); ++i) {
+            if (isUsed_m[i]) {
+                func(keys_m[i]);
+            }
+        }
+    }
+
+private:
+
+    // Doubles the table size and rehashes the keys.
+    void grow()
+    {
+        std::vector<Key_t> oldKeys;
+        std::vector<uint8_t> oldIsUsed;
+        oldKeys.swap(keys_m);
+        oldIsUsed.swap(isUsed_m);
+
+        size_t capacity = oldKeys.empty() ? 16 : oldKeys.size() * 2;
+        keys_m.assign(capacity, Key_t());
+        isUsed_m.assign(capacity, 0);
+        mask_m = capacity - 1;
+        size_m = 0;
+
+        for (size_t i = 0; i < oldKeys.size(); ++i) {
+            if (oldIsUsed[i]) {
+                insert(oldKeys[i]);
+            }
+        }
+    }
+};
+
+#endif // __INC_FlatHashSet_H
@@ -0,0 +1,162 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "EventView.h"
+#include "FlightRecorder.h"
+#include "JournalFormat.h"
+#include "ShmRing.h"
+
+extern int optind;
+
+//-----------------------------------------------------------------------------
+// Print the dump usage.
+
+static void printDumpUsage()
+{
+    fprintf(stderr, "Usage: filemon dump [-hx] file\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -x :   print output in XML form\n");
+    fprintf(stderr, "  -h :   print help\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Prints the events in a flight recorder file written with -F, oldest\n");
+    fprintf(stderr, "first. The file can be read while filemon is running, or after it\n");
+    fprintf(stderr, "has crashed.\n");
+}
+
+//-----------------------------------------------------------------------------
+
+void formatRecorderRecords(char const * name, std::vector<char> const & records, EventFormatter_t & formatter, bool isXml, std::string & out)
+{
+    out += "RECORDER-BEGIN: ";
+    out += name;
+    out += "\n";
+
+    std::string line;
+    uint64_t numEvents = 0;
+    for (size_t offset = 0; offset + 2 * sizeof(uint32_t) <= records.size(); ) {
+        // The size and kind come first in every record, and the sizes were checked when the records were copied.
+        char const * begin = &records[offset];
+        ShmRingRecord_t record;
+        memcpy(&record, begin, 2 * sizeof(uint32_t));
+        offset += record.size_m;
+        if (record.kind_m != SHM_RING_EVENT || record.size_m < sizeof(record)) {
+            continue;
+        }
+
+        // The flight recorder keeps no path table, so the raw event bytes follow the header, and then the process name.
+        memcpy(&record, begin, sizeof(record));
+        if (record.numPaths_m != 0 || sizeof(record) + record.rawSize_m + record.procNameLen_m + (record.procNameLen_m != 0 ? 1 : 0) > record.size_m) {
+            continue;
+        }
+        char const * procName = begin + sizeof(record) + record.rawSize_m;
+        if (record.procNameLen_m == 0 || procName[record.procNameLen_m] != '\0') {
+            procName = NULL;
+        }
+        EventIterator_t iter(begin + sizeof(record), record.rawSize_m);
+        EventView_t event;
+        if (!iter.next(event)) {
+            continue;
+        }
+        numEvents++;
+
+        if (isXml) {
+            formatter.format(event, record.matchMask_m, record.eventNumber_m, out, procName);
+            continue;
+        }
+
+        line.clear();
+        formatter.format(event, record.matchMask_m, record.eventNumber_m, line, procName);
+        for (size_t start = 0; start < line.size(); ) {
+            size_t end = line.find('\n', start);
+            end = end == std::string::npos ? line.size() : end + 1;
+            appendJournalTime(out, record.timeUsec_m);
+            out.append(line, start, end - start);
+            start = end;
+        }
+    }
+
+    char buf [64];
+    snprintf(buf, sizeof(buf), " %llu events\n", (unsigned long long) numEvents);
+    out += "RECORDER-END: ";
+    out += name;
+    out += buf;
+}
+
+//-----------------------------------------------------------------------------
+
+int runDump(int argc, char * argv[])
+{
+    bool isXml = false;
+    bool isError = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "hx")) != -1) {
+        switch (c) {
+            case 'h':
+                printDumpUsage();
+                return 0;
+            case 'x':
+                isXml = true;
+                break;
+            case '?':
+                isError = true;
+                break;
+        }
+    }
+    if (isError || optind != argc - 1) {
+        printDumpUsage();
+        return 1;
+    }
+
+    char const * path = argv[optind];
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        fprintf(stderr, "Error: can't open flight recorder %s: %s\n", path, strerror(errno));
+        return 1;
+    }
+    void * p = st.st_size >= (off_t) sizeof(ShmRingHeader_t) ? mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Error: can't map flight recorder %s\n", path);
+        return 1;
+    }
+
+    ShmRingHeader_t const & header = *(ShmRingHeader_t const *) p;
+    std::vector<char> records;
+    if (header.magic_m != ShmRingHeader_t::MAGIC || header.version_m != ShmRingHeader_t::VERSION || header.dataOffset_m + header.capacity_m > (uint64_t) st.st_size ||
+        !copyShmRingRecords(header, (char const *) p + header.dataOffset_m, records)) {
+        fprintf(stderr, "Error: %s is not a flight recorder file\n", path);
+        munmap(p, st.st_size);
+        return 1;
+    }
+    munmap(p, st.st_size);
+
+    EventFormatter_t formatter(isXml);
+    std::string out;
+    formatRecorderRecords(path, records, formatter, isXml, out);
+    fwrite(out.data(), 1, out.size(), stdout);
+    return 0;
+}
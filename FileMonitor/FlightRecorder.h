@@ -0,0 +1,32 @@
+#ifndef __INC_FlightRecorder_H
+#define __INC_FlightRecorder_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string>
+#include <vector>
+
+#include "EventFormatter.h"
+
+// Formats the records of a flight recorder, as copied by copyShmRingRecords(), in the terse or the XML format, appending the output. The events are framed by "RECORDER-BEGIN: <name>" and "RECORDER-END: <name> <n> events" lines, and each terse line is prefixed with the event time.
+void formatRecorderRecords(char const * name, std::vector<char> const & records, EventFormatter_t & formatter, bool isXml, std::string & out);
+
+// Runs the "filemon dump" subcommand, which prints the events in a flight recorder file, e.g. after a crash. The arguments start with the subcommand name. Returns the process exit code.
+int runDump(int argc, char * argv[]);
+
+#endif // __INC_FlightRecorder_H
@@ -0,0 +1,293 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+
+#include <algorithm>
+
+#include "AllocCounter.h"
+#include "EventFormatter.h"
+#include "FormatterPool.h"
+#include "MutexLocker.h"
+
+//-----------------------------------------------------------------------------
+
+void FormatBatch_t::addEvent(EventView_t const & event, uint32_t matchMask, int64_t eventNumber)
+{
+    // Batches are reused, so a batch only allocates when it is given a bigger read than it has held before.
+    if (data_m.size() + event.size_m > data_m.capacity() || items_m.size() == items_m.capacity()) {
+        AllocExempt_t allocExempt;
+        data_m.reserve(std::max(data_m.size() + event.size_m, data_m.capacity() * 2));
+        items_m.reserve(std::max((size_t) 64, items_m.capacity() * 2));
+    }
+
+    data_m.insert(data_m.end(), event.data_m, event.data_m + event.size_m);
+
+    FormatItem_t item;
+    item.eventNumber_m = eventNumber;
+    item.matchMask_m = matchMask;
+    item.outEnd_m = 0;
+    items_m.push_back(item);
+}
+
+//-----------------------------------------------------------------------------
+
+void FormatBatch_t::clear()
+{
+    seq_m = 0;
+    data_m.clear();
+    items_m.clear();
+    out_m.clear();
+}
+
+//-----------------------------------------------------------------------------
+
+FormatterPool_t::FormatterPool_t(int numThreads, bool isXml, OutputSink_t * sink)
+    : isXml_m(isXml),
+      sink_pm(sink),
+      maxInFlight_m(4 * numThreads),
+      numInFlight_m(0),
+      nextSubmitSeq_m(0),
+      numWritten_m(0),
+      done_m(maxInFlight_m, (FormatBatch_t *) NULL),
+      nextWriteSeq_m(0)
+{
+    // The queues never hold more than the batches in flight, and the one being filled, so they don't allocate once they are full size.
+    work_m.reserve(maxInFlight_m);
+    free_m.reserve(maxInFlight_m + 1);
+    messages_m.reserve(64);
+
+    pthread_mutex_init(&mutex_m, NULL);
+    pthread_cond_init(&workCond_m, NULL);
+    pthread_cond_init(&spaceCond_m, NULL);
+    pthread_mutex_init(&seqMutex_m, NULL);
+
+    for (int i = 0; i < numThreads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, threadEntry, this) != 0) {
+            perror(NULL);
+            exit(1);
+        }
+        threads_m.push_back(thread);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+FormatBatch_t * FormatterPool_t::allocBatch()
+{
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        if (!free_m.empty()) {
+            FormatBatch_t * batch_p = free_m.back();
+            free_m.pop_back();
+            return batch_p;
+        }
+    }
+
+    // There are only ever as many batches as can be in flight, and the one being filled.
+    AllocExempt_t allocExempt;
+    FormatBatch_t * batch_p = new FormatBatch_t;
+    batch_p->clear();
+    return batch_p;
+}
+
+//-----------------------------------------------------------------------------
+
+void FormatterPool_t::freeBatch(FormatBatch_t * batch_p)
+{
+    batch_p->clear();
+
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    free_m.push_back(batch_p);
+}
+
+//-----------------------------------------------------------------------------
+
+void FormatterPool_t::sequence(FormatBatch_t * batch_p)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    batch_p->seq_m = nextSubmitSeq_m++;
+}
+
+//-----------------------------------------------------------------------------
+
+void FormatterPool_t::submit(FormatBatch_t * batch_p)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+
+    // Only the reader sequences and submits batches, one at a time, so a batch's slot in the sequencer is free once there is room for it.
+    while (numInFlight_m >= maxInFlight_m) {
+        MUTEX_COND_WAIT(&spaceCond_m);
+    }
+
+    numInFlight_m += 1;
+    work_m.push_back(batch_p);
+    pthread_cond_signal(&workCond_m);
+}
+
+//-----------------------------------------------------------------------------
+
+void FormatterPool_t::writeMessage(char const * text, size_t len)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&seqMutex_m);
+
+    uint64_t seq;
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        seq = nextSubmitSeq_m;
+    }
+
+    // Once every batch sequenced before the message has been written, there is nothing to wait for.
+    if (seq == nextWriteSeq_m) {
+        sink_pm->writeMessage(text, len);
+        return;
+    }
+
+    Message_t message;
+    message.seq_m = seq;
+    message.len_m = len;
+    messages_m.push_back(message);
+    messageText_m.append(text, len);
+}
+
+//-----------------------------------------------------------------------------
+
+void FormatterPool_t::waitForSequenced()
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+
+    uint64_t seq = nextSubmitSeq_m;
+    while (numWritten_m < seq) {
+        MUTEX_COND_WAIT(&spaceCond_m);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void FormatterPool_t::drain()
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+
+    // A batch is sequenced under the event mutex but submitted after it is released, so waiting for the submitted batches alone could miss the last one, and the messages behind it.
+    while (numWritten_m < nextSubmitSeq_m) {
+        MUTEX_COND_WAIT(&spaceCond_m);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void * FormatterPool_t::threadEntry(void * arg)
+{
+    ((FormatterPool_t *) arg)->run();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void FormatterPool_t::run()
+{
+    if (isXml_m) {
+        runAs<true>();
+    }
+    else {
+        runAs<false>();
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+template <bool IS_XML>
+void FormatterPool_t::runAs()
+{
+    // Each thread has its own formatter, and so its own serializer buffers.
+    EventFormatter_t formatter(IS_XML);
+    uint64_t numRuns = 0;
+
+    while (true) {
+        FormatBatch_t * batch_p = NULL;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            while (work_m.empty()) {
+                MUTEX_COND_WAIT(&workCond_m);
+            }
+            batch_p = work_m.front();
+            work_m.pop_front();
+        }
+
+        AllocCheck_t allocCheck("formatting events", numRuns);
+        EventIterator_t iter(&batch_p->data_m[0], batch_p->data_m.size());
+        EventView_t event;
+        for (size_t i = 0; i < batch_p->items_m.size() && iter.next(event); ++i) {
+            FormatItem_t & item = batch_p->items_m[i];
+            formatter.formatAs<IS_XML>(event, item.matchMask_m, item.eventNumber_m, batch_p->out_m);
+            item.outEnd_m = batch_p->out_m.size();
+        }
+
+        complete(batch_p);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void FormatterPool_t::complete(FormatBatch_t * batch_p)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&seqMutex_m);
+
+    done_m[batch_p->seq_m % maxInFlight_m] = batch_p;
+
+    // Write every batch that is now next in sequence. Whichever thread completes the oldest outstanding batch does the writing.
+    while (done_m[nextWriteSeq_m % maxInFlight_m] != NULL) {
+        FormatBatch_t * next_p = done_m[nextWriteSeq_m % maxInFlight_m];
+        done_m[nextWriteSeq_m % maxInFlight_m] = NULL;
+        nextWriteSeq_m += 1;
+
+        // Each event is written separately, so that the sink's policy applies per event.
+        EventIterator_t eventIter(&next_p->data_m[0], next_p->data_m.size());
+        EventView_t event;
+        size_t start = 0;
+        for (size_t i = 0; i < next_p->items_m.size() && eventIter.next(event); ++i) {
+            FormatItem_t const & item = next_p->items_m[i];
+            sink_pm->write(event, item.matchMask_m, next_p->out_m.data() + start, item.outEnd_m - start);
+            start = item.outEnd_m;
+        }
+
+        next_p->clear();
+        writeMessages();
+
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        free_m.push_back(next_p);
+        numInFlight_m -= 1;
+        numWritten_m = nextWriteSeq_m;
+
+        // The reader in submit(), and any threads in waitForSequenced() or drain(), may be waiting.
+        pthread_cond_broadcast(&spaceCond_m);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void FormatterPool_t::writeMessages()
+{
+    size_t start = 0;
+    while (!messages_m.empty() && messages_m.front().seq_m <= nextWriteSeq_m) {
+        sink_pm->writeMessage(messageText_m.data() + start, messages_m.front().len_m);
+        start += messages_m.front().len_m;
+        messages_m.pop_front();
+    }
+    messageText_m.erase(0, start);
+}
@@ -0,0 +1,142 @@
+#ifndef __INC_FormatterPool_H
+#define __INC_FormatterPool_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "EventView.h"
+#include "OutputSink.h"
+#include "RingQueue.h"
+
+// A matched event waiting to be formatted.
+struct FormatItem_t
+{
+    int64_t eventNumber_m;
+    uint32_t matchMask_m;
+    size_t outEnd_m; // The end of the event's output in the batch's output, once formatted
+};
+
+// A batch of matched events, copied out of the read buffer so that it can be formatted while the reader carries on. The items correspond one to one, in order, with the events in the data.
+struct FormatBatch_t
+{
+    uint64_t seq_m;
+    std::vector<char> data_m;
+    std::vector<FormatItem_t> items_m;
+    std::string out_m;
+
+    // Appends a matched event to the batch.
+    void addEvent(EventView_t const & event, uint32_t matchMask, int64_t eventNumber);
+
+    // Returns true if the batch has no events.
+    bool isEmpty() const { return items_m.empty(); }
+
+    // Clears the batch for reuse, keeping its buffers' capacity.
+    void clear();
+};
+
+// This class formats batches of matched events on a pool of threads, each with its own formatter, and writes the output to a sink strictly in the order that the batches were sequenced. Batches are sequence numbered with the event mutex held, just before they are submitted; a finished batch is held back by the sequencer until all earlier batches have been written. Messages that aren't events can be sequenced in between the batches in the same way.
+class FormatterPool_t
+{
+private:
+
+    // A message waiting for the batches before it to be written. Its text follows that of the messages before it in the waiting message text.
+    struct Message_t
+    {
+        uint64_t seq_m; // The sequence number of the first batch after the message
+        size_t len_m;
+    };
+
+    bool isXml_m;
+    OutputSink_t * sink_pm;
+    size_t maxInFlight_m;
+
+    // Protects the work queue, the free list and the in flight count.
+    pthread_mutex_t mutex_m;
+    pthread_cond_t workCond_m;
+    pthread_cond_t spaceCond_m;
+    RingQueue_t<FormatBatch_t *> work_m;
+    std::vector<FormatBatch_t *> free_m;
+    size_t numInFlight_m;
+    uint64_t nextSubmitSeq_m;
+    uint64_t numWritten_m;  // The number of batches the sequencer has written.
+
+    // Protects the sequencer state, and serializes writes to the sink. If both mutexes are needed this one must be locked first. The finished batches are held in a slot per sequence number modulo the most batches in flight, or NULL.
+    pthread_mutex_t seqMutex_m;
+    std::vector<FormatBatch_t *> done_m;
+    uint64_t nextWriteSeq_m;
+    RingQueue_t<Message_t> messages_m;
+    std::string messageText_m;
+
+    std::vector<pthread_t> threads_m;
+
+public:
+
+    // Constructor. Starts the formatter threads.
+    FormatterPool_t(int numThreads, bool isXml, OutputSink_t * sink);
+
+    // Returns an empty batch, reusing a previously written one if possible.
+    FormatBatch_t * allocBatch();
+
+    // Returns an unused batch to the pool without writing it.
+    void freeBatch(FormatBatch_t * batch_p);
+
+    // Gives a batch its place in the output, after the batches and messages sequenced before it. Must be called with the event mutex held, and the batch must then be submitted.
+    void sequence(FormatBatch_t * batch_p);
+
+    // Submits a sequenced batch for formatting and output. The pool takes ownership of the batch. Blocks while too many batches are in flight, so that a sink that blocks throttles the reader rather than batches queueing without bound.
+    void submit(FormatBatch_t * batch_p);
+
+    // Writes output that isn't events, such as a note about the events, after the output of the batches sequenced so far. Must be called with the event mutex held. Like the sink's messages, it is never dropped, and never waits for the consumer.
+    void writeMessage(char const * text, size_t len);
+
+    // Waits until the batches sequenced so far have been written to the sink, so that output written to the sink afterwards, such as a line about an event that waits for room in the sink like the events do, follows them.
+    void waitForSequenced();
+
+    // Waits until every batch sequenced so far has been formatted and written to the sink, along with the messages sequenced before the last of them.
+    void drain();
+
+private:
+
+    // The formatter thread entry function.
+    static void * threadEntry(void * arg);
+
+    // The formatter thread loop. Runs the loop specialized for the output format.
+    void run();
+
+    // The formatter thread loop for an output format chosen at compile time.
+    template <bool IS_XML>
+    void runAs();
+
+    // Hands a formatted batch to the sequencer, writing it and any later batches and messages that are now in order.
+    void complete(FormatBatch_t * batch_p);
+
+    // Writes the waiting messages that no unwritten batch comes before. Must be called with seqMutex_m locked.
+    void writeMessages();
+
+    // Not copyable.
+    FormatterPool_t(FormatterPool_t const &);
+    FormatterPool_t & operator=(FormatterPool_t const &);
+};
+
+#endif // __INC_FormatterPool_H
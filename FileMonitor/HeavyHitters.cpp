@@ -0,0 +1,277 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+
+#include "FlatHashSet.h"
+#include "HeavyHitters.h"
+
+int32_t const SpaceSaving_t::NO_COUNTER;
+
+//-----------------------------------------------------------------------------
+// Orders heavy hitters by descending count, then by key so that reports are stable.
+
+static bool isHigherCount(HeavyHitter_t const & a, HeavyHitter_t const & b)
+{
+    if (a.count_m != b.count_m) {
+        return a.count_m > b.count_m;
+    }
+    return a.key_m < b.key_m;
+}
+
+//-----------------------------------------------------------------------------
+
+SpaceSaving_t::SpaceSaving_t(size_t capacity, size_t maxKeyLen)
+    : capacity_m(capacity),
+      maxKeyLen_m(maxKeyLen),
+      total_m(0),
+      counters_m(capacity),
+      keys_m(capacity * maxKeyLen)
+{
+    heap_m.reserve(capacity);
+
+    // Keep the index at most half full, so that probe sequences stay short.
+    size_t indexSize = 16;
+    while (indexSize < capacity * 2) {
+        indexSize *= 2;
+    }
+    index_m.assign(indexSize, NO_COUNTER);
+    indexMask_m = indexSize - 1;
+}
+
+//-----------------------------------------------------------------------------
+
+void SpaceSaving_t::add(char const * key, size_t len)
+{
+    if (len > maxKeyLen_m) {
+        len = maxKeyLen_m;
+    }
+
+    total_m += 1;
+
+    uint64_t hash = StrHashTraits_t::hash(StrRef_t(key, len));
+    size_t slot = findSlot(key, len, hash);
+    if (index_m[slot] != NO_COUNTER) {
+        uint32_t counter = index_m[slot];
+        counters_m[counter].count_m += 1;
+        siftDown(counters_m[counter].heapPos_m);
+        return;
+    }
+
+    uint32_t counter;
+    uint64_t minCount = 0;
+    if (heap_m.size() < capacity_m) {
+        // Use a free counter.
+        counter = (uint32_t) heap_m.size();
+        heap_m.push_back(counter);
+        counters_m[counter].heapPos_m = counter;
+    }
+    else {
+        // Take over the counter with the smallest count. Removing it from the index may move other entries, so look up the new key's slot again afterwards.
+        counter = heap_m[0];
+        minCount = counters_m[counter].count_m;
+        eraseFromIndex(counter);
+        slot = findSlot(key, len, hash);
+    }
+
+    Counter_t & c = counters_m[counter];
+    c.count_m = minCount + 1;
+    c.error_m = minCount;
+    c.hash_m = hash;
+    c.keyLen_m = (uint32_t) len;
+    memcpy(getKey(counter), key, len);
+    index_m[slot] = counter;
+
+    if (minCount == 0) {
+        siftUp(c.heapPos_m);
+    }
+    else {
+        siftDown(c.heapPos_m);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void SpaceSaving_t::clear()
+{
+    total_m = 0;
+    heap_m.clear();
+    std::fill(index_m.begin(), index_m.end(), NO_COUNTER);
+}
+
+//-----------------------------------------------------------------------------
+
+size_t SpaceSaving_t::findSlot(char const * key, size_t len, uint64_t hash) const
+{
+    size_t slot = hash & indexMask_m;
+    while (index_m[slot] != NO_COUNTER) {
+        Counter_t const & c = counters_m[index_m[slot]];
+        if (c.hash_m == hash && c.keyLen_m == len && memcmp(getKey(index_m[slot]), key, len) == 0) {
+            break;
+        }
+        slot = (slot + 1) & indexMask_m;
+    }
+    return slot;
+}
+
+//-----------------------------------------------------------------------------
+
+void SpaceSaving_t::eraseFromIndex(uint32_t counter)
+{
+    size_t slot = counters_m[counter].hash_m & indexMask_m;
+    while (index_m[slot] != (int32_t) counter) {
+        slot = (slot + 1) & indexMask_m;
+    }
+
+    // Linear probing can't leave holes in a probe sequence, so shift back any later entries of the cluster that the hole would cut off from their home slot.
+    size_t hole = slot;
+    for (size_t next = (hole + 1) & indexMask_m; index_m[next] != NO_COUNTER; next = (next + 1) & indexMask_m) {
+        size_t home = counters_m[index_m[next]].hash_m & indexMask_m;
+        bool isReachable = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+        if (!isReachable) {
+            index_m[hole] = index_m[next];
+            hole = next;
+        }
+    }
+    index_m[hole] = NO_COUNTER;
+}
+
+//-----------------------------------------------------------------------------
+
+void SpaceSaving_t::siftDown(size_t pos)
+{
+    size_t size = heap_m.size();
+    while (true) {
+        size_t smallest = pos;
+        size_t left = pos * 2 + 1;
+        size_t right = left + 1;
+        if (left < size && counters_m[heap_m[left]].count_m < counters_m[heap_m[smallest]].count_m) {
+            smallest = left;
+        }
+        if (right < size && counters_m[heap_m[right]].count_m < counters_m[heap_m[smallest]].count_m) {
+            smallest = right;
+        }
+        if (smallest == pos) {
+            return;
+        }
+        swapHeap(pos, smallest);
+        pos = smallest;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void SpaceSaving_t::siftUp(size_t pos)
+{
+    while (pos > 0) {
+        size_t parent = (pos - 1) / 2;
+        if (counters_m[heap_m[parent]].count_m <= counters_m[heap_m[pos]].count_m) {
+            return;
+        }
+        swapHeap(pos, parent);
+        pos = parent;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void SpaceSaving_t::swapHeap(size_t a, size_t b)
+{
+    std::swap(heap_m[a], heap_m[b]);
+    counters_m[heap_m[a]].heapPos_m = (uint32_t) a;
+    counters_m[heap_m[b]].heapPos_m = (uint32_t) b;
+}
+
+//-----------------------------------------------------------------------------
+
+HeavyHitters_t::HeavyHitters_t(size_t numIntervals, size_t capacity, size_t maxKeyLen)
+    : intervals_m(numIntervals > 0 ? numIntervals : 1, SpaceSaving_t(capacity, maxKeyLen)),
+      current_m(0)
+{}
+
+//-----------------------------------------------------------------------------
+
+void HeavyHitters_t::rotate()
+{
+    current_m = (current_m + 1) % intervals_m.size();
+    intervals_m[current_m].clear();
+}
+
+//-----------------------------------------------------------------------------
+
+uint64_t HeavyHitters_t::getTotal() const
+{
+    uint64_t total = 0;
+    for (size_t i = 0; i < intervals_m.size(); ++i) {
+        total += intervals_m[i].getTotal();
+    }
+    return total;
+}
+
+//-----------------------------------------------------------------------------
+
+void HeavyHitters_t::getTop(size_t n, std::vector<HeavyHitter_t> & top) const
+{
+    // Merge the interval summaries. A key without a counter in an interval may still have occurred there up to that interval's smallest count, so that is added to both its count and its error, keeping the count an upper bound.
+    struct Merged_t
+    {
+        uint64_t count_m;
+        uint64_t error_m;
+        uint64_t minCounts_m;
+    };
+    typedef std::map<std::string, Merged_t> MergedMap_t;
+
+    struct Merger_t
+    {
+        MergedMap_t * merged_pm;
+        uint64_t minCount_m;
+        void operator()(char const * key, size_t len, uint64_t count, uint64_t error) const
+        {
+            Merged_t & m = merged_pm->insert(std::make_pair(std::string(key, len), Merged_t())).first->second;
+            m.count_m += count;
+            m.error_m += error;
+            m.minCounts_m += minCount_m;
+        }
+    };
+
+    MergedMap_t merged;
+    uint64_t sumMinCounts = 0;
+    for (size_t i = 0; i < intervals_m.size(); ++i) {
+        Merger_t merger = { &merged, intervals_m[i].getMinCount() };
+        sumMinCounts += merger.minCount_m;
+        intervals_m[i].forEach(merger);
+    }
+
+    top.clear();
+    top.reserve(merged.size());
+    for (MergedMap_t::const_iterator iter = merged.begin(); iter != merged.end(); ++iter) {
+        uint64_t missing = sumMinCounts - iter->second.minCounts_m;
+        HeavyHitter_t hitter;
+        hitter.key_m = iter->first;
+        hitter.count_m = iter->second.count_m + missing;
+        hitter.error_m = iter->second.error_m + missing;
+        top.push_back(hitter);
+    }
+
+    std::sort(top.begin(), top.end(), isHigherCount);
+    if (top.size() > n) {
+        top.resize(n);
+    }
+}
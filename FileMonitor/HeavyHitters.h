@@ -0,0 +1,143 @@
+#ifndef __INC_HeavyHitters_H
+#define __INC_HeavyHitters_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// One entry of a heavy hitter report.
+struct HeavyHitter_t
+{
+    std::string key_m;
+    uint64_t count_m; // The estimated count, which is never less than the true count
+    uint64_t error_m; // The most by which the estimated count may exceed the true count
+};
+
+// This class is a Space-Saving summary of the most frequent keys in a stream. It holds a fixed number of counters; when a key without a counter arrives and they are all in use, the counter with the smallest count is taken over by the new key, inheriting its count as the new key's error. Any key whose true count exceeds total / capacity is guaranteed to hold a counter.
+//
+// Keys are stored in a fixed arena and looked up through an open addressing index of counter numbers, and the counters are kept in a min heap by count. Adding a key never allocates and costs one hash, one probe sequence and a heap sift.
+class SpaceSaving_t
+{
+private:
+
+    struct Counter_t
+    {
+        uint64_t count_m;
+        uint64_t error_m;
+        uint64_t hash_m;
+        uint32_t keyLen_m;
+        uint32_t heapPos_m;
+    };
+
+    static int32_t const NO_COUNTER = -1;
+
+    size_t capacity_m;
+    size_t maxKeyLen_m;
+    uint64_t total_m;
+    std::vector<Counter_t> counters_m;
+    std::vector<char> keys_m;
+    std::vector<uint32_t> heap_m;
+    std::vector<int32_t> index_m;
+    size_t indexMask_m;
+
+public:
+
+    // Constructor. Keys longer than the maximum key length are truncated.
+    SpaceSaving_t(size_t capacity, size_t maxKeyLen);
+
+    // Counts one occurrence of a key.
+    void add(char const * key, size_t len);
+
+    // Removes all keys.
+    void clear();
+
+    // Returns the number of occurrences counted.
+    uint64_t getTotal() const { return total_m; }
+
+    // Returns the smallest count, which bounds the true count of any key without a counter.
+    uint64_t getMinCount() const
+    {
+        return heap_m.size() < capacity_m ? 0 : counters_m[heap_m[0]].count_m;
+    }
+
+    // Calls a function with the key, length, count and error of every counter, in no particular order.
+    template <typename Func_t>
+    void forEach(Func_t func) const
+    {
+        for (size_t i = 0; i < heap_m.size(); ++i) {
+            Counter_t const & counter = counters_m[heap_m[i]];
+            func(getKey(heap_m[i]), (size_t) counter.keyLen_m, counter.count_m, counter.error_m);
+        }
+    }
+
+private:
+
+    // Returns the arena storage of a counter's key.
+    char * getKey(uint32_t counter) { return &keys_m[counter * maxKeyLen_m]; }
+    char const * getKey(uint32_t counter) const { return &keys_m[counter * maxKeyLen_m]; }
+
+    // Returns the index slot holding a key's counter, or the empty slot where it would go.
+    size_t findSlot(char const * key, size_t len, uint64_t hash) const;
+
+    // Removes a counter from the index.
+    void eraseFromIndex(uint32_t counter);
+
+    // Restores the heap order after a counter's count increased.
+    void siftDown(size_t pos);
+
+    // Restores the heap order after a counter was added with the smallest possible count.
+    void siftUp(size_t pos);
+
+    // Swaps two heap entries, keeping the counters' heap positions up to date.
+    void swapHeap(size_t a, size_t b);
+};
+
+// This class tracks the heavy hitters of a stream over a sliding window. The window is divided into a fixed number of intervals, each with its own Space-Saving summary; rotating to the next interval discards the oldest one. The summaries are merged only when a report is requested.
+class HeavyHitters_t
+{
+private:
+
+    std::vector<SpaceSaving_t> intervals_m;
+    size_t current_m;
+
+public:
+
+    // Constructor.
+    HeavyHitters_t(size_t numIntervals, size_t capacity, size_t maxKeyLen);
+
+    // Counts one occurrence of a key in the current interval.
+    void add(char const * key, size_t len)
+    {
+        intervals_m[current_m].add(key, len);
+    }
+
+    // Starts a new interval, discarding the oldest one.
+    void rotate();
+
+    // Returns the number of occurrences counted over the window.
+    uint64_t getTotal() const;
+
+    // Gets the keys with the highest estimated counts over the window, in descending order of count.
+    void getTop(size_t n, std::vector<HeavyHitter_t> & top) const;
+};
+
+#endif // __INC_HeavyHitters_H
@@ -0,0 +1,671 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "AllocCounter.h"
+#include "Journal.h"
+#include "MutexLocker.h"
+
+size_t const Journal_t::MAX_PENDING;
+uint64_t const Journal_t::TIME_INDEX_INTERVAL;
+size_t const Journal_t::MAX_INDEXED_DIRS;
+
+//-----------------------------------------------------------------------------
+
+uint64_t getTimeUsec()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+//-----------------------------------------------------------------------------
+// Returns the size of a file, or 0 if it doesn't exist.
+
+static uint64_t getFileSize(std::string const & path)
+{
+    struct stat st;
+    return stat(path.c_str(), &st) == 0 ? st.st_size : 0;
+}
+
+//-----------------------------------------------------------------------------
+// Read the header of a segment's path index. Returns false if the segment isn't sealed.
+
+static bool readPathIndexHeader(std::string const & dir, uint64_t firstSeq, JournalPathIndexHeader_t & header)
+{
+    FILE * file = fopen(getJournalSegmentPath(dir, firstSeq, ".fmp").c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+    bool isRead = fread(&header, sizeof(header), 1, file) == 1 && header.magic_m == JournalPathIndexHeader_t::MAGIC;
+    fclose(file);
+    return isRead;
+}
+
+//-----------------------------------------------------------------------------
+
+JournalConfig_t::JournalConfig_t()
+    : segmentSize_m(64 * 1024 * 1024),
+      maxSize_m(0),
+      maxAgeSecs_m(0),
+      fsyncSecs_m(1)
+{}
+
+//-----------------------------------------------------------------------------
+
+bool JournalConfig_t::parse(char const * spec, std::string & error)
+{
+    char const * comma = strchr(spec, ',');
+    dir_m.assign(spec, comma != NULL ? comma - spec : strlen(spec));
+    if (dir_m.empty()) {
+        error = "missing journal directory";
+        return false;
+    }
+
+    while (comma != NULL) {
+        char const * setting = comma + 1;
+        comma = strchr(setting, ',');
+        std::string str(setting, comma != NULL ? comma - setting : strlen(setting));
+
+        size_t eq = str.find('=');
+        char * end = NULL;
+        unsigned long long value = eq != std::string::npos ? strtoull(str.c_str() + eq + 1, &end, 10) : 0;
+        if (eq == std::string::npos || eq + 1 == str.size() || *end != '\0') {
+            error = "invalid journal setting: " + str;
+            return false;
+        }
+
+        std::string key = str.substr(0, eq);
+        if (key == "segment" && value > 0) {
+            segmentSize_m = value * 1024 * 1024;
+        }
+        else if (key == "max-size") {
+            maxSize_m = value * 1024 * 1024;
+        }
+        else if (key == "max-age") {
+            maxAgeSecs_m = value * 60 * 60;
+        }
+        else if (key == "fsync") {
+            fsyncSecs_m = (unsigned) value;
+        }
+        else {
+            error = "invalid journal setting: " + str;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+Journal_t::Journal_t(JournalConfig_t const & config)
+    : config_m(config),
+      numDropped_m(0),
+      isClosing_m(false),
+      fd_m(-1),
+      timeIndexFd_m(-1),
+      segmentFirstSeq_m(0),
+      segmentSize_m(0),
+      segmentNumRecords_m(0),
+      segmentFirstTimeUsec_m(0),
+      isSegmentDirsOverflowed_m(false),
+      nextSeq_m(1),
+      lastTimeUsec_m(0),
+      lastSyncUsec_m(0),
+      numReportedDropped_m(0),
+      isFailed_m(false)
+{
+    pthread_mutex_init(&mutex_m, NULL);
+    pthread_cond_init(&cond_m, NULL);
+}
+
+//-----------------------------------------------------------------------------
+
+bool Journal_t::open(std::string & error)
+{
+    if (mkdir(config_m.dir_m.c_str(), 0755) != 0 && errno != EEXIST) {
+        error = "can't create journal directory " + config_m.dir_m + ": " + strerror(errno);
+        return false;
+    }
+
+    if (!recover(error)) {
+        return false;
+    }
+    applyRetention();
+
+    if (pthread_create(&thread_m, NULL, threadEntry, this) != 0) {
+        perror(NULL);
+        exit(1);
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void Journal_t::append(EventView_t const & event, uint64_t timeUsec)
+{
+    char const * procName = procNames_m.getName(event.pid_m);
+    size_t procNameLen = strlen(procName);
+
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    if (isClosing_m) {
+        return;
+    }
+
+    size_t pos = pending_m.size();
+    size_t need = sizeof(Pending_t) + ((procNameLen + event.size_m + 7) & ~(size_t) 7);
+    if (pos + need > MAX_PENDING) {
+        numDropped_m += 1;
+        return;
+    }
+
+    // The pending buffer is swapped with the writer's, so it only allocates when the writer falls further behind than ever before.
+    if (pos + need > pending_m.capacity()) {
+        AllocExempt_t allocExempt;
+        pending_m.reserve(std::min(std::max(pos + need, pending_m.capacity() * 2), MAX_PENDING));
+    }
+
+    pending_m.resize(pos + need);
+    Pending_t * pending_p = (Pending_t *) &pending_m[pos];
+    pending_p->timeUsec_m = timeUsec;
+    pending_p->size_m = (uint32_t) event.size_m;
+    pending_p->procNameLen_m = (uint16_t) procNameLen;
+    pending_p->reserved_m = 0;
+    memcpy(&pending_m[pos + sizeof(Pending_t)], procName, procNameLen);
+    memcpy(&pending_m[pos + sizeof(Pending_t) + procNameLen], event.data_m, event.size_m);
+}
+
+//-----------------------------------------------------------------------------
+
+void Journal_t::flush()
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    if (!pending_m.empty()) {
+        pthread_cond_signal(&cond_m);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void Journal_t::close()
+{
+    {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+        if (isClosing_m) {
+            return;
+        }
+        isClosing_m = true;
+        pthread_cond_signal(&cond_m);
+    }
+
+    // The writer writes and syncs what is queued before it exits, after which its state is ours.
+    pthread_join(thread_m, NULL);
+    closeFiles();
+}
+
+//-----------------------------------------------------------------------------
+
+void * Journal_t::threadEntry(void * arg)
+{
+    static_cast<Journal_t *>(arg)->run();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void Journal_t::run()
+{
+    bool isUnsynced = false;
+
+    while (true) {
+        uint64_t numDropped;
+        bool isClosing;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            while (pending_m.empty() && !isClosing_m) {
+                if (!isUnsynced) {
+                    MUTEX_COND_WAIT(&cond_m);
+                    continue;
+                }
+
+                // Wait no longer than the fsync interval for more events, so that the data written so far doesn't stay unsynced indefinitely.
+                uint64_t deadlineUsec = lastSyncUsec_m + config_m.fsyncSecs_m * 1000000ull;
+                struct timespec deadline;
+                deadline.tv_sec = deadlineUsec / 1000000;
+                deadline.tv_nsec = (deadlineUsec % 1000000) * 1000;
+                if (MUTEX_COND_TIMEDWAIT(&cond_m, &deadline) == ETIMEDOUT) {
+                    break;
+                }
+            }
+            pending_m.swap(writing_m);
+            numDropped = numDropped_m;
+            isClosing = isClosing_m;
+        }
+
+        if (numDropped > numReportedDropped_m) {
+            fprintf(stderr, "Warning: journal writer fell behind, %llu events dropped in total\n", (unsigned long long) numDropped);
+            numReportedDropped_m = numDropped;
+        }
+
+        if (!isFailed_m && !writing_m.empty()) {
+            writePending(&writing_m[0], writing_m.size());
+            writeOut();
+            isUnsynced = true;
+        }
+        writing_m.clear();
+
+        // Nothing can be appended once closing, so the events just written are the last ones.
+        if (isClosing) {
+            if (isUnsynced && !isFailed_m) {
+                sync();
+            }
+            return;
+        }
+
+        if (isUnsynced && !isFailed_m && getTimeUsec() >= lastSyncUsec_m + config_m.fsyncSecs_m * 1000000ull) {
+            sync();
+            isUnsynced = false;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void Journal_t::writePending(char const * buf, size_t size)
+{
+    static char const padding [8] = { 0 };
+
+    for (size_t pos = 0; pos < size && !isFailed_m; ) {
+        Pending_t const * pending_p = (Pending_t const *) (buf + pos);
+        char const * procName = buf + pos + sizeof(Pending_t);
+        size_t procNameLen = pending_p->procNameLen_m;
+        char const * eventData = procName + procNameLen;
+        pos += sizeof(Pending_t) + ((procNameLen + pending_p->size_m + 7) & ~(size_t) 7);
+
+        EventIterator_t iter(eventData, pending_p->size_m);
+        EventView_t event;
+        if (!iter.next(event)) {
+            continue;
+        }
+
+        // Keep the record times from going backwards, even if the clock does, so that the time index can be binary searched.
+        uint64_t timeUsec = std::max(pending_p->timeUsec_m, lastTimeUsec_m);
+        lastTimeUsec_m = timeUsec;
+
+        JournalRecordHeader_t header;
+        header.size_m = (uint32_t) (procNameLen + event.size_m);
+        header.seq_m = nextSeq_m;
+        header.timeUsec_m = timeUsec;
+        header.pid_m = event.pid_m;
+        header.procNameLen_m = (uint16_t) procNameLen;
+        header.reserved_m = 0;
+
+        size_t recordSize = getJournalRecordSize(header.size_m);
+        if (segmentNumRecords_m > 0 && segmentSize_m + recordSize > config_m.segmentSize_m) {
+            if (!sealSegment() || !startSegment()) {
+                return;
+            }
+            applyRetention();
+        }
+
+        if (segmentNumRecords_m % TIME_INDEX_INTERVAL == 0) {
+            JournalTimeIndexEntry_t entry;
+            entry.timeUsec_m = timeUsec;
+            entry.seq_m = nextSeq_m;
+            entry.offset_m = segmentSize_m;
+            timeIndexOut_m.append((char const *) &entry, sizeof(entry));
+        }
+        if (segmentNumRecords_m == 0) {
+            segmentFirstTimeUsec_m = timeUsec;
+        }
+
+        // The CRC is computed over the header fields and payload as they are laid out in the output.
+        size_t start = out_m.size();
+        out_m.append((char const *) &header, sizeof(header));
+        out_m.append(procName, procNameLen);
+        out_m.append(event.data_m, event.size_m);
+        out_m.append(padding, recordSize - sizeof(header) - header.size_m);
+        JournalRecordHeader_t * header_p = (JournalRecordHeader_t *) &out_m[start];
+        header_p->crc_m = getJournalRecordCrc(*header_p, &out_m[start + sizeof(header)]);
+
+        segmentSize_m += recordSize;
+        segmentNumRecords_m += 1;
+        nextSeq_m += 1;
+        addSegmentDirs(event);
+
+        if (out_m.size() >= 1024 * 1024) {
+            writeOut();
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void Journal_t::writeOut()
+{
+    if (!isFailed_m) {
+        if (!writeAll(fd_m, out_m.data(), out_m.size()) || !writeAll(timeIndexFd_m, timeIndexOut_m.data(), timeIndexOut_m.size())) {
+            fail("write");
+        }
+    }
+    out_m.clear();
+    timeIndexOut_m.clear();
+}
+
+//-----------------------------------------------------------------------------
+
+void Journal_t::sync()
+{
+    if (fsync(fd_m) != 0 || fsync(timeIndexFd_m) != 0) {
+        fail("fsync");
+    }
+    lastSyncUsec_m = getTimeUsec();
+}
+
+//-----------------------------------------------------------------------------
+
+void Journal_t::closeFiles()
+{
+    if (fd_m >= 0) {
+        ::close(fd_m);
+        fd_m = -1;
+    }
+    if (timeIndexFd_m >= 0) {
+        ::close(timeIndexFd_m);
+        timeIndexFd_m = -1;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool Journal_t::recover(std::string & error)
+{
+    std::vector<uint64_t> firstSeqs;
+    if (!listJournalSegments(config_m.dir_m, firstSeqs)) {
+        error = "can't read journal directory " + config_m.dir_m + ": " + strerror(errno);
+        return false;
+    }
+
+    if (firstSeqs.empty()) {
+        nextSeq_m = 1;
+        return startSegment();
+    }
+
+    // A sealed last segment means the previous run rotated cleanly; carry on in a new segment.
+    uint64_t firstSeq = firstSeqs.back();
+    JournalPathIndexHeader_t indexHeader;
+    if (readPathIndexHeader(config_m.dir_m, firstSeq, indexHeader)) {
+        nextSeq_m = indexHeader.lastSeq_m + 1;
+        lastTimeUsec_m = indexHeader.lastTimeUsec_m;
+        return startSegment();
+    }
+
+    std::string path = getJournalSegmentPath(config_m.dir_m, firstSeq, ".fmj");
+    std::string timeIndexPath = getJournalSegmentPath(config_m.dir_m, firstSeq, ".fmt");
+    int fd = ::open(path.c_str(), O_RDWR | O_APPEND);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        error = "can't open journal segment " + path + ": " + strerror(errno);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+
+    // A segment that doesn't even have a good header is started over.
+    JournalSegmentHeader_t segmentHeader;
+    if (st.st_size < (off_t) sizeof(segmentHeader) || pread(fd, &segmentHeader, sizeof(segmentHeader), 0) != sizeof(segmentHeader) ||
+        segmentHeader.magic_m != JournalSegmentHeader_t::MAGIC) {
+        ::close(fd);
+        nextSeq_m = firstSeq;
+        return startSegment();
+    }
+
+    // Scan the records for the last good one, and rebuild the writer's state for the segment.
+    void * p = st.st_size > 0 ? mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+    if (p == MAP_FAILED) {
+        error = "can't map journal segment " + path + ": " + strerror(errno);
+        ::close(fd);
+        return false;
+    }
+
+    segmentFirstSeq_m = firstSeq;
+    segmentNumRecords_m = 0;
+    segmentDirs_m.clear();
+    isSegmentDirsOverflowed_m = false;
+    nextSeq_m = firstSeq;
+
+    JournalRecordIterator_t iter((char const *) p, st.st_size);
+    JournalRecord_t record;
+    while (iter.next(record)) {
+        if (segmentNumRecords_m == 0) {
+            segmentFirstTimeUsec_m = record.header_pm->timeUsec_m;
+        }
+        segmentNumRecords_m += 1;
+        nextSeq_m = record.header_pm->seq_m + 1;
+        lastTimeUsec_m = record.header_pm->timeUsec_m;
+
+        EventIterator_t eventIter(record.event_m, record.eventSize_m);
+        EventView_t event;
+        if (eventIter.next(event)) {
+            addSegmentDirs(event);
+        }
+    }
+    munmap(p, st.st_size);
+
+    segmentSize_m = iter.getOffset();
+    if (segmentSize_m < (uint64_t) st.st_size) {
+        fprintf(stderr, "Warning: discarding %llu bytes after the last good journal record in %s\n", (unsigned long long) (st.st_size - segmentSize_m), path.c_str());
+        if (ftruncate(fd, segmentSize_m) != 0) {
+            error = "can't truncate journal segment " + path + ": " + strerror(errno);
+            ::close(fd);
+            return false;
+        }
+    }
+    fd_m = fd;
+
+    // Drop the time index entries that point past the kept records.
+    timeIndexFd_m = ::open(timeIndexPath.c_str(), O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (timeIndexFd_m < 0) {
+        error = "can't open journal time index " + timeIndexPath + ": " + strerror(errno);
+        closeFiles();
+        return false;
+    }
+    off_t timeIndexSize = 0;
+    JournalTimeIndexEntry_t entry;
+    while (pread(timeIndexFd_m, &entry, sizeof(entry), timeIndexSize) == sizeof(entry) && entry.offset_m < segmentSize_m) {
+        timeIndexSize += sizeof(entry);
+    }
+    if (ftruncate(timeIndexFd_m, timeIndexSize) != 0) {
+        error = "can't truncate journal time index " + timeIndexPath + ": " + strerror(errno);
+        closeFiles();
+        return false;
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool Journal_t::startSegment()
+{
+    segmentFirstSeq_m = nextSeq_m;
+    segmentSize_m = sizeof(JournalSegmentHeader_t);
+    segmentNumRecords_m = 0;
+    segmentDirs_m.clear();
+    isSegmentDirsOverflowed_m = false;
+
+    std::string path = getJournalSegmentPath(config_m.dir_m, segmentFirstSeq_m, ".fmj");
+    fd_m = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    timeIndexFd_m = ::open(getJournalSegmentPath(config_m.dir_m, segmentFirstSeq_m, ".fmt").c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+    if (fd_m < 0 || timeIndexFd_m < 0) {
+        fail("open");
+        closeFiles();
+        return false;
+    }
+
+    JournalSegmentHeader_t header;
+    header.magic_m = JournalSegmentHeader_t::MAGIC;
+    header.version_m = JournalSegmentHeader_t::VERSION;
+    header.firstSeq_m = segmentFirstSeq_m;
+    header.createTimeUsec_m = getTimeUsec();
+    if (!writeAll(fd_m, (char const *) &header, sizeof(header))) {
+        fail("write");
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool Journal_t::sealSegment()
+{
+    writeOut();
+    sync();
+    if (isFailed_m) {
+        return false;
+    }
+    closeFiles();
+
+    JournalPathIndexHeader_t header;
+    header.magic_m = JournalPathIndexHeader_t::MAGIC;
+    header.version_m = JournalPathIndexHeader_t::VERSION;
+    header.firstSeq_m = segmentFirstSeq_m;
+    header.lastSeq_m = nextSeq_m - 1;
+    header.firstTimeUsec_m = segmentFirstTimeUsec_m;
+    header.lastTimeUsec_m = lastTimeUsec_m;
+    header.numRecords_m = segmentNumRecords_m;
+    header.numDirs_m = isSegmentDirsOverflowed_m ? JournalPathIndexHeader_t::NO_DIRS : segmentDirs_m.size();
+
+    struct Collector_t
+    {
+        std::vector<std::string> * dirs_pm;
+        void operator()(std::string const & dir) const { dirs_pm->push_back(dir); }
+    };
+    std::vector<std::string> dirs;
+    Collector_t collector = { &dirs };
+    segmentDirs_m.forEach(collector);
+    std::sort(dirs.begin(), dirs.end());
+
+    std::string index((char const *) &header, sizeof(header));
+    if (!isSegmentDirsOverflowed_m) {
+        for (std::vector<std::string>::const_iterator iter = dirs.begin(); iter != dirs.end(); ++iter) {
+            uint32_t len = (uint32_t) iter->size();
+            index.append((char const *) &len, sizeof(len));
+            index.append(*iter);
+        }
+    }
+
+    // Write the index under a temporary name and rename it into place, so that a segment only looks sealed once its index is complete.
+    std::string path = getJournalSegmentPath(config_m.dir_m, segmentFirstSeq_m, ".fmp");
+    std::string tempPath = path + ".tmp";
+    int fd = ::open(tempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || !writeAll(fd, index.data(), index.size()) || fsync(fd) != 0 || ::close(fd) != 0 || rename(tempPath.c_str(), path.c_str()) != 0) {
+        fail("path index write");
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void Journal_t::applyRetention()
+{
+    if (config_m.maxSize_m == 0 && config_m.maxAgeSecs_m == 0) {
+        return;
+    }
+
+    std::vector<uint64_t> firstSeqs;
+    if (!listJournalSegments(config_m.dir_m, firstSeqs)) {
+        return;
+    }
+
+    std::vector<uint64_t> sizes;
+    uint64_t totalSize = 0;
+    for (size_t i = 0; i < firstSeqs.size(); ++i) {
+        uint64_t size = getFileSize(getJournalSegmentPath(config_m.dir_m, firstSeqs[i], ".fmj")) +
+            getFileSize(getJournalSegmentPath(config_m.dir_m, firstSeqs[i], ".fmt")) +
+            getFileSize(getJournalSegmentPath(config_m.dir_m, firstSeqs[i], ".fmp"));
+        sizes.push_back(size);
+        totalSize += size;
+    }
+
+    // Delete from the oldest segment on, stopping at the first one within both limits. The active segment is never deleted.
+    uint64_t minTimeUsec = getTimeUsec() - config_m.maxAgeSecs_m * 1000000;
+    for (size_t i = 0; i < firstSeqs.size() && firstSeqs[i] != segmentFirstSeq_m; ++i) {
+        JournalPathIndexHeader_t header;
+        bool isSealed = readPathIndexHeader(config_m.dir_m, firstSeqs[i], header);
+        bool isTooBig = config_m.maxSize_m != 0 && totalSize > config_m.maxSize_m;
+        bool isTooOld = config_m.maxAgeSecs_m != 0 && isSealed && header.lastTimeUsec_m < minTimeUsec;
+        if (!isTooBig && !isTooOld) {
+            break;
+        }
+
+        unlink(getJournalSegmentPath(config_m.dir_m, firstSeqs[i], ".fmp").c_str());
+        unlink(getJournalSegmentPath(config_m.dir_m, firstSeqs[i], ".fmt").c_str());
+        unlink(getJournalSegmentPath(config_m.dir_m, firstSeqs[i], ".fmj").c_str());
+        totalSize -= sizes[i];
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void Journal_t::addSegmentDirs(EventView_t const & event)
+{
+    if (isSegmentDirsOverflowed_m) {
+        return;
+    }
+
+    for (int i = 0; i < event.numArgs_m; ++i) {
+        EventArg_t const & arg = event.args_am[i];
+        if (!arg.isPath()) {
+            continue;
+        }
+
+        // Most events are in directories that were already seen, so check before making a string.
+        StrRef_t dir(arg.data_m, getParentDirLen(arg.data_m, arg.pathLen()));
+        if (segmentDirs_m.contains(dir)) {
+            continue;
+        }
+        segmentDirs_m.insert(std::string(dir.data_m, dir.len_m));
+        if (segmentDirs_m.size() > MAX_INDEXED_DIRS) {
+            isSegmentDirsOverflowed_m = true;
+            segmentDirs_m.clear();
+            return;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void Journal_t::fail(char const * what)
+{
+    fprintf(stderr, "Error: journal %s failed, journaling stopped: %s\n", what, strerror(errno));
+    isFailed_m = true;
+}
@@ -0,0 +1,173 @@
+#ifndef __INC_Journal_H
+#define __INC_Journal_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "EventView.h"
+#include "FlatHashSet.h"
+#include "JournalFormat.h"
+#include "ProcNameCache.h"
+
+// The journal settings.
+struct JournalConfig_t
+{
+    std::string dir_m;
+    uint64_t segmentSize_m; // Bytes per segment before rotating to a new one
+    uint64_t maxSize_m;     // Total bytes to retain, or 0 for no limit
+    uint64_t maxAgeSecs_m;  // Age of the newest record in a segment to retain, or 0 for no limit
+    unsigned fsyncSecs_m;   // Most seconds between fsyncs, or 0 to fsync every write
+
+    // Constructor. Sets the defaults.
+    JournalConfig_t();
+
+    // Parses a journal spec of the form "dir[,segment=MiB][,max-size=MiB][,max-age=hours][,fsync=secs]". Returns false with an error message if it is invalid.
+    bool parse(char const * spec, std::string & error);
+};
+
+// This class appends matched FS events to an on-disk journal, in the format described in JournalFormat.h. The reader thread only copies each event into an in-memory buffer; a writer thread builds the records, writes them and the indexes, rotates segments, fsyncs and applies the retention limits. If the writer falls behind far enough for the buffer to reach its limit the events are dropped and counted, rather than stalling the reader.
+//
+// On startup the writer resumes after the last good record of the journal: an unsealed segment left by a crash is truncated after its last record with a good CRC, and its time index after the last entry that points into the kept records.
+class Journal_t
+{
+private:
+
+    // The most bytes of events to buffer for the writer before dropping events.
+    static size_t const MAX_PENDING = 64 * 1024 * 1024;
+
+    // A time index entry is written every this many records.
+    static uint64_t const TIME_INDEX_INTERVAL = 256;
+
+    // Segments that touch more directories than this are left without a path index.
+    static size_t const MAX_INDEXED_DIRS = 64 * 1024;
+
+    // The header of an event waiting in the pending buffer, which is followed by the name of its process and the event bytes, padded to 8 bytes.
+    struct Pending_t
+    {
+        uint64_t timeUsec_m;
+        uint32_t size_m;
+        uint16_t procNameLen_m;
+        uint16_t reserved_m;
+    };
+
+    JournalConfig_t config_m;
+
+    // The names of the processes, looked up as the events are appended, while the processes are most likely still running. Protected by the event mutex.
+    ProcNameCache_t procNames_m;
+
+    // Protects the pending buffer.
+    pthread_mutex_t mutex_m;
+    pthread_cond_t cond_m;
+    std::vector<char> pending_m;
+    uint64_t numDropped_m;
+    bool isClosing_m;
+
+    // The writer's state, only accessed by the writer thread once it has started.
+    std::vector<char> writing_m;
+    std::string out_m;
+    std::string timeIndexOut_m;
+    int fd_m;
+    int timeIndexFd_m;
+    uint64_t segmentFirstSeq_m;
+    uint64_t segmentSize_m;
+    uint64_t segmentNumRecords_m;
+    uint64_t segmentFirstTimeUsec_m;
+    FlatHashSet_t<std::string, StrHashTraits_t> segmentDirs_m;
+    bool isSegmentDirsOverflowed_m;
+    uint64_t nextSeq_m;
+    uint64_t lastTimeUsec_m;
+    uint64_t lastSyncUsec_m;
+    uint64_t numReportedDropped_m;
+    bool isFailed_m;
+
+    pthread_t thread_m;
+
+public:
+
+    // Constructor.
+    Journal_t(JournalConfig_t const & config);
+
+    // Opens the journal, recovering the last segment if needed, and starts the writer thread. Returns false with an error message if the journal can't be opened.
+    bool open(std::string & error);
+
+    // Queues an event for the journal, with the name of its process. This never blocks on I/O. Must be called with the event mutex held.
+    void append(EventView_t const & event, uint64_t timeUsec);
+
+    // Forgets the names of the processes that have exited. Must be called with the event mutex held.
+    void expireExitedProcesses() { procNames_m.expireExited(); }
+
+    // Wakes the writer to write the queued events.
+    void flush();
+
+    // Writes the queued events, makes them durable and closes the journal files, stopping the writer thread. Events appended afterwards are dropped.
+    void close();
+
+private:
+
+    // The writer thread entry function.
+    static void * threadEntry(void * arg);
+
+    // The writer thread loop.
+    void run();
+
+    // Writes the records for a buffer of pending events.
+    void writePending(char const * buf, size_t size);
+
+    // Writes out the buffered record and time index bytes.
+    void writeOut();
+
+    // Makes the written data durable.
+    void sync();
+
+    // Closes the segment and time index files.
+    void closeFiles();
+
+    // Recovers the last segment left by a previous run. Returns false with an error message if the journal directory can't be used.
+    bool recover(std::string & error);
+
+    // Starts a new segment with the next sequence number.
+    bool startSegment();
+
+    // Seals the active segment, writing its path index.
+    bool sealSegment();
+
+    // Deletes the oldest sealed segments that exceed the retention limits.
+    void applyRetention();
+
+    // Notes the directory of each path in an event for the path index.
+    void addSegmentDirs(EventView_t const & event);
+
+    // Reports a failure and stops journaling.
+    void fail(char const * what);
+
+    // Not copyable.
+    Journal_t(Journal_t const &);
+    Journal_t & operator=(Journal_t const &);
+};
+
+// Returns the current time in microseconds since the epoch.
+uint64_t getTimeUsec();
+
+#endif // __INC_Journal_H
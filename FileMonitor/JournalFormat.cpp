@@ -0,0 +1,220 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "JournalFormat.h"
+
+uint64_t const JournalPathIndexHeader_t::NO_DIRS;
+
+//-----------------------------------------------------------------------------
+
+uint32_t journalCrc32(uint32_t crc, void const * data, size_t len)
+{
+    // The table is built on first use; building it twice concurrently is harmless, since both builds write the same values.
+    static uint32_t table_s [256];
+    static bool isTableBuilt_s = false;
+    if (!isTableBuilt_s) {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) != 0 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            table_s[i] = c;
+        }
+        isTableBuilt_s = true;
+    }
+
+    uint8_t const * p = (uint8_t const *) data;
+    crc = ~crc;
+    for (size_t i = 0; i < len; ++i) {
+        crc = table_s[(crc ^ p[i]) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+//-----------------------------------------------------------------------------
+
+uint32_t getJournalRecordCrc(JournalRecordHeader_t const & header, char const * payload)
+{
+    size_t crcEnd = offsetof(JournalRecordHeader_t, crc_m) + sizeof(header.crc_m);
+    uint32_t crc = journalCrc32(0, (char const *) &header + crcEnd, sizeof(header) - crcEnd);
+    return journalCrc32(crc, payload, header.size_m);
+}
+
+//-----------------------------------------------------------------------------
+
+std::string getJournalSegmentPath(std::string const & dir, uint64_t firstSeq, char const * ext)
+{
+    char name [64];
+    snprintf(name, sizeof(name), "/seg-%016llx%s", (unsigned long long) firstSeq, ext);
+    return dir + name;
+}
+
+//-----------------------------------------------------------------------------
+
+bool listJournalSegments(std::string const & dir, std::vector<uint64_t> & firstSeqs)
+{
+    firstSeqs.clear();
+
+    DIR * dir_p = opendir(dir.c_str());
+    if (dir_p == NULL) {
+        return false;
+    }
+
+    struct dirent * entry_p;
+    while ((entry_p = readdir(dir_p)) != NULL) {
+        char const * name = entry_p->d_name;
+        size_t len = strlen(name);
+        if (len == 4 + 16 + 4 && strncmp(name, "seg-", 4) == 0 && strcmp(name + 20, ".fmj") == 0) {
+            firstSeqs.push_back(strtoull(name + 4, NULL, 16));
+        }
+    }
+    closedir(dir_p);
+
+    std::sort(firstSeqs.begin(), firstSeqs.end());
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+size_t getParentDirLen(char const * path, size_t len)
+{
+    while (len > 0 && path[len - 1] != '/') {
+        --len;
+    }
+    return len > 1 ? len - 1 : len;
+}
+
+//-----------------------------------------------------------------------------
+
+bool isPathUnder(char const * path, size_t len, std::string const & dir)
+{
+    if (dir.size() > len || memcmp(path, dir.data(), dir.size()) != 0) {
+        return false;
+    }
+    return dir.size() == len || path[dir.size()] == '/' || dir == "/";
+}
+
+//-----------------------------------------------------------------------------
+
+bool writeAll(int fd, char const * data, size_t size)
+{
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        data += n;
+        size -= n;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool parseJournalTime(char const * str, uint64_t & timeUsec)
+{
+    if (str[0] == '@') {
+        char * end = NULL;
+        unsigned long long secs = strtoull(str + 1, &end, 10);
+        timeUsec = secs * 1000000;
+        return end != str + 1 && *end == '\0';
+    }
+
+    static char const * const formats [] = { "%Y-%m-%d %H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%dT%H:%M", "%H:%M:%S", "%H:%M" };
+    for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); ++i) {
+        // A time without a date is today.
+        time_t now = time(NULL);
+        struct tm tm;
+        localtime_r(&now, &tm);
+        tm.tm_sec = 0;
+
+        char const * end = strptime(str, formats[i], &tm);
+        if (end != NULL && *end == '\0') {
+            tm.tm_isdst = -1;
+            timeUsec = (uint64_t) mktime(&tm) * 1000000;
+            return true;
+        }
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+void appendJournalTime(std::string & out, uint64_t timeUsec)
+{
+    time_t secs = (time_t) (timeUsec / 1000000);
+    struct tm tm;
+    localtime_r(&secs, &tm);
+    char buf [64];
+    size_t len = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &tm);
+    snprintf(buf + len, sizeof(buf) - len, ".%06u ", (unsigned) (timeUsec % 1000000));
+    out += buf;
+}
+
+//-----------------------------------------------------------------------------
+
+JournalRecordIterator_t::JournalRecordIterator_t(char const * buf, size_t size, size_t offset)
+    : buf_pm(buf),
+      size_m(size),
+      pos_m(offset),
+      isCorrupt_m(false)
+{}
+
+//-----------------------------------------------------------------------------
+
+bool JournalRecordIterator_t::next(JournalRecord_t & record)
+{
+    if (pos_m >= size_m) {
+        return false;
+    }
+
+    // A record that runs past the end of the file, or whose CRC doesn't match, is where the good data ends.
+    JournalRecordHeader_t const * header_p = (JournalRecordHeader_t const *) (buf_pm + pos_m);
+    if (size_m - pos_m < sizeof(JournalRecordHeader_t) || header_p->size_m < header_p->procNameLen_m ||
+        size_m - pos_m < getJournalRecordSize(header_p->size_m)) {
+        isCorrupt_m = true;
+        return false;
+    }
+
+    char const * payload = buf_pm + pos_m + sizeof(JournalRecordHeader_t);
+    if (getJournalRecordCrc(*header_p, payload) != header_p->crc_m) {
+        isCorrupt_m = true;
+        return false;
+    }
+
+    record.header_pm = header_p;
+    record.procName_m = payload;
+    record.event_m = payload + header_p->procNameLen_m;
+    record.eventSize_m = header_p->size_m - header_p->procNameLen_m;
+    record.offset_m = pos_m;
+
+    pos_m += getJournalRecordSize(header_p->size_m);
+    return true;
+}
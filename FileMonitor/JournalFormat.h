@@ -0,0 +1,150 @@
+#ifndef __INC_JournalFormat_H
+#define __INC_JournalFormat_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// The journal is a directory of segments. Each segment has up to three files, named after the sequence number of its first record:
+//
+//   seg-<seq>.fmj  the records, appended in sequence order
+//   seg-<seq>.fmt  a sparse time index, appended as the records are written
+//   seg-<seq>.fmp  the path index, written when the segment is sealed
+//
+// A segment without a path index is the active one, or the one that was active when the writer last stopped. All values are in native byte order.
+
+// The header at the start of each record file.
+struct JournalSegmentHeader_t
+{
+    enum { MAGIC = 0x314a4d46, VERSION = 1 }; // 'FMJ1'
+
+    uint32_t magic_m;
+    uint32_t version_m;
+    uint64_t firstSeq_m;
+    uint64_t createTimeUsec_m;
+};
+
+// The header of each record. The record holds the process name and then the raw bytes of the event as read from the fsevents device, and is padded to a multiple of 8 bytes. The CRC covers everything after the CRC field, up to the end of the event bytes.
+struct JournalRecordHeader_t
+{
+    uint32_t size_m; // The size of the process name and event bytes, not including the header or padding
+    uint32_t crc_m;
+    uint64_t seq_m;
+    uint64_t timeUsec_m; // Microseconds since the epoch, never decreasing within a journal
+    int32_t pid_m;
+    uint16_t procNameLen_m;
+    uint16_t reserved_m;
+};
+
+// An entry of the sparse time index: the first record written at or after a time.
+struct JournalTimeIndexEntry_t
+{
+    uint64_t timeUsec_m;
+    uint64_t seq_m;
+    uint64_t offset_m;
+};
+
+// The header of the path index. It is followed by the directories that the segment's events are in, sorted, each as a u32 length and the path bytes. If a segment touched too many directories to index, the directory count is NO_DIRS and every query has to scan the segment.
+struct JournalPathIndexHeader_t
+{
+    enum { MAGIC = 0x31504d46, VERSION = 1 }; // 'FMP1'
+    static uint64_t const NO_DIRS = ~0ull;
+
+    uint32_t magic_m;
+    uint32_t version_m;
+    uint64_t firstSeq_m;
+    uint64_t lastSeq_m;
+    uint64_t firstTimeUsec_m;
+    uint64_t lastTimeUsec_m;
+    uint64_t numRecords_m;
+    uint64_t numDirs_m;
+};
+
+// A record decoded in place from a record file.
+struct JournalRecord_t
+{
+    JournalRecordHeader_t const * header_pm;
+    char const * procName_m;
+    char const * event_m;
+    size_t eventSize_m;
+    size_t offset_m; // The offset of the record in the file
+};
+
+// Returns the padded size of a record with a given size of process name and event bytes.
+inline size_t getJournalRecordSize(size_t size)
+{
+    return (sizeof(JournalRecordHeader_t) + size + 7) & ~(size_t) 7;
+}
+
+// Updates a CRC-32 (the ISO-HDLC polynomial, as used by zlib) with a block of data. Start with a CRC of 0.
+uint32_t journalCrc32(uint32_t crc, void const * data, size_t len);
+
+// Returns the CRC of a record, as stored in its header.
+uint32_t getJournalRecordCrc(JournalRecordHeader_t const & header, char const * payload);
+
+// Returns the path of one of a segment's files, given the extension, e.g. ".fmj".
+std::string getJournalSegmentPath(std::string const & dir, uint64_t firstSeq, char const * ext);
+
+// Gets the first sequence numbers of the segments in a journal directory, in ascending order. Returns false if the directory can't be read.
+bool listJournalSegments(std::string const & dir, std::vector<uint64_t> & firstSeqs);
+
+// Returns the parent directory length of a path, e.g. 4 for "/etc/hosts", or 1 for a top level path so that the parent is "/".
+size_t getParentDirLen(char const * path, size_t len);
+
+// Is a path the same as a directory, or under it? The path need not be NUL terminated.
+bool isPathUnder(char const * path, size_t len, std::string const & dir);
+
+// Writes all of a buffer to a file, retrying partial writes. Returns false on error.
+bool writeAll(int fd, char const * data, size_t size);
+
+// Parses a time given as local "YYYY-MM-DD HH:MM[:SS]", "HH:MM[:SS]" for today, or "@secs" since the epoch, into microseconds since the epoch. Returns false if the time is invalid.
+bool parseJournalTime(char const * str, uint64_t & timeUsec);
+
+// Appends a time as local "YYYY-MM-DD HH:MM:SS.uuuuuu ".
+void appendJournalTime(std::string & out, uint64_t timeUsec);
+
+// This class walks the records of a record file, checking each one's size and CRC. The iteration stops at the first record that is incomplete or corrupt, which is where a crashed writer's last good record ended.
+class JournalRecordIterator_t
+{
+private:
+
+    char const * buf_pm;
+    size_t size_m;
+    size_t pos_m;
+    bool isCorrupt_m;
+
+public:
+
+    // Constructor. The buffer holds the whole record file, including the segment header.
+    JournalRecordIterator_t(char const * buf, size_t size, size_t offset = sizeof(JournalSegmentHeader_t));
+
+    // Decodes the next record. Returns false when there are no more good records.
+    bool next(JournalRecord_t & record);
+
+    // Returns the offset just past the last good record.
+    size_t getOffset() const { return pos_m; }
+
+    // Returns true if the iteration stopped on bad data rather than at the end of the file.
+    bool isCorrupt() const { return isCorrupt_m; }
+};
+
+#endif // __INC_JournalFormat_H
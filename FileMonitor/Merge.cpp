@@ -0,0 +1,640 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "EventView.h"
+#include "Journal.h"
+#include "Merge.h"
+#include "MutexLocker.h"
+
+extern int optind;
+
+size_t const Merge_t::CHUNK_SIZE;
+size_t const Merge_t::MAX_CHUNKS;
+unsigned const Merge_t::POLL_MSECS;
+
+//-----------------------------------------------------------------------------
+// Print the merge usage.
+
+static void printMergeUsage()
+{
+    fprintf(stderr, "Usage: filemon merge [-fhtx] [-w msecs] [-s time] [-e time]\n");
+    fprintf(stderr, "               [name=]dir ...\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -f :   follow the journals as they grow, e.g. journals that\n");
+    fprintf(stderr, "         other filemon processes are writing\n");
+    fprintf(stderr, "  -w :   how long to wait in milliseconds for a followed journal\n");
+    fprintf(stderr, "         with nothing new before outputting later events from the\n");
+    fprintf(stderr, "         others (default 1000)\n");
+    fprintf(stderr, "  -s :   only events at or after a time\n");
+    fprintf(stderr, "  -e :   only events at or before a time\n");
+    fprintf(stderr, "  -t :   prefix each terse output line with the event time\n");
+    fprintf(stderr, "  -x :   print output in XML form\n");
+    fprintf(stderr, "  -h :   print help\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "Each dir is a journal directory. Its events are labelled with the\n");
+    fprintf(stderr, "name, or with the last component of the directory if no name is\n");
+    fprintf(stderr, "given. Times are as for \"filemon query\".\n");
+}
+
+//-----------------------------------------------------------------------------
+// Append a string with the XML special characters escaped, for an attribute value.
+
+static void appendXmlEscaped(std::string & out, std::string const & str)
+{
+    for (size_t i = 0; i < str.size(); ++i) {
+        switch (str[i]) {
+            case '&': out += "&amp;"; break;
+            case '<': out += "&lt;"; break;
+            case '>': out += "&gt;"; break;
+            case '"': out += "&quot;"; break;
+            default: out += str[i]; break;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Is there a segment newer than a given one in a journal directory?
+
+static bool hasNewerSegment(std::string const & dir, uint64_t firstSeq)
+{
+    std::vector<uint64_t> firstSeqs;
+    return listJournalSegments(dir, firstSeqs) && !firstSeqs.empty() && firstSeqs.back() > firstSeq;
+}
+
+//-----------------------------------------------------------------------------
+
+MergeOptions_t::MergeOptions_t()
+    : startUsec_m(0),
+      endUsec_m(~0ull),
+      windowUsec_m(1000000),
+      isFollow_m(false),
+      isXml_m(false),
+      isTimed_m(false)
+{}
+
+//-----------------------------------------------------------------------------
+
+Merge_t::Merge_t(MergeOptions_t const & options, FILE * out)
+    : options_m(options),
+      out_pm(out),
+      numEvents_m(0),
+      numLate_m(0)
+{
+    pthread_mutex_init(&mutex_m, NULL);
+    pthread_cond_init(&readCond_m, NULL);
+    pthread_cond_init(&spaceCond_m, NULL);
+}
+
+//-----------------------------------------------------------------------------
+
+Merge_t::~Merge_t()
+{
+    for (size_t i = 0; i < sources_m.size(); ++i) {
+        Source_t * source_p = sources_m[i];
+        while (!source_p->full_m.empty()) {
+            delete source_p->full_m.front();
+            source_p->full_m.pop_front();
+        }
+        for (size_t j = 0; j < source_p->free_m.size(); ++j) {
+            delete source_p->free_m[j];
+        }
+        delete source_p;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool Merge_t::run(std::string & error)
+{
+    for (size_t i = 0; i < options_m.dirs_m.size(); ++i) {
+        std::vector<uint64_t> firstSeqs;
+        if (!listJournalSegments(options_m.dirs_m[i], firstSeqs)) {
+            error = "can't read journal directory " + options_m.dirs_m[i] + ": " + strerror(errno);
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < options_m.dirs_m.size(); ++i) {
+        Source_t * source_p = new Source_t;
+        source_p->merge_pm = this;
+        source_p->name_m = options_m.names_m[i];
+        source_p->dir_m = options_m.dirs_m[i];
+        if (options_m.isXml_m) {
+            source_p->label_m = "<event source=\"";
+            appendXmlEscaped(source_p->label_m, source_p->name_m);
+            source_p->label_m += "\">\n";
+        }
+        else {
+            source_p->label_m = "[" + source_p->name_m + "] ";
+        }
+        source_p->full_m.reserve(MAX_CHUNKS);
+        for (size_t j = 0; j < MAX_CHUNKS; ++j) {
+            source_p->free_m.push_back(new Chunk_t);
+        }
+        source_p->isIdle_m = false;
+        source_p->isDone_m = false;
+        source_p->pos_m = 0;
+        source_p->hasHead_m = false;
+        sources_m.push_back(source_p);
+    }
+
+    for (size_t i = 0; i < sources_m.size(); ++i) {
+        if (pthread_create(&sources_m[i]->thread_m, NULL, threadEntry, sources_m[i]) != 0) {
+            perror(NULL);
+            exit(1);
+        }
+    }
+
+    EventFormatter_t formatter(options_m.isXml_m);
+    std::string out;
+    std::string line;
+    uint64_t lastUsec = 0;
+    while (true) {
+        Source_t * next_p = NULL;
+        bool isDone = false;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            while (true) {
+                // Find the earliest head record, and whether any source that hasn't finished has nothing to merge, either because it is still reading or because it is idle.
+                bool isReading = false;
+                bool isIdle = false;
+                next_p = NULL;
+                for (size_t i = 0; i < sources_m.size(); ++i) {
+                    Source_t & source = *sources_m[i];
+                    if (!source.hasHead_m && !takeNext(source)) {
+                        if (!source.isDone_m) {
+                            (source.isIdle_m ? isIdle : isReading) = true;
+                        }
+                        continue;
+                    }
+                    if (next_p == NULL || source.head_m.header_pm->timeUsec_m < next_p->head_m.header_pm->timeUsec_m) {
+                        next_p = &source;
+                    }
+                }
+
+                // With a record from every source that can still have one, the earliest one is next.
+                if (!isReading && !isIdle) {
+                    isDone = next_p == NULL;
+                    break;
+                }
+
+                // The idle sources are only waited for until the earliest record has been waiting for the length of the window.
+                uint64_t dueUsec = 0;
+                if (!isReading && next_p != NULL) {
+                    dueUsec = next_p->head_m.header_pm->timeUsec_m + options_m.windowUsec_m;
+                    if (getTimeUsec() >= dueUsec) {
+                        break;
+                    }
+                }
+
+                // Write out what there is before waiting for idle sources, so that followed events aren't held back.
+                if (!isReading && !out.empty()) {
+                    next_p = NULL;
+                    break;
+                }
+
+                if (dueUsec == 0) {
+                    MUTEX_COND_WAIT(&readCond_m);
+                }
+                else {
+                    struct timespec deadline;
+                    deadline.tv_sec = dueUsec / 1000000;
+                    deadline.tv_nsec = (dueUsec % 1000000) * 1000;
+                    MUTEX_COND_TIMEDWAIT(&readCond_m, &deadline);
+                }
+            }
+        }
+
+        if (next_p == NULL) {
+            writeOut(out);
+            if (isDone) {
+                break;
+            }
+            continue;
+        }
+
+        // The head record's chunk stays in place until the merge takes the source's next record, so it is formatted without the lock.
+        uint64_t timeUsec = next_p->head_m.header_pm->timeUsec_m;
+        if (timeUsec < lastUsec) {
+            numLate_m++;
+        }
+        else {
+            lastUsec = timeUsec;
+        }
+        numEvents_m++;
+        format(*next_p, formatter, line, out);
+        next_p->hasHead_m = false;
+
+        if (out.size() >= CHUNK_SIZE) {
+            writeOut(out);
+        }
+    }
+
+    for (size_t i = 0; i < sources_m.size(); ++i) {
+        pthread_join(sources_m[i]->thread_m, NULL);
+    }
+
+    if (numLate_m > 0) {
+        fprintf(stderr, "Warning: %llu of %llu events were output out of order, after the reorder window\n", (unsigned long long) numLate_m, (unsigned long long) numEvents_m);
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void * Merge_t::threadEntry(void * arg)
+{
+    Source_t * source_p = static_cast<Source_t *>(arg);
+    source_p->merge_pm->read(*source_p);
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void Merge_t::read(Source_t & source)
+{
+    Chunk_t * chunk_p = handOver(source, NULL);
+    std::vector<uint64_t> firstSeqs;
+    uint64_t lastSeq = 0;
+    bool hasRead = false;
+
+    while (true) {
+        // Find the first segment after the last one read. Segments that have been deleted in the meantime by the journal's retention are skipped.
+        if (!listJournalSegments(source.dir_m, firstSeqs)) {
+            fprintf(stderr, "Error: can't read journal directory %s: %s\n", source.dir_m.c_str(), strerror(errno));
+            break;
+        }
+        size_t i = 0;
+        while (hasRead && i < firstSeqs.size() && firstSeqs[i] <= lastSeq) {
+            ++i;
+        }
+
+        if (i < firstSeqs.size()) {
+            lastSeq = firstSeqs[i];
+            hasRead = true;
+            if (!readSegment(source, lastSeq, chunk_p)) {
+                break;
+            }
+            continue;
+        }
+
+        if (!options_m.isFollow_m || isPastEnd()) {
+            break;
+        }
+
+        // Wait for the writer to start a segment.
+        if (!chunk_p->data_m.empty()) {
+            chunk_p = handOver(source, chunk_p);
+        }
+        setIdle(source, true);
+        usleep(POLL_MSECS * 1000);
+    }
+
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    if (!chunk_p->data_m.empty()) {
+        source.full_m.push_back(chunk_p);
+    }
+    else {
+        source.free_m.push_back(chunk_p);
+    }
+    source.isDone_m = true;
+    pthread_cond_signal(&readCond_m);
+}
+
+//-----------------------------------------------------------------------------
+
+bool Merge_t::readSegment(Source_t & source, uint64_t firstSeq, Chunk_t *& chunk_p)
+{
+    std::string path = getJournalSegmentPath(source.dir_m, firstSeq, ".fmj");
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        if (errno != ENOENT) {
+            fprintf(stderr, "Error: can't open journal segment %s: %s\n", path.c_str(), strerror(errno));
+        }
+        return true;
+    }
+
+    // The bytes read and not yet copied into chunks, and the position of the next record in them.
+    std::vector<char> buf;
+    size_t pos = 0;
+    bool isHeaderChecked = false;
+    bool isNewer = false;
+    bool isPastEnd = false;
+    char block [64 * 1024];
+
+    while (!isPastEnd) {
+        ssize_t n = ::read(fd, block, sizeof(block));
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "Error: can't read journal segment %s: %s\n", path.c_str(), strerror(errno));
+            break;
+        }
+
+        if (n == 0) {
+            // A segment is complete once the writer has moved on to a newer one. Read once more after seeing the newer one, for the last records written before it.
+            if (!options_m.isFollow_m || isNewer) {
+                break;
+            }
+            isNewer = hasNewerSegment(source.dir_m, firstSeq);
+            if (isNewer) {
+                continue;
+            }
+            if (this->isPastEnd()) {
+                isPastEnd = true;
+                break;
+            }
+
+            // Let the merge have everything read so far, and wait for the writer.
+            if (!chunk_p->data_m.empty()) {
+                chunk_p = handOver(source, chunk_p);
+            }
+            setIdle(source, true);
+            usleep(POLL_MSECS * 1000);
+            continue;
+        }
+
+        if (source.isIdle_m) {
+            setIdle(source, false);
+        }
+        isNewer = false;
+
+        // Drop the bytes already copied before appending more, once they are most of the buffer.
+        if (pos > 0 && pos * 2 >= buf.size()) {
+            buf.erase(buf.begin(), buf.begin() + pos);
+            pos = 0;
+        }
+        buf.insert(buf.end(), block, block + n);
+
+        if (!isHeaderChecked) {
+            if (buf.size() < sizeof(JournalSegmentHeader_t)) {
+                continue;
+            }
+            JournalSegmentHeader_t header;
+            memcpy(&header, &buf[0], sizeof(header));
+            if (header.magic_m != JournalSegmentHeader_t::MAGIC) {
+                fprintf(stderr, "Error: %s is not a journal segment\n", path.c_str());
+                break;
+            }
+            pos = sizeof(header);
+            isHeaderChecked = true;
+        }
+
+        // A record that isn't all there yet stops the iteration, and is picked up again after the next read.
+        JournalRecordIterator_t iter(&buf[0], buf.size(), pos);
+        JournalRecord_t record;
+        while (iter.next(record)) {
+            uint64_t timeUsec = record.header_pm->timeUsec_m;
+            if (timeUsec > options_m.endUsec_m) {
+                isPastEnd = true;
+                break;
+            }
+            if (timeUsec < options_m.startUsec_m) {
+                continue;
+            }
+
+            char const * begin = &buf[0] + record.offset_m;
+            chunk_p->data_m.insert(chunk_p->data_m.end(), begin, begin + getJournalRecordSize(record.header_pm->size_m));
+            if (chunk_p->data_m.size() >= CHUNK_SIZE) {
+                chunk_p = handOver(source, chunk_p);
+            }
+        }
+        pos = iter.getOffset();
+    }
+
+    close(fd);
+    return !isPastEnd;
+}
+
+//-----------------------------------------------------------------------------
+
+bool Merge_t::isPastEnd() const
+{
+    return options_m.endUsec_m != ~0ull && getTimeUsec() >= options_m.endUsec_m + options_m.windowUsec_m;
+}
+
+//-----------------------------------------------------------------------------
+
+Merge_t::Chunk_t * Merge_t::handOver(Source_t & source, Chunk_t * chunk_p)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    if (chunk_p != NULL) {
+        source.full_m.push_back(chunk_p);
+        pthread_cond_signal(&readCond_m);
+    }
+
+    while (source.free_m.empty()) {
+        MUTEX_COND_WAIT(&spaceCond_m);
+    }
+    chunk_p = source.free_m.back();
+    source.free_m.pop_back();
+    chunk_p->data_m.clear();
+    return chunk_p;
+}
+
+//-----------------------------------------------------------------------------
+
+void Merge_t::setIdle(Source_t & source, bool isIdle)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    source.isIdle_m = isIdle;
+    pthread_cond_signal(&readCond_m);
+}
+
+//-----------------------------------------------------------------------------
+
+bool Merge_t::takeNext(Source_t & source)
+{
+    while (!source.full_m.empty()) {
+        Chunk_t * chunk_p = source.full_m.front();
+        if (source.pos_m < chunk_p->data_m.size()) {
+            // The records were checked when they were read, so they are decoded without checking them again.
+            char const * begin = &chunk_p->data_m[0] + source.pos_m;
+            JournalRecordHeader_t const * header_p = (JournalRecordHeader_t const *) begin;
+            source.head_m.header_pm = header_p;
+            source.head_m.procName_m = begin + sizeof(JournalRecordHeader_t);
+            source.head_m.event_m = source.head_m.procName_m + header_p->procNameLen_m;
+            source.head_m.eventSize_m = header_p->size_m - header_p->procNameLen_m;
+            source.head_m.offset_m = source.pos_m;
+            source.pos_m += getJournalRecordSize(header_p->size_m);
+            source.hasHead_m = true;
+            return true;
+        }
+
+        // Give a merged chunk back to the reader.
+        source.full_m.pop_front();
+        source.free_m.push_back(chunk_p);
+        source.pos_m = 0;
+        pthread_cond_broadcast(&spaceCond_m);
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+void Merge_t::format(Source_t const & source, EventFormatter_t & formatter, std::string & line, std::string & out)
+{
+    JournalRecord_t const & record = source.head_m;
+    JournalRecordHeader_t const & header = *record.header_pm;
+    EventIterator_t eventIter(record.event_m, record.eventSize_m);
+    EventView_t event;
+    if (!eventIter.next(event)) {
+        return;
+    }
+
+    // Every path of a merged event is output.
+    uint32_t matchMask = 0;
+    for (int i = 0; i < event.numArgs_m; ++i) {
+        if (event.args_am[i].isPath()) {
+            matchMask |= 1u << i;
+        }
+    }
+
+    char procName [NAME_BUF_SIZE];
+    size_t procNameLen = header.procNameLen_m < sizeof(procName) ? header.procNameLen_m : sizeof(procName) - 1;
+    memcpy(procName, record.procName_m, procNameLen);
+    procName[procNameLen] = '\0';
+
+    if (options_m.isXml_m) {
+        out += source.label_m;
+        formatter.format(event, matchMask, header.seq_m, out, procName);
+        out += "</event>\n";
+        return;
+    }
+
+    // Prefix each line of the terse output with the source name, and the event time if wanted.
+    line.clear();
+    formatter.format(event, matchMask, header.seq_m, line, procName);
+    for (size_t start = 0; start < line.size(); ) {
+        size_t end = line.find('\n', start);
+        end = end == std::string::npos ? line.size() : end + 1;
+        if (options_m.isTimed_m) {
+            appendJournalTime(out, header.timeUsec_m);
+        }
+        out += source.label_m;
+        out.append(line, start, end - start);
+        start = end;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void Merge_t::writeOut(std::string & out)
+{
+    fwrite(out.data(), 1, out.size(), out_pm);
+    fflush(out_pm);
+    out.clear();
+}
+
+//-----------------------------------------------------------------------------
+
+int runMerge(int argc, char * argv[])
+{
+    MergeOptions_t options;
+    bool isError = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "e:fhs:tw:x")) != -1) {
+        switch (c) {
+            case 'e':
+                if (!parseJournalTime(optarg, options.endUsec_m)) {
+                    fprintf(stderr, "Invalid time: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 'f':
+                options.isFollow_m = true;
+                break;
+            case 'h':
+                printMergeUsage();
+                return 0;
+            case 's':
+                if (!parseJournalTime(optarg, options.startUsec_m)) {
+                    fprintf(stderr, "Invalid time: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 't':
+                options.isTimed_m = true;
+                break;
+            case 'w': {
+                char * end = NULL;
+                unsigned long msecs = strtoul(optarg, &end, 10);
+                if (end == optarg || *end != '\0') {
+                    fprintf(stderr, "Invalid reorder window: %s\n", optarg);
+                    isError = true;
+                }
+                options.windowUsec_m = (uint64_t) msecs * 1000;
+                break;
+            }
+            case 'x':
+                options.isXml_m = true;
+                break;
+            case '?':
+                isError = true;
+                break;
+        }
+    }
+
+    // Each source is "name=dir", or just "dir", named after its last component.
+    for (int i = optind; i < argc; ++i) {
+        std::string arg(argv[i]);
+        size_t equals = arg.find('=');
+        std::string dir = equals == std::string::npos ? arg : arg.substr(equals + 1);
+        std::string name;
+        if (equals != std::string::npos) {
+            name = arg.substr(0, equals);
+        }
+        else {
+            std::string trimmed(dir);
+            while (trimmed.size() > 1 && trimmed[trimmed.size() - 1] == '/') {
+                trimmed.erase(trimmed.size() - 1);
+            }
+            size_t slash = trimmed.rfind('/');
+            name = slash == std::string::npos || trimmed.size() == 1 ? trimmed : trimmed.substr(slash + 1);
+        }
+        if (name.empty() || dir.empty()) {
+            fprintf(stderr, "Invalid journal source: %s\n", argv[i]);
+            isError = true;
+        }
+        options.names_m.push_back(name);
+        options.dirs_m.push_back(dir);
+    }
+
+    if (options.dirs_m.empty()) {
+        isError = true;
+    }
+    if (isError) {
+        printMergeUsage();
+        return 1;
+    }
+
+    Merge_t merge(options, stdout);
+    std::string error;
+    if (!merge.run(error)) {
+        fprintf(stderr, "Error: %s\n", error.c_str());
+        return 1;
+    }
+    return 0;
+}
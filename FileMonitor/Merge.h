@@ -0,0 +1,152 @@
+#ifndef __INC_Merge_H
+#define __INC_Merge_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "EventFormatter.h"
+#include "JournalFormat.h"
+#include "RingQueue.h"
+
+// The sources and output settings of a merge.
+struct MergeOptions_t
+{
+    std::vector<std::string> names_m;
+    std::vector<std::string> dirs_m;
+    uint64_t startUsec_m;
+    uint64_t endUsec_m;
+    uint64_t windowUsec_m; // How long to wait for a source that has nothing to read before outputting later events from the others
+    bool isFollow_m;
+    bool isXml_m;
+    bool isTimed_m;
+
+    // Constructor. Sets the defaults.
+    MergeOptions_t();
+};
+
+// This class merges the events of several journals into one stream, ordered by the time they were journaled, with each event labelled with the name of its source. The journals can be copies from several hosts, or live journals that other filemon processes are still writing to, which are followed as they grow.
+//
+// Each source has its own reader thread, which reads its journal's segments in order and copies the records into chunks of up to 256 KiB, with at most 4 chunks read ahead. The merging thread takes the record with the earliest time from the heads of the sources, so it only ever looks at the next record of each. While a source is still reading, the merge waits for it. When a followed source has read everything there is, the merge only waits for it until the earliest waiting record is older than the reorder window; after that the record is output, and an event that the idle source journals later with an earlier time is output as soon as it is read, and counted as out of order. So a slow or quiet source delays the others by at most the window.
+class Merge_t
+{
+private:
+
+    // The size of a chunk of records, which can be exceeded by one record.
+    static size_t const CHUNK_SIZE = 256 * 1024;
+
+    // The most chunks that a source reads ahead of the merge.
+    static size_t const MAX_CHUNKS = 4;
+
+    // How often a followed source checks for more records once it has read everything.
+    static unsigned const POLL_MSECS = 100;
+
+    // The records read from a journal, copied as they are in the record file.
+    struct Chunk_t
+    {
+        std::vector<char> data_m;
+    };
+
+    // A source and its reader's state.
+    struct Source_t
+    {
+        Merge_t * merge_pm;
+        std::string name_m;
+        std::string dir_m;
+        std::string label_m; // The name as it prefixes the output
+        pthread_t thread_m;
+
+        // The chunks read and not yet merged, and the chunks free for the reader. Protected by mutex_m.
+        RingQueue_t<Chunk_t *> full_m;
+        std::vector<Chunk_t *> free_m;
+        bool isIdle_m; // A followed source has read all there is for now
+        bool isDone_m; // The reader has read all it will
+
+        // The merge's position in the front chunk, and the next record, if it has one. Only used by the merging thread.
+        size_t pos_m;
+        JournalRecord_t head_m;
+        bool hasHead_m;
+    };
+
+    MergeOptions_t const & options_m;
+    FILE * out_pm;
+
+    // Protects the sources' chunks and states.
+    pthread_mutex_t mutex_m;
+    pthread_cond_t readCond_m;  // Signalled when a source has read a chunk or finished
+    pthread_cond_t spaceCond_m; // Signalled when the merge frees a chunk
+    std::vector<Source_t *> sources_m;
+
+    uint64_t numEvents_m;
+    uint64_t numLate_m;
+
+public:
+
+    // Constructor.
+    Merge_t(MergeOptions_t const & options, FILE * out);
+
+    // Destructor.
+    ~Merge_t();
+
+    // Runs the merge, writing the merged events, until all the sources are read, or for ever if they are followed. Returns false with an error message if a source can't be read.
+    bool run(std::string & error);
+
+private:
+
+    // The reader thread entry function.
+    static void * threadEntry(void * arg);
+
+    // The reader thread loop for a source.
+    void read(Source_t & source);
+
+    // Reads the records of one segment into chunks, following the segment as it grows until the writer moves on to a newer one. Returns false once the source is past the end time.
+    bool readSegment(Source_t & source, uint64_t firstSeq, Chunk_t *& chunk_p);
+
+    // Is the end time past, for a followed source that has read everything there is?
+    bool isPastEnd() const;
+
+    // Hands a chunk of records to the merge, if there is one, and returns a free chunk, waiting for one if the source is too far ahead.
+    Chunk_t * handOver(Source_t & source, Chunk_t * chunk_p);
+
+    // Marks a source's reader as idle or not, waking the merge if it is waiting for the source.
+    void setIdle(Source_t & source, bool isIdle);
+
+    // Takes the next record of a source into its head, freeing the chunks it is done with. Must be called with mutex_m held. Returns false if the source has no record read.
+    bool takeNext(Source_t & source);
+
+    // Formats a source's head record, appending the output.
+    void format(Source_t const & source, EventFormatter_t & formatter, std::string & line, std::string & out);
+
+    // Writes out the output so far.
+    void writeOut(std::string & out);
+
+    // Not copyable.
+    Merge_t(Merge_t const &);
+    Merge_t & operator=(Merge_t const &);
+};
+
+// Runs the "filemon merge" subcommand. The arguments start with the subcommand name. Returns the process exit code.
+int runMerge(int argc, char * argv[]);
+
+#endif // __INC_Merge_H
@@ -0,0 +1,533 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+
+#include "AllocCounter.h"
+#include "JournalFormat.h"
+#include "Mirror.h"
+#include "MutexLocker.h"
+
+size_t const Mirror_t::MAX_PENDING;
+
+//-----------------------------------------------------------------------------
+
+void setMirrorAttrs(MirrorAttrs_t & attrs, struct stat const & st)
+{
+    attrs.mode_m = st.st_mode & S_IFMT;
+    attrs.inode_m = st.st_ino;
+    attrs.size_m = st.st_size;
+    attrs.mtime_m = st.st_mtime;
+}
+
+//-----------------------------------------------------------------------------
+
+void appendMirrorAttrs(char const * prefix, MirrorAttrs_t const & attrs, char const * path, size_t len, std::string & out)
+{
+    char type = '?';
+    if (S_ISDIR(attrs.mode_m)) {
+        type = 'd';
+    }
+    else if (S_ISREG(attrs.mode_m)) {
+        type = 'f';
+    }
+    else if (S_ISLNK(attrs.mode_m)) {
+        type = 'l';
+    }
+    else if (attrs.mode_m != 0) {
+        type = 'o';
+    }
+
+    char buf [128];
+    snprintf(buf, sizeof(buf), "%s%c ino=%llu size=%llu mtime=%lld ", prefix, type,
+             (unsigned long long) attrs.inode_m, (unsigned long long) attrs.size_m, (long long) attrs.mtime_m);
+    out += buf;
+    out.append(path, len);
+    out += '\n';
+}
+
+//-----------------------------------------------------------------------------
+
+Mirror_t::Mirror_t()
+    : isRescanNeeded_m(false)
+{
+    pthread_mutex_init(&mutex_m, NULL);
+    pthread_cond_init(&workCond_m, NULL);
+    pthread_mutex_init(&treeMutex_m, NULL);
+
+    MirrorAttrs_t rootAttrs;
+    memset(&rootAttrs, 0, sizeof(rootAttrs));
+    rootAttrs.mode_m = S_IFDIR;
+    tree_m.setValue(MirrorTree_t::ROOT_NODE, rootAttrs);
+
+    if (pthread_create(&thread_m, NULL, threadEntry, this) != 0) {
+        perror(NULL);
+        exit(1);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void Mirror_t::setRoots(std::vector<std::string> const & roots)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+
+    std::vector<std::string> oldRoots;
+    oldRoots.swap(roots_m);
+    roots_m = roots;
+
+    for (size_t i = 0; i < roots_m.size(); ++i) {
+        if (std::find(oldRoots.begin(), oldRoots.end(), roots_m[i]) == oldRoots.end()) {
+            scans_m.push_back(roots_m[i]);
+        }
+    }
+
+    for (size_t i = 0; i < oldRoots.size(); ++i) {
+        std::string const & root = oldRoots[i];
+        if (!isUnderRoot(root.data(), root.size())) {
+            scans_m.erase(std::remove(scans_m.begin(), scans_m.end(), root), scans_m.end());
+            removals_m.push_back(root);
+        }
+    }
+
+    if (!scans_m.empty() || !removals_m.empty()) {
+        pthread_cond_signal(&workCond_m);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool Mirror_t::hasRoots()
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    return !roots_m.empty();
+}
+
+//-----------------------------------------------------------------------------
+
+void Mirror_t::addEvent(EventView_t const & event)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+
+    // After dropped events the mirror can't be trusted until it is rescanned.
+    if (event.getBaseType() == FSE_EVENTS_DROPPED) {
+        isRescanNeeded_m = true;
+        pthread_cond_signal(&workCond_m);
+        return;
+    }
+
+    if (roots_m.empty()) {
+        return;
+    }
+
+    // The type and inode follow the first path, among its file info arguments.
+    Op_t op;
+    op.type_m = event.getBaseType();
+    op.mode_m = 0;
+    op.inode_m = 0;
+    EventArg_t const * paths_ap [2] = { NULL, NULL };
+    int numPaths = 0;
+    for (int i = 0; i < event.numArgs_m; ++i) {
+        EventArg_t const & arg = event.args_am[i];
+        if (arg.isPath()) {
+            if (numPaths == 2) {
+                break;
+            }
+            paths_ap[numPaths++] = &arg;
+        }
+        else if (numPaths == 1 && arg.type_m == FSE_ARG_MODE) {
+            int32_t mode = 0;
+            arg.getValue(mode);
+            op.mode_m = mode & S_IFMT;
+        }
+        else if (numPaths == 1 && arg.type_m == FSE_ARG_INO) {
+            ino_t inode = 0;
+            arg.getValue(inode);
+            op.inode_m = inode;
+        }
+    }
+    if (numPaths == 0) {
+        return;
+    }
+
+    char const * path = paths_ap[0]->data_m;
+    op.pathLen_m = paths_ap[0]->pathLen();
+    char const * toPath = numPaths > 1 ? paths_ap[1]->data_m : "";
+    op.toPathLen_m = numPaths > 1 ? paths_ap[1]->pathLen() : 0;
+
+    bool isPathMirrored = isUnderRoot(path, op.pathLen_m);
+    bool isToPathMirrored = numPaths > 1 && isUnderRoot(toPath, op.toPathLen_m);
+    if (!isPathMirrored && !isToPathMirrored) {
+        return;
+    }
+
+    // A rename out of the mirrored trees is a delete. A rename into them is applied as a rename of a path that isn't in the tree, which stats and scans the new path.
+    if (op.type_m == FSE_RENAME && !isToPathMirrored) {
+        op.type_m = FSE_DELETE;
+        op.toPathLen_m = 0;
+    }
+
+    // Otherwise only the mirrored paths are kept.
+    if (op.type_m != FSE_RENAME && !isToPathMirrored) {
+        op.toPathLen_m = 0;
+    }
+    if (op.type_m != FSE_RENAME && !isPathMirrored) {
+        path = toPath;
+        op.pathLen_m = op.toPathLen_m;
+        op.toPathLen_m = 0;
+    }
+
+    if (pending_m.size() > MAX_PENDING) {
+        isRescanNeeded_m = true;
+        pending_m.clear();
+        return;
+    }
+
+    // The queue only allocates when the mirror falls further behind than ever before; otherwise its buffer is reused.
+    size_t size = pending_m.size() + sizeof(op) + op.pathLen_m + op.toPathLen_m + 2;
+    if (size > pending_m.capacity()) {
+        AllocExempt_t allocExempt;
+        pending_m.reserve(std::max(size, pending_m.capacity() * 2));
+    }
+
+    // The paths are stored NUL terminated, ready for stat.
+    pending_m.append((char const *) &op, sizeof(op));
+    pending_m.append(path, op.pathLen_m);
+    pending_m += '\0';
+    pending_m.append(toPath, op.toPathLen_m);
+    pending_m += '\0';
+    pthread_cond_signal(&workCond_m);
+}
+
+//-----------------------------------------------------------------------------
+
+bool Mirror_t::query(char const * line, std::string & reply)
+{
+    bool isStat = strncmp(line, "stat:", 5) == 0;
+    bool isList = strncmp(line, "ls:", 3) == 0;
+
+    if (strcmp(line, "mirror") == 0) {
+        size_t numRoots;
+        size_t numPending;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            numRoots = roots_m.size();
+            numPending = pending_m.size();
+        }
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&treeMutex_m);
+        char buf [128];
+        snprintf(buf, sizeof(buf), "MIRROR: %lu roots, %lu nodes, %lu bytes of events queued\n",
+                 (unsigned long) numRoots, (unsigned long) tree_m.getNumNodes(), (unsigned long) numPending);
+        reply += buf;
+        return true;
+    }
+
+    if (!isStat && !isList) {
+        return false;
+    }
+
+    char const * path = strchr(line, ':') + 1;
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') {
+        --len;
+    }
+
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&treeMutex_m);
+    uint32_t node = tree_m.find(path, len);
+    if (node == MirrorTree_t::NO_NODE) {
+        reply += "MIRROR: not mirrored: " + std::string(path, len) + "\n";
+    }
+    else if (isStat) {
+        addToReply(node, reply);
+    }
+    else {
+        std::vector<uint32_t> children;
+        tree_m.getChildren(node, children);
+        for (size_t i = 0; i < children.size(); ++i) {
+            addToReply(children[i], reply);
+        }
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool Mirror_t::isUnderRoot(char const * path, size_t len) const
+{
+    for (size_t i = 0; i < roots_m.size(); ++i) {
+        if (isPathUnder(path, len, roots_m[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+void Mirror_t::addToReply(uint32_t node, std::string & reply)
+{
+    std::string path;
+    tree_m.getPath(node, path);
+    appendMirrorAttrs("MIRROR: ", tree_m.getValue(node), path.data(), path.size(), reply);
+}
+
+//-----------------------------------------------------------------------------
+
+void * Mirror_t::threadEntry(void * arg)
+{
+    ((Mirror_t *) arg)->run();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void Mirror_t::run()
+{
+    std::vector<std::string> removals;
+    std::vector<std::string> scans;
+    std::string ops;
+
+    while (true) {
+        bool isRescanNeeded;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            while (scans_m.empty() && removals_m.empty() && pending_m.empty() && !isRescanNeeded_m) {
+                MUTEX_COND_WAIT(&workCond_m);
+            }
+
+            removals.swap(removals_m);
+            removals_m.clear();
+            scans.swap(scans_m);
+            scans_m.clear();
+            ops.swap(pending_m);
+            pending_m.clear();
+
+            // A rescan of every root makes the queued events redundant.
+            isRescanNeeded = isRescanNeeded_m;
+            isRescanNeeded_m = false;
+            if (isRescanNeeded) {
+                scans = roots_m;
+                ops.clear();
+            }
+        }
+
+        if (isRescanNeeded) {
+            fprintf(stderr, "Warning: events were dropped, rescanning the mirrored trees\n");
+            removals.insert(removals.end(), scans.begin(), scans.end());
+        }
+
+        if (!removals.empty()) {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&treeMutex_m);
+            for (size_t i = 0; i < removals.size(); ++i) {
+                removeFromTree(removals[i]);
+            }
+        }
+
+        for (size_t i = 0; i < scans.size(); ++i) {
+            scan(scans[i]);
+        }
+
+        for (size_t pos = 0; pos + sizeof(Op_t) <= ops.size(); ) {
+            Op_t op;
+            memcpy(&op, ops.data() + pos, sizeof(op));
+            char const * path = ops.data() + pos + sizeof(op);
+            char const * toPath = path + op.pathLen_m + 1;
+            apply(op, path, toPath);
+            pos += sizeof(op) + op.pathLen_m + 1 + op.toPathLen_m + 1;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void Mirror_t::scan(std::string const & root)
+{
+    uint32_t rootNode = refresh(root.data(), root.size(), 0, 0, true);
+    if (rootNode == MirrorTree_t::NO_NODE) {
+        return;
+    }
+
+    // Walk the directories depth first, reading each one without the tree locked and then adding its entries in one go.
+    std::vector<std::pair<std::string, uint32_t> > stack;
+    stack.push_back(std::make_pair(root, rootNode));
+    std::vector<std::pair<std::string, MirrorAttrs_t> > entries;
+    std::string path;
+
+    while (!stack.empty()) {
+        std::string dir = stack.back().first;
+        uint32_t dirNode = stack.back().second;
+        stack.pop_back();
+
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&treeMutex_m);
+            if (!S_ISDIR(tree_m.getValue(dirNode).mode_m)) {
+                continue;
+            }
+        }
+
+        DIR * dirp = opendir(dir.c_str());
+        if (dirp == NULL) {
+            continue;
+        }
+
+        entries.clear();
+        struct dirent * entry;
+        while ((entry = readdir(dirp)) != NULL) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            path = dir == "/" ? dir : dir + "/";
+            path += entry->d_name;
+            struct stat st;
+            if (lstat(path.c_str(), &st) == 0) {
+                MirrorAttrs_t attrs;
+                setMirrorAttrs(attrs, st);
+                entries.push_back(std::make_pair(path, attrs));
+            }
+        }
+        closedir(dirp);
+
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&treeMutex_m);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            uint32_t node = tree_m.findOrAdd(entries[i].first.data(), entries[i].first.size());
+            tree_m.setValue(node, entries[i].second);
+            if (S_ISDIR(entries[i].second.mode_m)) {
+                stack.push_back(std::make_pair(entries[i].first, node));
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void Mirror_t::apply(Op_t const & op, char const * path, char const * toPath)
+{
+    switch (op.type_m) {
+        case FSE_DELETE: {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&treeMutex_m);
+            uint32_t node = tree_m.find(path, op.pathLen_m);
+            if (node != MirrorTree_t::NO_NODE) {
+                tree_m.remove(node);
+            }
+            break;
+        }
+
+        case FSE_RENAME: {
+            // A renamed node is re-linked under its new name with its subtree intact. A path renamed in from outside the tree is scanned.
+            bool isMoved = false;
+            {
+                MUTEX_LOCK_UNTIL_SCOPE_EXIT(&treeMutex_m);
+                uint32_t node = tree_m.find(path, op.pathLen_m);
+                if (node != MirrorTree_t::NO_NODE) {
+                    tree_m.move(node, toPath, op.toPathLen_m);
+                    isMoved = true;
+                }
+            }
+            if (isMoved) {
+                refresh(toPath, op.toPathLen_m, op.mode_m, op.inode_m, false);
+            }
+            else {
+                scan(toPath);
+            }
+            break;
+        }
+
+        case FSE_EXCHANGE:
+            refresh(path, op.pathLen_m, 0, 0, true);
+            if (op.toPathLen_m > 0) {
+                refresh(toPath, op.toPathLen_m, 0, 0, true);
+            }
+            break;
+
+        case FSE_CREATE_FILE:
+        case FSE_CREATE_DIR:
+        case FSE_CONTENT_MODIFIED:
+        case FSE_STAT_CHANGED:
+            refresh(path, op.pathLen_m, op.mode_m, op.inode_m, true);
+            break;
+
+        default:
+            // The other event types can't change the size or modification time.
+            refresh(path, op.pathLen_m, op.mode_m, op.inode_m, false);
+            break;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+uint32_t Mirror_t::refresh(char const * path, size_t len, uint32_t mode, uint64_t inode, bool isStatNeeded)
+{
+    if (!isStatNeeded) {
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(&treeMutex_m);
+        uint32_t node = tree_m.find(path, len);
+        if (node != MirrorTree_t::NO_NODE) {
+            MirrorAttrs_t attrs = tree_m.getValue(node);
+            if (mode != 0) {
+                attrs.mode_m = mode;
+            }
+            if (inode != 0) {
+                attrs.inode_m = inode;
+            }
+            tree_m.setValue(node, attrs);
+            return node;
+        }
+    }
+
+    // The stat is done without the tree locked, so that queries aren't held up.
+    struct stat st;
+    bool isStated = lstat(path, &st) == 0;
+    int error = errno;
+
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&treeMutex_m);
+    if (!isStated && (error == ENOENT || error == ENOTDIR)) {
+        uint32_t node = tree_m.find(path, len);
+        if (node != MirrorTree_t::NO_NODE) {
+            tree_m.remove(node);
+        }
+        return MirrorTree_t::NO_NODE;
+    }
+
+    uint32_t node = tree_m.findOrAdd(path, len);
+    MirrorAttrs_t attrs = tree_m.getValue(node);
+    if (isStated) {
+        setMirrorAttrs(attrs, st);
+    }
+    else {
+        // Without a stat, the event's type and inode are the best there is.
+        attrs.mode_m = mode != 0 ? mode : attrs.mode_m;
+        attrs.inode_m = inode != 0 ? inode : attrs.inode_m;
+    }
+    tree_m.setValue(node, attrs);
+    return node;
+}
+
+//-----------------------------------------------------------------------------
+
+void Mirror_t::removeFromTree(std::string const & path)
+{
+    uint32_t node = tree_m.find(path.data(), path.size());
+    if (node != MirrorTree_t::NO_NODE) {
+        tree_m.remove(node);
+    }
+}
@@ -0,0 +1,134 @@
+#ifndef __INC_Mirror_H
+#define __INC_Mirror_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <string>
+#include <vector>
+
+#include "EventView.h"
+#include "PathTree.h"
+
+// The attributes of a mirrored file or directory.
+struct MirrorAttrs_t
+{
+    uint32_t mode_m;  // The file type bits, or 0 if not yet known
+    uint64_t inode_m;
+    uint64_t size_m;
+    int64_t mtime_m;  // Seconds since the epoch
+};
+
+// Sets mirror attributes from the result of a stat.
+void setMirrorAttrs(MirrorAttrs_t & attrs, struct stat const & st);
+
+// Appends a line describing a path and its attributes to a string, e.g. "MIRROR: f ino=12 size=3 mtime=1700000000 /etc/hosts".
+void appendMirrorAttrs(char const * prefix, MirrorAttrs_t const & attrs, char const * path, size_t len, std::string & out);
+
+// The tree of mirrored files and directories.
+typedef PathTree_t<MirrorAttrs_t> MirrorTree_t;
+
+// This class keeps an in-memory mirror of the monitored trees, so that tools can look up the names, types, inodes, sizes and modification times of files without walking the file system themselves. Each root is scanned once when it is added, and from then on the mirror is updated incrementally from the FS events: the file type and inode come from the event, and only the affected path is re-stat'ed, and only for the event types that can change its size or modification time. Renamed directories are re-linked in place rather than rescanned.
+//
+// The events are queued by the caller and applied on the mirror's own thread, so the stat calls never hold up the reading of events. If the queue overflows, or the kernel reports dropped events, every root is rescanned.
+class Mirror_t
+{
+private:
+
+    // An event queued for the mirror thread, followed by its one or two paths.
+    struct Op_t
+    {
+        int32_t type_m;
+        uint32_t mode_m;
+        uint64_t inode_m;
+        uint32_t pathLen_m;
+        uint32_t toPathLen_m;
+    };
+
+    // The most bytes of queued events before giving up on them and rescanning.
+    static size_t const MAX_PENDING = 16 * 1024 * 1024;
+
+    // Protects the roots and the queue.
+    pthread_mutex_t mutex_m;
+    pthread_cond_t workCond_m;
+    std::vector<std::string> roots_m;
+    std::vector<std::string> scans_m;
+    std::vector<std::string> removals_m;
+    std::string pending_m;
+    bool isRescanNeeded_m;
+
+    // Protects the tree, which is only changed on the mirror thread. If both mutexes are needed this one must be locked second.
+    pthread_mutex_t treeMutex_m;
+    MirrorTree_t tree_m;
+
+    pthread_t thread_m;
+
+public:
+
+    // Constructor. Starts the mirror thread.
+    Mirror_t();
+
+    // Sets the roots to mirror. New roots are scanned in the background, and roots that are dropped are removed from the tree unless they are under another root.
+    void setRoots(std::vector<std::string> const & roots);
+
+    // Returns true if there are any roots.
+    bool hasRoots();
+
+    // Queues an event for the mirror, if any of its paths are under a root.
+    void addEvent(EventView_t const & event);
+
+    // Answers a query command: "stat:<path>" for a mirrored path's attributes, "ls:<path>" for those of its children, or "mirror" for the mirror's size. Returns false if the command isn't a query.
+    bool query(char const * line, std::string & reply);
+
+private:
+
+    // Is a path under one of the roots? Must be called with mutex_m locked.
+    bool isUnderRoot(char const * path, size_t len) const;
+
+    // Adds a path and its attributes to a query reply.
+    void addToReply(uint32_t node, std::string & reply);
+
+    // The mirror thread entry function.
+    static void * threadEntry(void * arg);
+
+    // The mirror thread loop.
+    void run();
+
+    // Scans a root, or a directory that appeared under a root, into the tree.
+    void scan(std::string const & path);
+
+    // Applies a queued event to the tree.
+    void apply(Op_t const & op, char const * path, char const * toPath);
+
+    // Updates a path's node from an event's type and inode, re-stat'ing it if asked to or if it is new to the tree. Removes the node if the path no longer exists. Returns the node, or NO_NODE.
+    uint32_t refresh(char const * path, size_t len, uint32_t mode, uint64_t inode, bool isStatNeeded);
+
+    // Removes a root's subtree from the tree, if it is in the tree.
+    void removeFromTree(std::string const & path);
+
+    // Not copyable.
+    Mirror_t(Mirror_t const &);
+    Mirror_t & operator=(Mirror_t const &);
+};
+
+#endif // __INC_Mirror_H
@@ -15,28 +15,343 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <errno.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <algorithm>
+#include <vector>
 
 #include "MutexLocker.h"
 
 //-----------------------------------------------------------------------------
 
-MutexLocker_t::MutexLocker_t(pthread_mutex_t * mutex_p)
-    : mutex_pm(mutex_p)
+bool MutexLocker_t::isStatsEnabled_s = false;
+
+// The list of all lock sites, and the mutex protecting it. This mutex only protects the list links, not the statistics.
+static LockSite_t * lockSiteList_s = NULL;
+static pthread_mutex_t lockSiteListMutex_s = PTHREAD_MUTEX_INITIALIZER;
+
+//-----------------------------------------------------------------------------
+// Get the current monotonic time in nanoseconds.
+
+static uint64_t getNowNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000ull + (uint64_t) ts.tv_nsec;
+}
+
+//-----------------------------------------------------------------------------
+// Add to a lock site counter, which other threads may be updating under other mutexes.
+
+static void addToCounter(uint64_t & counter, uint64_t n)
+{
+    __atomic_fetch_add(&counter, n, __ATOMIC_RELAXED);
+}
+
+//-----------------------------------------------------------------------------
+// Raise a lock site maximum, which other threads may be updating under other mutexes.
+
+static void raiseToMax(uint64_t & counter, uint64_t n)
+{
+    uint64_t old = __atomic_load_n(&counter, __ATOMIC_RELAXED);
+    while (n > old && !__atomic_compare_exchange_n(&counter, &old, n, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Read a lock site counter.
+
+static uint64_t loadCounter(uint64_t const & counter)
+{
+    return __atomic_load_n(&counter, __ATOMIC_RELAXED);
+}
+
+//-----------------------------------------------------------------------------
+// Get the histogram bucket index for a duration.
+
+static int getBucketIndex(uint64_t ns)
+{
+    int index = 0;
+    while (ns > 1 && index < LockSite_t::NUM_BUCKETS - 1) {
+        ns >>= 1;
+        index += 1;
+    }
+    return index;
+}
+
+//-----------------------------------------------------------------------------
+// Format a nanosecond duration in a human readable unit.
+
+static void formatNs(uint64_t ns, char * buf, size_t size)
+{
+    if (ns < 1000ull) {
+        snprintf(buf, size, "%lluns", (unsigned long long) ns);
+    }
+    else if (ns < 1000000ull) {
+        snprintf(buf, size, "%.1fus", ns / 1e3);
+    }
+    else if (ns < 1000000000ull) {
+        snprintf(buf, size, "%.1fms", ns / 1e6);
+    }
+    else {
+        snprintf(buf, size, "%.1fs", ns / 1e9);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Append formatted text to a string.
+
+static void appendFormat(std::string & out, char const * format, ...)
+{
+    char buf [512];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(buf, sizeof(buf), format, args);
+    va_end(args);
+    out += buf;
+}
+
+//-----------------------------------------------------------------------------
+// Append the non-empty buckets of a histogram.
+
+static void appendHistogram(std::string & out, char const * prefix, char const * name, uint64_t const * hist)
+{
+    appendFormat(out, "%s    %s:", prefix, name);
+    for (int i = 0; i < LockSite_t::NUM_BUCKETS; ++i) {
+        if (hist[i] != 0) {
+            char lowStr [32];
+            formatNs(i == 0 ? 0 : (1ull << i), lowStr, sizeof(lowStr));
+            appendFormat(out, " >=%s:%llu", lowStr, (unsigned long long) hist[i]);
+        }
+    }
+    out += "\n";
+}
+
+//-----------------------------------------------------------------------------
+// A copy of a lock site's statistics, read while the site may be in use, so that the sites can be ordered and printed from values that don't change meanwhile.
+
+struct SiteStats_t
+{
+    LockSite_t const * site_pm;
+    uint64_t acquireCount_m;
+    uint64_t contendedCount_m;
+    uint64_t totalWaitNs_m;
+    uint64_t maxWaitNs_m;
+    uint64_t totalHoldNs_m;
+    uint64_t maxHoldNs_m;
+    uint64_t waitHist_am [LockSite_t::NUM_BUCKETS];
+    uint64_t holdHist_am [LockSite_t::NUM_BUCKETS];
+};
+
+//-----------------------------------------------------------------------------
+// Copy a lock site's statistics.
+
+static void loadSiteStats(LockSite_t const * site_p, SiteStats_t & stats)
+{
+    stats.site_pm = site_p;
+    stats.acquireCount_m = loadCounter(site_p->acquireCount_m);
+    stats.contendedCount_m = loadCounter(site_p->contendedCount_m);
+    stats.totalWaitNs_m = loadCounter(site_p->totalWaitNs_m);
+    stats.maxWaitNs_m = loadCounter(site_p->maxWaitNs_m);
+    stats.totalHoldNs_m = loadCounter(site_p->totalHoldNs_m);
+    stats.maxHoldNs_m = loadCounter(site_p->maxHoldNs_m);
+    for (int i = 0; i < LockSite_t::NUM_BUCKETS; ++i) {
+        stats.waitHist_am[i] = loadCounter(site_p->waitHist_am[i]);
+        stats.holdHist_am[i] = loadCounter(site_p->holdHist_am[i]);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Order lock sites by decreasing total hold time.
+
+static bool isHeldLonger(SiteStats_t const & a, SiteStats_t const & b)
 {
-    if (pthread_mutex_lock(mutex_pm) != 0) {
+    return a.totalHoldNs_m > b.totalHoldNs_m;
+}
+
+//-----------------------------------------------------------------------------
+
+LockSite_t::LockSite_t(char const * function, char const * file, int line)
+    : function_m(function),
+      file_m(file),
+      line_m(line),
+      acquireCount_m(0),
+      contendedCount_m(0),
+      totalWaitNs_m(0),
+      maxWaitNs_m(0),
+      totalHoldNs_m(0),
+      maxHoldNs_m(0),
+      next_pm(NULL)
+{
+    memset(waitHist_am, 0, sizeof(waitHist_am));
+    memset(holdHist_am, 0, sizeof(holdHist_am));
+
+    pthread_mutex_lock(&lockSiteListMutex_s);
+    next_pm = lockSiteList_s;
+    lockSiteList_s = this;
+    pthread_mutex_unlock(&lockSiteListMutex_s);
+}
+
+//-----------------------------------------------------------------------------
+
+void LockSite_t::recordWait(uint64_t waitNs)
+{
+    addToCounter(acquireCount_m, 1);
+    if (waitNs != 0) {
+        addToCounter(contendedCount_m, 1);
+        addToCounter(totalWaitNs_m, waitNs);
+        raiseToMax(maxWaitNs_m, waitNs);
+        addToCounter(waitHist_am[getBucketIndex(waitNs)], 1);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void LockSite_t::recordHold(uint64_t holdNs)
+{
+    addToCounter(totalHoldNs_m, holdNs);
+    raiseToMax(maxHoldNs_m, holdNs);
+    addToCounter(holdHist_am[getBucketIndex(holdNs)], 1);
+}
+
+//-----------------------------------------------------------------------------
+
+MutexLocker_t::MutexLocker_t(pthread_mutex_t * mutex_p, LockSite_t * site_p)
+    : mutex_pm(mutex_p),
+      site_pm(isStatsEnabled_s ? site_p : NULL),
+      acquiredNs_m(0),
+      heldNs_m(0)
+{
+    if (site_pm == NULL) {
+        if (pthread_mutex_lock(mutex_pm) != 0) {
+            perror(NULL);
+            exit(-1);
+        }
+        return;
+    }
+
+    // Try the lock first so that the uncontended case doesn't pay for timing the wait.
+    uint64_t waitNs = 0;
+    int rc = pthread_mutex_trylock(mutex_pm);
+    if (rc == EBUSY) {
+        uint64_t startNs = getNowNs();
+        rc = pthread_mutex_lock(mutex_pm);
+        acquiredNs_m = getNowNs();
+        // Guard against a zero reading being mistaken for an uncontended acquisition.
+        waitNs = std::max<uint64_t>(acquiredNs_m - startNs, 1);
+    }
+    else {
+        acquiredNs_m = getNowNs();
+    }
+
+    if (rc != 0) {
         perror(NULL);
         exit(-1);
     }
+
+    site_pm->recordWait(waitNs);
 }
 
 //-----------------------------------------------------------------------------
 
 MutexLocker_t::~MutexLocker_t()
 {
+    // The hold time is recorded before unlocking, so that it covers everything done under the lock.
+    if (site_pm != NULL) {
+        site_pm->recordHold(heldNs_m + getNowNs() - acquiredNs_m);
+    }
+
     if (pthread_mutex_unlock(mutex_pm) != 0) {
         perror(NULL);
         exit(-1);
     }
 }
+
+//-----------------------------------------------------------------------------
+
+int MutexLocker_t::condWait(pthread_cond_t * cond_p, struct timespec const * deadline_p)
+{
+    if (site_pm != NULL) {
+        heldNs_m += getNowNs() - acquiredNs_m;
+    }
+
+    int rc = deadline_p != NULL ? pthread_cond_timedwait(cond_p, mutex_pm, deadline_p) : pthread_cond_wait(cond_p, mutex_pm);
+
+    if (site_pm != NULL) {
+        acquiredNs_m = getNowNs();
+    }
+    return rc;
+}
+
+//-----------------------------------------------------------------------------
+
+void MutexLocker_t::setStatsEnabled(bool isEnabled)
+{
+    isStatsEnabled_s = isEnabled;
+}
+
+//-----------------------------------------------------------------------------
+
+void MutexLocker_t::appendStats(std::string & out, char const * prefix)
+{
+    if (!isStatsEnabled_s) {
+        appendFormat(out, "%sLock statistics are disabled\n", prefix);
+        return;
+    }
+
+    std::vector<SiteStats_t> sites;
+
+    pthread_mutex_lock(&lockSiteListMutex_s);
+    for (LockSite_t * site_p = lockSiteList_s; site_p != NULL; site_p = site_p->next_pm) {
+        sites.push_back(SiteStats_t());
+        loadSiteStats(site_p, sites.back());
+    }
+    pthread_mutex_unlock(&lockSiteListMutex_s);
+
+    std::sort(sites.begin(), sites.end(), isHeldLonger);
+
+    appendFormat(out, "%sLOCK SITES:\n", prefix);
+    for (std::vector<SiteStats_t>::const_iterator iter = sites.begin(); iter != sites.end(); ++iter) {
+        SiteStats_t const * site_p = &*iter;
+        if (site_p->acquireCount_m == 0) {
+            continue;
+        }
+
+        char totalWaitStr [32], maxWaitStr [32], totalHoldStr [32], maxHoldStr [32];
+        formatNs(site_p->totalWaitNs_m, totalWaitStr, sizeof(totalWaitStr));
+        formatNs(site_p->maxWaitNs_m, maxWaitStr, sizeof(maxWaitStr));
+        formatNs(site_p->totalHoldNs_m, totalHoldStr, sizeof(totalHoldStr));
+        formatNs(site_p->maxHoldNs_m, maxHoldStr, sizeof(maxHoldStr));
+
+        appendFormat(out, "%s  - %s (%s:%d)\n", prefix, site_p->site_pm->function_m, site_p->site_pm->file_m, site_p->site_pm->line_m);
+        appendFormat(out, "%s    acquired %llu, contended %llu (%.1f%%)\n", prefix,
+                (unsigned long long) site_p->acquireCount_m,
+                (unsigned long long) site_p->contendedCount_m,
+                100.0 * site_p->contendedCount_m / site_p->acquireCount_m);
+        appendFormat(out, "%s    wait total %s, max %s; hold total %s, max %s\n", prefix,
+                totalWaitStr, maxWaitStr, totalHoldStr, maxHoldStr);
+        appendHistogram(out, prefix, "wait", site_p->waitHist_am);
+        appendHistogram(out, prefix, "hold", site_p->holdHist_am);
+    }
+
+    // The top holders are the sites most likely to stall other threads.
+    appendFormat(out, "%sTOP HOLDERS:\n", prefix);
+    enum { MAX_TOP_HOLDERS = 5 };
+    int rank = 0;
+    for (std::vector<SiteStats_t>::const_iterator iter = sites.begin(); iter != sites.end() && rank < MAX_TOP_HOLDERS; ++iter) {
+        SiteStats_t const * site_p = &*iter;
+        if (site_p->acquireCount_m == 0) {
+            continue;
+        }
+        rank += 1;
+
+        char totalHoldStr [32];
+        formatNs(site_p->totalHoldNs_m, totalHoldStr, sizeof(totalHoldStr));
+        appendFormat(out, "%s  %d. %s (%s:%d) held %s\n", prefix, rank, site_p->site_pm->function_m, site_p->site_pm->file_m, site_p->site_pm->line_m, totalHoldStr);
+    }
+}
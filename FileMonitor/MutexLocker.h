@@ -18,26 +18,90 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
 #include "pthread.h"
 
+// This class holds the lock contention statistics for a single lock site, i.e. a single place in the code where a mutex is locked. Instances are expected to have static storage duration, and register themselves in a global list on construction so that they can be reported on. A site can be passed with different mutexes, e.g. the per-instance mutexes of a class, so the statistics are updated with relaxed atomic operations rather than under any one mutex; each counter is exact, though a set of counters read while the site is in use needn't be consistent with each other.
+class LockSite_t
+{
+public:
+
+    // Histogram buckets are powers of two of nanoseconds, i.e. bucket N counts durations in [2^N, 2^(N+1)) ns.
+    enum { NUM_BUCKETS = 40 };
+
+    char const * function_m;
+    char const * file_m;
+    int line_m;
+
+    uint64_t acquireCount_m;
+    uint64_t contendedCount_m;
+    uint64_t totalWaitNs_m;
+    uint64_t maxWaitNs_m;
+    uint64_t totalHoldNs_m;
+    uint64_t maxHoldNs_m;
+    uint64_t waitHist_am [NUM_BUCKETS];
+    uint64_t holdHist_am [NUM_BUCKETS];
+
+    LockSite_t * next_pm;
+
+    // Constructor.
+    LockSite_t(char const * function, char const * file, int line);
+
+    // Record the time spent waiting to acquire the lock. A zero wait means the lock was acquired without contention.
+    void recordWait(uint64_t waitNs);
+
+    // Record the time the lock was held.
+    void recordHold(uint64_t holdNs);
+};
+
 // This class performs the simple function of locking a mutex in its constructor and unlocking the mutex in its destructor. This is useful in that if an instance of this class is created in some scope, then when the scope ends the object will be automatically destructed, unlocking the mutex without the programmer having to remember to write any code.
+//
+// If lock statistics are enabled and a lock site is provided then the wait time and hold time of the lock are accounted to the lock site. Contention is detected by first trying the lock, so uncontended acquisitions only cost a single clock read. The time spent in condWait() has the mutex released, so it isn't counted as held; otherwise an idle thread waiting for work would look like the worst holder.
 class MutexLocker_t
 {
 private:
-    
+
     pthread_mutex_t * mutex_pm;
+    LockSite_t * site_pm;
+    uint64_t acquiredNs_m;
+    uint64_t heldNs_m;      // The time held before the last condWait()
+
+    static bool isStatsEnabled_s;
 
 public:
 
     // Constructor.
-    MutexLocker_t(pthread_mutex_t * mutex_p);
+    MutexLocker_t(pthread_mutex_t * mutex_p, LockSite_t * site_p = NULL);
 
     // Destructor.
     ~MutexLocker_t();
+
+    // Waits on a condition variable, with the mutex released meanwhile, until it is signalled or, if there is a deadline, the deadline passes. Returns the result of the wait.
+    int condWait(pthread_cond_t * cond_p, struct timespec const * deadline_p);
+
+    // Enables or disables lock statistics. This should be called before any threads are started.
+    static void setStatsEnabled(bool isEnabled);
+
+    // Returns whether lock statistics are enabled.
+    static bool isStatsEnabled() { return isStatsEnabled_s; }
+
+    // Appends the wait and hold histograms of every lock site, followed by the lock sites ordered by total hold time. Every output line starts with the given prefix. The counters of each site are read atomically, so the sites can be in use meanwhile.
+    static void appendStats(std::string & out, char const * prefix);
 };
 
-// This macro provides a slightly simpler and more obvious way of creating a MutexLocker_t instance.
+// This macro provides a slightly simpler and more obvious way of creating a MutexLocker_t instance. Each use of the macro is a separate lock site for the purposes of lock statistics.
 #define MUTEX_LOCK_UNTIL_SCOPE_EXIT(mutex_p) \
-    MutexLocker_t __mutexLocker(mutex_p);
+    static LockSite_t __lockSite(__FUNCTION__, __FILE__, __LINE__); \
+    MutexLocker_t __mutexLocker(mutex_p, &__lockSite);
+
+// These macros wait on a condition variable with the mutex locked by MUTEX_LOCK_UNTIL_SCOPE_EXIT in the same or an enclosing scope, leaving the wait out of the lock's hold time.
+#define MUTEX_COND_WAIT(cond_p) \
+    __mutexLocker.condWait(cond_p, NULL)
+#define MUTEX_COND_TIMEDWAIT(cond_p, deadline_p) \
+    __mutexLocker.condWait(cond_p, deadline_p)
 
 #endif // __INC_MutexLocker_H
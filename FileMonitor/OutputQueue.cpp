@@ -0,0 +1,340 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "AllocCounter.h"
+#include "OutputQueue.h"
+
+//-----------------------------------------------------------------------------
+
+bool parseOutputPolicy(char const * name, OutputPolicy_t & policy)
+{
+    if (strcmp(name, "block") == 0) {
+        policy = OUTPUT_BLOCK;
+    }
+    else if (strcmp(name, "drop-newest") == 0) {
+        policy = OUTPUT_DROP_NEWEST;
+    }
+    else if (strcmp(name, "drop-oldest") == 0) {
+        policy = OUTPUT_DROP_OLDEST;
+    }
+    else if (strcmp(name, "summarize") == 0) {
+        policy = OUTPUT_SUMMARIZE;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+char const * getOutputPolicyName(OutputPolicy_t policy)
+{
+    switch (policy) {
+        case OUTPUT_BLOCK:
+            return "block";
+        case OUTPUT_DROP_NEWEST:
+            return "drop-newest";
+        case OUTPUT_DROP_OLDEST:
+            return "drop-oldest";
+        case OUTPUT_SUMMARIZE:
+            return "summarize";
+    }
+    return "unknown";
+}
+
+//-----------------------------------------------------------------------------
+
+size_t const OutputQueue_t::CHUNK_SIZE;
+size_t const OutputQueue_t::MAX_SUMMARY_DIRS;
+size_t const OutputQueue_t::MAX_FREE_CHUNKS;
+
+//-----------------------------------------------------------------------------
+
+OutputQueue_t::OutputQueue_t(size_t capacity, OutputPolicy_t policy)
+    : capacity_m(capacity),
+      policy_m(policy),
+      frontOffset_m(0),
+      isFrontPinned_m(false),
+      isOverloaded_m(false),
+      eventBytes_m(0),
+      pendingLost_m(0)
+{
+    memset(&stats_m, 0, sizeof(stats_m));
+    free_m.reserve(MAX_FREE_CHUNKS);
+}
+
+//-----------------------------------------------------------------------------
+
+OutputQueue_t::~OutputQueue_t()
+{
+    for (size_t i = 0; i < chunks_m.size(); ++i) {
+        delete chunks_m[i];
+    }
+    for (size_t i = 0; i < free_m.size(); ++i) {
+        delete free_m[i];
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool OutputQueue_t::push(char const * text, size_t len, uint32_t numEvents, char const * dir, size_t dirLen)
+{
+    // Once events start being dropped or summarized they carry on being so until the consumer has caught up by half the capacity, so that the losses are reported as a few large runs rather than many small ones.
+    if (isOverloaded_m && eventBytes_m <= capacity_m / 2) {
+        isOverloaded_m = false;
+    }
+
+    if (isOverloaded_m || eventBytes_m + len > capacity_m) {
+        switch (policy_m) {
+            case OUTPUT_BLOCK:
+                // Output bigger than the whole capacity is let through once the queue is empty, rather than blocking forever.
+                if (eventBytes_m > 0) {
+                    return false;
+                }
+                break;
+
+            case OUTPUT_DROP_NEWEST:
+                isOverloaded_m = true;
+                pendingLost_m += numEvents;
+                stats_m.numLost_m += numEvents;
+                return true;
+
+            case OUTPUT_DROP_OLDEST:
+                if (!dropOldest(len)) {
+                    pendingLost_m += numEvents;
+                    stats_m.numLost_m += numEvents;
+                    return true;
+                }
+                break;
+
+            case OUTPUT_SUMMARIZE: {
+                isOverloaded_m = true;
+                std::string key(dir != NULL && dirLen > 0 ? std::string(dir, dirLen) : std::string("/"));
+                SummaryMap_t::iterator iter = pendingSummary_m.find(key);
+                if (iter == pendingSummary_m.end() && pendingSummary_m.size() >= MAX_SUMMARY_DIRS) {
+                    iter = pendingSummary_m.find("(other)");
+                    if (iter == pendingSummary_m.end()) {
+                        iter = pendingSummary_m.insert(SummaryMap_t::value_type("(other)", 0)).first;
+                    }
+                }
+                else if (iter == pendingSummary_m.end()) {
+                    iter = pendingSummary_m.insert(SummaryMap_t::value_type(key, 0)).first;
+                }
+                iter->second += numEvents;
+                stats_m.numSummarized_m += numEvents;
+                return true;
+            }
+        }
+    }
+
+    // Any losses are reported where they happened, ahead of the output that follows them.
+    pushLosses();
+
+    Chunk_t * back_p = chunks_m.empty() ? NULL : chunks_m.back();
+    bool isBackBusy = chunks_m.size() == 1 && isFrontPinned_m;
+    if (back_p == NULL || back_p->isMessage_m || isBackBusy || back_p->text_m.size() + len > CHUNK_SIZE) {
+        // Event chunks are allocated full size, so that once there are enough of them queueing output doesn't allocate. Until then, a backlog deeper than any before allocates by design.
+        AllocExempt_t allocExempt;
+        back_p = allocChunk();
+        back_p->text_m.reserve(CHUNK_SIZE);
+        chunks_m.push_back(back_p);
+    }
+    back_p->text_m.append(text, len);
+    back_p->numEvents_m += numEvents;
+
+    eventBytes_m += len;
+    stats_m.numQueued_m += numEvents;
+    stats_m.numBytes_m += len;
+    if (stats_m.numBytes_m > stats_m.maxBytes_m) {
+        stats_m.maxBytes_m = stats_m.numBytes_m;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void OutputQueue_t::pushMessage(char const * text, size_t len)
+{
+    Chunk_t * chunk_p = allocChunk();
+    chunk_p->text_m.assign(text, len);
+    chunk_p->isMessage_m = true;
+    chunks_m.push_back(chunk_p);
+    stats_m.numBytes_m += len;
+}
+
+//-----------------------------------------------------------------------------
+
+bool OutputQueue_t::peek(char const * & text, size_t & len)
+{
+    // Losses are reported even if no more output follows them.
+    if (chunks_m.empty()) {
+        pushLosses();
+        if (chunks_m.empty()) {
+            return false;
+        }
+    }
+
+    Chunk_t const * chunk_p = chunks_m.front();
+    text = chunk_p->text_m.data() + frontOffset_m;
+    len = chunk_p->text_m.size() - frontOffset_m;
+    isFrontPinned_m = true;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void OutputQueue_t::consume(size_t len)
+{
+    Chunk_t * chunk_p = chunks_m.front();
+    frontOffset_m += len;
+    isFrontPinned_m = false;
+    stats_m.numBytes_m -= len;
+    if (!chunk_p->isMessage_m) {
+        eventBytes_m -= len;
+    }
+
+    if (frontOffset_m >= chunk_p->text_m.size()) {
+        chunks_m.pop_front();
+        freeChunk(chunk_p);
+        frontOffset_m = 0;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void OutputQueue_t::appendStats(std::string & out, char const * prefix, char const * name) const
+{
+    char line [512];
+    snprintf(line, sizeof(line), "%s%s policy=%s queued=%llu lost=%llu summarized=%llu bytes=%llu max-bytes=%llu\n",
+            prefix, name, getOutputPolicyName(policy_m),
+            (unsigned long long) stats_m.numQueued_m,
+            (unsigned long long) stats_m.numLost_m,
+            (unsigned long long) stats_m.numSummarized_m,
+            (unsigned long long) stats_m.numBytes_m,
+            (unsigned long long) stats_m.maxBytes_m);
+    out += line;
+}
+
+//-----------------------------------------------------------------------------
+
+bool OutputQueue_t::dropOldest(size_t len)
+{
+    // The front chunk can't be dropped if it is partly written, since that would leave a partial line in the output.
+    size_t index = isFrontBusy() ? 1 : 0;
+    size_t markerIndex = chunks_m.size();
+    uint64_t numLost = 0;
+
+    while (eventBytes_m + len > capacity_m && index < chunks_m.size()) {
+        Chunk_t * chunk_p = chunks_m[index];
+        if (chunk_p->isMessage_m) {
+            index += 1;
+            continue;
+        }
+        if (markerIndex == chunks_m.size()) {
+            markerIndex = index;
+        }
+        numLost += chunk_p->numEvents_m;
+        eventBytes_m -= chunk_p->text_m.size();
+        stats_m.numBytes_m -= chunk_p->text_m.size();
+        chunks_m.erase(index);
+        freeChunk(chunk_p);
+    }
+
+    if (numLost > 0) {
+        stats_m.numLost_m += numLost;
+
+        // Dropped chunks are reported by a loss marker in their place, which is merged with an earlier marker right before them.
+        Chunk_t * marker_p = markerIndex > 0 ? chunks_m[markerIndex - 1] : NULL;
+        bool isMarkerBusy = markerIndex == 1 && isFrontBusy();
+        if (marker_p == NULL || marker_p->numLost_m == 0 || isMarkerBusy) {
+            marker_p = allocChunk();
+            marker_p->isMessage_m = true;
+            chunks_m.insert(markerIndex, marker_p);
+        }
+        stats_m.numBytes_m -= marker_p->text_m.size();
+
+        char buf [64];
+        marker_p->numLost_m += numLost;
+        snprintf(buf, sizeof(buf), "LOST:%llu events\n", (unsigned long long) marker_p->numLost_m);
+        marker_p->text_m = buf;
+        stats_m.numBytes_m += marker_p->text_m.size();
+    }
+
+    return eventBytes_m + len <= capacity_m;
+}
+
+//-----------------------------------------------------------------------------
+
+void OutputQueue_t::pushLosses()
+{
+    if (pendingLost_m > 0) {
+        char buf [64];
+        snprintf(buf, sizeof(buf), "LOST:%llu events\n", (unsigned long long) pendingLost_m);
+        pushMessage(buf, strlen(buf));
+        chunks_m.back()->numLost_m = pendingLost_m;
+        pendingLost_m = 0;
+    }
+
+    if (!pendingSummary_m.empty()) {
+        std::string text;
+        char buf [64];
+        for (SummaryMap_t::const_iterator iter = pendingSummary_m.begin(); iter != pendingSummary_m.end(); ++iter) {
+            snprintf(buf, sizeof(buf), "SUMMARY:%llu events under ", (unsigned long long) iter->second);
+            text += buf;
+            text += iter->first;
+            text += '\n';
+        }
+        pushMessage(text.data(), text.size());
+        pendingSummary_m.clear();
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+OutputQueue_t::Chunk_t * OutputQueue_t::allocChunk()
+{
+    Chunk_t * chunk_p = NULL;
+    if (!free_m.empty()) {
+        chunk_p = free_m.back();
+        free_m.pop_back();
+    }
+    else {
+        chunk_p = new Chunk_t;
+    }
+
+    chunk_p->text_m.clear();
+    chunk_p->numEvents_m = 0;
+    chunk_p->isMessage_m = false;
+    chunk_p->numLost_m = 0;
+    return chunk_p;
+}
+
+//-----------------------------------------------------------------------------
+
+void OutputQueue_t::freeChunk(Chunk_t * chunk_p)
+{
+    // Oversized chunks aren't kept, so that one huge output doesn't hold on to its memory.
+    if (free_m.size() >= MAX_FREE_CHUNKS || chunk_p->text_m.capacity() > CHUNK_SIZE) {
+        delete chunk_p;
+    }
+    else {
+        free_m.push_back(chunk_p);
+    }
+}
@@ -0,0 +1,159 @@
+#ifndef __INC_OutputQueue_H
+#define __INC_OutputQueue_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "RingQueue.h"
+
+// What an output queue does with event output that doesn't fit.
+enum OutputPolicy_t
+{
+    OUTPUT_BLOCK,       // Wait for the consumer to make room
+    OUTPUT_DROP_NEWEST, // Drop the output that doesn't fit
+    OUTPUT_DROP_OLDEST, // Drop the oldest queued output to make room
+    OUTPUT_SUMMARIZE,   // Count the output that doesn't fit per directory, and queue the counts instead
+};
+
+// Parses a policy name: block, drop-newest, drop-oldest or summarize. Returns false if the name is invalid.
+bool parseOutputPolicy(char const * name, OutputPolicy_t & policy);
+
+// Returns the name of a policy.
+char const * getOutputPolicyName(OutputPolicy_t policy);
+
+// Counters for an output queue.
+struct OutputStats_t
+{
+    uint64_t numQueued_m;     // Events queued for output
+    uint64_t numLost_m;       // Events dropped
+    uint64_t numSummarized_m; // Events replaced by summary counts
+    size_t numBytes_m;        // Bytes currently queued, including messages
+    size_t maxBytes_m;        // The most bytes ever queued
+};
+
+// This class is a bounded queue of formatted output waiting for a consumer, such as stdout or a subscriber's socket. When event output doesn't fit, the queue applies its policy; events that are lost are reported in the output stream itself, by "LOST:<n> events" lines where they were dropped, and "SUMMARY:<n> events under <dir>" lines in place of summarized events. The queue does no locking of its own.
+class OutputQueue_t
+{
+private:
+
+    // A run of queued output. Event output is appended to the last chunk until it is full, so that most events don't need a chunk of their own.
+    struct Chunk_t
+    {
+        std::string text_m;
+        uint32_t numEvents_m;
+        bool isMessage_m;   // Not event output, so never dropped
+        uint64_t numLost_m; // For a loss marker, the number of events lost
+    };
+
+    typedef std::map<std::string, uint64_t> SummaryMap_t;
+
+    // The largest chunk that event output is appended to.
+    static size_t const CHUNK_SIZE = 64 * 1024;
+
+    // The most directories to count summarized events under. Beyond this they are counted under "(other)".
+    static size_t const MAX_SUMMARY_DIRS = 256;
+
+    // The most unused chunks to keep for reuse.
+    static size_t const MAX_FREE_CHUNKS = 64;
+
+    size_t capacity_m;
+    OutputPolicy_t policy_m;
+    RingQueue_t<Chunk_t *> chunks_m;
+    std::vector<Chunk_t *> free_m;
+    size_t frontOffset_m;
+    bool isFrontPinned_m;
+    bool isOverloaded_m; // Dropping or summarizing until the consumer catches up
+    size_t eventBytes_m;
+    uint64_t pendingLost_m;
+    SummaryMap_t pendingSummary_m;
+    OutputStats_t stats_m;
+
+public:
+
+    // Constructor. The capacity is the most bytes of event output to hold.
+    OutputQueue_t(size_t capacity, OutputPolicy_t policy);
+
+    // Destructor.
+    ~OutputQueue_t();
+
+    // Returns the policy.
+    OutputPolicy_t getPolicy() const { return policy_m; }
+
+    // Sets the policy.
+    void setPolicy(OutputPolicy_t policy) { policy_m = policy; isOverloaded_m = false; }
+
+    // Queues the output of some events, applying the policy if it doesn't fit. The directory is the one that the events are counted under if they are summarized. Returns false, having queued nothing, if the output doesn't fit and the policy is to block; the caller should wait for the consumer and try again.
+    bool push(char const * text, size_t len, uint32_t numEvents, char const * dir, size_t dirLen);
+
+    // Is there room for some event output without applying the policy? As in push(), a queue that is dropping or summarizing has no room until it is half empty.
+    bool hasRoom(size_t len) const { return (!isOverloaded_m || eventBytes_m <= capacity_m / 2) && eventBytes_m + len <= capacity_m; }
+
+    // Returns how full the queue is with event output, as a percentage of the capacity.
+    unsigned getFillPercent() const { return (unsigned) (eventBytes_m * 100 / capacity_m); }
+
+    // Queues output that isn't events, such as a reply to a command. It is never dropped, and doesn't count against the capacity.
+    void pushMessage(char const * text, size_t len);
+
+    // Returns the bytes of queued output that isn't events.
+    size_t getMessageBytes() const { return (size_t) (stats_m.numBytes_m - eventBytes_m); }
+
+    // Is there nothing waiting to be consumed, including loss markers and summaries?
+    bool isEmpty() const { return chunks_m.empty() && pendingLost_m == 0 && pendingSummary_m.empty(); }
+
+    // Returns the next run of output to write, or false if there is none. The run stays valid, and isn't dropped, until it is consumed.
+    bool peek(char const * & text, size_t & len);
+
+    // Consumes some of the run returned by peek(), once it is written.
+    void consume(size_t len);
+
+    // Returns the counters.
+    OutputStats_t const & getStats() const { return stats_m; }
+
+    // Appends the policy and counters on a single line.
+    void appendStats(std::string & out, char const * prefix, char const * name) const;
+
+private:
+
+    // Makes room for some event output by dropping the oldest event output that isn't pinned. Returns false if there still isn't room.
+    bool dropOldest(size_t len);
+
+    // Queues a loss marker, and any summary lines, for the events lost since the last one.
+    void pushLosses();
+
+    // Returns a cleared chunk, reusing an unused one if possible.
+    Chunk_t * allocChunk();
+
+    // Returns an unused chunk for reuse.
+    void freeChunk(Chunk_t * chunk_p);
+
+    // Is the front chunk partly written, or being written?
+    bool isFrontBusy() const { return isFrontPinned_m || frontOffset_m > 0; }
+
+    // Not copyable.
+    OutputQueue_t(OutputQueue_t const &);
+    OutputQueue_t & operator=(OutputQueue_t const &);
+};
+
+#endif // __INC_OutputQueue_H
@@ -0,0 +1,164 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "AllocCounter.h"
+#include "JournalFormat.h"
+#include "MutexLocker.h"
+#include "OutputSink.h"
+
+//-----------------------------------------------------------------------------
+
+OutputSink_t::OutputSink_t(int fd, size_t capacity, OutputPolicy_t policy)
+    : fd_m(fd),
+      queue_m(capacity, policy)
+{
+    pthread_mutex_init(&mutex_m, NULL);
+    pthread_cond_init(&dataCond_m, NULL);
+    pthread_cond_init(&spaceCond_m, NULL);
+
+    if (pthread_create(&thread_m, NULL, threadEntry, this) != 0) {
+        perror(NULL);
+        exit(1);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void OutputSink_t::write(char const * text, size_t len, uint32_t numEvents, char const * dir, size_t dirLen)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+
+    while (!queue_m.push(text, len, numEvents, dir, dirLen)) {
+        MUTEX_COND_WAIT(&spaceCond_m);
+    }
+    pthread_cond_signal(&dataCond_m);
+}
+
+//-----------------------------------------------------------------------------
+
+void OutputSink_t::write(EventView_t const & event, uint32_t matchMask, char const * text, size_t len)
+{
+    for (int i = 0; i < event.numArgs_m; ++i) {
+        if ((matchMask & (1u << i)) != 0) {
+            EventArg_t const & arg = event.args_am[i];
+            write(text, len, 1, arg.data_m, getParentDirLen(arg.data_m, arg.pathLen()));
+            return;
+        }
+    }
+    write(text, len, 1, NULL, 0);
+}
+
+//-----------------------------------------------------------------------------
+
+void OutputSink_t::writeWhenRoom(char const * text, size_t len, uint32_t numEvents, char const * dir, size_t dirLen)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+
+    while (!queue_m.hasRoom(len) && !queue_m.isEmpty()) {
+        MUTEX_COND_WAIT(&spaceCond_m);
+    }
+    while (!queue_m.push(text, len, numEvents, dir, dirLen)) {
+        MUTEX_COND_WAIT(&spaceCond_m);
+    }
+    pthread_cond_signal(&dataCond_m);
+}
+
+//-----------------------------------------------------------------------------
+
+void OutputSink_t::writeMessage(char const * text, size_t len)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+
+    queue_m.pushMessage(text, len);
+    pthread_cond_signal(&dataCond_m);
+}
+
+//-----------------------------------------------------------------------------
+
+unsigned OutputSink_t::getFillPercent()
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    return queue_m.getFillPercent();
+}
+
+//-----------------------------------------------------------------------------
+
+void OutputSink_t::drain()
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+
+    while (!queue_m.isEmpty()) {
+        MUTEX_COND_WAIT(&spaceCond_m);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void OutputSink_t::appendStats(std::string & out, char const * prefix, char const * name)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+    queue_m.appendStats(out, prefix, name);
+}
+
+//-----------------------------------------------------------------------------
+
+void * OutputSink_t::threadEntry(void * arg)
+{
+    ((OutputSink_t *) arg)->run();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void OutputSink_t::run()
+{
+    uint64_t numRuns = 0;
+    while (true) {
+        // Taking a run off the queue, writing it and giving it back are all done in place.
+        AllocCheck_t allocCheck("writing output", numRuns);
+        char const * text = NULL;
+        size_t len = 0;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            while (!queue_m.peek(text, len)) {
+                MUTEX_COND_WAIT(&dataCond_m);
+            }
+        }
+
+        // The run stays valid while it is pinned by peek(), so it is written without holding the lock.
+        ssize_t n = ::write(fd_m, text, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                n = 0;
+            }
+            else {
+                // There is nobody to report the output to, so it is discarded, as an unchecked printf would.
+                n = len;
+            }
+        }
+
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            queue_m.consume(n);
+            pthread_cond_broadcast(&spaceCond_m);
+        }
+    }
+}
@@ -0,0 +1,83 @@
+#ifndef __INC_OutputSink_H
+#define __INC_OutputSink_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "EventView.h"
+#include "OutputQueue.h"
+
+// This class writes formatted event output to a file descriptor, such as stdout, on its own thread, through a bounded output queue. A consumer that stalls holds up only the sink's thread; unless the policy is to block, the callers carry on and the queue's policy decides which output is lost.
+class OutputSink_t
+{
+private:
+
+    int fd_m;
+
+    // Protects the queue.
+    pthread_mutex_t mutex_m;
+    pthread_cond_t dataCond_m;
+    pthread_cond_t spaceCond_m;
+    OutputQueue_t queue_m;
+
+    pthread_t thread_m;
+
+public:
+
+    // Constructor. Starts the writer thread.
+    OutputSink_t(int fd, size_t capacity, OutputPolicy_t policy);
+
+    // Queues the output of some events. The directory is the one that the events are counted under if they are summarized. Only blocks if the queue is full and the policy is to block.
+    void write(char const * text, size_t len, uint32_t numEvents, char const * dir, size_t dirLen);
+
+    // Queues the output of an event, counting it under the parent directory of its first matched path if it is summarized.
+    void write(EventView_t const & event, uint32_t matchMask, char const * text, size_t len);
+
+    // Queues the output of some events, waiting for room in the queue whatever the policy, or for the queue to empty if the output is bigger than the capacity. For output that can just as well be produced at the consumer's pace, such as a baseline scan.
+    void writeWhenRoom(char const * text, size_t len, uint32_t numEvents, char const * dir, size_t dirLen);
+
+    // Queues output that isn't events, such as a note about the events. It is never dropped.
+    void writeMessage(char const * text, size_t len);
+
+    // Returns how full the queue is with event output, as a percentage of the capacity.
+    unsigned getFillPercent();
+
+    // Waits until all of the queued output has been written.
+    void drain();
+
+    // Appends the policy and counters on a single line.
+    void appendStats(std::string & out, char const * prefix, char const * name);
+
+private:
+
+    // The writer thread entry function.
+    static void * threadEntry(void * arg);
+
+    // The writer thread loop.
+    void run();
+
+    // Not copyable.
+    OutputSink_t(OutputSink_t const &);
+    OutputSink_t & operator=(OutputSink_t const &);
+};
+
+#endif // __INC_OutputSink_H
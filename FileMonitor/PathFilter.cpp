@@ -0,0 +1,744 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include <algorithm>
+#include <map>
+
+#include "PathFilter.h"
+
+//-----------------------------------------------------------------------------
+
+// A set of byte values.
+struct ByteSet_t
+{
+    uint64_t bits_am [4];
+
+    ByteSet_t()
+    {
+        memset(bits_am, 0, sizeof(bits_am));
+    }
+
+    void add(uint8_t c)
+    {
+        bits_am[c >> 6] |= 1ull << (c & 63);
+    }
+
+    void addRange(uint8_t low, uint8_t high)
+    {
+        for (int c = low; c <= high; ++c) {
+            add((uint8_t) c);
+        }
+    }
+
+    void invert()
+    {
+        for (int i = 0; i < 4; ++i) {
+            bits_am[i] = ~bits_am[i];
+        }
+    }
+
+    bool has(uint8_t c) const
+    {
+        return (bits_am[c >> 6] >> (c & 63)) & 1;
+    }
+};
+
+// A Thompson NFA state. A BYTES state consumes one byte in its set and moves to out1; a SPLIT state moves to out1 and, if set, out2 without consuming input; a MATCH state accepts.
+struct NfaState_t
+{
+    enum Kind_t
+    {
+        BYTES,
+        SPLIT,
+        MATCH
+    };
+
+    Kind_t kind_m;
+    ByteSet_t bytes_m;
+    int out1_m;
+    int out2_m;
+    uint8_t accept_m;
+};
+
+// A partially built piece of NFA: its start state, and the dangling outputs that still need to be connected to whatever follows. Each dangling output is a state index, and 1 or 2 for which of its outputs is dangling.
+struct NfaFragment_t
+{
+    int start_m;
+    std::vector<std::pair<int, int> > outs_m;
+};
+
+//-----------------------------------------------------------------------------
+
+// This class parses a regular expression into a fragment of a shared NFA.
+class RegexParser_t
+{
+private:
+
+    std::vector<NfaState_t> & states_m;
+    std::string const & text_m;
+    size_t pos_m;
+    std::string error_m;
+
+public:
+
+    RegexParser_t(std::vector<NfaState_t> & states, std::string const & text)
+        : states_m(states),
+          text_m(text),
+          pos_m(0)
+    {}
+
+    // Parses the whole expression, reporting whether it is anchored by a leading '^' or a trailing '$'. Returns false and sets an error message if the expression is invalid.
+    bool parse(NfaFragment_t & frag, bool & isStartAnchored, bool & isEndAnchored, std::string & error);
+
+    // Adds a state that accepts.
+    NfaFragment_t makeMatch(uint8_t accept);
+
+    // Adds a state that consumes one byte in a set.
+    NfaFragment_t makeBytes(ByteSet_t const & bytes);
+
+    // Adds a state that consumes nothing.
+    NfaFragment_t makeEmpty();
+
+    // Connects the dangling outputs of a fragment to a state.
+    void patch(NfaFragment_t const & frag, int state);
+
+    // Fragment combinators.
+    NfaFragment_t makeConcat(NfaFragment_t const & a, NfaFragment_t const & b);
+    NfaFragment_t makeAlt(NfaFragment_t const & a, NfaFragment_t const & b);
+    NfaFragment_t makeStar(NfaFragment_t const & a);
+    NfaFragment_t makePlus(NfaFragment_t const & a);
+    NfaFragment_t makeQuest(NfaFragment_t const & a);
+
+private:
+
+    int addState(NfaState_t::Kind_t kind);
+
+    bool parseAlt(NfaFragment_t & frag);
+    bool parseConcat(NfaFragment_t & frag);
+    bool parseRepeat(NfaFragment_t & frag);
+    bool parseAtom(NfaFragment_t & frag);
+    bool parseClass(ByteSet_t & bytes);
+
+    bool isEnd() const { return pos_m >= text_m.size(); }
+    char peek() const { return text_m[pos_m]; }
+};
+
+//-----------------------------------------------------------------------------
+
+int RegexParser_t::addState(NfaState_t::Kind_t kind)
+{
+    NfaState_t state;
+    state.kind_m = kind;
+    state.out1_m = -1;
+    state.out2_m = -1;
+    state.accept_m = 0;
+    states_m.push_back(state);
+    return (int) states_m.size() - 1;
+}
+
+//-----------------------------------------------------------------------------
+
+NfaFragment_t RegexParser_t::makeBytes(ByteSet_t const & bytes)
+{
+    NfaFragment_t frag;
+    frag.start_m = addState(NfaState_t::BYTES);
+    states_m[frag.start_m].bytes_m = bytes;
+    frag.outs_m.push_back(std::make_pair(frag.start_m, 1));
+    return frag;
+}
+
+//-----------------------------------------------------------------------------
+
+NfaFragment_t RegexParser_t::makeEmpty()
+{
+    NfaFragment_t frag;
+    frag.start_m = addState(NfaState_t::SPLIT);
+    frag.outs_m.push_back(std::make_pair(frag.start_m, 1));
+    return frag;
+}
+
+//-----------------------------------------------------------------------------
+
+NfaFragment_t RegexParser_t::makeMatch(uint8_t accept)
+{
+    NfaFragment_t frag;
+    frag.start_m = addState(NfaState_t::MATCH);
+    states_m[frag.start_m].accept_m = accept;
+    return frag;
+}
+
+//-----------------------------------------------------------------------------
+
+void RegexParser_t::patch(NfaFragment_t const & frag, int state)
+{
+    for (size_t i = 0; i < frag.outs_m.size(); ++i) {
+        NfaState_t & s = states_m[frag.outs_m[i].first];
+        if (frag.outs_m[i].second == 1) {
+            s.out1_m = state;
+        }
+        else {
+            s.out2_m = state;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+NfaFragment_t RegexParser_t::makeConcat(NfaFragment_t const & a, NfaFragment_t const & b)
+{
+    patch(a, b.start_m);
+    NfaFragment_t frag;
+    frag.start_m = a.start_m;
+    frag.outs_m = b.outs_m;
+    return frag;
+}
+
+//-----------------------------------------------------------------------------
+
+NfaFragment_t RegexParser_t::makeAlt(NfaFragment_t const & a, NfaFragment_t const & b)
+{
+    NfaFragment_t frag;
+    frag.start_m = addState(NfaState_t::SPLIT);
+    states_m[frag.start_m].out1_m = a.start_m;
+    states_m[frag.start_m].out2_m = b.start_m;
+    frag.outs_m = a.outs_m;
+    frag.outs_m.insert(frag.outs_m.end(), b.outs_m.begin(), b.outs_m.end());
+    return frag;
+}
+
+//-----------------------------------------------------------------------------
+
+NfaFragment_t RegexParser_t::makeStar(NfaFragment_t const & a)
+{
+    NfaFragment_t frag;
+    frag.start_m = addState(NfaState_t::SPLIT);
+    states_m[frag.start_m].out1_m = a.start_m;
+    patch(a, frag.start_m);
+    frag.outs_m.push_back(std::make_pair(frag.start_m, 2));
+    return frag;
+}
+
+//-----------------------------------------------------------------------------
+
+NfaFragment_t RegexParser_t::makePlus(NfaFragment_t const & a)
+{
+    int split = addState(NfaState_t::SPLIT);
+    states_m[split].out1_m = a.start_m;
+    patch(a, split);
+    NfaFragment_t frag;
+    frag.start_m = a.start_m;
+    frag.outs_m.push_back(std::make_pair(split, 2));
+    return frag;
+}
+
+//-----------------------------------------------------------------------------
+
+NfaFragment_t RegexParser_t::makeQuest(NfaFragment_t const & a)
+{
+    NfaFragment_t frag;
+    frag.start_m = addState(NfaState_t::SPLIT);
+    states_m[frag.start_m].out1_m = a.start_m;
+    frag.outs_m = a.outs_m;
+    frag.outs_m.push_back(std::make_pair(frag.start_m, 2));
+    return frag;
+}
+
+//-----------------------------------------------------------------------------
+
+bool RegexParser_t::parse(NfaFragment_t & frag, bool & isStartAnchored, bool & isEndAnchored, std::string & error)
+{
+    isStartAnchored = !isEnd() && peek() == '^';
+    if (isStartAnchored) {
+        pos_m += 1;
+    }
+
+    if (!parseAlt(frag)) {
+        error = error_m;
+        return false;
+    }
+
+    isEndAnchored = false;
+    if (!isEnd()) {
+        if (peek() == '$' && pos_m + 1 == text_m.size()) {
+            isEndAnchored = true;
+        }
+        else {
+            error = "unexpected '" + std::string(1, peek()) + "' in regex: " + text_m;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool RegexParser_t::parseAlt(NfaFragment_t & frag)
+{
+    if (!parseConcat(frag)) {
+        return false;
+    }
+    while (!isEnd() && peek() == '|') {
+        pos_m += 1;
+        NfaFragment_t other;
+        if (!parseConcat(other)) {
+            return false;
+        }
+        frag = makeAlt(frag, other);
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool RegexParser_t::parseConcat(NfaFragment_t & frag)
+{
+    frag = makeEmpty();
+    while (!isEnd() && peek() != '|' && peek() != ')') {
+        // A '$' is only special at the very end of the expression.
+        if (peek() == '$' && pos_m + 1 == text_m.size()) {
+            break;
+        }
+        NfaFragment_t next;
+        if (!parseRepeat(next)) {
+            return false;
+        }
+        frag = makeConcat(frag, next);
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool RegexParser_t::parseRepeat(NfaFragment_t & frag)
+{
+    if (!parseAtom(frag)) {
+        return false;
+    }
+    while (!isEnd()) {
+        char c = peek();
+        if (c == '*') {
+            frag = makeStar(frag);
+        }
+        else if (c == '+') {
+            frag = makePlus(frag);
+        }
+        else if (c == '?') {
+            frag = makeQuest(frag);
+        }
+        else {
+            break;
+        }
+        pos_m += 1;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool RegexParser_t::parseAtom(NfaFragment_t & frag)
+{
+    char c = peek();
+    pos_m += 1;
+
+    ByteSet_t bytes;
+    switch (c) {
+        case '(':
+            if (!parseAlt(frag)) {
+                return false;
+            }
+            if (isEnd() || peek() != ')') {
+                error_m = "missing ')' in regex: " + text_m;
+                return false;
+            }
+            pos_m += 1;
+            return true;
+        case '.':
+            bytes.invert();
+            break;
+        case '[':
+            if (!parseClass(bytes)) {
+                return false;
+            }
+            break;
+        case '\\':
+            if (isEnd()) {
+                error_m = "trailing '\\' in regex: " + text_m;
+                return false;
+            }
+            bytes.add((uint8_t) peek());
+            pos_m += 1;
+            break;
+        case '*':
+        case '+':
+        case '?':
+            error_m = "nothing to repeat in regex: " + text_m;
+            return false;
+        default:
+            bytes.add((uint8_t) c);
+            break;
+    }
+
+    frag = makeBytes(bytes);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool RegexParser_t::parseClass(ByteSet_t & bytes)
+{
+    bool isNegated = !isEnd() && peek() == '^';
+    if (isNegated) {
+        pos_m += 1;
+    }
+
+    // A ']' straight after the opening bracket is a literal.
+    bool isFirst = true;
+    while (!isEnd() && (isFirst || peek() != ']')) {
+        isFirst = false;
+
+        uint8_t low = (uint8_t) peek();
+        pos_m += 1;
+        if (low == '\\' && !isEnd()) {
+            low = (uint8_t) peek();
+            pos_m += 1;
+        }
+
+        uint8_t high = low;
+        if (pos_m + 1 < text_m.size() && peek() == '-' && text_m[pos_m + 1] != ']') {
+            high = (uint8_t) text_m[pos_m + 1];
+            pos_m += 2;
+            if (high == '\\' && !isEnd()) {
+                high = (uint8_t) peek();
+                pos_m += 1;
+            }
+        }
+
+        if (low > high) {
+            error_m = "invalid range in regex: " + text_m;
+            return false;
+        }
+        bytes.addRange(low, high);
+    }
+
+    if (isEnd()) {
+        error_m = "missing ']' in regex: " + text_m;
+        return false;
+    }
+    pos_m += 1;
+
+    if (isNegated) {
+        bytes.invert();
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// Translate a glob into an equivalent regular expression. The leading "any parent directories" and trailing "any children" parts of the glob's meaning are left out, since they are shared between all globs when the NFA is built.
+
+static std::string globToRegex(std::string const & glob)
+{
+    std::string g(glob);
+    while (g.size() > 1 && g[g.size() - 1] == '/') {
+        g.erase(g.size() - 1);
+    }
+
+    std::string re;
+    for (size_t i = 0; i < g.size(); ++i) {
+        char c = g[i];
+        switch (c) {
+            case '*':
+                if (i + 1 < g.size() && g[i + 1] == '*') {
+                    i += 1;
+                    if (i + 1 < g.size() && g[i + 1] == '/') {
+                        // "**/" may match no directories at all.
+                        i += 1;
+                        re += "(.*/)?";
+                    }
+                    else {
+                        re += ".*";
+                    }
+                }
+                else {
+                    re += "[^/]*";
+                }
+                break;
+            case '?':
+                re += "[^/]";
+                break;
+            case '[': {
+                size_t end = g.find(']', i + 2);
+                if (end == std::string::npos) {
+                    re += "\\[";
+                    break;
+                }
+                std::string cls = g.substr(i + 1, end - i - 1);
+                if (cls[0] == '!' || cls[0] == '^') {
+                    re += "[^/" + cls.substr(1) + "]";
+                }
+                else {
+                    re += "[" + cls + "]";
+                }
+                i = end;
+                break;
+            }
+            case '\\':
+                if (i + 1 < g.size()) {
+                    i += 1;
+                    re += '\\';
+                    re += g[i];
+                }
+                break;
+            default:
+                if (strchr(".+()|^$", c) != NULL) {
+                    re += '\\';
+                }
+                re += c;
+                break;
+        }
+    }
+
+    return re;
+}
+
+//-----------------------------------------------------------------------------
+// Add the epsilon closure of an NFA state to a set of states. Only the BYTES and MATCH states are kept, since those are all that matter for the DFA.
+
+static void addClosure(std::vector<NfaState_t> const & states, int state, std::vector<bool> & visited, std::vector<int> & set)
+{
+    if (state < 0 || visited[state]) {
+        return;
+    }
+    visited[state] = true;
+
+    NfaState_t const & s = states[state];
+    if (s.kind_m == NfaState_t::SPLIT) {
+        addClosure(states, s.out1_m, visited, set);
+        addClosure(states, s.out2_m, visited, set);
+    }
+    else {
+        set.push_back(state);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+PathFilter_t::PathFilter_t()
+    : hasIncludes_m(false)
+{}
+
+//-----------------------------------------------------------------------------
+
+bool PathFilter_t::compile(std::vector<PathPattern_t> const & patterns, std::string & error)
+{
+    std::vector<Dfa_t> dfas;
+    if (!patterns.empty() && !compileDfas(patterns, 0, patterns.size(), dfas, error)) {
+        return false;
+    }
+
+    bool hasIncludes = false;
+    for (std::vector<PathPattern_t>::const_iterator iter = patterns.begin(); iter != patterns.end(); ++iter) {
+        hasIncludes = hasIncludes || !iter->isExclude_m;
+    }
+
+    dfas_m.swap(dfas);
+    hasIncludes_m = hasIncludes;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool PathFilter_t::compileDfas(std::vector<PathPattern_t> const & patterns, size_t begin, size_t end, std::vector<Dfa_t> & dfas, std::string & error)
+{
+    dfas.push_back(Dfa_t());
+    CompileResult_t result = compileDfa(patterns, begin, end, dfas.back(), error);
+    if (result == COMPILE_OK) {
+        return true;
+    }
+    dfas.pop_back();
+
+    if (result == COMPILE_INVALID) {
+        return false;
+    }
+    if (end - begin == 1) {
+        error = "pattern is too complex: " + patterns[begin].text_m;
+        return false;
+    }
+
+    size_t middle = begin + (end - begin) / 2;
+    return compileDfas(patterns, begin, middle, dfas, error) && compileDfas(patterns, middle, end, dfas, error);
+}
+
+//-----------------------------------------------------------------------------
+
+PathFilter_t::CompileResult_t PathFilter_t::compileDfa(std::vector<PathPattern_t> const & patterns, size_t begin, size_t end, Dfa_t & dfa, std::string & error)
+{
+    // Build one NFA for the patterns. The parts that every pattern of a kind has in common are shared rather than repeated per pattern, which keeps the DFA small: the leading "any parent directories" of unrooted globs and ".*" of unanchored regexes, and the trailing "any children" of globs and ".*" of unanchored regexes, which end in a MATCH state for either include or exclude.
+    std::vector<NfaState_t> states;
+    RegexParser_t builder(states, std::string());
+
+    ByteSet_t anyByte;
+    anyByte.invert();
+    ByteSet_t slash;
+    slash.add('/');
+
+    int matchStates [2];
+    int globTails [2];
+    int regexTails [2];
+    for (int i = 0; i < 2; ++i) {
+        matchStates[i] = builder.makeMatch(i == 0 ? ACCEPT_INCLUDE : ACCEPT_EXCLUDE).start_m;
+
+        NfaFragment_t globTail = builder.makeQuest(builder.makeConcat(builder.makeBytes(slash), builder.makeStar(builder.makeBytes(anyByte))));
+        builder.patch(globTail, matchStates[i]);
+        globTails[i] = globTail.start_m;
+
+        NfaFragment_t regexTail = builder.makeStar(builder.makeBytes(anyByte));
+        builder.patch(regexTail, matchStates[i]);
+        regexTails[i] = regexTail.start_m;
+    }
+
+    // The pattern bodies are grouped by which shared prefix leads to them.
+    enum { ROOTED, GLOB_PREFIXED, REGEX_PREFIXED, NUM_GROUPS };
+    int groups [NUM_GROUPS] = { -1, -1, -1 };
+    for (std::vector<PathPattern_t>::const_iterator iter = patterns.begin() + begin; iter != patterns.begin() + end; ++iter) {
+        std::string re = iter->isRegex_m ? iter->text_m : globToRegex(iter->text_m);
+
+        RegexParser_t parser(states, re);
+        NfaFragment_t frag;
+        bool isStartAnchored = false;
+        bool isEndAnchored = false;
+        if (!parser.parse(frag, isStartAnchored, isEndAnchored, error)) {
+            return COMPILE_INVALID;
+        }
+
+        int kind = iter->isExclude_m ? 1 : 0;
+        int group = 0;
+        if (iter->isRegex_m) {
+            parser.patch(frag, isEndAnchored ? matchStates[kind] : regexTails[kind]);
+            group = isStartAnchored ? ROOTED : REGEX_PREFIXED;
+        }
+        else {
+            parser.patch(frag, globTails[kind]);
+            group = (!iter->text_m.empty() && iter->text_m[0] == '/') ? ROOTED : GLOB_PREFIXED;
+        }
+
+        if (groups[group] < 0) {
+            groups[group] = frag.start_m;
+        }
+        else {
+            NfaFragment_t prev;
+            prev.start_m = groups[group];
+            groups[group] = parser.makeAlt(prev, frag).start_m;
+        }
+    }
+
+    // Join the groups behind their prefixes: nothing for rooted patterns, "(.*/)?" for unrooted globs, and ".*" for unanchored regexes.
+    std::vector<int> starts;
+    if (groups[ROOTED] >= 0) {
+        starts.push_back(groups[ROOTED]);
+    }
+    if (groups[GLOB_PREFIXED] >= 0) {
+        NfaFragment_t prefix = builder.makeQuest(builder.makeConcat(builder.makeStar(builder.makeBytes(anyByte)), builder.makeBytes(slash)));
+        builder.patch(prefix, groups[GLOB_PREFIXED]);
+        starts.push_back(prefix.start_m);
+    }
+    if (groups[REGEX_PREFIXED] >= 0) {
+        NfaFragment_t prefix = builder.makeStar(builder.makeBytes(anyByte));
+        builder.patch(prefix, groups[REGEX_PREFIXED]);
+        starts.push_back(prefix.start_m);
+    }
+
+    NfaFragment_t all;
+    all.start_m = starts[0];
+    for (size_t i = 1; i < starts.size(); ++i) {
+        NfaFragment_t frag;
+        frag.start_m = starts[i];
+        all = builder.makeAlt(all, frag);
+    }
+    int start = all.start_m;
+
+    // Partition the byte values into classes that no BYTES state can tell apart, so the DFA only needs one transition per class.
+    uint8_t byteClasses [256];
+    std::map<std::vector<bool>, uint8_t> classIds;
+    std::vector<uint8_t> classReps;
+    for (int c = 0; c < 256; ++c) {
+        std::vector<bool> signature;
+        for (size_t i = 0; i < states.size(); ++i) {
+            if (states[i].kind_m == NfaState_t::BYTES) {
+                signature.push_back(states[i].bytes_m.has((uint8_t) c));
+            }
+        }
+        std::map<std::vector<bool>, uint8_t>::iterator iter = classIds.find(signature);
+        if (iter == classIds.end()) {
+            iter = classIds.insert(std::make_pair(signature, (uint8_t) classReps.size())).first;
+            classReps.push_back((uint8_t) c);
+        }
+        byteClasses[c] = iter->second;
+    }
+    size_t numClasses = classReps.size();
+
+    // Convert the NFA to a DFA by subset construction.
+    std::map<std::vector<int>, size_t> dfaIds;
+    std::vector<std::vector<int> > dfaSets;
+    std::vector<uint16_t> transitions;
+    std::vector<uint8_t> accept;
+
+    std::vector<int> set;
+    std::vector<bool> visited(states.size(), false);
+    addClosure(states, start, visited, set);
+    std::sort(set.begin(), set.end());
+    dfaIds[set] = 0;
+    dfaSets.push_back(set);
+
+    for (size_t d = 0; d < dfaSets.size(); ++d) {
+        uint8_t stateAccept = 0;
+        for (size_t i = 0; i < dfaSets[d].size(); ++i) {
+            stateAccept |= states[dfaSets[d][i]].accept_m;
+        }
+        accept.push_back(stateAccept);
+
+        for (size_t k = 0; k < numClasses; ++k) {
+            set.clear();
+            visited.assign(states.size(), false);
+            for (size_t i = 0; i < dfaSets[d].size(); ++i) {
+                NfaState_t const & s = states[dfaSets[d][i]];
+                if (s.kind_m == NfaState_t::BYTES && s.bytes_m.has(classReps[k])) {
+                    addClosure(states, s.out1_m, visited, set);
+                }
+            }
+            std::sort(set.begin(), set.end());
+
+            std::map<std::vector<int>, size_t>::iterator iter = dfaIds.find(set);
+            if (iter == dfaIds.end()) {
+                if (dfaSets.size() >= MAX_STATES) {
+                    return COMPILE_TOO_COMPLEX;
+                }
+                iter = dfaIds.insert(std::make_pair(set, dfaSets.size())).first;
+                dfaSets.push_back(set);
+            }
+            transitions.push_back((uint16_t) iter->second);
+        }
+    }
+
+    memcpy(dfa.byteClasses_am, byteClasses, sizeof(dfa.byteClasses_am));
+    dfa.numClasses_m = numClasses;
+    dfa.transitions_m.swap(transitions);
+    dfa.accept_m.swap(accept);
+    return COMPILE_OK;
+}
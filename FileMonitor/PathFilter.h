@@ -0,0 +1,150 @@
+#ifndef __INC_PathFilter_H
+#define __INC_PathFilter_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// An include or exclude pattern, either a glob or a regular expression.
+//
+// Globs match whole path components: '*' matches within a component, '**' matches across components, '?' matches a single character other than '/', and '[...]' matches a character class. A glob starting with '/' is anchored at the root, otherwise it may match starting at any component. A glob matches a path if it matches the path itself or any of its parent directories, so "*.o" matches "/a/b.o" and ".git" matches "/a/.git/index".
+//
+// Regular expressions support literals, '.', '[...]', '*', '+', '?', '|' and '(...)', with '\' escapes. They match anywhere in the path unless anchored with a leading '^' or trailing '$'.
+struct PathPattern_t
+{
+    std::string text_m;
+    bool isExclude_m;
+    bool isRegex_m;
+
+    PathPattern_t(std::string const & text, bool isExclude, bool isRegex)
+        : text_m(text),
+          isExclude_m(isExclude),
+          isRegex_m(isRegex)
+    {}
+
+    bool operator<(PathPattern_t const & other) const
+    {
+        if (isExclude_m != other.isExclude_m) {
+            return isExclude_m < other.isExclude_m;
+        }
+        if (isRegex_m != other.isRegex_m) {
+            return isRegex_m < other.isRegex_m;
+        }
+        return text_m < other.text_m;
+    }
+};
+
+// This class compiles a set of include and exclude patterns into a DFA over the bytes of a path. Testing a path walks the DFA once, so the cost is proportional to the path length regardless of the number of patterns. A path passes the filter if it matches no exclude pattern, and either there are no include patterns or it matches at least one of them.
+//
+// Some pattern sets blow up when combined, such as many patterns of the form "*a*b*", since the DFA has to track every partial match of every pattern at once. If the combined DFA would have more than MAX_STATES states, the patterns are split in halves, recursively, until each part compiles on its own, and a path is tested against every part. Only a single pattern that is too complex by itself is rejected.
+class PathFilter_t
+{
+private:
+
+    enum
+    {
+        ACCEPT_INCLUDE = 0x01,
+        ACCEPT_EXCLUDE = 0x02
+    };
+
+    // A DFA for some of the patterns. It has numClasses_m transitions per state, indexed by the byte class of each input byte. State 0 is the start state.
+    struct Dfa_t
+    {
+        uint8_t byteClasses_am [256];
+        size_t numClasses_m;
+        std::vector<uint16_t> transitions_m;
+        std::vector<uint8_t> accept_m;
+
+        // Returns the ACCEPT_* bits of the state that a path leads to.
+        uint8_t run(char const * path, size_t pathLen) const
+        {
+            size_t state = 0;
+            for (size_t i = 0; i < pathLen; ++i) {
+                state = transitions_m[state * numClasses_m + byteClasses_am[(uint8_t) path[i]]];
+            }
+            return accept_m[state];
+        }
+    };
+
+    // The result of compiling some patterns into a single DFA.
+    enum CompileResult_t
+    {
+        COMPILE_OK,
+        COMPILE_INVALID,
+        COMPILE_TOO_COMPLEX
+    };
+
+    std::vector<Dfa_t> dfas_m;
+    bool hasIncludes_m;
+
+    // Compiles patterns [begin, end) into a single DFA.
+    static CompileResult_t compileDfa(std::vector<PathPattern_t> const & patterns, size_t begin, size_t end, Dfa_t & dfa, std::string & error);
+
+    // Compiles patterns [begin, end) into as few DFAs as splitting them in halves allows, appending them to a vector.
+    static bool compileDfas(std::vector<PathPattern_t> const & patterns, size_t begin, size_t end, std::vector<Dfa_t> & dfas, std::string & error);
+
+public:
+
+    // The maximum number of states of each DFA.
+    enum { MAX_STATES = 8192 };
+
+    // Constructor. An empty filter passes every path.
+    PathFilter_t();
+
+    // Compiles a set of patterns, replacing the current filter. Returns false and sets an error message if a pattern is invalid or too complex by itself, in which case the filter is left unchanged.
+    bool compile(std::vector<PathPattern_t> const & patterns, std::string & error);
+
+    // Returns true if the filter has no patterns.
+    bool isEmpty() const { return dfas_m.empty(); }
+
+    // Returns the number of DFAs that the patterns were split into.
+    size_t getNumDfas() const { return dfas_m.size(); }
+
+    // Returns the total number of DFA states.
+    size_t getNumStates() const
+    {
+        size_t numStates = 0;
+        for (size_t i = 0; i < dfas_m.size(); ++i) {
+            numStates += dfas_m[i].accept_m.size();
+        }
+        return numStates;
+    }
+
+    // Does a path pass the filter? The path need not be NUL terminated.
+    bool isPassed(char const * path, size_t pathLen) const
+    {
+        if (dfas_m.empty()) {
+            return true;
+        }
+
+        uint8_t accept = 0;
+        for (size_t i = 0; i < dfas_m.size(); ++i) {
+            accept |= dfas_m[i].run(path, pathLen);
+            if (accept & ACCEPT_EXCLUDE) {
+                return false;
+            }
+        }
+        return !hasIncludes_m || (accept & ACCEPT_INCLUDE) != 0;
+    }
+};
+
+#endif // __INC_PathFilter_H
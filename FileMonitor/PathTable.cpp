@@ -0,0 +1,236 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "AllocCounter.h"
+#include "FlatHashSet.h"
+#include "PathTable.h"
+
+//-----------------------------------------------------------------------------
+
+uint32_t const PathTable_t::NO_ENTRY;
+uint32_t const PathTable_t::ENTRY_BITS;
+uint32_t const PathTable_t::ENTRY_MASK;
+PathId_t const PathTable_t::NO_PATH;
+
+//-----------------------------------------------------------------------------
+
+PathTable_t::PathTable_t(size_t maxBytes)
+    : maxBytes_m(maxBytes),
+      epoch_m(0),
+      indexMask_m(0),
+      numLive_m(0),
+      liveBytes_m(0)
+{
+    rebuildIndex();
+}
+
+//-----------------------------------------------------------------------------
+
+PathId_t PathTable_t::intern(char const * path, size_t len)
+{
+    uint32_t hash = hashPath(path, len);
+    size_t slot = findSlot(path, len, hash);
+    if (index_m[slot] != NO_ENTRY) {
+        Entry_t & entry = entries_m[index_m[slot]];
+        entry.lastEpoch_m = epoch_m;
+        return makeId(index_m[slot]);
+    }
+
+    if (liveBytes_m + len + sizeof(Entry_t) > maxBytes_m || arena_m.size() + len > 0xffffffffu) {
+        return NO_PATH;
+    }
+
+    // Learning a new path allocates by design.
+    AllocExempt_t allocExempt;
+
+    uint32_t entryNum;
+    if (!free_m.empty()) {
+        entryNum = free_m.back();
+        free_m.pop_back();
+        entries_m[entryNum].generation_m += 1;
+    }
+    else if (entries_m.size() < ENTRY_MASK) {
+        entryNum = entries_m.size();
+        entries_m.push_back(Entry_t());
+        entries_m[entryNum].generation_m = 0;
+    }
+    else {
+        return NO_PATH;
+    }
+
+    Entry_t & entry = entries_m[entryNum];
+    entry.offset_m = arena_m.size();
+    entry.len_m = len;
+    entry.hash_m = hash;
+    entry.lastEpoch_m = epoch_m;
+    entry.isLive_m = true;
+    arena_m.insert(arena_m.end(), path, path + len);
+
+    numLive_m += 1;
+    liveBytes_m += len + sizeof(Entry_t);
+
+    // Keep the index at most half full.
+    if (numLive_m * 2 > index_m.size()) {
+        rebuildIndex();
+    }
+    else {
+        index_m[slot] = entryNum;
+    }
+
+    return makeId(entryNum);
+}
+
+//-----------------------------------------------------------------------------
+
+PathId_t PathTable_t::find(char const * path, size_t len) const
+{
+    size_t slot = findSlot(path, len, hashPath(path, len));
+    if (index_m[slot] == NO_ENTRY) {
+        return NO_PATH;
+    }
+    return makeId(index_m[slot]);
+}
+
+//-----------------------------------------------------------------------------
+
+char const * PathTable_t::getPath(PathId_t id, size_t & len) const
+{
+    uint32_t entryNum = id & ENTRY_MASK;
+    if (id == NO_PATH || entryNum >= entries_m.size()) {
+        return NULL;
+    }
+
+    Entry_t const & entry = entries_m[entryNum];
+    if (!entry.isLive_m || entry.generation_m != (uint8_t) (id >> ENTRY_BITS)) {
+        return NULL;
+    }
+
+    len = entry.len_m;
+    return getBytes(entry);
+}
+
+//-----------------------------------------------------------------------------
+
+size_t PathTable_t::evict(uint32_t oldestEpoch)
+{
+    size_t numEvicted = 0;
+    for (uint32_t i = 0; i < entries_m.size(); ++i) {
+        Entry_t & entry = entries_m[i];
+        if (entry.isLive_m && (int32_t) (entry.lastEpoch_m - oldestEpoch) < 0) {
+            entry.isLive_m = false;
+            free_m.push_back(i);
+            numLive_m -= 1;
+            liveBytes_m -= entry.len_m + sizeof(Entry_t);
+            numEvicted += 1;
+        }
+    }
+
+    if (numEvicted > 0) {
+        // The arena is compacted once less than half of it is live paths, so its size stays within twice the live bytes.
+        size_t liveArenaBytes = liveBytes_m - numLive_m * sizeof(Entry_t);
+        if (arena_m.size() > 2 * liveArenaBytes) {
+            compact();
+        }
+        rebuildIndex();
+    }
+
+    return numEvicted;
+}
+
+//-----------------------------------------------------------------------------
+
+size_t PathTable_t::findSlot(char const * path, size_t len, uint32_t hash) const
+{
+    for (size_t slot = hash & indexMask_m; ; slot = (slot + 1) & indexMask_m) {
+        uint32_t entryNum = index_m[slot];
+        if (entryNum == NO_ENTRY) {
+            return slot;
+        }
+        Entry_t const & entry = entries_m[entryNum];
+        if (entry.hash_m == hash && entry.len_m == len && memcmp(getBytes(entry), path, len) == 0) {
+            return slot;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void PathTable_t::rebuildIndex()
+{
+    size_t size = 64;
+    while (size < numLive_m * 4) {
+        size *= 2;
+    }
+
+    index_m.assign(size, NO_ENTRY);
+    indexMask_m = size - 1;
+
+    for (uint32_t i = 0; i < entries_m.size(); ++i) {
+        Entry_t const & entry = entries_m[i];
+        if (entry.isLive_m) {
+            size_t slot = entry.hash_m & indexMask_m;
+            while (index_m[slot] != NO_ENTRY) {
+                slot = (slot + 1) & indexMask_m;
+            }
+            index_m[slot] = i;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void PathTable_t::compact()
+{
+    std::vector<char> arena;
+    arena.reserve(liveBytes_m - numLive_m * sizeof(Entry_t));
+
+    for (size_t i = 0; i < entries_m.size(); ++i) {
+        Entry_t & entry = entries_m[i];
+        if (entry.isLive_m) {
+            char const * path = getBytes(entry);
+            entry.offset_m = arena.size();
+            arena.insert(arena.end(), path, path + entry.len_m);
+        }
+    }
+
+    arena_m.swap(arena);
+}
+
+//-----------------------------------------------------------------------------
+
+PathId_t PathTable_t::makeId(uint32_t entryNum) const
+{
+    return ((uint32_t) entries_m[entryNum].generation_m << ENTRY_BITS) | entryNum;
+}
+
+//-----------------------------------------------------------------------------
+
+char const * PathTable_t::getBytes(Entry_t const & entry) const
+{
+    // An empty path may be interned while the arena is still empty.
+    return arena_m.empty() ? "" : &arena_m[0] + entry.offset_m;
+}
+
+//-----------------------------------------------------------------------------
+
+uint32_t PathTable_t::hashPath(char const * path, size_t len)
+{
+    uint64_t hash = StrHashTraits_t::hash(StrRef_t(path, len));
+    return (uint32_t) (hash ^ (hash >> 32));
+}
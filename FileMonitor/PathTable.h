@@ -0,0 +1,119 @@
+#ifndef __INC_PathTable_H
+#define __INC_PathTable_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <vector>
+
+// A compact id for an interned path.
+typedef uint32_t PathId_t;
+
+// This class interns paths, giving each distinct path a small integer id, so that summaries, caches and indexes can hold four byte ids instead of copies of the paths. The path bytes are kept end to end in a bump arena, and looked up through an open addressing index of entry numbers.
+//
+// Memory is bounded by the eviction policy. Time is divided into epochs by the caller, and each path records the last epoch in which it was interned. The caller evicts the paths not used since some epoch, once it no longer holds their ids, and the arena is compacted when evicted paths make up most of it. An id stays the same for as long as its path stays interned; the id of an evicted path is reused with a new generation, so stale ids can be told apart from live ones, unless the entry has been reused 256 times since. If the table reaches its size limit with paths that are all still in use, new paths aren't interned.
+class PathTable_t
+{
+private:
+
+    struct Entry_t
+    {
+        uint32_t offset_m;
+        uint32_t len_m;
+        uint32_t hash_m;
+        uint32_t lastEpoch_m;
+        uint8_t generation_m;
+        bool isLive_m;
+    };
+
+    static uint32_t const NO_ENTRY = 0xffffffff;
+
+    // The id bits that hold the entry number; the rest hold its generation.
+    static uint32_t const ENTRY_BITS = 24;
+    static uint32_t const ENTRY_MASK = (1u << ENTRY_BITS) - 1;
+
+    size_t maxBytes_m;
+    uint32_t epoch_m;
+    std::vector<char> arena_m;
+    std::vector<Entry_t> entries_m;
+    std::vector<uint32_t> free_m;
+    std::vector<uint32_t> index_m;
+    size_t indexMask_m;
+    size_t numLive_m;
+    size_t liveBytes_m;
+
+public:
+
+    // An id that no path has.
+    static PathId_t const NO_PATH = 0xffffffff;
+
+    // Constructor. The size limit covers the live path bytes and the per path overhead.
+    PathTable_t(size_t maxBytes);
+
+    // Returns the id of a path, interning it if need be, and marks it as used in the current epoch. The path need not be NUL terminated. Returns NO_PATH if the table is full.
+    PathId_t intern(char const * path, size_t len);
+
+    // Returns the id of a path if it is interned, otherwise NO_PATH. Doesn't mark it as used.
+    PathId_t find(char const * path, size_t len) const;
+
+    // Returns the path of an id, which is not NUL terminated, or NULL if the id is stale. The path is valid until the next call that interns or evicts.
+    char const * getPath(PathId_t id, size_t & len) const;
+
+    // Returns the current epoch.
+    uint32_t getEpoch() const { return epoch_m; }
+
+    // Starts a new epoch.
+    void advanceEpoch() { epoch_m += 1; }
+
+    // Evicts the paths not used in an epoch at or after the oldest one given, compacting the arena if it is mostly garbage. Returns the number of paths evicted.
+    size_t evict(uint32_t oldestEpoch);
+
+    // Returns the number of interned paths.
+    size_t getNumPaths() const { return numLive_m; }
+
+    // Returns the number of bytes counted against the size limit.
+    size_t getNumBytes() const { return liveBytes_m; }
+
+private:
+
+    // Returns the index slot that holds an entry for a path, or the empty slot where it would go.
+    size_t findSlot(char const * path, size_t len, uint32_t hash) const;
+
+    // Rebuilds the index from the live entries, sizing it for their number.
+    void rebuildIndex();
+
+    // Moves the live paths to the start of a new arena.
+    void compact();
+
+    // Returns the id of an entry, including its generation.
+    PathId_t makeId(uint32_t entryNum) const;
+
+    // Returns the bytes of an entry's path.
+    char const * getBytes(Entry_t const & entry) const;
+
+    // Returns the 32 bit hash of a path.
+    static uint32_t hashPath(char const * path, size_t len);
+
+    // Not copyable.
+    PathTable_t(PathTable_t const &);
+    PathTable_t & operator=(PathTable_t const &);
+};
+
+#endif // __INC_PathTable_H
@@ -0,0 +1,452 @@
+#ifndef __INC_PathTree_H
+#define __INC_PathTree_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "FlatHashSet.h"
+#include "JournalFormat.h"
+
+// This class is a compact in-memory tree of files and directories, one node per path component, with a value of type Value_t on every node. Child nodes are found through a single open addressing index keyed by the parent node and the name, and names are kept in one arena, as in the rollup tree. Value_t must be a plain struct; new nodes start with it zeroed.
+//
+// Because a node is keyed only by its parent and its own name, moving a directory re-links that one node under its new parent; its whole subtree moves with it without being touched.
+template <typename Value_t>
+class PathTree_t
+{
+private:
+
+    struct Node_t
+    {
+        uint32_t parent_m;
+        uint32_t firstChild_m;
+        uint32_t nextSibling_m;
+        uint32_t prevSibling_m;
+        uint32_t nameOffset_m;
+        uint32_t nameLen_m;
+        uint64_t hash_m;
+        Value_t value_m;
+    };
+
+    // Orders nodes by name.
+    struct NameLess_t
+    {
+        PathTree_t const & tree_m;
+
+        NameLess_t(PathTree_t const & tree)
+            : tree_m(tree)
+        {}
+
+        bool operator()(uint32_t a, uint32_t b) const
+        {
+            size_t aLen;
+            size_t bLen;
+            char const * aName = tree_m.getName(a, aLen);
+            char const * bName = tree_m.getName(b, bLen);
+            int cmp = memcmp(aName, bName, std::min(aLen, bLen));
+            return cmp != 0 ? cmp < 0 : aLen < bLen;
+        }
+    };
+
+    std::vector<Node_t> nodes_m;
+    std::vector<uint32_t> free_m;
+    std::vector<char> names_m;
+    size_t liveNameBytes_m;
+    std::vector<uint32_t> index_m;
+    size_t indexMask_m;
+    size_t numIndexed_m;
+
+public:
+
+    static uint32_t const NO_NODE = 0xffffffff;
+
+    // The root directory's node.
+    static uint32_t const ROOT_NODE = 0;
+
+    // Constructor.
+    PathTree_t()
+        : liveNameBytes_m(0),
+          indexMask_m(0),
+          numIndexed_m(0)
+    {
+        // The root node, which has no name and is never in the index.
+        Node_t root;
+        memset(&root, 0, sizeof(root));
+        root.parent_m = NO_NODE;
+        root.firstChild_m = NO_NODE;
+        root.nextSibling_m = NO_NODE;
+        root.prevSibling_m = NO_NODE;
+        nodes_m.push_back(root);
+
+        rebuildIndex(256);
+    }
+
+    // Returns the node for a path, or NO_NODE if it isn't in the tree. The path need not be NUL terminated.
+    uint32_t find(char const * path, size_t len) const
+    {
+        uint32_t node = ROOT_NODE;
+        size_t pos = 0;
+        for (size_t nameLen; node != NO_NODE && (nameLen = getNextComponent(path, len, pos)) > 0; pos += nameLen) {
+            node = findChild(node, path + pos, nameLen);
+        }
+        return node;
+    }
+
+    // Returns the node for a path, adding it and any missing directories above it with zeroed values.
+    uint32_t findOrAdd(char const * path, size_t len)
+    {
+        uint32_t node = ROOT_NODE;
+        size_t pos = 0;
+        for (size_t nameLen; (nameLen = getNextComponent(path, len, pos)) > 0; pos += nameLen) {
+            uint32_t child = findChild(node, path + pos, nameLen);
+            node = child != NO_NODE ? child : addChild(node, path + pos, nameLen);
+        }
+        return node;
+    }
+
+    // Removes a node and its whole subtree. The root can't be removed.
+    void remove(uint32_t node)
+    {
+        if (node == ROOT_NODE) {
+            return;
+        }
+
+        unlink(node);
+        freeSubtree(node);
+    }
+
+    // Removes a node's whole subtree, but not the node itself.
+    void removeChildren(uint32_t node)
+    {
+        uint32_t child = nodes_m[node].firstChild_m;
+        nodes_m[node].firstChild_m = NO_NODE;
+        while (child != NO_NODE) {
+            uint32_t next = nodes_m[child].nextSibling_m;
+            eraseFromIndex(child);
+            freeSubtree(child);
+            child = next;
+        }
+    }
+
+    // Moves a node, with its subtree, to a new path, replacing anything already there. The new parent directory is added if need be. The cost doesn't depend on the size of the subtree.
+    void move(uint32_t node, char const * path, size_t len)
+    {
+        if (node == ROOT_NODE) {
+            return;
+        }
+
+        size_t dirLen = getParentDirLen(path, len);
+        size_t namePos = dirLen;
+        size_t nameLen = getNextComponent(path, len, namePos);
+        if (nameLen == 0) {
+            return;
+        }
+
+        // A directory can't be moved under itself; if the tree says otherwise it is out of date, so the node is dropped.
+        uint32_t parent = findOrAdd(path, dirLen);
+        for (uint32_t n = parent; n != NO_NODE; n = nodes_m[n].parent_m) {
+            if (n == node) {
+                remove(node);
+                return;
+            }
+        }
+
+        if (parent == nodes_m[node].parent_m && findChild(parent, path + namePos, nameLen) == node) {
+            return;
+        }
+
+        // Whatever is at the new path is replaced. The node is unlinked first, so that it can't be removed with it.
+        unlink(node);
+        uint32_t existing = findChild(parent, path + namePos, nameLen);
+        if (existing != NO_NODE) {
+            remove(existing);
+        }
+
+        nodes_m[node].parent_m = parent;
+        setName(node, path + namePos, nameLen);
+        link(node);
+    }
+
+    // Returns a node's value.
+    Value_t const & getValue(uint32_t node) const { return nodes_m[node].value_m; }
+
+    // Sets a node's value.
+    void setValue(uint32_t node, Value_t const & value) { nodes_m[node].value_m = value; }
+
+    // Returns a node's parent, or NO_NODE for the root.
+    uint32_t getParent(uint32_t node) const { return nodes_m[node].parent_m; }
+
+    // Returns a node's first child, or NO_NODE. The children are in no particular order.
+    uint32_t getFirstChild(uint32_t node) const { return nodes_m[node].firstChild_m; }
+
+    // Returns a node's next sibling, or NO_NODE.
+    uint32_t getNextSibling(uint32_t node) const { return nodes_m[node].nextSibling_m; }
+
+    // Gets the path of a node.
+    void getPath(uint32_t node, std::string & path) const
+    {
+        path.clear();
+        if (node == ROOT_NODE) {
+            path = "/";
+            return;
+        }
+
+        std::vector<uint32_t> chain;
+        for (uint32_t n = node; n != ROOT_NODE; n = nodes_m[n].parent_m) {
+            chain.push_back(n);
+        }
+        for (size_t i = chain.size(); i > 0; --i) {
+            Node_t const & n = nodes_m[chain[i - 1]];
+            path += '/';
+            path.append(&names_m[n.nameOffset_m], n.nameLen_m);
+        }
+    }
+
+    // Gets the children of a node, in name order.
+    void getChildren(uint32_t node, std::vector<uint32_t> & children) const
+    {
+        children.clear();
+        for (uint32_t child = nodes_m[node].firstChild_m; child != NO_NODE; child = nodes_m[child].nextSibling_m) {
+            children.push_back(child);
+        }
+        std::sort(children.begin(), children.end(), NameLess_t(*this));
+    }
+
+    // Returns the name of a node, which is not NUL terminated.
+    char const * getName(uint32_t node, size_t & len) const
+    {
+        Node_t const & n = nodes_m[node];
+        len = n.nameLen_m;
+        return len > 0 ? &names_m[n.nameOffset_m] : "";
+    }
+
+    // Returns the number of nodes, including the root.
+    size_t getNumNodes() const { return nodes_m.size() - free_m.size(); }
+
+private:
+
+    // Gets the length of a path's next component, skipping any slashes before it. Returns 0 at the end of the path.
+    static size_t getNextComponent(char const * path, size_t len, size_t & pos)
+    {
+        while (pos < len && path[pos] == '/') {
+            ++pos;
+        }
+        size_t end = pos;
+        while (end < len && path[end] != '/') {
+            ++end;
+        }
+        return end - pos;
+    }
+
+    // Hashes a child's name together with its parent node.
+    static uint64_t hashChild(uint32_t parent, char const * name, size_t len)
+    {
+        return StrHashTraits_t::hash(StrRef_t(name, len)) ^ IntHashTraits_t::hash(parent);
+    }
+
+    // Returns the child of a node with a name, or NO_NODE.
+    uint32_t findChild(uint32_t parent, char const * name, size_t len) const
+    {
+        uint64_t hash = hashChild(parent, name, len);
+        for (size_t slot = hash & indexMask_m; index_m[slot] != NO_NODE; slot = (slot + 1) & indexMask_m) {
+            Node_t const & n = nodes_m[index_m[slot]];
+            if (n.hash_m == hash && n.parent_m == parent && n.nameLen_m == len && memcmp(&names_m[n.nameOffset_m], name, len) == 0) {
+                return index_m[slot];
+            }
+        }
+        return NO_NODE;
+    }
+
+    // Adds a child node with a name and a zeroed value.
+    uint32_t addChild(uint32_t parent, char const * name, size_t len)
+    {
+        uint32_t node;
+        if (!free_m.empty()) {
+            node = free_m.back();
+            free_m.pop_back();
+        }
+        else {
+            node = (uint32_t) nodes_m.size();
+            nodes_m.push_back(Node_t());
+        }
+
+        Node_t & n = nodes_m[node];
+        n.parent_m = parent;
+        n.firstChild_m = NO_NODE;
+        memset(&n.value_m, 0, sizeof(n.value_m));
+        n.nameLen_m = 0;
+        setName(node, name, len);
+        link(node);
+        return node;
+    }
+
+    // Frees a node that has been unlinked from its parent, together with its descendants.
+    void freeSubtree(uint32_t node)
+    {
+        // The descendants are only in the index; their sibling links die with them.
+        std::vector<uint32_t> stack(1, node);
+        while (!stack.empty()) {
+            uint32_t n = stack.back();
+            stack.pop_back();
+            for (uint32_t child = nodes_m[n].firstChild_m; child != NO_NODE; child = nodes_m[child].nextSibling_m) {
+                eraseFromIndex(child);
+                stack.push_back(child);
+            }
+
+            liveNameBytes_m -= nodes_m[n].nameLen_m;
+            nodes_m[n].parent_m = NO_NODE;
+            free_m.push_back(n);
+        }
+    }
+
+    // Links a node into its parent's child list and the index, under its current parent and name.
+    void link(uint32_t node)
+    {
+        Node_t & n = nodes_m[node];
+        Node_t & p = nodes_m[n.parent_m];
+        n.hash_m = hashChild(n.parent_m, &names_m[n.nameOffset_m], n.nameLen_m);
+        n.prevSibling_m = NO_NODE;
+        n.nextSibling_m = p.firstChild_m;
+        if (p.firstChild_m != NO_NODE) {
+            nodes_m[p.firstChild_m].prevSibling_m = node;
+        }
+        p.firstChild_m = node;
+
+        // Keep the index at most half full, so that probe sequences stay short.
+        numIndexed_m += 1;
+        if (numIndexed_m * 2 > index_m.size()) {
+            rebuildIndex(index_m.size() * 2);
+        }
+        else {
+            size_t slot = n.hash_m & indexMask_m;
+            while (index_m[slot] != NO_NODE) {
+                slot = (slot + 1) & indexMask_m;
+            }
+            index_m[slot] = node;
+        }
+    }
+
+    // Unlinks a node from its parent's child list and the index.
+    void unlink(uint32_t node)
+    {
+        Node_t & n = nodes_m[node];
+        if (n.prevSibling_m != NO_NODE) {
+            nodes_m[n.prevSibling_m].nextSibling_m = n.nextSibling_m;
+        }
+        else {
+            nodes_m[n.parent_m].firstChild_m = n.nextSibling_m;
+        }
+        if (n.nextSibling_m != NO_NODE) {
+            nodes_m[n.nextSibling_m].prevSibling_m = n.prevSibling_m;
+        }
+
+        eraseFromIndex(node);
+    }
+
+    // Removes a node from the index.
+    void eraseFromIndex(uint32_t node)
+    {
+        size_t slot = nodes_m[node].hash_m & indexMask_m;
+        while (index_m[slot] != node) {
+            slot = (slot + 1) & indexMask_m;
+        }
+
+        // Linear probing can't leave holes in a probe sequence, so shift back any later entries of the cluster that the hole would cut off from their home slot.
+        size_t hole = slot;
+        for (size_t next = (hole + 1) & indexMask_m; index_m[next] != NO_NODE; next = (next + 1) & indexMask_m) {
+            size_t home = nodes_m[index_m[next]].hash_m & indexMask_m;
+            bool isReachable = hole <= next ? (hole < home && home <= next) : (hole < home || home <= next);
+            if (!isReachable) {
+                index_m[hole] = index_m[next];
+                hole = next;
+            }
+        }
+        index_m[hole] = NO_NODE;
+        numIndexed_m -= 1;
+    }
+
+    // Sets a node's name, appending it to the name arena.
+    void setName(uint32_t node, char const * name, size_t len)
+    {
+        // The old name becomes garbage. The arena is compacted once it is mostly garbage.
+        liveNameBytes_m -= nodes_m[node].nameLen_m;
+        nodes_m[node].nameLen_m = 0;
+        size_t garbage = names_m.size() - liveNameBytes_m;
+        if (garbage > 64 * 1024 && garbage > liveNameBytes_m) {
+            compactNames();
+        }
+
+        nodes_m[node].nameOffset_m = (uint32_t) names_m.size();
+        nodes_m[node].nameLen_m = (uint32_t) len;
+        names_m.insert(names_m.end(), name, name + len);
+        liveNameBytes_m += len;
+    }
+
+    // Moves the live names to the start of a new arena.
+    void compactNames()
+    {
+        std::vector<char> names;
+        names.reserve(liveNameBytes_m);
+
+        for (size_t i = 0; i < nodes_m.size(); ++i) {
+            Node_t & n = nodes_m[i];
+            if ((n.parent_m != NO_NODE || i == ROOT_NODE) && n.nameLen_m > 0) {
+                uint32_t offset = (uint32_t) names.size();
+                names.insert(names.end(), &names_m[n.nameOffset_m], &names_m[n.nameOffset_m] + n.nameLen_m);
+                n.nameOffset_m = offset;
+            }
+        }
+
+        names_m.swap(names);
+    }
+
+    // Resizes the index and reinserts the linked nodes.
+    void rebuildIndex(size_t size)
+    {
+        index_m.assign(size, NO_NODE);
+        indexMask_m = size - 1;
+
+        for (uint32_t node = 1; node < nodes_m.size(); ++node) {
+            if (nodes_m[node].parent_m != NO_NODE) {
+                size_t slot = nodes_m[node].hash_m & indexMask_m;
+                while (index_m[slot] != NO_NODE) {
+                    slot = (slot + 1) & indexMask_m;
+                }
+                index_m[slot] = node;
+            }
+        }
+    }
+
+    // Not copyable.
+    PathTree_t(PathTree_t const &);
+    PathTree_t & operator=(PathTree_t const &);
+};
+
+template <typename Value_t>
+uint32_t const PathTree_t<Value_t>::NO_NODE;
+
+template <typename Value_t>
+uint32_t const PathTree_t<Value_t>::ROOT_NODE;
+
+#endif // __INC_PathTree_H
@@ -0,0 +1,94 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+
+#include "FlatHashSet.h"
+#include "PrefixIndex.h"
+
+int32_t const PrefixIndex_t::NO_ENTRY;
+
+//-----------------------------------------------------------------------------
+
+PrefixIndex_t::PrefixIndex_t()
+    : table_m(16, NO_ENTRY),
+      tableMask_m(15)
+{}
+
+//-----------------------------------------------------------------------------
+
+void PrefixIndex_t::clear()
+{
+    entries_m.clear();
+    keys_m.clear();
+    table_m.assign(16, NO_ENTRY);
+    tableMask_m = 15;
+}
+
+//-----------------------------------------------------------------------------
+
+void PrefixIndex_t::add(std::string const & path, int subscriber, uint32_t typeMask)
+{
+    // The hash must be the same FNV-1a that getSubscribers() computes incrementally.
+    uint64_t hash = StrHashTraits_t::hash(path);
+    size_t slot = hash & tableMask_m;
+    for (; table_m[slot] != NO_ENTRY; slot = (slot + 1) & tableMask_m) {
+        Entry_t const & entry = entries_m[table_m[slot]];
+        if (entry.hash_m == hash && entry.keyLen_m == path.size() && memcmp(&keys_m[entry.keyOffset_m], path.data(), path.size()) == 0) {
+            break;
+        }
+    }
+
+    if (table_m[slot] == NO_ENTRY) {
+        Entry_t entry;
+        memset(&entry, 0, sizeof(entry));
+        entry.hash_m = hash;
+        entry.keyOffset_m = (uint32_t) keys_m.size();
+        entry.keyLen_m = (uint32_t) path.size();
+        keys_m.insert(keys_m.end(), path.begin(), path.end());
+        table_m[slot] = (int32_t) entries_m.size();
+        entries_m.push_back(entry);
+    }
+
+    Entry_t & entry = entries_m[table_m[slot]];
+    for (int type = 0; type < FSE_MAX_EVENTS; ++type) {
+        if ((typeMask & (1u << type)) != 0) {
+            entry.subscribersByType_am[type] |= 1ull << subscriber;
+        }
+    }
+
+    // Keep the table at most half full, so that probe sequences stay short.
+    if (entries_m.size() * 2 > table_m.size()) {
+        grow();
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void PrefixIndex_t::grow()
+{
+    table_m.assign(table_m.size() * 2, NO_ENTRY);
+    tableMask_m = table_m.size() - 1;
+
+    for (size_t i = 0; i < entries_m.size(); ++i) {
+        size_t slot = entries_m[i].hash_m & tableMask_m;
+        while (table_m[slot] != NO_ENTRY) {
+            slot = (slot + 1) & tableMask_m;
+        }
+        table_m[slot] = (int32_t) i;
+    }
+}
@@ -0,0 +1,108 @@
+#ifndef __INC_PrefixIndex_H
+#define __INC_PrefixIndex_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "fsevents.h"
+
+// This class is a combined index of the monitored paths of up to 64 subscribers, mapping each path to the set of subscribers that monitor it for each event type. A path matches a monitored path if it is that path or is under it.
+//
+// Finding the subscribers of a path hashes the path's prefixes at each component boundary in a single pass, since FNV-1a can be extended a byte at a time, and looks each one up in an open addressing table. The cost is therefore proportional to the path length, however many subscribers and monitored paths there are.
+class PrefixIndex_t
+{
+private:
+
+    struct Entry_t
+    {
+        uint64_t hash_m;
+        uint32_t keyOffset_m;
+        uint32_t keyLen_m;
+        uint64_t subscribersByType_am [FSE_MAX_EVENTS];
+    };
+
+    static int32_t const NO_ENTRY = -1;
+
+    std::vector<Entry_t> entries_m;
+    std::vector<char> keys_m;
+    std::vector<int32_t> table_m;
+    size_t tableMask_m;
+
+public:
+
+    // The most subscribers that the index can hold.
+    enum { MAX_SUBSCRIBERS = 64 };
+
+    // Constructor. The new index is empty.
+    PrefixIndex_t();
+
+    // Removes all paths.
+    void clear();
+
+    // Adds a monitored path of a subscriber, for the event types in a mask. The path must not have a trailing slash; the root is the empty path.
+    void add(std::string const & path, int subscriber, uint32_t typeMask);
+
+    // Returns the set of subscribers, as a bit mask, that monitor a path for an event type. The path need not be NUL terminated.
+    uint64_t getSubscribers(char const * path, size_t len, int32_t type) const
+    {
+        if (entries_m.empty() || type < 0 || type >= FSE_MAX_EVENTS) {
+            return 0;
+        }
+
+        uint64_t subscribers = 0;
+        uint64_t hash = 0xcbf29ce484222325ull;
+        for (size_t i = 0; i <= len; ++i) {
+            if (i == len || path[i] == '/') {
+                Entry_t const * entry_p = find(path, i, hash);
+                if (entry_p != NULL) {
+                    subscribers |= entry_p->subscribersByType_am[type];
+                }
+            }
+            if (i < len) {
+                hash ^= (uint8_t) path[i];
+                hash *= 0x100000001b3ull;
+            }
+        }
+        return subscribers;
+    }
+
+private:
+
+    // Returns the entry for a path with a given hash, or NULL if there is none.
+    Entry_t const * find(char const * path, size_t len, uint64_t hash) const
+    {
+        for (size_t slot = hash & tableMask_m; table_m[slot] != NO_ENTRY; slot = (slot + 1) & tableMask_m) {
+            Entry_t const & entry = entries_m[table_m[slot]];
+            if (entry.hash_m == hash && entry.keyLen_m == len && memcmp(&keys_m[entry.keyOffset_m], path, len) == 0) {
+                return &entry;
+            }
+        }
+        return NULL;
+    }
+
+    // Doubles the table size and rehashes the entries.
+    void grow();
+};
+
+#endif // __INC_PrefixIndex_H
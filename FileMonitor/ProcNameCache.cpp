@@ -0,0 +1,87 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <string.h>
+#include <sys/event.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "EventFormatter.h"
+#include "ProcNameCache.h"
+
+//-----------------------------------------------------------------------------
+
+ProcNameCache_t::ProcNameCache_t()
+    : kq_m(kqueue()),
+      numWatched_m(0)
+{
+    memset(entries_am, 0, sizeof(entries_am));
+}
+
+//-----------------------------------------------------------------------------
+
+ProcNameCache_t::~ProcNameCache_t()
+{
+    if (kq_m >= 0) {
+        close(kq_m);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+char const * ProcNameCache_t::getName(pid_t pid)
+{
+    Entry_t & entry = entries_am[(uint32_t) pid % NUM_ENTRIES];
+    if (entry.pid_m == pid && pid != 0) {
+        return entry.name_am;
+    }
+
+    getProcessName(pid, entry.name_am, sizeof(entry.name_am));
+    entry.pid_m = 0;
+
+    // The name is only cached if the exit of the process can be seen. Registering fails if the process has already exited.
+    struct kevent change;
+    EV_SET(&change, pid, EVFILT_PROC, EV_ADD | EV_ONESHOT, NOTE_EXIT, 0, NULL);
+    if (kq_m >= 0 && pid != 0 && kevent(kq_m, &change, 1, NULL, 0, NULL) == 0) {
+        entry.pid_m = pid;
+        numWatched_m += 1;
+    }
+    return entry.name_am;
+}
+
+//-----------------------------------------------------------------------------
+
+void ProcNameCache_t::expireExited()
+{
+    if (numWatched_m == 0) {
+        return;
+    }
+
+    struct timespec timeout = { 0, 0 };
+    struct kevent events [64];
+    int n;
+    do {
+        n = kevent(kq_m, NULL, 0, events, 64, &timeout);
+        for (int i = 0; i < n; ++i) {
+            Entry_t & entry = entries_am[(uint32_t) events[i].ident % NUM_ENTRIES];
+            if (entry.pid_m == (pid_t) events[i].ident) {
+                entry.pid_m = 0;
+            }
+            numWatched_m -= 1;
+        }
+    } while (n == 64);
+}
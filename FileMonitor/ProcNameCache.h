@@ -0,0 +1,64 @@
+#ifndef __INC_ProcNameCache_H
+#define __INC_ProcNameCache_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+// This class caches the names of the processes that generate events, so that a busy process costs one system call to look up rather than one per event. Each cached process is watched for its exit through a kqueue, and its entry is dropped once it has exited, so a reused pid is looked up afresh. The exits are collected once per read of events, so a pid that is reused within a single read may keep its old name for the rest of that read. If the kqueue can't be created, nothing is cached.
+class ProcNameCache_t
+{
+private:
+
+    // A cached name. A pid of 0 marks an empty entry, since the kernel's own events aren't attributed to a process name.
+    struct Entry_t
+    {
+        pid_t pid_m;
+        char name_am [32];
+    };
+
+    // The number of entries, which are direct mapped by pid.
+    enum { NUM_ENTRIES = 256 };
+
+    int kq_m;
+    Entry_t entries_am [NUM_ENTRIES];
+    size_t numWatched_m; // Exits still to be collected, over-counted if a process was watched twice
+
+public:
+
+    // Constructor.
+    ProcNameCache_t();
+
+    // Destructor.
+    ~ProcNameCache_t();
+
+    // Returns the name of a process, which stays valid until the next call.
+    char const * getName(pid_t pid);
+
+    // Drops the entries of the processes that have exited since the last call.
+    void expireExited();
+
+private:
+
+    // Not copyable.
+    ProcNameCache_t(ProcNameCache_t const &);
+    ProcNameCache_t & operator=(ProcNameCache_t const &);
+};
+
+#endif // __INC_ProcNameCache_H
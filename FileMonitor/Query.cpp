@@ -0,0 +1,471 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "EventView.h"
+#include "MutexLocker.h"
+#include "Query.h"
+
+extern int optind;
+
+//-----------------------------------------------------------------------------
+// Print the query usage.
+
+static void printQueryUsage()
+{
+    fprintf(stderr, "Usage: filemon query -J dir [-htx] [-j threads] [-s time] [-e time]\n");
+    fprintf(stderr, "               [-p prefix] [-g glob] [-P pid] [-n name] [-T types]\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "  -J :   the journal directory\n");
+    fprintf(stderr, "  -s :   only events at or after a time\n");
+    fprintf(stderr, "  -e :   only events at or before a time\n");
+    fprintf(stderr, "  -p :   only events on paths under a prefix\n");
+    fprintf(stderr, "  -g :   only events on paths matching a glob\n");
+    fprintf(stderr, "  -P :   only events from a process id\n");
+    fprintf(stderr, "  -n :   only events from a process name\n");
+    fprintf(stderr, "  -T :   only events of a comma separated list of types\n");
+    fprintf(stderr, "  -j :   number of scanning threads (default one per core)\n");
+    fprintf(stderr, "  -t :   prefix each terse output line with the event time\n");
+    fprintf(stderr, "  -x :   print output in XML form\n");
+    fprintf(stderr, "  -h :   print help\n");
+    fprintf(stderr, "\n");
+    fprintf(stderr, "The -p, -g, -P, -n options may be repeated to select any of several\n");
+    fprintf(stderr, "values. Times are local, as \"YYYY-MM-DD HH:MM[:SS]\", \"HH:MM[:SS]\"\n");
+    fprintf(stderr, "for today, or \"@secs\" since the epoch.\n");
+}
+
+//-----------------------------------------------------------------------------
+// Read a whole file into a string. Returns false if it can't be read.
+
+static bool readFile(std::string const & path, std::string & data)
+{
+    FILE * file = fopen(path.c_str(), "rb");
+    if (file == NULL) {
+        return false;
+    }
+    data.clear();
+    char buf [64 * 1024];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+        data.append(buf, n);
+    }
+    fclose(file);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+QueryOptions_t::QueryOptions_t()
+    : startUsec_m(0),
+      endUsec_m(~0ull),
+      typeMask_m(ALL_EVENT_TYPES_MASK),
+      isXml_m(false),
+      isTimed_m(false),
+      numThreads_m(0)
+{}
+
+//-----------------------------------------------------------------------------
+
+Query_t::Query_t(QueryOptions_t const & options, FILE * out)
+    : options_m(options),
+      out_pm(out),
+      nextScan_m(0),
+      nextWrite_m(0),
+      maxAhead_m(0)
+{
+    pthread_mutex_init(&mutex_m, NULL);
+    pthread_cond_init(&doneCond_m, NULL);
+}
+
+//-----------------------------------------------------------------------------
+
+bool Query_t::run(std::string & error)
+{
+    if (!pathFilter_m.compile(options_m.patterns_m, error)) {
+        return false;
+    }
+
+    std::vector<uint64_t> firstSeqs;
+    if (!listJournalSegments(options_m.dir_m, firstSeqs)) {
+        error = "can't read journal directory " + options_m.dir_m + ": " + strerror(errno);
+        return false;
+    }
+
+    for (size_t i = 0; i < firstSeqs.size(); ++i) {
+        if (!isSegmentSkipped(firstSeqs[i])) {
+            Segment_t segment;
+            segment.firstSeq_m = firstSeqs[i];
+            segment.isDone_m = false;
+            segments_m.push_back(segment);
+        }
+    }
+
+    size_t numThreads = options_m.numThreads_m > 0 ? options_m.numThreads_m : 1;
+    if (numThreads > segments_m.size()) {
+        numThreads = segments_m.size();
+    }
+
+    // Twice as many segments as threads keeps the threads busy while the writer catches up.
+    maxAhead_m = 2 * numThreads;
+
+    std::vector<pthread_t> threads;
+    for (size_t i = 0; i < numThreads; ++i) {
+        pthread_t thread;
+        if (pthread_create(&thread, NULL, threadEntry, this) != 0) {
+            perror(NULL);
+            exit(1);
+        }
+        threads.push_back(thread);
+    }
+
+    // Write each segment's output as soon as it and all earlier segments are done.
+    for (size_t i = 0; i < segments_m.size(); ++i) {
+        std::string out;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            while (!segments_m[i].isDone_m) {
+                MUTEX_COND_WAIT(&doneCond_m);
+            }
+            out.swap(segments_m[i].out_m);
+            nextWrite_m = i + 1;
+            pthread_cond_broadcast(&doneCond_m);
+        }
+        fwrite(out.data(), 1, out.size(), out_pm);
+    }
+    fflush(out_pm);
+
+    for (size_t i = 0; i < threads.size(); ++i) {
+        pthread_join(threads[i], NULL);
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void * Query_t::threadEntry(void * arg)
+{
+    static_cast<Query_t *>(arg)->scan();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void Query_t::scan()
+{
+    EventFormatter_t formatter(options_m.isXml_m);
+
+    while (true) {
+        size_t index;
+        uint64_t firstSeq;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            while (nextScan_m < segments_m.size() && nextScan_m >= nextWrite_m + maxAhead_m) {
+                MUTEX_COND_WAIT(&doneCond_m);
+            }
+            if (nextScan_m == segments_m.size()) {
+                return;
+            }
+            index = nextScan_m++;
+            firstSeq = segments_m[index].firstSeq_m;
+        }
+
+        std::string out;
+        scanSegment(firstSeq, formatter, out);
+
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            segments_m[index].out_m.swap(out);
+            segments_m[index].isDone_m = true;
+            pthread_cond_broadcast(&doneCond_m);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void Query_t::scanSegment(uint64_t firstSeq, EventFormatter_t & formatter, std::string & out)
+{
+    std::string path = getJournalSegmentPath(options_m.dir_m, firstSeq, ".fmj");
+    int fd = open(path.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(JournalSegmentHeader_t)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+
+    void * p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "Error: can't map journal segment %s\n", path.c_str());
+        return;
+    }
+
+    // The segment is read front to back once.
+    madvise(p, st.st_size, MADV_SEQUENTIAL);
+
+    std::string line;
+    JournalRecordIterator_t iter((char const *) p, st.st_size, findStartOffset(firstSeq));
+    JournalRecord_t record;
+    while (iter.next(record)) {
+        JournalRecordHeader_t const & header = *record.header_pm;
+        if (header.timeUsec_m < options_m.startUsec_m) {
+            continue;
+        }
+        if (header.timeUsec_m > options_m.endUsec_m) {
+            break;
+        }
+
+        // Check the cheap header fields before decoding the event.
+        if (!options_m.pids_m.empty() && !options_m.pids_m.contains((uint32_t) header.pid_m)) {
+            continue;
+        }
+        if (!options_m.names_m.empty() && !options_m.names_m.contains(StrRef_t(record.procName_m, header.procNameLen_m))) {
+            continue;
+        }
+
+        EventIterator_t eventIter(record.event_m, record.eventSize_m);
+        EventView_t event;
+        if (!eventIter.next(event) || (getEventTypeBit(event.getBaseType()) & options_m.typeMask_m) == 0) {
+            continue;
+        }
+
+        uint32_t matchMask = 0;
+        for (int i = 0; i < event.numArgs_m; ++i) {
+            EventArg_t const & arg = event.args_am[i];
+            if (arg.isPath()) {
+                size_t pathLen = arg.pathLen();
+                if (isUnderPrefix(arg.data_m, pathLen) && pathFilter_m.isPassed(arg.data_m, pathLen)) {
+                    matchMask |= 1u << i;
+                }
+            }
+        }
+        if (matchMask == 0) {
+            continue;
+        }
+
+        std::string procName(record.procName_m, header.procNameLen_m);
+        if (!options_m.isTimed_m || options_m.isXml_m) {
+            formatter.format(event, matchMask, header.seq_m, out, procName.c_str());
+            continue;
+        }
+
+        // Prefix each line of the terse output with the event time.
+        line.clear();
+        formatter.format(event, matchMask, header.seq_m, line, procName.c_str());
+        for (size_t start = 0; start < line.size(); ) {
+            size_t end = line.find('\n', start);
+            end = end == std::string::npos ? line.size() : end + 1;
+            appendJournalTime(out, header.timeUsec_m);
+            out.append(line, start, end - start);
+            start = end;
+        }
+    }
+
+    munmap(p, st.st_size);
+}
+
+//-----------------------------------------------------------------------------
+
+bool Query_t::isSegmentSkipped(uint64_t firstSeq) const
+{
+    std::string index;
+    if (!readFile(getJournalSegmentPath(options_m.dir_m, firstSeq, ".fmp"), index) || index.size() < sizeof(JournalPathIndexHeader_t)) {
+        // An unsealed segment has no path index or end time; only its start time can rule it out.
+        JournalTimeIndexEntry_t entry;
+        FILE * file = fopen(getJournalSegmentPath(options_m.dir_m, firstSeq, ".fmt").c_str(), "rb");
+        bool isRead = file != NULL && fread(&entry, sizeof(entry), 1, file) == 1;
+        if (file != NULL) {
+            fclose(file);
+        }
+        return isRead && entry.timeUsec_m > options_m.endUsec_m;
+    }
+
+    JournalPathIndexHeader_t header;
+    memcpy(&header, index.data(), sizeof(header));
+    if (header.magic_m != JournalPathIndexHeader_t::MAGIC) {
+        return false;
+    }
+    if (header.lastTimeUsec_m < options_m.startUsec_m || header.firstTimeUsec_m > options_m.endUsec_m) {
+        return true;
+    }
+    if (options_m.prefixes_m.empty() || header.numDirs_m == JournalPathIndexHeader_t::NO_DIRS) {
+        return false;
+    }
+
+    // The segment is needed if one of its directories is under a prefix, or is above one, since a prefix may name a file in it.
+    size_t pos = sizeof(header);
+    for (uint64_t i = 0; i < header.numDirs_m && pos + sizeof(uint32_t) <= index.size(); ++i) {
+        uint32_t len;
+        memcpy(&len, index.data() + pos, sizeof(len));
+        pos += sizeof(len);
+        if (pos + len > index.size()) {
+            return false;
+        }
+
+        char const * dir = index.data() + pos;
+        std::string dirStr(dir, len == 1 && dir[0] == '/' ? 0 : len);
+        for (size_t j = 0; j < options_m.prefixes_m.size(); ++j) {
+            std::string const & prefix = options_m.prefixes_m[j];
+            if (isPathUnder(dirStr.data(), dirStr.size(), prefix) || isPathUnder(prefix.data(), prefix.size(), dirStr)) {
+                return false;
+            }
+        }
+        pos += len;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+uint64_t Query_t::findStartOffset(uint64_t firstSeq) const
+{
+    std::string index;
+    if (options_m.startUsec_m == 0 || !readFile(getJournalSegmentPath(options_m.dir_m, firstSeq, ".fmt"), index)) {
+        return sizeof(JournalSegmentHeader_t);
+    }
+
+    // Find the last entry before the start time. Records between it and the next entry may still be in range, so the scan starts there.
+    JournalTimeIndexEntry_t const * entries = (JournalTimeIndexEntry_t const *) index.data();
+    size_t numEntries = index.size() / sizeof(JournalTimeIndexEntry_t);
+    size_t lo = 0;
+    size_t hi = numEntries;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (entries[mid].timeUsec_m < options_m.startUsec_m) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo == 0 ? sizeof(JournalSegmentHeader_t) : entries[lo - 1].offset_m;
+}
+
+//-----------------------------------------------------------------------------
+
+bool Query_t::isUnderPrefix(char const * path, size_t len) const
+{
+    if (options_m.prefixes_m.empty()) {
+        return true;
+    }
+    for (size_t i = 0; i < options_m.prefixes_m.size(); ++i) {
+        if (isPathUnder(path, len, options_m.prefixes_m[i])) {
+            return true;
+        }
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+int runQuery(int argc, char * argv[])
+{
+    QueryOptions_t options;
+    options.numThreads_m = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    bool isError = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "e:g:hJ:j:n:P:p:s:T:tx")) != -1) {
+        switch (c) {
+            case 'e':
+                if (!parseJournalTime(optarg, options.endUsec_m)) {
+                    fprintf(stderr, "Invalid time: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 'g':
+                options.patterns_m.push_back(PathPattern_t(optarg, false, false));
+                break;
+            case 'h':
+                printQueryUsage();
+                return 0;
+            case 'J':
+                options.dir_m = optarg;
+                break;
+            case 'j':
+                options.numThreads_m = atoi(optarg);
+                if (options.numThreads_m <= 0) {
+                    fprintf(stderr, "Invalid number of threads: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 'n':
+                options.names_m.insert(std::string(optarg));
+                break;
+            case 'P':
+                options.pids_m.insert((uint32_t) strtoul(optarg, NULL, 10));
+                break;
+            case 'p': {
+                // A prefix matches on path component boundaries, so drop any trailing slashes, leaving the root as an empty prefix.
+                std::string prefix(optarg);
+                while (!prefix.empty() && prefix[prefix.size() - 1] == '/') {
+                    prefix.erase(prefix.size() - 1);
+                }
+                options.prefixes_m.push_back(prefix);
+                break;
+            }
+            case 's':
+                if (!parseJournalTime(optarg, options.startUsec_m)) {
+                    fprintf(stderr, "Invalid time: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 'T':
+                if (!parseEventTypeList(optarg, options.typeMask_m)) {
+                    fprintf(stderr, "Invalid event type list: %s\n", optarg);
+                    isError = true;
+                }
+                break;
+            case 't':
+                options.isTimed_m = true;
+                break;
+            case 'x':
+                options.isXml_m = true;
+                break;
+            case '?':
+                isError = true;
+                break;
+        }
+    }
+
+    if (options.dir_m.empty() || optind != argc) {
+        isError = true;
+    }
+    if (isError) {
+        printQueryUsage();
+        return 1;
+    }
+
+    Query_t query(options, stdout);
+    std::string error;
+    if (!query.run(error)) {
+        fprintf(stderr, "Error: %s\n", error.c_str());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,114 @@
+#ifndef __INC_Query_H
+#define __INC_Query_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+#include "EventFormatter.h"
+#include "FlatHashSet.h"
+#include "JournalFormat.h"
+#include "PathFilter.h"
+
+// The selection criteria and output settings of a journal query.
+struct QueryOptions_t
+{
+    std::string dir_m;
+    uint64_t startUsec_m;
+    uint64_t endUsec_m;
+    std::vector<std::string> prefixes_m;
+    std::vector<PathPattern_t> patterns_m;
+    FlatHashSet_t<uint32_t, IntHashTraits_t> pids_m;
+    FlatHashSet_t<std::string, StrHashTraits_t> names_m;
+    uint32_t typeMask_m;
+    bool isXml_m;
+    bool isTimed_m;
+    int numThreads_m;
+
+    // Constructor. The default query selects everything.
+    QueryOptions_t();
+};
+
+// This class runs a query over the event journal. Each segment's files are memory mapped, and the segments are pruned using their path index and time range before any records are read. Within a segment the time index is binary searched for the first record that can be in the time range. The surviving segments are scanned in parallel, and the results are written in journal order.
+class Query_t
+{
+private:
+
+    // A segment to scan, and its output once scanned.
+    struct Segment_t
+    {
+        uint64_t firstSeq_m;
+        std::string out_m;
+        bool isDone_m;
+    };
+
+    QueryOptions_t const & options_m;
+    PathFilter_t pathFilter_m;
+    FILE * out_pm;
+
+    // Protects the segments' outputs and the next segments to scan and write. A segment is only scanned once it is within the most segments ahead of the next to write, so that a slow segment can't leave the output of all the later ones waiting in memory.
+    pthread_mutex_t mutex_m;
+    pthread_cond_t doneCond_m;
+    std::vector<Segment_t> segments_m;
+    size_t nextScan_m;
+    size_t nextWrite_m;
+    size_t maxAhead_m;
+
+public:
+
+    // Constructor.
+    Query_t(QueryOptions_t const & options, FILE * out);
+
+    // Runs the query, writing the selected events. Returns false with an error message if the query can't be run.
+    bool run(std::string & error);
+
+private:
+
+    // The scanner thread entry function.
+    static void * threadEntry(void * arg);
+
+    // The scanner thread loop.
+    void scan();
+
+    // Scans one segment, appending the output for its selected events.
+    void scanSegment(uint64_t firstSeq, EventFormatter_t & formatter, std::string & out);
+
+    // Can a sealed segment's path index, or its time range, rule it out?
+    bool isSegmentSkipped(uint64_t firstSeq) const;
+
+    // Returns the offset of the first record in a segment that can be in the time range.
+    uint64_t findStartOffset(uint64_t firstSeq) const;
+
+    // Is a path under one of the prefixes, if there are any?
+    bool isUnderPrefix(char const * path, size_t len) const;
+
+    // Not copyable.
+    Query_t(Query_t const &);
+    Query_t & operator=(Query_t const &);
+};
+
+// Runs the "filemon query" subcommand. The arguments start with the subcommand name. Returns the process exit code.
+int runQuery(int argc, char * argv[]);
+
+#endif // __INC_Query_H
@@ -0,0 +1,135 @@
+#ifndef __INC_RingQueue_H
+#define __INC_RingQueue_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+
+#include <vector>
+
+// This class is a double ended queue stored in a single circular array. Unlike std::deque, which may allocate and free blocks as items pass through it, it only allocates when it grows beyond the most items it has held, so a queue in steady use never touches the heap. The capacity is a power of two.
+template <typename Item_t>
+class RingQueue_t
+{
+private:
+
+    std::vector<Item_t> items_m;
+    size_t head_m;
+    size_t size_m;
+    size_t mask_m;
+
+public:
+
+    // Constructor.
+    RingQueue_t()
+        : head_m(0),
+          size_m(0),
+          mask_m(0)
+    {}
+
+    // Returns the number of items.
+    size_t size() const { return size_m; }
+
+    // Returns true if there are no items.
+    bool empty() const { return size_m == 0; }
+
+    // Returns an item by its index from the front.
+    Item_t & operator[](size_t index) { return items_m[(head_m + index) & mask_m]; }
+    Item_t const & operator[](size_t index) const { return items_m[(head_m + index) & mask_m]; }
+
+    // Returns the first or last item.
+    Item_t & front() { return (*this)[0]; }
+    Item_t & back() { return (*this)[size_m - 1]; }
+
+    // Removes all items, keeping the capacity.
+    void clear()
+    {
+        head_m = 0;
+        size_m = 0;
+    }
+
+    // Makes room for a number of items without allocating again.
+    void reserve(size_t capacity)
+    {
+        while (items_m.size() < capacity) {
+            grow();
+        }
+    }
+
+    // Appends an item at the back.
+    void push_back(Item_t const & item)
+    {
+        if (size_m == items_m.size()) {
+            grow();
+        }
+        items_m[(head_m + size_m) & mask_m] = item;
+        size_m += 1;
+    }
+
+    // Removes the first item.
+    void pop_front()
+    {
+        head_m = (head_m + 1) & mask_m;
+        size_m -= 1;
+    }
+
+    // Removes the last item.
+    void pop_back()
+    {
+        size_m -= 1;
+    }
+
+    // Inserts an item before the one at an index, moving the later items back.
+    void insert(size_t index, Item_t const & item)
+    {
+        if (size_m == items_m.size()) {
+            grow();
+        }
+        for (size_t i = size_m; i > index; --i) {
+            (*this)[i] = (*this)[i - 1];
+        }
+        (*this)[index] = item;
+        size_m += 1;
+    }
+
+    // Removes the item at an index, moving the later items forward.
+    void erase(size_t index)
+    {
+        for (size_t i = index; i + 1 < size_m; ++i) {
+            (*this)[i] = (*this)[i + 1];
+        }
+        size_m -= 1;
+    }
+
+private:
+
+    // Doubles the capacity, moving the items to the start of the new array.
+    void grow()
+    {
+        size_t capacity = items_m.empty() ? 16 : items_m.size() * 2;
+        std::vector<Item_t> items(capacity);
+        for (size_t i = 0; i < size_m; ++i) {
+            items[i] = (*this)[i];
+        }
+        items_m.swap(items);
+        head_m = 0;
+        mask_m = capacity - 1;
+    }
+};
+
+#endif // __INC_RingQueue_H
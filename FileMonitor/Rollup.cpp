@@ -0,0 +1,386 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "AllocCounter.h"
+#include "FlatHashSet.h"
+#include "MutexLocker.h"
+#include "Rollup.h"
+
+uint32_t const RollupTree_t::NO_NODE;
+uint64_t const RollupTree_t::IDLE_SNAPSHOTS;
+
+//-----------------------------------------------------------------------------
+// Hash a child's name together with its parent node.
+
+static uint64_t hashChild(uint32_t parent, char const * name, size_t len)
+{
+    return StrHashTraits_t::hash(StrRef_t(name, len)) ^ IntHashTraits_t::hash(parent);
+}
+
+//-----------------------------------------------------------------------------
+// Append a string to JSON output as a quoted and escaped JSON string.
+
+static void appendJsonString(std::string & out, std::string const & str)
+{
+    out += '"';
+    for (size_t i = 0; i < str.size(); ++i) {
+        unsigned char c = str[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        }
+        else if (c < 0x20) {
+            char buf [8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+//-----------------------------------------------------------------------------
+
+RollupTree_t::RollupTree_t(size_t maxDepth)
+    : maxDepth_m(maxDepth),
+      numSnapshots_m(0),
+      indexMask_m(0)
+{
+    // The root node, which is never in the index.
+    Node_t root;
+    memset(&root, 0, sizeof(root));
+    root.parent_m = NO_NODE;
+    root.firstChild_m = NO_NODE;
+    root.nextSibling_m = NO_NODE;
+    nodes_m.push_back(root);
+
+    index_m.assign(256, NO_NODE);
+    indexMask_m = index_m.size() - 1;
+}
+
+//-----------------------------------------------------------------------------
+
+void RollupTree_t::add(char const * path, size_t len)
+{
+    uint32_t node = 0;
+    nodes_m[node].count_m += 1;
+
+    // Walk the directory components, leaving out the last component, which is the file.
+    size_t depth = 0;
+    size_t pos = 0;
+    while (depth < maxDepth_m) {
+        while (pos < len && path[pos] == '/') {
+            ++pos;
+        }
+        size_t end = pos;
+        while (end < len && path[end] != '/') {
+            ++end;
+        }
+        if (end >= len) {
+            break;
+        }
+
+        node = findOrAddChild(node, path + pos, end - pos);
+        nodes_m[node].count_m += 1;
+        depth += 1;
+        pos = end;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+uint32_t RollupTree_t::findOrAddChild(uint32_t parent, char const * name, size_t len)
+{
+    uint64_t hash = hashChild(parent, name, len);
+    size_t slot = hash & indexMask_m;
+    while (index_m[slot] != NO_NODE) {
+        Node_t const & n = nodes_m[index_m[slot]];
+        if (n.hash_m == hash && n.parent_m == parent && n.nameLen_m == len && memcmp(&names_m[n.nameOffset_m], name, len) == 0) {
+            return index_m[slot];
+        }
+        slot = (slot + 1) & indexMask_m;
+    }
+
+    // Learning a new directory allocates by design.
+    AllocExempt_t allocExempt;
+    uint32_t node = (uint32_t) nodes_m.size();
+
+    Node_t child;
+    child.parent_m = parent;
+    child.firstChild_m = NO_NODE;
+    child.nextSibling_m = nodes_m[parent].firstChild_m;
+    child.nameOffset_m = (uint32_t) names_m.size();
+    child.nameLen_m = (uint32_t) len;
+    child.hash_m = hash;
+    child.count_m = 0;
+    child.reportedCount_m = 0;
+    child.lastActiveSnapshot_m = numSnapshots_m;
+    nodes_m.push_back(child);
+    nodes_m[parent].firstChild_m = node;
+    names_m.insert(names_m.end(), name, name + len);
+
+    // Keep the index at most half full, so that probe sequences stay short.
+    if (nodes_m.size() * 2 > index_m.size()) {
+        growIndex();
+    }
+    else {
+        index_m[slot] = node;
+    }
+
+    return node;
+}
+
+//-----------------------------------------------------------------------------
+
+void RollupTree_t::growIndex()
+{
+    rebuildIndex(index_m.size() * 2);
+}
+
+//-----------------------------------------------------------------------------
+
+void RollupTree_t::rebuildIndex(size_t size)
+{
+    index_m.assign(size, NO_NODE);
+    indexMask_m = index_m.size() - 1;
+
+    for (uint32_t node = 1; node < nodes_m.size(); ++node) {
+        size_t slot = nodes_m[node].hash_m & indexMask_m;
+        while (index_m[slot] != NO_NODE) {
+            slot = (slot + 1) & indexMask_m;
+        }
+        index_m[slot] = node;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void RollupTree_t::getSnapshot(std::vector<RollupEntry_t> & entries)
+{
+    entries.clear();
+    std::string path;
+    numSnapshots_m += 1;
+    addToSnapshot(0, path, entries);
+
+    if (numSnapshots_m % IDLE_SNAPSHOTS == 0) {
+        prune();
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void RollupTree_t::addToSnapshot(uint32_t node, std::string & path, std::vector<RollupEntry_t> & entries)
+{
+    Node_t & n = nodes_m[node];
+
+    RollupEntry_t entry;
+    entry.path_m = path.empty() ? std::string("/") : path;
+    entry.count_m = n.count_m;
+    entry.delta_m = n.count_m - n.reportedCount_m;
+    entries.push_back(entry);
+    n.reportedCount_m = n.count_m;
+    n.lastActiveSnapshot_m = numSnapshots_m;
+
+    // The children are linked most recent first; order the ones with events by name so that snapshots are stable.
+    std::vector<std::pair<std::string, uint32_t> > children;
+    for (uint32_t child = n.firstChild_m; child != NO_NODE; child = nodes_m[child].nextSibling_m) {
+        Node_t const & c = nodes_m[child];
+        if (c.count_m != c.reportedCount_m) {
+            children.push_back(std::make_pair(std::string(&names_m[c.nameOffset_m], c.nameLen_m), child));
+        }
+    }
+    std::sort(children.begin(), children.end());
+
+    size_t pathLen = path.size();
+    for (size_t i = 0; i < children.size(); ++i) {
+        path += '/';
+        path += children[i].first;
+        addToSnapshot(children[i].second, path, entries);
+        path.resize(pathLen);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void RollupTree_t::prune()
+{
+    // A node is always added after its parent, so a parent is kept, and renumbered, before its children are looked at. The subtree of an idle node is idle too.
+    std::vector<uint32_t> newNodes(nodes_m.size(), NO_NODE);
+    std::vector<Node_t> nodes;
+    std::vector<char> names;
+    for (uint32_t node = 0; node < nodes_m.size(); ++node) {
+        Node_t n = nodes_m[node];
+        char const * name = names_m.empty() ? NULL : &names_m[n.nameOffset_m];
+        if (node != 0) {
+            if (n.lastActiveSnapshot_m + IDLE_SNAPSHOTS <= numSnapshots_m || newNodes[n.parent_m] == NO_NODE) {
+                continue;
+            }
+            n.parent_m = newNodes[n.parent_m];
+            n.hash_m = hashChild(n.parent_m, name, n.nameLen_m);
+            n.nextSibling_m = nodes[n.parent_m].firstChild_m;
+            nodes[n.parent_m].firstChild_m = (uint32_t) nodes.size();
+        }
+        n.firstChild_m = NO_NODE;
+        n.nameOffset_m = (uint32_t) names.size();
+        names.insert(names.end(), name, name + n.nameLen_m);
+        newNodes[node] = (uint32_t) nodes.size();
+        nodes.push_back(n);
+    }
+
+    if (nodes.size() == nodes_m.size()) {
+        return;
+    }
+    nodes_m.swap(nodes);
+    names_m.swap(names);
+
+    // Shrink the index along with the tree, keeping it at most half full.
+    size_t indexSize = 256;
+    while (nodes_m.size() * 2 > indexSize) {
+        indexSize *= 2;
+    }
+    rebuildIndex(indexSize);
+}
+
+//-----------------------------------------------------------------------------
+
+Rollup_t::Rollup_t(size_t maxDepth, unsigned intervalSecs, RollupFormat_t format, FILE * out)
+    : intervalSecs_m(intervalSecs),
+      format_m(format),
+      out_pm(out),
+      tree_m(maxDepth)
+{
+    pthread_mutex_init(&mutex_m, NULL);
+
+    if (pthread_create(&thread_m, NULL, threadEntry, this) != 0) {
+        perror(NULL);
+        exit(1);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void Rollup_t::addEvent(EventView_t const & event, uint32_t matchMask)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+
+    for (int i = 0; i < event.numArgs_m; ++i) {
+        if ((matchMask & (1u << i)) != 0) {
+            EventArg_t const & arg = event.args_am[i];
+            tree_m.add(arg.data_m, arg.pathLen());
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void * Rollup_t::threadEntry(void * arg)
+{
+    static_cast<Rollup_t *>(arg)->run();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void Rollup_t::run()
+{
+    std::vector<RollupEntry_t> entries;
+
+    while (true) {
+        sleep(intervalSecs_m);
+
+        // Take the snapshot under the lock, then print outside of it so that event processing isn't held up.
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            tree_m.getSnapshot(entries);
+        }
+
+        time_t now = time(NULL);
+        switch (format_m) {
+            case ROLLUP_TEXT:
+                printText(entries);
+                break;
+            case ROLLUP_JSON:
+                printJson(now, entries);
+                break;
+            case ROLLUP_BINARY:
+                printBinary(now, entries);
+                break;
+        }
+        fflush(out_pm);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void Rollup_t::printText(std::vector<RollupEntry_t> const & entries)
+{
+    fprintf(out_pm, "ROLLUP: %llu events, %llu in the last %u seconds\n", (unsigned long long) entries[0].count_m, (unsigned long long) entries[0].delta_m, intervalSecs_m);
+    fprintf(out_pm, "  %12s %10s  %s\n", "EVENTS", "DELTA", "DIRECTORY");
+    for (size_t i = 0; i < entries.size(); ++i) {
+        RollupEntry_t const & entry = entries[i];
+        fprintf(out_pm, "  %12llu %10llu  %s\n", (unsigned long long) entry.count_m, (unsigned long long) entry.delta_m, entry.path_m.c_str());
+    }
+    fprintf(out_pm, "\n");
+}
+
+//-----------------------------------------------------------------------------
+
+void Rollup_t::printJson(time_t now, std::vector<RollupEntry_t> const & entries)
+{
+    std::string out;
+    char buf [128];
+    snprintf(buf, sizeof(buf), "{\"time\":%lld,\"interval\":%u,\"dirs\":[", (long long) now, intervalSecs_m);
+    out += buf;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        RollupEntry_t const & entry = entries[i];
+        out += i == 0 ? "{\"path\":" : ",{\"path\":";
+        appendJsonString(out, entry.path_m);
+        snprintf(buf, sizeof(buf), ",\"count\":%llu,\"delta\":%llu}", (unsigned long long) entry.count_m, (unsigned long long) entry.delta_m);
+        out += buf;
+    }
+    out += "]}\n";
+    fwrite(out.data(), 1, out.size(), out_pm);
+}
+
+//-----------------------------------------------------------------------------
+
+void Rollup_t::printBinary(time_t now, std::vector<RollupEntry_t> const & entries)
+{
+    uint32_t header [2] = { 0x55524d46, 1 }; // 'FMRU' as a little endian u32
+    uint64_t time = (uint64_t) now;
+    uint64_t numEntries = entries.size();
+    fwrite(header, sizeof(header), 1, out_pm);
+    fwrite(&time, sizeof(time), 1, out_pm);
+    fwrite(&numEntries, sizeof(numEntries), 1, out_pm);
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        RollupEntry_t const & entry = entries[i];
+        uint64_t counts [2] = { entry.count_m, entry.delta_m };
+        uint32_t pathLen = (uint32_t) entry.path_m.size();
+        fwrite(counts, sizeof(counts), 1, out_pm);
+        fwrite(&pathLen, sizeof(pathLen), 1, out_pm);
+        fwrite(entry.path_m.data(), 1, pathLen, out_pm);
+    }
+}
@@ -0,0 +1,157 @@
+#ifndef __INC_Rollup_H
+#define __INC_Rollup_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include "EventView.h"
+
+// One directory of a rollup snapshot.
+struct RollupEntry_t
+{
+    std::string path_m;
+    uint64_t count_m; // Events under the directory since the start, or since it was last forgotten for being idle
+    uint64_t delta_m; // Events under the directory since the previous snapshot
+};
+
+// This class is a prefix tree of event counters, one node per directory, truncated at a maximum depth below the root. Adding a path counts one event at every directory above it, like du counts blocks, so each node's count covers its whole subtree.
+//
+// The child nodes are found through a single open addressing index keyed by the parent node and the name, so adding a path costs O(path length). Node names are kept in one arena, so once the tree holds every directory seen, adding a path never allocates.
+//
+// A snapshot only walks the directories with events since the previous one, since a directory without any has none under it either. The directories without events for IDLE_SNAPSHOTS snapshots are forgotten, so that directories that come and go, like per build temporary directories, don't grow the tree without bound; one that has events again counts from zero.
+class RollupTree_t
+{
+private:
+
+    struct Node_t
+    {
+        uint32_t parent_m;
+        uint32_t firstChild_m;
+        uint32_t nextSibling_m;
+        uint32_t nameOffset_m;
+        uint32_t nameLen_m;
+        uint64_t hash_m;
+        uint64_t count_m;
+        uint64_t reportedCount_m;
+        uint64_t lastActiveSnapshot_m; // The last snapshot in which the directory had events
+    };
+
+    static uint32_t const NO_NODE = 0xffffffff;
+
+    // The number of snapshots without events after which a directory is forgotten. The idle directories are pruned every this many snapshots.
+    static uint64_t const IDLE_SNAPSHOTS = 10;
+
+    size_t maxDepth_m;
+    uint64_t numSnapshots_m;
+    std::vector<Node_t> nodes_m;
+    std::vector<char> names_m;
+    std::vector<uint32_t> index_m;
+    size_t indexMask_m;
+
+public:
+
+    // Constructor. The maximum depth is the number of directory levels below the root that get their own node.
+    RollupTree_t(size_t maxDepth);
+
+    // Counts an event on a path. The path need not be NUL terminated. The last path component is taken to be the file, and isn't counted.
+    void add(char const * path, size_t len);
+
+    // Returns the number of directory nodes.
+    size_t getNumNodes() const { return nodes_m.size(); }
+
+    // Gets a snapshot of the root and the directories with events since the previous snapshot, parents before their children and siblings in name order. The deltas are relative to the previous snapshot.
+    void getSnapshot(std::vector<RollupEntry_t> & entries);
+
+private:
+
+    // Returns the child of a node with a name, adding it if there isn't one.
+    uint32_t findOrAddChild(uint32_t parent, char const * name, size_t len);
+
+    // Doubles the index size and rehashes the nodes.
+    void growIndex();
+
+    // Rehashes the nodes into an index of a given size.
+    void rebuildIndex(size_t size);
+
+    // Adds a node and the parts of its subtree with events to a snapshot.
+    void addToSnapshot(uint32_t node, std::string & path, std::vector<RollupEntry_t> & entries);
+
+    // Rebuilds the tree without the directories that have been idle for IDLE_SNAPSHOTS snapshots.
+    void prune();
+};
+
+// The rollup snapshot output formats.
+enum RollupFormat_t
+{
+    ROLLUP_TEXT,
+    ROLLUP_JSON,
+    ROLLUP_BINARY
+};
+
+// This class accumulates matched FS events into a directory rollup tree, and prints a snapshot of the per directory counts every interval in place of the individual events.
+//
+// The text format is a table, the JSON format is one object per line, and the binary format is a sequence of native endian records: a snapshot header {u32 magic 'FMRU', u32 version 1, u64 time, u64 number of entries} followed by the entries {u64 count, u64 delta, u32 path length, path bytes}.
+class Rollup_t
+{
+private:
+
+    unsigned intervalSecs_m;
+    RollupFormat_t format_m;
+    FILE * out_pm;
+
+    // Protects the tree.
+    pthread_mutex_t mutex_m;
+    RollupTree_t tree_m;
+
+    pthread_t thread_m;
+
+public:
+
+    // Constructor. Starts the reporter thread.
+    Rollup_t(size_t maxDepth, unsigned intervalSecs, RollupFormat_t format, FILE * out);
+
+    // Counts a matched event. The match mask has the bit for each argument index set if that argument is a monitored path.
+    void addEvent(EventView_t const & event, uint32_t matchMask);
+
+private:
+
+    // The reporter thread entry function.
+    static void * threadEntry(void * arg);
+
+    // The reporter thread loop.
+    void run();
+
+    // Prints a snapshot in each of the formats.
+    void printText(std::vector<RollupEntry_t> const & entries);
+    void printJson(time_t now, std::vector<RollupEntry_t> const & entries);
+    void printBinary(time_t now, std::vector<RollupEntry_t> const & entries);
+
+    // Not copyable.
+    Rollup_t(Rollup_t const &);
+    Rollup_t & operator=(Rollup_t const &);
+};
+
+#endif // __INC_Rollup_H
@@ -0,0 +1,141 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include "FlatHashSet.h"
+#include "Sampler.h"
+
+unsigned const Sampler_t::MAX_LEVEL;
+unsigned const Sampler_t::HIGH_FILL_PERCENT;
+unsigned const Sampler_t::LOW_FILL_PERCENT;
+uint64_t const Sampler_t::MAX_LAG_USEC;
+uint64_t const Sampler_t::STEP_DOWN_USEC;
+uint64_t const Sampler_t::STEP_UP_USEC;
+
+//-----------------------------------------------------------------------------
+
+Sampler_t::Sampler_t()
+    : level_m(0),
+      behindSinceUsec_m(0),
+      calmSinceUsec_m(0),
+      changeUsec_m(0),
+      numSkipped_m(0),
+      totalSkipped_m(0),
+      numChanges_m(0)
+{}
+
+//-----------------------------------------------------------------------------
+
+bool Sampler_t::update(unsigned fillPercent, bool isReaderBehind, uint64_t nowUsec, std::string & message)
+{
+    if (!isReaderBehind) {
+        behindSinceUsec_m = 0;
+    }
+    else if (behindSinceUsec_m == 0) {
+        behindSinceUsec_m = nowUsec;
+    }
+    uint64_t lagUsec = behindSinceUsec_m != 0 ? nowUsec - behindSinceUsec_m : 0;
+
+    bool isCalm = fillPercent <= LOW_FILL_PERCENT && !isReaderBehind;
+    if (!isCalm) {
+        calmSinceUsec_m = 0;
+    }
+    else if (calmSinceUsec_m == 0) {
+        calmSinceUsec_m = nowUsec;
+    }
+
+    // The rate drops quickly and recovers slowly, so that a burst doesn't make it flap.
+    bool isOverloaded = fillPercent >= HIGH_FILL_PERCENT || lagUsec >= MAX_LAG_USEC;
+    unsigned oldLevel = level_m;
+    if (isOverloaded && level_m < MAX_LEVEL && nowUsec - changeUsec_m >= STEP_DOWN_USEC) {
+        level_m += 1;
+    }
+    else if (level_m > 0 && calmSinceUsec_m != 0 && nowUsec - calmSinceUsec_m >= STEP_UP_USEC && nowUsec - changeUsec_m >= STEP_UP_USEC) {
+        level_m -= 1;
+    }
+    if (level_m == oldLevel) {
+        return false;
+    }
+
+    message = "SAMPLING: ";
+    if (level_m > 0) {
+        appendRate(message);
+    }
+    else {
+        message += "off";
+    }
+    char buf [128];
+    snprintf(buf, sizeof(buf), ", %llu events skipped, output queue %u%% full, reader %llu ms behind\n",
+             (unsigned long long) numSkipped_m, fillPercent, (unsigned long long) (lagUsec / 1000));
+    message += buf;
+
+    changeUsec_m = nowUsec;
+    numSkipped_m = 0;
+    numChanges_m += 1;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool Sampler_t::isSampled(EventView_t const & event, uint32_t matchMask)
+{
+    if (level_m == 0) {
+        return true;
+    }
+
+    for (int i = 0; i < event.numArgs_m; ++i) {
+        if ((matchMask & (1u << i)) != 0) {
+            // The top bits of the hash are the best mixed.
+            EventArg_t const & arg = event.args_am[i];
+            uint64_t hash = StrHashTraits_t::hash(StrRef_t(arg.data_m, arg.pathLen()));
+            if ((hash >> (64 - level_m)) == 0) {
+                return true;
+            }
+            break;
+        }
+    }
+
+    numSkipped_m += 1;
+    totalSkipped_m += 1;
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+
+void Sampler_t::appendStats(std::string & out, char const * prefix) const
+{
+    std::string rate;
+    if (level_m > 0) {
+        appendRate(rate);
+    }
+    else {
+        rate = "off";
+    }
+    char line [256];
+    snprintf(line, sizeof(line), "%s%s, %llu events skipped, %llu changes of rate\n", prefix, rate.c_str(), (unsigned long long) totalSkipped_m, (unsigned long long) numChanges_m);
+    out += line;
+}
+
+//-----------------------------------------------------------------------------
+
+void Sampler_t::appendRate(std::string & out) const
+{
+    char buf [32];
+    snprintf(buf, sizeof(buf), "1 in %u paths", 1u << level_m);
+    out += buf;
+}
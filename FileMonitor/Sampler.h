@@ -0,0 +1,86 @@
+#ifndef __INC_Sampler_H
+#define __INC_Sampler_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "EventView.h"
+
+// This class sheds load deterministically when the events come faster than they can be formatted and written. It watches how full the output queue is, and whether the reader is keeping up with the kernel, once per read. When either falls behind it halves the sampling rate, and when both have been calm for a while it doubles it again, back up to every event.
+//
+// An event is in the sample if the hash of its first matched path has as many leading zero bits as the sampling level, so at a given rate a path's events are either all reported or all skipped, and the paths reported at a lower rate are always among those reported at a higher one. Each change of rate is recorded in the output by a "SAMPLING:" line, so that a consumer knows what fraction of the paths it is seeing.
+class Sampler_t
+{
+private:
+
+    // The lowest sampling rate is 1 in 2^MAX_LEVEL paths.
+    static unsigned const MAX_LEVEL = 8;
+
+    // The output queue fill at or above which the rate is lowered.
+    static unsigned const HIGH_FILL_PERCENT = 50;
+
+    // The output queue fill at or below which the rate may be raised.
+    static unsigned const LOW_FILL_PERCENT = 10;
+
+    // How long the reader can be continuously behind the kernel before the rate is lowered.
+    static uint64_t const MAX_LAG_USEC = 100 * 1000;
+
+    // The least time between lowerings of the rate, so that a lowering can take effect before the next.
+    static uint64_t const STEP_DOWN_USEC = 200 * 1000;
+
+    // How long the load must be calm before each raising of the rate.
+    static uint64_t const STEP_UP_USEC = 1000 * 1000;
+
+    unsigned level_m;
+    uint64_t behindSinceUsec_m; // Zero if the reader is keeping up
+    uint64_t calmSinceUsec_m;   // Zero if the load isn't calm
+    uint64_t changeUsec_m;
+    uint64_t numSkipped_m;      // Since the last change of rate
+    uint64_t totalSkipped_m;
+    uint64_t numChanges_m;
+
+public:
+
+    // Constructor. Starts with every event in the sample.
+    Sampler_t();
+
+    // Updates the sampling rate from the output queue's fill and whether the last read was big enough that the kernel probably has more queued. Returns true, with a line for the output, if the rate changed.
+    bool update(unsigned fillPercent, bool isReaderBehind, uint64_t nowUsec, std::string & message);
+
+    // Is a matched event in the sample? Events that aren't are counted as skipped.
+    bool isSampled(EventView_t const & event, uint32_t matchMask);
+
+    // Appends the sampling rate and counters on a single line.
+    void appendStats(std::string & out, char const * prefix) const;
+
+private:
+
+    // Appends the current rate, e.g. "1 in 8 paths".
+    void appendRate(std::string & out) const;
+
+    // Not copyable.
+    Sampler_t(Sampler_t const &);
+    Sampler_t & operator=(Sampler_t const &);
+};
+
+#endif // __INC_Sampler_H
@@ -0,0 +1,319 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ShmRing.h"
+
+//-----------------------------------------------------------------------------
+
+ShmRing_t::ShmRing_t()
+    : isPathsCopied_m(true),
+      header_pm(NULL),
+      data_pm(NULL),
+      mapSize_m(0),
+      capacity_m(0),
+      pos_m(0),
+      tailPos_m(0),
+      nextSeq_m(1),
+      numTooBig_m(0),
+      procNames_pm(NULL)
+{}
+
+//-----------------------------------------------------------------------------
+
+ShmRing_t::~ShmRing_t()
+{
+    if (header_pm != NULL) {
+        munmap(header_pm, mapSize_m);
+    }
+    delete procNames_pm;
+}
+
+//-----------------------------------------------------------------------------
+
+bool ShmRing_t::open(char const * name, size_t capacity, std::string & error)
+{
+    capacity_m = 4096;
+    while (capacity_m < capacity) {
+        capacity_m *= 2;
+    }
+    name_m = name;
+    mapSize_m = SHM_RING_DATA_OFFSET + capacity_m;
+
+    // Readers still attached to a previous run's ring keep their mapping of it, and see that its writer is gone.
+    shm_unlink(name);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0) {
+        error = "can't create shared memory ring " + name_m + ": " + strerror(errno);
+        return false;
+    }
+    if (ftruncate(fd, mapSize_m) != 0) {
+        error = "can't size shared memory ring " + name_m + ": " + strerror(errno);
+        ::close(fd);
+        shm_unlink(name);
+        return false;
+    }
+
+    if (!map(fd, false, error)) {
+        shm_unlink(name);
+        return false;
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool ShmRing_t::openFile(char const * path, size_t capacity, std::string & error)
+{
+    capacity_m = 4096;
+    while (capacity_m < capacity) {
+        capacity_m *= 2;
+    }
+    name_m = path;
+    mapSize_m = SHM_RING_DATA_OFFSET + capacity_m;
+
+    // The paths are in the raw event bytes too, so the recorder doesn't copy them, to fit more events. It keeps the process names instead, which a dump can't look up once the processes have gone.
+    isPathsCopied_m = false;
+    procNames_pm = new ProcNameCache_t;
+
+    int fd = ::open(path, O_RDWR | O_CREAT, 0600);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        error = "can't open flight recorder " + name_m + ": " + strerror(errno);
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+
+    // A file of the same size may hold a previous run's ring.
+    bool isSameSize = st.st_size == (off_t) mapSize_m;
+    if (!isSameSize && ftruncate(fd, mapSize_m) != 0) {
+        error = "can't size flight recorder " + name_m + ": " + strerror(errno);
+        ::close(fd);
+        return false;
+    }
+    return map(fd, isSameSize, error);
+}
+
+//-----------------------------------------------------------------------------
+
+bool ShmRing_t::map(int fd, bool isResumed, std::string & error)
+{
+    void * p = mmap(NULL, mapSize_m, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        error = "can't map " + name_m + ": " + strerror(errno);
+        return false;
+    }
+    header_pm = (ShmRingHeader_t *) p;
+    data_pm = (char *) p + SHM_RING_DATA_OFFSET;
+
+    if (!isResumed || !resume()) {
+        header_pm->magic_m = 0;
+        header_pm->version_m = ShmRingHeader_t::VERSION;
+        header_pm->capacity_m = capacity_m;
+        header_pm->dataOffset_m = SHM_RING_DATA_OFFSET;
+        header_pm->tailPos_m = 0;
+        header_pm->reservePos_m = 0;
+        header_pm->writePos_m = 0;
+        pos_m = 0;
+        tailPos_m = 0;
+        nextSeq_m = 1;
+    }
+    header_pm->writerPid_m = getpid();
+    header_pm->writerStartUsec_m = getShmRingProcessStartUsec(getpid());
+    header_pm->isClosed_m = 0;
+
+    // The magic number goes in last, so that a reader never sees a half initialized header.
+    __atomic_store_n(&header_pm->magic_m, (uint32_t) ShmRingHeader_t::MAGIC, __ATOMIC_RELEASE);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+bool ShmRing_t::resume()
+{
+    ShmRingHeader_t const & header = *header_pm;
+    if (header.magic_m != ShmRingHeader_t::MAGIC || header.version_m != ShmRingHeader_t::VERSION || header.capacity_m != capacity_m ||
+        header.dataOffset_m != SHM_RING_DATA_OFFSET) {
+        return false;
+    }
+
+    // Carry on after the last good record, which is where a crash mid-write left the ring anyway.
+    std::vector<char> records;
+    if (!copyShmRingRecords(header, data_pm, records)) {
+        return false;
+    }
+    tailPos_m = header.tailPos_m;
+    pos_m = tailPos_m + records.size();
+    nextSeq_m = 1;
+    for (size_t offset = 0; offset < records.size(); ) {
+        ShmRingRecord_t const * record_p = (ShmRingRecord_t const *) &records[offset];
+        if (record_p->kind_m == SHM_RING_EVENT && record_p->size_m >= sizeof(ShmRingRecord_t)) {
+            nextSeq_m = record_p->seq_m + 1;
+        }
+        offset += record_p->size_m;
+    }
+
+    header_pm->reservePos_m = pos_m;
+    header_pm->writePos_m = pos_m;
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void ShmRing_t::publish(EventView_t const & event, uint32_t matchMask, int64_t eventNumber, uint64_t timeUsec)
+{
+    ShmRingPath_t paths [EventView_t::MAX_ARGS];
+    size_t numPaths = 0;
+    size_t pathBytes = 0;
+    for (int i = 0; i < event.numArgs_m && isPathsCopied_m; ++i) {
+        EventArg_t const & arg = event.args_am[i];
+        if (arg.isPath()) {
+            paths[numPaths].argIndex_m = (uint16_t) i;
+            paths[numPaths].len_m = (uint16_t) arg.pathLen();
+            pathBytes += paths[numPaths].len_m + 1;
+            numPaths++;
+        }
+    }
+
+    char const * procName = procNames_pm != NULL ? procNames_pm->getName(event.pid_m) : NULL;
+    size_t procNameLen = procName != NULL ? strlen(procName) : 0;
+    size_t size = getShmRingRecordSize(numPaths, pathBytes, event.size_m, procName != NULL ? procNameLen + 1 : 0);
+    if (size > capacity_m / 4) {
+        numTooBig_m++;
+        return;
+    }
+
+    // A record that wouldn't fit before the end of the ring goes at the start, after a padding record.
+    uint64_t room = capacity_m - (pos_m & (capacity_m - 1));
+    uint64_t padSize = room < size ? room : 0;
+    uint64_t endPos = pos_m + padSize + size;
+
+    // Drop the records that are about to be overwritten from the tail, so that the records from the tail up are always whole.
+    if (tailPos_m + capacity_m < endPos) {
+        while (tailPos_m + capacity_m < endPos) {
+            uint32_t oldSize;
+            memcpy(&oldSize, data_pm + (tailPos_m & (capacity_m - 1)), sizeof(oldSize));
+            tailPos_m += oldSize;
+        }
+        __atomic_store_n(&header_pm->tailPos_m, tailPos_m, __ATOMIC_RELAXED);
+    }
+
+    // Claim the bytes before overwriting them, so that a reader copying the old records there can tell.
+    __atomic_store_n(&header_pm->reservePos_m, endPos, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    if (padSize > 0) {
+        uint32_t pad [2] = { (uint32_t) padSize, SHM_RING_PAD };
+        copyIn(pos_m, pad, sizeof(pad));
+        pos_m += padSize;
+    }
+
+    ShmRingRecord_t record;
+    record.size_m = (uint32_t) size;
+    record.kind_m = SHM_RING_EVENT;
+    record.seq_m = nextSeq_m++;
+    record.eventNumber_m = (uint64_t) eventNumber;
+    record.timeUsec_m = timeUsec;
+    record.type_m = event.type_m;
+    record.pid_m = event.pid_m;
+    record.matchMask_m = matchMask;
+    record.numPaths_m = (uint16_t) numPaths;
+    record.reserved_m = 0;
+    record.rawSize_m = (uint32_t) event.size_m;
+    record.procNameLen_m = (uint32_t) procNameLen;
+
+    uint64_t pos = pos_m;
+    copyIn(pos, &record, sizeof(record));
+    pos += sizeof(record);
+    copyIn(pos, paths, numPaths * sizeof(ShmRingPath_t));
+    pos += numPaths * sizeof(ShmRingPath_t);
+    for (size_t i = 0; i < numPaths; ++i) {
+        EventArg_t const & arg = event.args_am[paths[i].argIndex_m];
+        copyIn(pos, arg.data_m, paths[i].len_m);
+        data_pm[(pos + paths[i].len_m) & (capacity_m - 1)] = '\0';
+        pos += paths[i].len_m + 1;
+    }
+    copyIn(pos, event.data_m, event.size_m);
+    pos += event.size_m;
+    if (procName != NULL) {
+        copyIn(pos, procName, procNameLen + 1);
+    }
+
+    // Publish the record.
+    pos_m += size;
+    __atomic_store_n(&header_pm->writePos_m, pos_m, __ATOMIC_RELEASE);
+}
+
+//-----------------------------------------------------------------------------
+
+void ShmRing_t::close()
+{
+    if (header_pm != NULL) {
+        __atomic_store_n(&header_pm->isClosed_m, 1u, __ATOMIC_RELEASE);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void ShmRing_t::snapshot(std::vector<char> & records) const
+{
+    copyShmRingRecords(*header_pm, data_pm, records);
+}
+
+//-----------------------------------------------------------------------------
+
+void ShmRing_t::appendStats(std::string & out, char const * prefix)
+{
+    char line [512];
+    snprintf(line, sizeof(line), "%s%s, %llu KiB, %llu events published, %llu too big\n", prefix, name_m.c_str(), (unsigned long long) capacity_m / 1024, (unsigned long long) nextSeq_m - 1, (unsigned long long) numTooBig_m);
+    out += line;
+}
+
+//-----------------------------------------------------------------------------
+
+bool copyShmRingRecords(ShmRingHeader_t const & header, char const * data, std::vector<char> & records)
+{
+    records.clear();
+    uint64_t capacity = header.capacity_m;
+    uint64_t tailPos = header.tailPos_m;
+    uint64_t writePos = header.writePos_m;
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0 || tailPos > writePos || writePos - tailPos > capacity || tailPos % 8 != 0) {
+        return false;
+    }
+
+    records.reserve(writePos - tailPos);
+    for (uint64_t pos = tailPos; pos < writePos; ) {
+        uint64_t offset = pos & (capacity - 1);
+        uint32_t size;
+        memcpy(&size, data + offset, sizeof(size));
+        if (!isShmRingRecordSizeValid(size, offset, capacity) || size > writePos - pos) {
+            break;
+        }
+        records.insert(records.end(), data + offset, data + offset + size);
+        pos += size;
+    }
+    return true;
+}
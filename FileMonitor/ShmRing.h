@@ -0,0 +1,108 @@
+#ifndef __INC_ShmRing_H
+#define __INC_ShmRing_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "EventView.h"
+#include "ProcNameCache.h"
+#include "ShmRingFormat.h"
+
+// This class publishes matched FS events into a shared memory ring, in the format described in ShmRingFormat.h, for readers on the same host that want the events without a copy through a pipe or socket and a system call per batch. The events are written by the reader thread as they are matched; publishing an event is a copy into the ring and a few stores, and never waits for the readers. ShmRingReader.h is the readers' side.
+//
+// The same ring in a memory mapped file is the flight recorder, which keeps the most recent events for post-mortems. Its data is in the page cache, so it survives a crash of the process, and a restarted filemon carries on after the records that are already there.
+class ShmRing_t
+{
+private:
+
+    std::string name_m;
+    bool isPathsCopied_m;
+    ShmRingHeader_t * header_pm;
+    char * data_pm;
+    size_t mapSize_m;
+    uint64_t capacity_m;
+    uint64_t pos_m;
+    uint64_t tailPos_m;
+    uint64_t nextSeq_m;
+    uint64_t numTooBig_m;
+    ProcNameCache_t * procNames_pm; // Only for the flight recorder
+
+public:
+
+    // Constructor.
+    ShmRing_t();
+
+    // Destructor. Unmaps the ring, leaving the shared memory object for its readers.
+    ~ShmRing_t();
+
+    // Creates the ring's shared memory object with a given capacity in bytes, which is rounded up to a power of two, replacing any ring of the same name left by a previous run. Returns false with an error message if it can't be created.
+    bool open(char const * name, size_t capacity, std::string & error);
+
+    // Opens a flight recorder file with a given capacity in bytes, which is rounded up to a power of two, continuing after its records if it already holds a ring of that capacity. Returns false with an error message if it can't be opened.
+    bool openFile(char const * path, size_t capacity, std::string & error);
+
+    // Publishes an event. Events too big for a quarter of the ring are counted and skipped.
+    void publish(EventView_t const & event, uint32_t matchMask, int64_t eventNumber, uint64_t timeUsec);
+
+    // Forgets the names of the processes that have exited. Called once per read of events.
+    void expireExitedProcesses()
+    {
+        if (procNames_pm != NULL) {
+            procNames_pm->expireExited();
+        }
+    }
+
+    // Marks the ring closed, so that readers know there will be no more events.
+    void close();
+
+    // Copies the records from the oldest to the newest into a buffer. The caller must prevent any publishing meanwhile.
+    void snapshot(std::vector<char> & records) const;
+
+    // Appends the ring's name, capacity and counters on a single line.
+    void appendStats(std::string & out, char const * prefix);
+
+private:
+
+    // Maps a ring's file descriptor, initializing the header unless a ring is being resumed. Returns false with an error message if it can't be mapped.
+    bool map(int fd, bool isResumed, std::string & error);
+
+    // Resumes publishing after the records of a mapped ring left by a previous run. Returns false if there is no valid ring to resume.
+    bool resume();
+
+    // Copies bytes into the ring at a position, which the caller has checked doesn't run past the end.
+    void copyIn(uint64_t pos, void const * data, size_t size)
+    {
+        memcpy(data_pm + (pos & (capacity_m - 1)), data, size);
+    }
+
+    // Not copyable.
+    ShmRing_t(ShmRing_t const &);
+    ShmRing_t & operator=(ShmRing_t const &);
+};
+
+// Copies the records of a ring from the oldest to the newest into a buffer, stopping at the first one that is malformed. Returns false if the ring's positions are invalid.
+bool copyShmRingRecords(ShmRingHeader_t const & header, char const * data, std::vector<char> & records);
+
+#endif // __INC_ShmRing_H
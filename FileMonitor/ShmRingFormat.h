@@ -0,0 +1,115 @@
+#ifndef __INC_ShmRingFormat_H
+#define __INC_ShmRingFormat_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/sysctl.h>
+#include <sys/types.h>
+
+// The shared memory ring is a POSIX shared memory object, e.g. "/filemon", that filemon publishes the matched events into for readers on the same host. The flight recorder file has the same layout, in a memory mapped file. There is one writer and any number of readers, each with its own cursor; the writer never waits for the readers, and a reader that falls more than the ring's capacity behind loses the events that were overwritten. All values are in native byte order.
+//
+// The object starts with a ShmRingHeader_t, followed at dataOffset_m by the ring of capacity_m bytes, a power of two. Positions in the ring count bytes written since the ring was created, and never wrap; the byte for a position is at (position & (capacity - 1)). Each record starts at a multiple of 8 bytes and never runs past the end of the ring; a record that wouldn't fit is preceded by a padding record that fills the rest of the ring.
+//
+// The writer stores its pid and start time in the header, so that a reader can tell that it has gone even if it died without closing the ring and its pid has since been reused. A start time of 0 is unknown, and then only the pid is checked.
+//
+// The writer keeps tailPos_m at the oldest record that hasn't been overwritten, so the records from tailPos_m up to writePos_m can always be walked, e.g. to recover them from a flight recorder file after a crash.
+//
+// To write a record the writer first moves tailPos_m past the records that it will overwrite, then stores reservePos_m, the end of the record, then writes the record, then stores writePos_m, with a release fence between each step. A reader reads the records between its cursor and writePos_m, copying each one out, and then re-reads reservePos_m: if it is more than the capacity past the start of the record, the writer may have overwritten the record while it was being copied, and the reader has been overrun. After an overrun the reader resumes at writePos_m, and the gap in the record sequence numbers says how many events were lost.
+
+// The header at the start of the shared memory object.
+struct ShmRingHeader_t
+{
+    enum { MAGIC = 0x52534d46, VERSION = 1 }; // 'FMSR'
+
+    uint32_t magic_m;
+    uint32_t version_m;
+    uint64_t capacity_m;
+    uint64_t dataOffset_m;
+    int32_t writerPid_m;
+    uint32_t isClosed_m; // Set when the writer exits cleanly
+
+    uint64_t tailPos_m;
+    uint64_t writerStartUsec_m; // Microseconds since the epoch when the writer process started
+    uint8_t reserved_am [16];
+
+    // The writer's positions, on their own cache line.
+    uint64_t reservePos_m;
+    uint64_t writePos_m;
+};
+
+// The kinds of record.
+enum ShmRingRecordKind_t
+{
+    SHM_RING_EVENT = 1,
+    SHM_RING_PAD = 2
+};
+
+// The header of each record. An event record is followed by a ShmRingPath_t for each path argument of the event, then the paths, each NUL terminated, then the raw bytes of the event as read from the fsevents device, and is padded to a multiple of 8 bytes. The flight recorder leaves out the paths, which are in the raw bytes too, so its records have no paths; instead the raw bytes are followed by the name of the event's process as it was when the event was read, NUL terminated, so that a dump after the process has gone still names it. A padding record only has the size and kind fields.
+struct ShmRingRecord_t
+{
+    uint32_t size_m; // The size of the whole record, including the header and padding
+    uint32_t kind_m;
+    uint64_t seq_m;         // Consecutive for the records of a ring, starting at 1
+    uint64_t eventNumber_m; // The event number, as in the other output formats
+    uint64_t timeUsec_m;    // Microseconds since the epoch when the event was read
+    int32_t type_m;         // The event type, with any extended info flags
+    int32_t pid_m;
+    uint32_t matchMask_m;   // The bit for each argument index that is a monitored path
+    uint16_t numPaths_m;
+    uint16_t reserved_m;
+    uint32_t rawSize_m;
+    uint32_t procNameLen_m; // For the flight recorder, the length of the process name, not including the terminating NUL; 0 if there is none
+};
+
+// A path argument of an event record.
+struct ShmRingPath_t
+{
+    uint16_t argIndex_m;
+    uint16_t len_m; // Not including the terminating NUL
+};
+
+// The offset of the ring in the shared memory object.
+enum { SHM_RING_DATA_OFFSET = 128 };
+
+// Is a record size valid for a record at an offset in a ring of a given capacity?
+inline bool isShmRingRecordSizeValid(uint64_t size, uint64_t offset, uint64_t capacity)
+{
+    return size >= 2 * sizeof(uint32_t) && size % 8 == 0 && size <= capacity - offset;
+}
+
+// Returns the start time of a process in microseconds since the epoch, or 0 if there is no such process.
+inline uint64_t getShmRingProcessStartUsec(pid_t pid)
+{
+    int mib [4] = { CTL_KERN, KERN_PROC, KERN_PROC_PID, pid };
+    struct kinfo_proc kp;
+    size_t len = sizeof(kp);
+    if (sysctl(mib, 4, &kp, &len, NULL, 0) != 0 || len == 0) {
+        return 0;
+    }
+    return kp.kp_proc.p_starttime.tv_sec * 1000000ull + kp.kp_proc.p_starttime.tv_usec;
+}
+
+// Returns the padded size of an event record.
+inline size_t getShmRingRecordSize(size_t numPaths, size_t pathBytes, size_t rawSize, size_t procNameBytes = 0)
+{
+    return (sizeof(ShmRingRecord_t) + numPaths * sizeof(ShmRingPath_t) + pathBytes + rawSize + procNameBytes + 7) & ~(size_t) 7;
+}
+
+#endif // __INC_ShmRingFormat_H
@@ -0,0 +1,229 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "ShmRingReader.h"
+
+unsigned const ShmRingReader_t::SPIN_POLLS;
+unsigned const ShmRingReader_t::MAX_SLEEP_USECS;
+
+//-----------------------------------------------------------------------------
+
+ShmRingReader_t::ShmRingReader_t()
+    : header_pm(NULL),
+      data_pm(NULL),
+      mapSize_m(0),
+      capacity_m(0),
+      cursor_m(0),
+      nextSeq_m(0),
+      numLost_m(0)
+{}
+
+//-----------------------------------------------------------------------------
+
+ShmRingReader_t::~ShmRingReader_t()
+{
+    close();
+}
+
+//-----------------------------------------------------------------------------
+
+bool ShmRingReader_t::open(char const * name, std::string & error)
+{
+    close();
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        error = std::string("can't open shared memory ring ") + name + ": " + strerror(errno);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(ShmRingHeader_t)) {
+        error = std::string("shared memory ring ") + name + " is not initialized";
+        ::close(fd);
+        return false;
+    }
+
+    void * p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        error = std::string("can't map shared memory ring ") + name + ": " + strerror(errno);
+        return false;
+    }
+    header_pm = (ShmRingHeader_t const *) p;
+    mapSize_m = st.st_size;
+
+    uint64_t capacity = header_pm->capacity_m;
+    if (__atomic_load_n(&header_pm->magic_m, __ATOMIC_ACQUIRE) != ShmRingHeader_t::MAGIC || header_pm->version_m != ShmRingHeader_t::VERSION ||
+        capacity == 0 || (capacity & (capacity - 1)) != 0 || header_pm->dataOffset_m + capacity > (uint64_t) st.st_size) {
+        error = std::string("shared memory ring ") + name + " is not a valid ring";
+        close();
+        return false;
+    }
+
+    data_pm = (char const *) p + header_pm->dataOffset_m;
+    capacity_m = capacity;
+    cursor_m = __atomic_load_n(&header_pm->writePos_m, __ATOMIC_ACQUIRE);
+    nextSeq_m = 0;
+    numLost_m = 0;
+    record_m.resize(4096);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void ShmRingReader_t::close()
+{
+    if (header_pm != NULL) {
+        munmap((void *) header_pm, mapSize_m);
+        header_pm = NULL;
+        data_pm = NULL;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+ShmRingReader_t::Result_t ShmRingReader_t::read(ShmRingEvent_t & event, unsigned timeoutMsecs)
+{
+    unsigned numPolls = 0;
+    unsigned sleepUsecs = 1;
+    uint64_t waitedUsecs = 0;
+
+    while (true) {
+        uint64_t writePos = __atomic_load_n(&header_pm->writePos_m, __ATOMIC_ACQUIRE);
+        if (cursor_m == writePos) {
+            if (__atomic_load_n(&header_pm->isClosed_m, __ATOMIC_ACQUIRE) != 0) {
+                return READ_CLOSED;
+            }
+            if (numPolls < SPIN_POLLS) {
+                numPolls++;
+                continue;
+            }
+            if (isWriterGone()) {
+                return READ_CLOSED;
+            }
+            if (waitedUsecs >= timeoutMsecs * 1000ull) {
+                return READ_TIMEOUT;
+            }
+            usleep(sleepUsecs);
+            waitedUsecs += sleepUsecs;
+            sleepUsecs = sleepUsecs * 2 < MAX_SLEEP_USECS ? sleepUsecs * 2 : MAX_SLEEP_USECS;
+            continue;
+        }
+
+        // Skip to the newest event once the writer has lapped the reader.
+        if (writePos - cursor_m > capacity_m) {
+            cursor_m = writePos;
+            continue;
+        }
+
+        // Copy the record out, and then check that the writer didn't start overwriting it meanwhile.
+        size_t offset = cursor_m & (capacity_m - 1);
+        uint32_t size;
+        memcpy(&size, data_pm + offset, sizeof(size));
+        bool isSizeValid = isShmRingRecordSizeValid(size, offset, capacity_m);
+        size_t copySize = isSizeValid ? size : 2 * sizeof(uint32_t);
+        if (record_m.size() < copySize) {
+            record_m.resize(copySize);
+        }
+        memcpy(&record_m[0], data_pm + offset, copySize);
+
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        uint64_t reservePos = __atomic_load_n(&header_pm->reservePos_m, __ATOMIC_RELAXED);
+        if (reservePos - cursor_m > capacity_m || !isSizeValid) {
+            cursor_m = __atomic_load_n(&header_pm->writePos_m, __ATOMIC_ACQUIRE);
+            continue;
+        }
+        cursor_m += size;
+
+        uint32_t kind;
+        memcpy(&kind, &record_m[sizeof(uint32_t)], sizeof(kind));
+        if (kind != SHM_RING_EVENT || !decode(event)) {
+            continue;
+        }
+
+        // A gap in the sequence numbers is the events that were overwritten before they could be read.
+        if (nextSeq_m != 0 && event.seq_m > nextSeq_m) {
+            numLost_m += event.seq_m - nextSeq_m;
+        }
+        nextSeq_m = event.seq_m + 1;
+        return READ_EVENT;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool ShmRingReader_t::isWriterGone() const
+{
+    pid_t pid = header_pm->writerPid_m;
+    if (kill(pid, 0) != 0 && errno == ESRCH) {
+        return true;
+    }
+
+    // A writer that died without closing the ring may have had its pid reused by another process, which started later.
+    uint64_t startUsec = header_pm->writerStartUsec_m;
+    return startUsec != 0 && getShmRingProcessStartUsec(pid) != startUsec;
+}
+
+//-----------------------------------------------------------------------------
+
+bool ShmRingReader_t::decode(ShmRingEvent_t & event) const
+{
+    char const * buf = &record_m[0];
+    ShmRingRecord_t record;
+    memcpy(&record, buf, sizeof(record));
+    if (record.size_m < sizeof(record) + record.numPaths_m * sizeof(ShmRingPath_t)) {
+        return false;
+    }
+
+    event.seq_m = record.seq_m;
+    event.eventNumber_m = record.eventNumber_m;
+    event.timeUsec_m = record.timeUsec_m;
+    event.type_m = record.type_m;
+    event.pid_m = record.pid_m;
+    event.matchMask_m = record.matchMask_m;
+    event.numPaths_m = 0;
+
+    ShmRingPath_t const * paths = (ShmRingPath_t const *) (buf + sizeof(record));
+    size_t pos = sizeof(record) + record.numPaths_m * sizeof(ShmRingPath_t);
+    for (size_t i = 0; i < record.numPaths_m; ++i) {
+        if (pos + paths[i].len_m + 1 > record.size_m) {
+            return false;
+        }
+        if (event.numPaths_m < ShmRingEvent_t::MAX_PATHS) {
+            event.paths_apm[event.numPaths_m] = buf + pos;
+            event.pathLens_am[event.numPaths_m] = paths[i].len_m;
+            event.pathArgIndexes_am[event.numPaths_m] = paths[i].argIndex_m;
+            event.numPaths_m++;
+        }
+        pos += paths[i].len_m + 1;
+    }
+
+    if (pos + record.rawSize_m > record.size_m) {
+        return false;
+    }
+    event.raw_m = buf + pos;
+    event.rawSize_m = record.rawSize_m;
+    return true;
+}
@@ -0,0 +1,117 @@
+#ifndef __INC_ShmRingReader_H
+#define __INC_ShmRingReader_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "ShmRingFormat.h"
+
+// An event read from a shared memory ring. The pointers point into the reader's copy of the record, so they are only valid until the next read.
+struct ShmRingEvent_t
+{
+    enum { MAX_PATHS = 16 };
+
+    uint64_t seq_m;
+    uint64_t eventNumber_m;
+    uint64_t timeUsec_m;
+    int32_t type_m;
+    int32_t pid_m;
+    uint32_t matchMask_m;
+
+    // The path arguments, with the index of each among the event's arguments.
+    size_t numPaths_m;
+    char const * paths_apm [MAX_PATHS];
+    size_t pathLens_am [MAX_PATHS];
+    int pathArgIndexes_am [MAX_PATHS];
+
+    // The raw bytes of the event as read from the fsevents device.
+    char const * raw_m;
+    size_t rawSize_m;
+};
+
+// This class reads the events that a filemon process publishes into a shared memory ring with the -R option. It is the client side of ShmRing_t, and only depends on ShmRingFormat.h, so it can be built into other programs. Each reader has its own cursor, which starts at the newest event; reading an event copies it out of the ring without any system call. When there are no new events the reader spins for a while, then sleeps for gradually longer, up to a millisecond, since there is no portable way on macOS to wait on a shared memory word.
+//
+// A reader that falls more than the ring's capacity behind is overrun: it skips to the newest event, and the events it missed are counted as lost.
+class ShmRingReader_t
+{
+public:
+
+    // The results of a read.
+    enum Result_t
+    {
+        READ_EVENT,   // An event was read
+        READ_TIMEOUT, // No event arrived in time
+        READ_CLOSED   // The writer has exited; reopen the ring to read from its next run
+    };
+
+private:
+
+    // Polls of the ring before the reader starts sleeping.
+    static unsigned const SPIN_POLLS = 1000;
+
+    // The longest sleep between polls.
+    static unsigned const MAX_SLEEP_USECS = 1000;
+
+    ShmRingHeader_t const * header_pm;
+    char const * data_pm;
+    size_t mapSize_m;
+    uint64_t capacity_m;
+    uint64_t cursor_m;
+    uint64_t nextSeq_m;
+    uint64_t numLost_m;
+    std::vector<char> record_m;
+
+public:
+
+    // Constructor.
+    ShmRingReader_t();
+
+    // Destructor.
+    ~ShmRingReader_t();
+
+    // Opens a ring by name, e.g. "/filemon", positioning the reader at its newest event. Returns false with an error message if there is no valid ring of that name.
+    bool open(char const * name, std::string & error);
+
+    // Closes the ring.
+    void close();
+
+    // Reads the next event, waiting up to a timeout in milliseconds for one to be published.
+    Result_t read(ShmRingEvent_t & event, unsigned timeoutMsecs);
+
+    // Returns the number of events lost to overruns.
+    uint64_t getNumLost() const { return numLost_m; }
+
+private:
+
+    // Checks whether the writer has exited.
+    bool isWriterGone() const;
+
+    // Decodes the copied event record. Returns false if it is malformed.
+    bool decode(ShmRingEvent_t & event) const;
+
+    // Not copyable.
+    ShmRingReader_t(ShmRingReader_t const &);
+    ShmRingReader_t & operator=(ShmRingReader_t const &);
+};
+
+#endif // __INC_ShmRingReader_H
@@ -0,0 +1,244 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+#include "JournalFormat.h"
+#include "Subscriber.h"
+
+size_t const Subscriber_t::MAX_OUTPUT;
+size_t const Subscriber_t::MAX_REPLIES;
+
+//-----------------------------------------------------------------------------
+
+Subscriber_t::Subscriber_t(int fd, QueryFunc_t onQuery)
+    : fd_m(fd),
+      onQuery_m(onQuery),
+      formatter_pm(new EventFormatter_t(false)),
+      out_m(MAX_OUTPUT, OUTPUT_DROP_NEWEST),
+      isRepliesOverflowed_m(false)
+{}
+
+//-----------------------------------------------------------------------------
+
+Subscriber_t::~Subscriber_t()
+{
+    close(fd_m);
+    delete formatter_pm;
+}
+
+//-----------------------------------------------------------------------------
+
+bool Subscriber_t::readCommands(bool & isChanged)
+{
+    char buf [4096];
+    ssize_t n = read(fd_m, buf, sizeof(buf));
+    if (n == 0 || (n < 0 && errno != EINTR && errno != EAGAIN)) {
+        return false;
+    }
+    if (n > 0) {
+        in_m.append(buf, n);
+    }
+
+    size_t start = 0;
+    for (size_t end = in_m.find('\n'); end != std::string::npos; end = in_m.find('\n', start)) {
+        std::string line(in_m, start, end - start);
+        if (!line.empty() && line[line.size() - 1] == '\r') {
+            line.erase(line.size() - 1);
+        }
+        processCmd(&line[0], isChanged);
+        start = end + 1;
+    }
+    in_m.erase(0, start);
+
+    // A client that sends an overlong line, or that doesn't read its replies, is misbehaving.
+    return in_m.size() <= 128 + PATH_MAX && !isRepliesOverflowed_m;
+}
+
+//-----------------------------------------------------------------------------
+
+void Subscriber_t::deliver(EventView_t const & event, char const * procName, uint32_t matchMask, int64_t eventNumber)
+{
+    if (!eventFilter_m.isPassed(event, procName)) {
+        return;
+    }
+
+    if (!pathFilter_m.isEmpty()) {
+        for (int i = 0; i < event.numArgs_m; ++i) {
+            EventArg_t const & arg = event.args_am[i];
+            if ((matchMask & (1u << i)) != 0 && !pathFilter_m.isPassed(arg.data_m, arg.pathLen())) {
+                matchMask &= ~(1u << i);
+            }
+        }
+        if (matchMask == 0) {
+            return;
+        }
+    }
+
+    // A client that doesn't keep up loses events, according to its output policy, rather than holding up everyone else. The event is counted under the parent directory of its first matched path if it is summarized.
+    text_m.clear();
+    formatter_pm->format(event, matchMask, eventNumber, text_m);
+
+    for (int i = 0; i < event.numArgs_m; ++i) {
+        if ((matchMask & (1u << i)) != 0) {
+            EventArg_t const & arg = event.args_am[i];
+            out_m.push(text_m.data(), text_m.size(), 1, arg.data_m, getParentDirLen(arg.data_m, arg.pathLen()));
+            return;
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool Subscriber_t::writeOutput()
+{
+    char const * text = NULL;
+    size_t len = 0;
+    while (out_m.peek(text, len)) {
+        ssize_t n = write(fd_m, text, len);
+        if (n < 0) {
+            out_m.consume(0);
+            if (errno == EINTR) {
+                continue;
+            }
+            return errno == EAGAIN;
+        }
+        out_m.consume(n);
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+void Subscriber_t::reply(std::string const & text)
+{
+    if (isRepliesOverflowed_m || out_m.getMessageBytes() + text.size() > MAX_REPLIES) {
+        isRepliesOverflowed_m = true;
+        return;
+    }
+    out_m.pushMessage(text.data(), text.size());
+}
+
+//-----------------------------------------------------------------------------
+
+void Subscriber_t::processCmd(char * line, bool & isChanged)
+{
+    // Monitored paths may be preceded by a list of event types, as on stdin.
+    if (strncmp(line, "add:", 4) == 0 || strncmp(line, "del:", 4) == 0) {
+        bool isAdd = line[0] == 'a';
+        char * path = line + 4;
+        uint32_t typeMask = DEFAULT_EVENT_TYPES_MASK;
+        char * colon = strchr(path, ':');
+        if (isAdd && path[0] != '/' && colon != NULL) {
+            *colon = '\0';
+            if (!parseEventTypeList(path, typeMask)) {
+                reply("Error: invalid event type list: " + std::string(path) + "\n");
+                return;
+            }
+            path = colon + 1;
+        }
+
+        size_t len = strlen(path);
+        while (len > 0 && path[len - 1] == '/') {
+            path[--len] = '\0';
+        }
+
+        if (isAdd) {
+            paths_m[std::string(path)] = typeMask;
+        }
+        else {
+            paths_m.erase(std::string(path));
+        }
+        isChanged = true;
+        return;
+    }
+
+    if (strcmp(line, "clr") == 0) {
+        paths_m.clear();
+        isChanged = true;
+        return;
+    }
+
+    if (strncmp(line, "policy:", 7) == 0) {
+        // Blocking on one client would hold up the reader, and so every other client.
+        OutputPolicy_t policy;
+        if (!parseOutputPolicy(line + 7, policy) || policy == OUTPUT_BLOCK) {
+            reply("Error: invalid output policy: " + std::string(line + 7) + "\n");
+        }
+        else {
+            out_m.setPolicy(policy);
+        }
+        return;
+    }
+
+    if (strcmp(line, "format:terse") == 0 || strcmp(line, "format:xml") == 0) {
+        delete formatter_pm;
+        formatter_pm = new EventFormatter_t(strcmp(line, "format:xml") == 0);
+        return;
+    }
+
+    std::string error;
+    if (eventFilter_m.processCmd(line, error)) {
+        if (!error.empty()) {
+            reply("Error: " + error + "\n");
+        }
+        isChanged = true;
+        return;
+    }
+
+    // Update the include/exclude pattern set, keeping the old set in case the new one doesn't compile.
+    PatternSet_t oldPatterns(patterns_m);
+    if (strncmp(line, "include:", 8) == 0) {
+        patterns_m.insert(PathPattern_t(line + 8, false, false));
+    }
+    else if (strncmp(line, "exclude:", 8) == 0) {
+        patterns_m.insert(PathPattern_t(line + 8, true, false));
+    }
+    else if (strncmp(line, "include-re:", 11) == 0) {
+        patterns_m.insert(PathPattern_t(line + 11, false, true));
+    }
+    else if (strncmp(line, "exclude-re:", 11) == 0) {
+        patterns_m.insert(PathPattern_t(line + 11, true, true));
+    }
+    else if (strcmp(line, "clr-filters") == 0) {
+        patterns_m.clear();
+        eventFilter_m.clear();
+        isChanged = true;
+    }
+    else {
+        std::string answer;
+        if (onQuery_m != NULL && onQuery_m(line, answer)) {
+            reply(answer);
+        }
+        else {
+            reply("Error: unknown command: " + std::string(line) + "\n");
+        }
+        return;
+    }
+
+    std::vector<PathPattern_t> patterns(patterns_m.begin(), patterns_m.end());
+    if (!pathFilter_m.compile(patterns, error)) {
+        reply("Error: " + error + "\n");
+        patterns_m.swap(oldPatterns);
+    }
+}
@@ -0,0 +1,111 @@
+#ifndef __INC_Subscriber_H
+#define __INC_Subscriber_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <set>
+#include <string>
+
+#include "EventFilter.h"
+#include "EventFormatter.h"
+#include "EventView.h"
+#include "OutputQueue.h"
+#include "PathFilter.h"
+
+// A function that answers a query command, such as a lookup in the mirrored trees, appending the answer to a reply. Returns false if the command isn't a query.
+typedef bool (*QueryFunc_t)(char const * line, std::string & reply);
+
+// This class is a client of the daemon's Unix socket. Each subscriber has its own monitored paths, path patterns, event predicates and output format, set by sending the same commands as filemon takes on stdin, one per line, plus "format:terse", "format:xml" and "policy:<policy>" to choose what happens to its events when it falls behind. The events matched for it are formatted into its output buffer and written to the socket without blocking.
+class Subscriber_t
+{
+public:
+
+    typedef std::map<std::string, uint32_t> PathMap_t;
+
+private:
+
+    typedef std::set<PathPattern_t> PatternSet_t;
+
+    // The most bytes of unwritten event output to hold before applying the output policy.
+    static size_t const MAX_OUTPUT = 16 * 1024 * 1024;
+
+    // The most bytes of unwritten replies to hold before disconnecting a client that sends commands without reading the replies.
+    static size_t const MAX_REPLIES = 16 * 1024 * 1024;
+
+    int fd_m;
+    QueryFunc_t onQuery_m;
+    EventFormatter_t * formatter_pm;
+    PathMap_t paths_m;
+    PatternSet_t patterns_m;
+    PathFilter_t pathFilter_m;
+    EventFilter_t eventFilter_m;
+    std::string in_m;
+    std::string text_m;
+    OutputQueue_t out_m;
+    bool isRepliesOverflowed_m;
+
+public:
+
+    // Constructor. The subscriber takes ownership of the socket. Commands that the subscriber doesn't know are passed to the query function, if there is one.
+    Subscriber_t(int fd, QueryFunc_t onQuery);
+
+    // Destructor. Closes the socket.
+    ~Subscriber_t();
+
+    // Returns the socket.
+    int getFd() const { return fd_m; }
+
+    // Returns the monitored paths, and the event types of interest for each.
+    PathMap_t const & getPaths() const { return paths_m; }
+
+    // Returns the event types that can pass the subscriber's event predicates.
+    uint32_t getTypeMask() const { return eventFilter_m.getTypeMask(); }
+
+    // Do the subscriber's event predicates need the name of an event's process?
+    bool isProcNameNeeded() const { return eventFilter_m.hasNamePredicates(); }
+
+    // Reads and processes the commands available on the socket. Sets a flag if the monitored paths or event types changed. Returns false if the client has gone away, or is to be disconnected for misbehaving.
+    bool readCommands(bool & isChanged);
+
+    // Delivers an event that is under the subscriber's monitored paths, checking it against the subscriber's predicates and patterns. The process name is the name of the event's process, which may be NULL unless isProcNameNeeded() is true. The match mask has the bit for each argument index set if that argument is a monitored path.
+    void deliver(EventView_t const & event, char const * procName, uint32_t matchMask, int64_t eventNumber);
+
+    // Is there output waiting to be written?
+    bool hasOutput() const { return !out_m.isEmpty(); }
+
+    // Writes as much of the waiting output as the socket takes without blocking. Returns false if the client has gone away.
+    bool writeOutput();
+
+private:
+
+    // Processes one command line.
+    void processCmd(char * line, bool & isChanged);
+
+    // Queues a reply to a command. Replies are never dropped, but a client that lets too many of them build up is disconnected.
+    void reply(std::string const & text);
+
+    // Not copyable.
+    Subscriber_t(Subscriber_t const &);
+    Subscriber_t & operator=(Subscriber_t const &);
+};
+
+#endif // __INC_Subscriber_H
@@ -0,0 +1,309 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "MutexLocker.h"
+#include "SubscriberServer.h"
+
+//-----------------------------------------------------------------------------
+// Make a file descriptor non-blocking.
+
+static bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+//-----------------------------------------------------------------------------
+
+SubscriberServer_t::SubscriberServer_t(pthread_mutex_t * mutex_p, void (*onChange)(), QueryFunc_t onQuery)
+    : mutex_pm(mutex_p),
+      onChange_m(onChange),
+      onQuery_m(onQuery),
+      listenFd_m(-1),
+      pendingOutput_m(0)
+{
+    wakeupPipe_am[0] = -1;
+    wakeupPipe_am[1] = -1;
+    for (int i = 0; i < PrefixIndex_t::MAX_SUBSCRIBERS; ++i) {
+        subscribers_apm[i] = NULL;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+bool SubscriberServer_t::open(char const * path, std::string & error)
+{
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        error = std::string("socket path too long: ") + path;
+        return false;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    path_m = path;
+
+    // A socket left behind by an earlier run would make bind fail. Anything else at the path is left alone.
+    struct stat st;
+    if (lstat(path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            error = "can't listen on " + path_m + ": not a socket";
+            return false;
+        }
+        unlink(path);
+    }
+
+    // Only root may connect by default, since subscribers can watch any path on the system. The socket is created with that mode, so that there is no window in which others could connect.
+    listenFd_m = socket(AF_UNIX, SOCK_STREAM, 0);
+    mode_t oldMask = umask(0177);
+    bool isBound = listenFd_m >= 0 && bind(listenFd_m, (struct sockaddr *) &addr, sizeof(addr)) == 0;
+    umask(oldMask);
+    if (!isBound || listen(listenFd_m, 16) != 0) {
+        error = "can't listen on " + path_m + ": " + strerror(errno);
+        return false;
+    }
+
+    if (pipe(wakeupPipe_am) != 0 || !setNonBlocking(wakeupPipe_am[1]) || !setNonBlocking(listenFd_m)) {
+        error = std::string("can't create server pipe: ") + strerror(errno);
+        return false;
+    }
+
+    if (pthread_create(&thread_m, NULL, threadEntry, this) != 0) {
+        perror(NULL);
+        exit(1);
+    }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+
+uint32_t SubscriberServer_t::getTypeMask() const
+{
+    uint32_t typeMask = 0;
+    for (int i = 0; i < PrefixIndex_t::MAX_SUBSCRIBERS; ++i) {
+        Subscriber_t const * subscriber_p = subscribers_apm[i];
+        if (subscriber_p == NULL) {
+            continue;
+        }
+
+        uint32_t pathTypeMask = 0;
+        Subscriber_t::PathMap_t const & paths = subscriber_p->getPaths();
+        for (Subscriber_t::PathMap_t::const_iterator iter = paths.begin(); iter != paths.end(); ++iter) {
+            pathTypeMask |= iter->second;
+        }
+        typeMask |= pathTypeMask & subscriber_p->getTypeMask();
+    }
+    return typeMask;
+}
+
+//-----------------------------------------------------------------------------
+
+void SubscriberServer_t::dispatch(EventView_t const & event, int64_t eventNumber)
+{
+    // Find the subscribers of each path argument in the combined index, then give each subscriber the event with the arguments that it matched.
+    int32_t type = event.getBaseType();
+    uint64_t argSubscribers [EventView_t::MAX_ARGS];
+    uint64_t subscribers = 0;
+    for (int i = 0; i < event.numArgs_m; ++i) {
+        EventArg_t const & arg = event.args_am[i];
+        argSubscribers[i] = arg.isPath() ? index_m.getSubscribers(arg.data_m, arg.pathLen(), type) : 0;
+        subscribers |= argSubscribers[i];
+    }
+
+    char const * procName = NULL;
+    while (subscribers != 0) {
+        int subscriber = __builtin_ctzll(subscribers);
+        uint64_t bit = 1ull << subscriber;
+        subscribers &= ~bit;
+
+        uint32_t matchMask = 0;
+        for (int i = 0; i < event.numArgs_m; ++i) {
+            if ((argSubscribers[i] & bit) != 0) {
+                matchMask |= 1u << i;
+            }
+        }
+        Subscriber_t * subscriber_p = subscribers_apm[subscriber];
+        if (procName == NULL && subscriber_p->isProcNameNeeded()) {
+            procName = procNames_m.getName(event.pid_m);
+        }
+        subscriber_p->deliver(event, procName, matchMask, eventNumber);
+        pendingOutput_m |= bit;
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void SubscriberServer_t::flush()
+{
+    bool isWakeupNeeded = false;
+    for (uint64_t pending = pendingOutput_m; pending != 0; ) {
+        int subscriber = __builtin_ctzll(pending);
+        pending &= ~(1ull << subscriber);
+
+        // Whatever the socket doesn't take now is left for the server thread, which waits for the socket to be writable.
+        Subscriber_t * subscriber_p = subscribers_apm[subscriber];
+        if (subscriber_p->writeOutput() && subscriber_p->hasOutput()) {
+            isWakeupNeeded = true;
+        }
+    }
+    pendingOutput_m = 0;
+
+    if (isWakeupNeeded) {
+        char c = 0;
+        write(wakeupPipe_am[1], &c, 1);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void * SubscriberServer_t::threadEntry(void * arg)
+{
+    static_cast<SubscriberServer_t *>(arg)->run();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void SubscriberServer_t::run()
+{
+    while (true) {
+        fd_set readfds;
+        fd_set writefds;
+        FD_ZERO(&readfds);
+        FD_ZERO(&writefds);
+        FD_SET(listenFd_m, &readfds);
+        FD_SET(wakeupPipe_am[0], &readfds);
+        int maxfd = listenFd_m > wakeupPipe_am[0] ? listenFd_m : wakeupPipe_am[0];
+
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(mutex_pm);
+            for (int i = 0; i < PrefixIndex_t::MAX_SUBSCRIBERS; ++i) {
+                if (subscribers_apm[i] != NULL) {
+                    int fd = subscribers_apm[i]->getFd();
+                    FD_SET(fd, &readfds);
+                    if (subscribers_apm[i]->hasOutput()) {
+                        FD_SET(fd, &writefds);
+                    }
+                    maxfd = fd > maxfd ? fd : maxfd;
+                }
+            }
+        }
+
+        if (select(maxfd + 1, &readfds, &writefds, NULL, NULL) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            perror(NULL);
+            exit(1);
+        }
+
+        if (FD_ISSET(wakeupPipe_am[0], &readfds)) {
+            char buf [64];
+            read(wakeupPipe_am[0], buf, sizeof(buf));
+        }
+
+        MUTEX_LOCK_UNTIL_SCOPE_EXIT(mutex_pm);
+
+        if (FD_ISSET(listenFd_m, &readfds)) {
+            accept();
+        }
+
+        bool isChanged = false;
+        for (int i = 0; i < PrefixIndex_t::MAX_SUBSCRIBERS; ++i) {
+            Subscriber_t * subscriber_p = subscribers_apm[i];
+            if (subscriber_p == NULL) {
+                continue;
+            }
+
+            int fd = subscriber_p->getFd();
+            bool isConnected = true;
+            if (FD_ISSET(fd, &readfds)) {
+                isConnected = subscriber_p->readCommands(isChanged);
+            }
+            if (isConnected && subscriber_p->hasOutput()) {
+                isConnected = subscriber_p->writeOutput();
+            }
+            if (!isConnected) {
+                remove(i);
+                isChanged = true;
+            }
+        }
+
+        if (isChanged) {
+            rebuildIndex();
+            onChange_m();
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void SubscriberServer_t::accept()
+{
+    int fd = ::accept(listenFd_m, NULL, NULL);
+    if (fd < 0) {
+        return;
+    }
+
+    for (int i = 0; i < PrefixIndex_t::MAX_SUBSCRIBERS; ++i) {
+        if (subscribers_apm[i] == NULL) {
+            setNonBlocking(fd);
+            subscribers_apm[i] = new Subscriber_t(fd, onQuery_m);
+            return;
+        }
+    }
+
+    static char const message [] = "Error: too many subscribers\n";
+    write(fd, message, sizeof(message) - 1);
+    close(fd);
+}
+
+//-----------------------------------------------------------------------------
+
+void SubscriberServer_t::remove(int subscriber)
+{
+    delete subscribers_apm[subscriber];
+    subscribers_apm[subscriber] = NULL;
+    pendingOutput_m &= ~(1ull << subscriber);
+}
+
+//-----------------------------------------------------------------------------
+
+void SubscriberServer_t::rebuildIndex()
+{
+    index_m.clear();
+    for (int i = 0; i < PrefixIndex_t::MAX_SUBSCRIBERS; ++i) {
+        if (subscribers_apm[i] == NULL) {
+            continue;
+        }
+        Subscriber_t::PathMap_t const & paths = subscribers_apm[i]->getPaths();
+        for (Subscriber_t::PathMap_t::const_iterator iter = paths.begin(); iter != paths.end(); ++iter) {
+            index_m.add(iter->first, i, iter->second);
+        }
+    }
+}
@@ -0,0 +1,96 @@
+#ifndef __INC_SubscriberServer_H
+#define __INC_SubscriberServer_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "EventView.h"
+#include "PrefixIndex.h"
+#include "ProcNameCache.h"
+#include "Subscriber.h"
+
+// This class serves FS events to many clients over a local Unix socket, so that the kernel event stream is read and decoded once however many tools are consuming it. Each client is a Subscriber_t with its own paths, filters and format. The monitored paths of all the subscribers are kept in one combined prefix index, so each event is matched once for all of them.
+//
+// The server thread accepts clients, reads their commands and writes output that couldn't be written right away. The events are dispatched on the reader thread. All of the server's state is protected by the mutex given to the constructor, which the reader thread already holds while processing events.
+class SubscriberServer_t
+{
+private:
+
+    pthread_mutex_t * mutex_pm;
+    void (*onChange_m)();
+    QueryFunc_t onQuery_m;
+    std::string path_m;
+    int listenFd_m;
+    int wakeupPipe_am [2];
+
+    Subscriber_t * subscribers_apm [PrefixIndex_t::MAX_SUBSCRIBERS];
+    PrefixIndex_t index_m;
+    uint64_t pendingOutput_m;
+
+    // The names of the processes checked against the subscribers' name predicates, looked up once per event for all of them.
+    ProcNameCache_t procNames_m;
+
+    pthread_t thread_m;
+
+public:
+
+    // Constructor. The change function is called, with the mutex held, whenever the subscribers' monitored paths or event types change. The query function, which may be NULL, answers the subscribers' query commands, also with the mutex held.
+    SubscriberServer_t(pthread_mutex_t * mutex_p, void (*onChange)(), QueryFunc_t onQuery);
+
+    // Creates the socket and starts the server thread. Returns false with an error message on failure.
+    bool open(char const * path, std::string & error);
+
+    // Returns the union of the event types that any subscriber is interested in. Must be called with the mutex held.
+    uint32_t getTypeMask() const;
+
+    // Dispatches an event to the subscribers that monitor any of its paths. Must be called with the mutex held.
+    void dispatch(EventView_t const & event, int64_t eventNumber);
+
+    // Forgets the names of the processes that have exited. Called once per read of events, with the mutex held.
+    void expireExitedProcesses() { procNames_m.expireExited(); }
+
+    // Writes the subscribers' output from the events dispatched since the last flush. Must be called with the mutex held.
+    void flush();
+
+private:
+
+    // The server thread entry function.
+    static void * threadEntry(void * arg);
+
+    // The server thread loop.
+    void run();
+
+    // Accepts a new client.
+    void accept();
+
+    // Disconnects a client.
+    void remove(int subscriber);
+
+    // Rebuilds the combined prefix index from the subscribers' paths.
+    void rebuildIndex();
+
+    // Not copyable.
+    SubscriberServer_t(SubscriberServer_t const &);
+    SubscriberServer_t & operator=(SubscriberServer_t const &);
+};
+
+#endif // __INC_SubscriberServer_H
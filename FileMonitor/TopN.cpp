@@ -0,0 +1,182 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "EventFormatter.h"
+#include "MutexLocker.h"
+#include "TopN.h"
+
+//-----------------------------------------------------------------------------
+// Get the number of counters to keep for reporting the top n keys. Space-Saving only guarantees to find the keys above total / capacity, so keep several times more counters than are reported.
+
+static size_t getCapacity(size_t n)
+{
+    return n * 8 > 64 ? n * 8 : 64;
+}
+
+//-----------------------------------------------------------------------------
+
+size_t const TopN_t::MAX_PATH_BYTES;
+
+//-----------------------------------------------------------------------------
+
+TopN_t::TopN_t(size_t n, unsigned intervalSecs, size_t numIntervals, FILE * out)
+    : n_m(n),
+      intervalSecs_m(intervalSecs),
+      numIntervals_m(numIntervals),
+      out_pm(out),
+      procs_m(numIntervals, getCapacity(n), sizeof(pid_t)),
+      paths_m(numIntervals, getCapacity(n), sizeof(PathId_t)),
+      dirs_m(numIntervals, getCapacity(n), sizeof(PathId_t)),
+      pathTable_m(MAX_PATH_BYTES),
+      numElapsed_m(0)
+{
+    pthread_mutex_init(&mutex_m, NULL);
+
+    if (pthread_create(&thread_m, NULL, threadEntry, this) != 0) {
+        perror(NULL);
+        exit(1);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void TopN_t::addEvent(EventView_t const & event, uint32_t matchMask)
+{
+    MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+
+    procs_m.add((char const *) &event.pid_m, sizeof(event.pid_m));
+
+    for (int i = 0; i < event.numArgs_m; ++i) {
+        if ((matchMask & (1u << i)) == 0) {
+            continue;
+        }
+
+        EventArg_t const & arg = event.args_am[i];
+        size_t pathLen = arg.pathLen();
+        PathId_t pathId = pathTable_m.intern(arg.data_m, pathLen);
+        paths_m.add((char const *) &pathId, sizeof(pathId));
+
+        // The parent directory is everything before the last slash, or the root for a top level path.
+        size_t dirLen = pathLen;
+        while (dirLen > 0 && arg.data_m[dirLen - 1] != '/') {
+            --dirLen;
+        }
+        PathId_t dirId = pathTable_m.intern(arg.data_m, dirLen > 1 ? dirLen - 1 : dirLen);
+        dirs_m.add((char const *) &dirId, sizeof(dirId));
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void * TopN_t::threadEntry(void * arg)
+{
+    static_cast<TopN_t *>(arg)->run();
+    return NULL;
+}
+
+//-----------------------------------------------------------------------------
+
+void TopN_t::run()
+{
+    std::vector<HeavyHitter_t> procs;
+    std::vector<HeavyHitter_t> paths;
+    std::vector<HeavyHitter_t> dirs;
+
+    while (true) {
+        sleep(intervalSecs_m);
+
+        // Take a snapshot of the window and start a new interval, then print outside of the lock so that event processing isn't held up.
+        uint64_t total;
+        size_t numElapsed;
+        {
+            MUTEX_LOCK_UNTIL_SCOPE_EXIT(&mutex_m);
+            if (numElapsed_m < numIntervals_m) {
+                numElapsed_m += 1;
+            }
+            numElapsed = numElapsed_m;
+            total = procs_m.getTotal();
+            procs_m.getTop(n_m, procs);
+            paths_m.getTop(n_m, paths);
+            dirs_m.getTop(n_m, dirs);
+            resolvePaths(paths);
+            resolvePaths(dirs);
+            procs_m.rotate();
+            paths_m.rotate();
+            dirs_m.rotate();
+
+            // The summaries only hold the ids of paths added during the window, so the rest can be evicted.
+            pathTable_m.advanceEpoch();
+            pathTable_m.evict(pathTable_m.getEpoch() - (numIntervals_m - 1));
+        }
+
+        fprintf(out_pm, "TOP %lu: %llu events in the last %lu seconds\n", (unsigned long) n_m, (unsigned long long) total, (unsigned long) (numElapsed * intervalSecs_m));
+        printSection("PROCESS", procs, true);
+        printSection("DIRECTORY", dirs, false);
+        printSection("PATH", paths, false);
+        fprintf(out_pm, "\n");
+        fflush(out_pm);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void TopN_t::resolvePaths(std::vector<HeavyHitter_t> & top) const
+{
+    for (size_t i = 0; i < top.size(); ++i) {
+        std::string & key = top[i].key_m;
+        PathId_t id;
+        memcpy(&id, key.data(), sizeof(id));
+
+        // Paths that arrived while the path table was full are counted together.
+        size_t len = 0;
+        char const * path = pathTable_m.getPath(id, len);
+        if (path != NULL) {
+            key.assign(path, len);
+        }
+        else {
+            key = "(untracked paths)";
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void TopN_t::printSection(char const * title, std::vector<HeavyHitter_t> const & top, bool isPid)
+{
+    // The counts are upper bounds; the error column is how much they may overestimate by.
+    fprintf(out_pm, "  %10s %8s  %s\n", "EVENTS", "ERROR", title);
+    for (size_t i = 0; i < top.size(); ++i) {
+        HeavyHitter_t const & hitter = top[i];
+        fprintf(out_pm, "  %10llu %8llu  ", (unsigned long long) hitter.count_m, (unsigned long long) hitter.error_m);
+        if (isPid) {
+            pid_t pid;
+            memcpy(&pid, hitter.key_m.data(), sizeof(pid));
+            fprintf(out_pm, "%d (%s)\n", pid, getProcessName(pid).c_str());
+        }
+        else {
+            fprintf(out_pm, "%s\n", hitter.key_m.c_str());
+        }
+    }
+}
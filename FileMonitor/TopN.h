@@ -0,0 +1,79 @@
+#ifndef __INC_TopN_H
+#define __INC_TopN_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "EventView.h"
+#include "HeavyHitters.h"
+#include "PathTable.h"
+
+// This class aggregates matched FS events into heavy hitter summaries of the processes, paths and parent directories that generate the most events, with the paths interned so that the summaries hold compact ids, and prints a table of the top entries every interval in place of the individual events. The summaries cover a sliding window of a number of intervals, and their memory is fixed regardless of the event rate.
+class TopN_t
+{
+private:
+
+    // The most bytes of paths to intern. Paths are keyed in the summaries by their interned ids, and evicted once they fall out of the window.
+    static size_t const MAX_PATH_BYTES = 16 * 1024 * 1024;
+
+    size_t n_m;
+    unsigned intervalSecs_m;
+    size_t numIntervals_m;
+    FILE * out_pm;
+
+    // Protects the summaries.
+    pthread_mutex_t mutex_m;
+    HeavyHitters_t procs_m;
+    HeavyHitters_t paths_m;
+    HeavyHitters_t dirs_m;
+    PathTable_t pathTable_m;
+    size_t numElapsed_m;
+
+    pthread_t thread_m;
+
+public:
+
+    // Constructor. Starts the reporter thread.
+    TopN_t(size_t n, unsigned intervalSecs, size_t numIntervals, FILE * out);
+
+    // Counts a matched event. The match mask has the bit for each argument index set if that argument is a monitored path.
+    void addEvent(EventView_t const & event, uint32_t matchMask);
+
+private:
+
+    // The reporter thread entry function.
+    static void * threadEntry(void * arg);
+
+    // The reporter thread loop.
+    void run();
+
+    // Replaces the path ids in the keys of a report with the paths.
+    void resolvePaths(std::vector<HeavyHitter_t> & top) const;
+
+    // Prints one section of a report.
+    void printSection(char const * title, std::vector<HeavyHitter_t> const & top, bool isPid);
+
+    // Not copyable.
+    TopN_t(TopN_t const &);
+    TopN_t & operator=(TopN_t const &);
+};
+
+#endif // __INC_TopN_H
@@ -30,8 +30,7 @@ XmlStrBuilder_t::XmlStrBuilder_t()
 
 void XmlStrBuilder_t::clear()
 {
-    os_m.str("");
-    tags_m.clear();
+    doc_m.clear();
     indent_m = 0;
 }
 
@@ -39,12 +38,14 @@ void XmlStrBuilder_t::clear()
 
 void XmlStrBuilder_t::pushTag(char const * tag)
 {
-    std::string s(tag);
-    tags_m.push_back(s);
-
     indent();
-    os_m << "<" << tag << ">" << std::endl;
+    doc_m += '<';
+    doc_m += tag;
+    doc_m += ">\n";
 
+    if (indent_m < MAX_DEPTH) {
+        tags_apm[indent_m] = tag;
+    }
     indent_m += 1;
 }
 
@@ -52,23 +53,29 @@ void XmlStrBuilder_t::pushTag(char const * tag)
 
 void XmlStrBuilder_t::popTag()
 {
-    if (!tags_m.empty()) {
+    if (indent_m > 0) {
         indent_m -= 1;
-        indent();
-        os_m << "</" << tags_m.back() << ">" <<std::endl;
-        tags_m.pop_back();
+        if (indent_m < MAX_DEPTH) {
+            indent();
+            doc_m += "</";
+            doc_m += tags_apm[indent_m];
+            doc_m += ">\n";
+        }
     }
 }
 
 //-----------------------------------------------------------------------------
 
-void XmlStrBuilder_t::addTagAndValue(char const * tag, std::string const & str)
+void XmlStrBuilder_t::addTagAndValue(char const * tag, char const * str, size_t len)
 {
     indent();
-    os_m << "<" << tag << ">"
-         << str
-         << "</" << tag << ">"
-         << std::endl;
+    doc_m += '<';
+    doc_m += tag;
+    doc_m += '>';
+    appendXmlSafe(str, len);
+    doc_m += "</";
+    doc_m += tag;
+    doc_m += ">\n";
 }
 
 //-----------------------------------------------------------------------------
@@ -83,24 +90,46 @@ void XmlStrBuilder_t::addTagAndVararg(char const * tag, char const * format, ...
     va_end(vargs);
 
     indent();
-    os_m << "<" << tag << ">"
-         << buf_am
-         << "</" << tag << ">"
-         << std::endl;
+    doc_m += '<';
+    doc_m += tag;
+    doc_m += '>';
+    doc_m += buf_am;
+    doc_m += "</";
+    doc_m += tag;
+    doc_m += ">\n";
 }
 
 //-----------------------------------------------------------------------------
 
-std::string XmlStrBuilder_t::str()
+void XmlStrBuilder_t::indent()
 {
-    return os_m.str();
+    doc_m.append(2 * indent_m, ' ');
 }
 
 //-----------------------------------------------------------------------------
 
-void XmlStrBuilder_t::indent()
+void XmlStrBuilder_t::appendXmlSafe(char const * str, size_t len)
 {
-    for (int i = 0; i < indent_m; ++i) {
-        os_m << "  ";
+    // Runs of characters that need no escape are appended in one go.
+    size_t start = 0;
+    for (size_t i = 0; i < len; ++i) {
+        char const * escape;
+        switch (str[i]) {
+            case '&':
+                escape = "&amp;";
+                break;
+            case '<':
+                escape = "&lt;";
+                break;
+            case '>':
+                escape = "&gt;";
+                break;
+            default:
+                continue;
+        }
+        doc_m.append(str + start, i - start);
+        doc_m += escape;
+        start = i + 1;
     }
+    doc_m.append(str + start, len - start);
 }
@@ -18,20 +18,22 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-#include <iostream>
-#include <sstream>
-#include <deque>
+#include <stddef.h>
+
 #include <string>
 
-// This class provides a convenient way of bullding an XML document and then converting it to a string.
+// This class provides a convenient way of bullding an XML document and then converting it to a string. The document is built in a string that is kept across clear()s, so once it has grown to the size of the largest document, building one doesn't allocate.
 class XmlStrBuilder_t
 {
 private:
 
-    std::ostringstream os_m;
+    // The deepest nesting of tags. Deeper tags are written, but not closed.
+    enum { MAX_DEPTH = 16 };
+
+    std::string doc_m;
 
-    typedef std::deque<std::string> Tags_t;
-    Tags_t tags_m;
+    // The open tags. They must outlive the document, e.g. string literals.
+    char const * tags_apm [MAX_DEPTH];
 
     int indent_m;
 
@@ -51,19 +53,22 @@ public:
     // Pops back a level on the XML document stack. The tag still remains, but new content added to the XML document will be at one level above.
     void popTag();
 
-    // Adds a closed tag to the XML document, e.g. <tagName>content</tagName>
-    void addTagAndValue(char const * tag, std::string const & str);
+    // Adds a closed tag to the XML document, e.g. <tagName>content</tagName>. The content is escaped to make it safe to be included in XML.
+    void addTagAndValue(char const * tag, char const * str, size_t len);
 
     // Adds a closed tag to the XML document where the content is in vararg format, e.g. <tagName>content</tagName>
     void addTagAndVararg(char const * tag, char const * format, ...);
 
-    // Returns the entire XML document as a string.
-    std::string str();
+    // Returns the entire XML document.
+    std::string const & str() const { return doc_m; }
 
 private:
 
     // Adds indentation to the current line.
     void indent();
+
+    // Appends a string with escapes to make it safe to be included as content in XML.
+    void appendXmlSafe(char const * str, size_t len);
 };
 
 #endif // __INC_XmlStrBuilder_H
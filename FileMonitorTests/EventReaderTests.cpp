@@ -0,0 +1,164 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "EventReader.h"
+#include "EventView.h"
+#include "Test.h"
+
+//-----------------------------------------------------------------------------
+// Describe the events in a buffer, one line per event with its type, pid and paths, returning the number of bytes of complete events.
+
+static size_t describeEvents(char const * buf, size_t size, std::string & out)
+{
+    EventIterator_t iter(buf, size);
+    EventView_t event;
+    while (iter.next(event)) {
+        char header [64];
+        snprintf(header, sizeof(header), "%d %d", (int) event.type_m, (int) event.pid_m);
+        out += header;
+        for (int i = 0; i < event.numArgs_m; ++i) {
+            if (event.args_am[i].isPath()) {
+                out += " ";
+                out.append(event.args_am[i].data_m, event.args_am[i].pathLen());
+            }
+        }
+        out += "\n";
+    }
+    return iter.getConsumed();
+}
+
+//-----------------------------------------------------------------------------
+// Describe the complete events buffered by a reader, carrying over the rest.
+
+static void readEvents(EventReader_t & reader, std::string & out)
+{
+    reader.consume(describeEvents(reader.getData(), reader.getSize(), out));
+}
+
+//-----------------------------------------------------------------------------
+// Make a stream of events of different sizes, including one with a path much longer than a socket's typical read.
+
+static void makeTestStream(std::vector<char> & stream)
+{
+    std::string longPath = "/Users/alice";
+    while (longPath.size() < 1000) {
+        longPath += "/directory";
+    }
+
+    appendTestEvent(stream, FSE_CREATE_FILE, 101, "/Users/alice/a.txt");
+    appendTestEvent(stream, FSE_RENAME, 102, "/Users/alice/a.txt", "/Users/alice/b.txt");
+    appendTestEvent(stream, FSE_CONTENT_MODIFIED, 103, longPath.c_str());
+    appendTestEvent(stream, FSE_DELETE, 104, "/tmp/x");
+    appendTestEvent(stream, FSE_CONTENT_MODIFIED | (FSE_COMBINED_EVENTS << FSE_FLAG_SHIFT), 105, "/tmp/y");
+}
+
+//-----------------------------------------------------------------------------
+// Every split of a stream into two reads decodes to the same events as the whole stream.
+
+static void testSplitAtEveryOffset()
+{
+    std::vector<char> stream;
+    makeTestStream(stream);
+
+    std::string expected;
+    CHECK(describeEvents(&stream[0], stream.size(), expected) == stream.size());
+
+    for (size_t split = 0; split <= stream.size(); ++split) {
+        int fds [2];
+        CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        EventReader_t reader(fds[0], 0);
+        std::string actual;
+
+        if (split > 0) {
+            CHECK(write(fds[1], &stream[0], split) == (ssize_t) split);
+            CHECK(reader.read() == (ssize_t) split);
+            readEvents(reader, actual);
+        }
+        if (split < stream.size()) {
+            CHECK(write(fds[1], &stream[split], stream.size() - split) == (ssize_t) (stream.size() - split));
+        }
+        close(fds[1]);
+        while (reader.read() > 0) {
+            readEvents(reader, actual);
+        }
+
+        CHECK(actual == expected);
+        CHECK(reader.getSize() == 0);
+        close(fds[0]);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// A stream that arrives a byte at a time decodes to the same events, with every event carried over many times.
+
+static void testByteAtATime()
+{
+    std::vector<char> stream;
+    makeTestStream(stream);
+
+    std::string expected;
+    describeEvents(&stream[0], stream.size(), expected);
+
+    int fds [2];
+    CHECK(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    EventReader_t reader(fds[0], 0);
+    std::string actual;
+    for (size_t i = 0; i < stream.size(); ++i) {
+        CHECK(write(fds[1], &stream[i], 1) == 1);
+        CHECK(reader.read() == 1);
+        readEvents(reader, actual);
+    }
+
+    CHECK(actual == expected);
+    CHECK(reader.getSize() == 0);
+    close(fds[0]);
+    close(fds[1]);
+}
+
+//-----------------------------------------------------------------------------
+// A truncated stream leaves its incomplete event buffered, and stops the iteration rather than decoding it.
+
+static void testTruncatedEvent()
+{
+    std::vector<char> stream;
+    makeTestStream(stream);
+
+    for (size_t size = 0; size < stream.size(); ++size) {
+        EventIterator_t iter(&stream[0], size);
+        EventView_t event;
+        while (iter.next(event)) {
+        }
+        CHECK(iter.getConsumed() <= size);
+        CHECK(iter.getConsumed() == size || iter.isTruncated());
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void runEventReaderTests()
+{
+    testSplitAtEveryOffset();
+    testByteAtATime();
+    testTruncatedEvent();
+}
@@ -0,0 +1,250 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "EventView.h"
+#include "fsevents.h"
+#include "Journal.h"
+#include "JournalFormat.h"
+#include "Test.h"
+
+//-----------------------------------------------------------------------------
+// A journal directory for a test, which is removed along with its files when the test is done.
+
+class TestJournalDir_t
+{
+public:
+
+    std::string path_m;
+
+    // Constructor. Creates the directory.
+    TestJournalDir_t()
+    {
+        char path [] = "/tmp/filemon-tests-journal-XXXXXX";
+        CHECK(mkdtemp(path) != NULL);
+        path_m = path;
+    }
+
+    // Destructor.
+    ~TestJournalDir_t()
+    {
+        DIR * dir = opendir(path_m.c_str());
+        if (dir != NULL) {
+            struct dirent * entry;
+            while ((entry = readdir(dir)) != NULL) {
+                if (entry->d_name[0] != '.') {
+                    unlink((path_m + "/" + entry->d_name).c_str());
+                }
+            }
+            closedir(dir);
+        }
+        rmdir(path_m.c_str());
+    }
+
+private:
+
+    // Not copyable.
+    TestJournalDir_t(TestJournalDir_t const &);
+    TestJournalDir_t & operator=(TestJournalDir_t const &);
+};
+
+//-----------------------------------------------------------------------------
+// Append events numbered from a first one up to a last one, each with its number as its pid and as its time in microseconds.
+
+static void appendTestEvents(Journal_t & journal, int first, int last)
+{
+    for (int i = first; i <= last; ++i) {
+        std::vector<char> buf;
+        appendTestEvent(buf, FSE_CREATE_FILE, i, "/tmp/journal/file");
+        EventIterator_t iter(&buf[0], buf.size());
+        EventView_t event;
+        CHECK(iter.next(event));
+        journal.append(event, i);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Read a whole file into a string.
+
+static std::string readTestFile(std::string const & path)
+{
+    std::string data;
+    FILE * file = fopen(path.c_str(), "rb");
+    CHECK(file != NULL);
+    if (file != NULL) {
+        char buf [64 * 1024];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), file)) > 0) {
+            data.append(buf, n);
+        }
+        fclose(file);
+    }
+    return data;
+}
+
+//-----------------------------------------------------------------------------
+// Read the good records of a segment.
+
+static std::vector<JournalRecord_t> readTestRecords(std::string const & data)
+{
+    std::vector<JournalRecord_t> records;
+    JournalRecordIterator_t iter(data.data(), data.size());
+    JournalRecord_t record;
+    while (iter.next(record)) {
+        records.push_back(record);
+    }
+    return records;
+}
+
+//-----------------------------------------------------------------------------
+// A segment cut off in the middle of a record, as by a crash, is truncated after its last good record when the journal is reopened, its time index loses the entries that point past it, and the journal carries on with the next sequence number.
+
+static void testRecover()
+{
+    TestJournalDir_t dir;
+    JournalConfig_t config;
+    config.dir_m = dir.path_m;
+    std::string error;
+
+    {
+        Journal_t journal(config);
+        CHECK(journal.open(error));
+        appendTestEvents(journal, 1, 1000);
+        journal.close();
+    }
+
+    std::vector<uint64_t> firstSeqs;
+    CHECK(listJournalSegments(dir.path_m, firstSeqs));
+    CHECK(firstSeqs.size() == 1 && firstSeqs[0] == 1);
+    std::string path = getJournalSegmentPath(dir.path_m, 1, ".fmj");
+    std::string timeIndexPath = getJournalSegmentPath(dir.path_m, 1, ".fmt");
+
+    // A time index entry is written every 256 records, so cutting off record 701 leaves those for records 1, 257 and 513.
+    std::string data = readTestFile(path);
+    std::vector<JournalRecord_t> records = readTestRecords(data);
+    CHECK(records.size() == 1000);
+    CHECK(readTestFile(timeIndexPath).size() == 4 * sizeof(JournalTimeIndexEntry_t));
+    size_t keptSize = records[700].offset_m;
+    CHECK(truncate(path.c_str(), keptSize + 10) == 0);
+
+    {
+        Journal_t journal(config);
+        CHECK(journal.open(error));
+        CHECK(readTestFile(path).size() == keptSize);
+        appendTestEvents(journal, 2001, 2001);
+        journal.close();
+    }
+
+    data = readTestFile(path);
+    records = readTestRecords(data);
+    CHECK(records.size() == 701);
+    for (size_t i = 0; i < records.size(); ++i) {
+        CHECK(records[i].header_pm->seq_m == i + 1);
+    }
+    CHECK(records.back().header_pm->pid_m == 2001);
+    CHECK(records.back().offset_m == keptSize);
+
+    std::string timeIndex = readTestFile(timeIndexPath);
+    CHECK(timeIndex.size() == 3 * sizeof(JournalTimeIndexEntry_t));
+    for (size_t i = 0; i * sizeof(JournalTimeIndexEntry_t) < timeIndex.size(); ++i) {
+        JournalTimeIndexEntry_t entry;
+        memcpy(&entry, timeIndex.data() + i * sizeof(entry), sizeof(entry));
+        CHECK(entry.seq_m == i * 256 + 1);
+        CHECK(entry.offset_m == records[i * 256].offset_m);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Full segments are sealed with a path index that carries on where the previous segment left off, and once the journal is over its size limit the oldest segments are deleted, but never the active one.
+
+static void testSealingAndRetention()
+{
+    TestJournalDir_t dir;
+    JournalConfig_t config;
+    config.dir_m = dir.path_m;
+    config.segmentSize_m = 16 * 1024;
+    config.maxSize_m = 64 * 1024;
+    std::string error;
+
+    {
+        Journal_t journal(config);
+        CHECK(journal.open(error));
+        appendTestEvents(journal, 1, 2000);
+        journal.close();
+    }
+
+    std::vector<uint64_t> firstSeqs;
+    CHECK(listJournalSegments(dir.path_m, firstSeqs));
+    CHECK(firstSeqs.size() >= 2);
+    CHECK(firstSeqs.size() > 0 && firstSeqs[0] > 1);
+
+    uint64_t totalSize = 0;
+    for (size_t i = 0; i < firstSeqs.size(); ++i) {
+        std::string data = readTestFile(getJournalSegmentPath(dir.path_m, firstSeqs[i], ".fmj"));
+        std::vector<JournalRecord_t> records = readTestRecords(data);
+        CHECK(!records.empty());
+        CHECK(data.size() <= config.segmentSize_m);
+        totalSize += data.size();
+        if (records.empty()) {
+            continue;
+        }
+        CHECK(records.front().header_pm->seq_m == firstSeqs[i]);
+
+        struct stat st;
+        std::string pathIndexPath = getJournalSegmentPath(dir.path_m, firstSeqs[i], ".fmp");
+        if (i + 1 == firstSeqs.size()) {
+            CHECK(stat(pathIndexPath.c_str(), &st) != 0);
+            CHECK(records.back().header_pm->seq_m == 2000);
+            continue;
+        }
+
+        std::string pathIndex = readTestFile(pathIndexPath);
+        JournalPathIndexHeader_t header;
+        CHECK(pathIndex.size() >= sizeof(header));
+        if (pathIndex.size() < sizeof(header)) {
+            continue;
+        }
+        memcpy(&header, pathIndex.data(), sizeof(header));
+        CHECK(header.magic_m == JournalPathIndexHeader_t::MAGIC);
+        CHECK(header.firstSeq_m == firstSeqs[i]);
+        CHECK(header.lastSeq_m == records.back().header_pm->seq_m);
+        CHECK(header.lastSeq_m + 1 == firstSeqs[i + 1]);
+        CHECK(header.numRecords_m == records.size());
+        CHECK(header.numDirs_m == 1);
+    }
+
+    // The limit is applied as each segment is started, so the active segment can take the journal over it.
+    CHECK(totalSize <= config.maxSize_m + config.segmentSize_m);
+}
+
+//-----------------------------------------------------------------------------
+
+void runJournalTests()
+{
+    testRecover();
+    testSealingAndRetention();
+}
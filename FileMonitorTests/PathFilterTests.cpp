@@ -0,0 +1,303 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "PathFilter.h"
+#include "Test.h"
+
+//-----------------------------------------------------------------------------
+// Does a NUL terminated path pass a filter?
+
+static bool isPassed(PathFilter_t const & filter, char const * path)
+{
+    return filter.isPassed(path, strlen(path));
+}
+
+//-----------------------------------------------------------------------------
+// Compile a filter from a single pattern.
+
+static void compileTestFilter(PathFilter_t & filter, char const * text, bool isExclude, bool isRegex)
+{
+    std::vector<PathPattern_t> patterns;
+    patterns.push_back(PathPattern_t(text, isExclude, isRegex));
+    std::string error;
+    CHECK(filter.compile(patterns, error));
+}
+
+//-----------------------------------------------------------------------------
+// An empty filter passes every path, and so does one that has been recompiled with no patterns.
+
+static void testEmptyFilter()
+{
+    PathFilter_t filter;
+    CHECK(filter.isEmpty());
+    CHECK(isPassed(filter, "/a/b.o"));
+
+    compileTestFilter(filter, "*.o", true, false);
+    CHECK(!filter.isEmpty());
+    CHECK(!isPassed(filter, "/a/b.o"));
+
+    std::string error;
+    CHECK(filter.compile(std::vector<PathPattern_t>(), error));
+    CHECK(filter.isEmpty());
+    CHECK(isPassed(filter, "/a/b.o"));
+}
+
+//-----------------------------------------------------------------------------
+// A '*' matches within a path component, and an unrooted glob matches any component and everything below it, while a rooted one matches from the root only.
+
+static void testGlobStar()
+{
+    PathFilter_t filter;
+    compileTestFilter(filter, "*.o", true, false);
+    CHECK(!isPassed(filter, "/a/b.o"));
+    CHECK(!isPassed(filter, "/b.o"));
+    CHECK(!isPassed(filter, "/a/b.o/c"));
+    CHECK(isPassed(filter, "/a/b.c"));
+    CHECK(isPassed(filter, "/a/bo"));
+    CHECK(isPassed(filter, "/a/b.oo"));
+
+    compileTestFilter(filter, ".git", true, false);
+    CHECK(!isPassed(filter, "/src/.git"));
+    CHECK(!isPassed(filter, "/src/.git/index"));
+    CHECK(isPassed(filter, "/src/.gitignore"));
+    CHECK(isPassed(filter, "/src/x.git"));
+
+    compileTestFilter(filter, "/a/*.o", true, false);
+    CHECK(!isPassed(filter, "/a/b.o"));
+    CHECK(!isPassed(filter, "/a/.o"));
+    CHECK(isPassed(filter, "/a/c/b.o"));
+    CHECK(isPassed(filter, "/x/a/b.o"));
+}
+
+//-----------------------------------------------------------------------------
+// A '**' matches across path components, and "**/" also matches no components at all.
+
+static void testGlobDoubleStar()
+{
+    PathFilter_t filter;
+    compileTestFilter(filter, "/src/**/*.tmp", true, false);
+    CHECK(!isPassed(filter, "/src/a.tmp"));
+    CHECK(!isPassed(filter, "/src/a/b/c.tmp"));
+    CHECK(isPassed(filter, "/src/a/b/c.txt"));
+    CHECK(isPassed(filter, "/other/a.tmp"));
+
+    compileTestFilter(filter, "/src/**.tmp", true, false);
+    CHECK(!isPassed(filter, "/src/a/b.tmp"));
+    CHECK(isPassed(filter, "/src/a/b.txt"));
+}
+
+//-----------------------------------------------------------------------------
+// A '?' matches one character other than '/', and '[...]' a character class, which '!' or '^' negates. A '[' without a closing ']' is a literal.
+
+static void testGlobClasses()
+{
+    PathFilter_t filter;
+    compileTestFilter(filter, "file?.[ch]", true, false);
+    CHECK(!isPassed(filter, "/x/file1.c"));
+    CHECK(!isPassed(filter, "/x/fileA.h"));
+    CHECK(isPassed(filter, "/x/file12.c"));
+    CHECK(isPassed(filter, "/x/file.c"));
+    CHECK(isPassed(filter, "/x/file1.o"));
+
+    compileTestFilter(filter, "/x/log[0-9]", true, false);
+    CHECK(!isPassed(filter, "/x/log7"));
+    CHECK(isPassed(filter, "/x/logA"));
+
+    compileTestFilter(filter, "/x/[!a-m]*", true, false);
+    CHECK(!isPassed(filter, "/x/z"));
+    CHECK(isPassed(filter, "/x/b"));
+
+    compileTestFilter(filter, "/x/a?b", true, false);
+    CHECK(isPassed(filter, "/x/a/b"));
+
+    compileTestFilter(filter, "/x/[ab", true, false);
+    CHECK(!isPassed(filter, "/x/[ab"));
+    CHECK(isPassed(filter, "/x/a"));
+}
+
+//-----------------------------------------------------------------------------
+// A regex matches anywhere in the path, unless it is anchored with '^' or '$'.
+
+static void testRegexAnchors()
+{
+    PathFilter_t filter;
+    compileTestFilter(filter, "log", true, true);
+    CHECK(!isPassed(filter, "/a/blog/x"));
+    CHECK(!isPassed(filter, "/log"));
+    CHECK(isPassed(filter, "/a/lo/g"));
+
+    compileTestFilter(filter, "^/tmp/", true, true);
+    CHECK(!isPassed(filter, "/tmp/a"));
+    CHECK(isPassed(filter, "/x/tmp/a"));
+    CHECK(isPassed(filter, "/tmp"));
+
+    compileTestFilter(filter, "\\.log$", true, true);
+    CHECK(!isPassed(filter, "/a/b.log"));
+    CHECK(isPassed(filter, "/a/b.log/c"));
+    CHECK(isPassed(filter, "/a/bxlog"));
+
+    compileTestFilter(filter, "^/a$", true, true);
+    CHECK(!isPassed(filter, "/a"));
+    CHECK(isPassed(filter, "/a/b"));
+    CHECK(isPassed(filter, "/b/a"));
+
+    compileTestFilter(filter, "a$b", true, true);
+    CHECK(!isPassed(filter, "/a$b"));
+    CHECK(isPassed(filter, "/ab"));
+}
+
+//-----------------------------------------------------------------------------
+// Alternation, grouping and repetition.
+
+static void testRegexAlternation()
+{
+    PathFilter_t filter;
+    compileTestFilter(filter, "^/(usr|opt)/(bin|lib)+/", true, true);
+    CHECK(!isPassed(filter, "/usr/bin/ls"));
+    CHECK(!isPassed(filter, "/opt/libbin/x"));
+    CHECK(isPassed(filter, "/usr/sbin/x"));
+    CHECK(isPassed(filter, "/var/usr/bin/x"));
+    CHECK(isPassed(filter, "/opt//x"));
+
+    compileTestFilter(filter, "^/x/ab?c*d$", true, true);
+    CHECK(!isPassed(filter, "/x/ad"));
+    CHECK(!isPassed(filter, "/x/abcccd"));
+    CHECK(isPassed(filter, "/x/abbd"));
+
+    compileTestFilter(filter, "^/x/[^/]+\\.(c|h)$", true, true);
+    CHECK(!isPassed(filter, "/x/a.c"));
+    CHECK(isPassed(filter, "/x/a/b.c"));
+    CHECK(isPassed(filter, "/x/.c"));
+}
+
+//-----------------------------------------------------------------------------
+// A path passes if it matches no exclude pattern and, if there are any include patterns, at least one of those.
+
+static void testIncludeExcludePrecedence()
+{
+    std::vector<PathPattern_t> patterns;
+    patterns.push_back(PathPattern_t("/src", false, false));
+    patterns.push_back(PathPattern_t("\\.txt$", false, true));
+    patterns.push_back(PathPattern_t("*.o", true, false));
+    patterns.push_back(PathPattern_t("^/src/gen/", true, true));
+
+    PathFilter_t filter;
+    std::string error;
+    CHECK(filter.compile(patterns, error));
+    CHECK(filter.getNumDfas() == 1);
+    CHECK(isPassed(filter, "/src/a.c"));
+    CHECK(isPassed(filter, "/other/a.txt"));
+    CHECK(!isPassed(filter, "/other/a.c"));
+    CHECK(!isPassed(filter, "/src/a.o"));
+    CHECK(!isPassed(filter, "/other/b.o/a.txt"));
+    CHECK(!isPassed(filter, "/src/gen/a.c"));
+    CHECK(!isPassed(filter, "/src/gen/a.txt"));
+
+    // With only exclude patterns, everything else passes.
+    patterns.erase(patterns.begin(), patterns.begin() + 2);
+    CHECK(filter.compile(patterns, error));
+    CHECK(isPassed(filter, "/other/a.c"));
+    CHECK(!isPassed(filter, "/other/a.o"));
+}
+
+//-----------------------------------------------------------------------------
+// An invalid pattern is reported, and leaves the filter as it was.
+
+static void testInvalidPatterns()
+{
+    PathFilter_t filter;
+    compileTestFilter(filter, "*.o", true, false);
+
+    char const * invalid [] = { "(ab", "ab)", "*a", "a|+", "[ab", "[z-a]", "ab\\" };
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); ++i) {
+        std::vector<PathPattern_t> patterns;
+        patterns.push_back(PathPattern_t("*.c", true, false));
+        patterns.push_back(PathPattern_t(invalid[i], true, true));
+        std::string error;
+        CHECK(!filter.compile(patterns, error));
+        CHECK(!error.empty());
+        CHECK(!isPassed(filter, "/a/b.o"));
+        CHECK(isPassed(filter, "/a/b.c"));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Patterns that blow up when combined into one DFA are split into several, and still match as they would one at a time. A single pattern that is too complex by itself is rejected.
+
+static void testManyComplexPatterns()
+{
+    std::vector<PathPattern_t> patterns;
+    for (int i = 0; i < 30; ++i) {
+        char text [32];
+        snprintf(text, sizeof(text), "*a*b%d*", i);
+        patterns.push_back(PathPattern_t(text, true, false));
+    }
+    patterns.push_back(PathPattern_t("/keep", false, false));
+
+    PathFilter_t filter;
+    std::string error;
+    CHECK(filter.compile(patterns, error));
+    CHECK(filter.getNumDfas() > 1);
+
+    char const * paths [] = { "/keep/xa_b7_", "/keep/a/b29/c", "/keep/b7a", "/keep/ab", "/keep/zab30", "/keep/ab3", "/other/ab7", "/keep" };
+    for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); ++i) {
+        bool isExcluded = false;
+        for (size_t j = 0; j + 1 < patterns.size(); ++j) {
+            PathFilter_t single;
+            compileTestFilter(single, patterns[j].text_m.c_str(), true, false);
+            isExcluded = isExcluded || !isPassed(single, paths[i]);
+        }
+        bool isIncluded = strncmp(paths[i], "/keep", 5) == 0;
+        CHECK(isPassed(filter, paths[i]) == (isIncluded && !isExcluded));
+    }
+    CHECK(!isPassed(filter, "/keep/xa_b7_"));
+    CHECK(isPassed(filter, "/keep/b7a"));
+
+    // A DFA for this has to remember the last 14 characters.
+    std::string tooComplex = "a";
+    for (int i = 0; i < 13; ++i) {
+        tooComplex += "[ab]";
+    }
+    std::vector<PathPattern_t> tooComplexPatterns;
+    tooComplexPatterns.push_back(PathPattern_t("*.o", true, false));
+    tooComplexPatterns.push_back(PathPattern_t(tooComplex + "$", true, true));
+    CHECK(!filter.compile(tooComplexPatterns, error));
+    CHECK(error.find("too complex") != std::string::npos);
+    CHECK(!isPassed(filter, "/keep/xa_b7_"));
+    CHECK(isPassed(filter, "/keep/b7a"));
+}
+
+//-----------------------------------------------------------------------------
+
+void runPathFilterTests()
+{
+    testEmptyFilter();
+    testGlobStar();
+    testGlobDoubleStar();
+    testGlobClasses();
+    testRegexAnchors();
+    testRegexAlternation();
+    testIncludeExcludePrecedence();
+    testInvalidPatterns();
+    testManyComplexPatterns();
+}
@@ -0,0 +1,58 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <signal.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+
+#include "EventFormatter.h"
+#include "ProcNameCache.h"
+#include "Test.h"
+
+//-----------------------------------------------------------------------------
+// A cached name is the process's name, and is dropped once the process has exited, so that its pid is looked up afresh.
+
+static void testExitedProcessIsForgotten()
+{
+    ProcNameCache_t cache;
+    CHECK(std::string(cache.getName(getpid())) == getProcessName(getpid()));
+
+    pid_t child = fork();
+    if (child == 0) {
+        pause();
+        _exit(0);
+    }
+    CHECK(child > 0);
+
+    std::string name = cache.getName(child);
+    CHECK(name == getProcessName(child));
+
+    kill(child, SIGKILL);
+    waitpid(child, NULL, 0);
+    cache.expireExited();
+    CHECK(std::string(cache.getName(child)) == getProcessName(child));
+}
+
+//-----------------------------------------------------------------------------
+
+void runProcNameCacheTests()
+{
+    testExitedProcessIsForgotten();
+}
@@ -0,0 +1,249 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+#include "EventView.h"
+#include "fsevents.h"
+#include "ShmRing.h"
+#include "ShmRingReader.h"
+#include "Test.h"
+
+// The smallest ring, so that the tests wrap around it quickly.
+static size_t const TEST_RING_SIZE = 4096;
+
+//-----------------------------------------------------------------------------
+// A ring written and read by the test, with a writable mapping of its own to look at and tamper with the header and the records as the writer would.
+
+class TestRing_t
+{
+public:
+
+    std::string name_m;
+    ShmRing_t ring_m;
+    ShmRingReader_t reader_m;
+    ShmRingHeader_t * header_pm;
+    char * data_pm;
+
+    // Constructor. Creates the ring and opens the reader on it.
+    TestRing_t()
+        : header_pm(NULL),
+          data_pm(NULL)
+    {
+        char name [64];
+        snprintf(name, sizeof(name), "/filemon-tests-%d", (int) getpid());
+        name_m = name;
+
+        std::string error;
+        CHECK(ring_m.open(name, TEST_RING_SIZE, error));
+        CHECK(reader_m.open(name, error));
+
+        int fd = shm_open(name, O_RDWR, 0);
+        CHECK(fd >= 0);
+        void * p = mmap(NULL, SHM_RING_DATA_OFFSET + TEST_RING_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        CHECK(p != MAP_FAILED);
+        header_pm = (ShmRingHeader_t *) p;
+        data_pm = (char *) p + SHM_RING_DATA_OFFSET;
+    }
+
+    // Destructor.
+    ~TestRing_t()
+    {
+        munmap(header_pm, SHM_RING_DATA_OFFSET + TEST_RING_SIZE);
+        shm_unlink(name_m.c_str());
+    }
+
+    // Publishes an event with a path, returning the size of its record.
+    size_t publish(pid_t pid, std::string const & path)
+    {
+        std::vector<char> buf;
+        appendTestEvent(buf, FSE_CREATE_FILE, pid, path.c_str());
+        EventIterator_t iter(&buf[0], buf.size());
+        EventView_t event;
+        CHECK(iter.next(event));
+        ring_m.publish(event, 1, pid, 0);
+        return getShmRingRecordSize(1, path.size() + 1, event.size_m);
+    }
+
+    // Reads an event, checking that it is the one published with a pid and path.
+    void checkRead(pid_t pid, std::string const & path)
+    {
+        ShmRingEvent_t event;
+        CHECK(reader_m.read(event, 0) == ShmRingReader_t::READ_EVENT);
+        CHECK(event.pid_m == pid);
+        CHECK(event.eventNumber_m == (uint64_t) pid);
+        CHECK(event.numPaths_m == 1);
+        CHECK(std::string(event.paths_apm[0], event.pathLens_am[0]) == path);
+    }
+
+    // Checks that there is nothing to read.
+    void checkNothingToRead()
+    {
+        ShmRingEvent_t event;
+        CHECK(reader_m.read(event, 0) == ShmRingReader_t::READ_TIMEOUT);
+    }
+
+private:
+
+    // Not copyable.
+    TestRing_t(TestRing_t const &);
+    TestRing_t & operator=(TestRing_t const &);
+};
+
+//-----------------------------------------------------------------------------
+// Make a path of a given length, which varies the sizes of the records.
+
+static std::string makeTestPath(size_t len)
+{
+    std::string path = "/tmp/";
+    while (path.size() < len) {
+        path += 'a' + (char) (path.size() % 26);
+    }
+    return path;
+}
+
+//-----------------------------------------------------------------------------
+// A reader that keeps up reads every event as it was published, as the writer wraps around the ring many times, and skips the padding records before the records that don't fit at the end.
+
+static void testWraparound()
+{
+    TestRing_t ring;
+    size_t numPads = 0;
+    for (pid_t pid = 1; pid <= 1000; ++pid) {
+        std::string path = makeTestPath(10 + pid * 37 % 300);
+        uint64_t pos = ring.header_pm->writePos_m;
+        size_t room = TEST_RING_SIZE - (pos & (TEST_RING_SIZE - 1));
+        size_t size = ring.publish(pid, path);
+
+        // A record that doesn't fit goes at the start of the ring, after a padding record that fills the rest.
+        if (room < size) {
+            uint32_t pad [2];
+            memcpy(pad, ring.data_pm + (pos & (TEST_RING_SIZE - 1)), sizeof(pad));
+            CHECK(pad[0] == room);
+            CHECK(pad[1] == SHM_RING_PAD);
+            CHECK(ring.header_pm->writePos_m == pos + room + size);
+            numPads++;
+        }
+        else {
+            CHECK(ring.header_pm->writePos_m == pos + size);
+        }
+
+        ring.checkRead(pid, path);
+    }
+
+    CHECK(ring.header_pm->writePos_m > 20 * TEST_RING_SIZE);
+    CHECK(numPads > 10);
+    CHECK(ring.reader_m.getNumLost() == 0);
+    ring.checkNothingToRead();
+}
+
+//-----------------------------------------------------------------------------
+// A reader that falls more than the ring's capacity behind skips to the newest event, and counts the events it missed as lost.
+
+static void testLapped()
+{
+    TestRing_t ring;
+    std::string path = makeTestPath(100);
+    size_t size = ring.publish(1, path);
+    ring.checkRead(1, path);
+
+    pid_t pid = 2;
+    while (ring.header_pm->writePos_m - size <= TEST_RING_SIZE) {
+        ring.publish(pid++, path);
+    }
+    ring.checkNothingToRead();
+
+    ring.publish(pid, path);
+    ring.checkRead(pid, path);
+    CHECK(ring.reader_m.getNumLost() == (uint64_t) (pid - 2));
+}
+
+//-----------------------------------------------------------------------------
+// A reader whose record is overwritten while it is copying it out, as the writer's reserved position shows, discards the copy and resumes at the newest event, and the events it missed are counted as lost.
+
+static void testOverrunMidCopy()
+{
+    TestRing_t ring;
+    std::string path = makeTestPath(100);
+    size_t size = ring.publish(1, path);
+    for (pid_t pid = 2; pid <= 5; ++pid) {
+        ring.publish(pid, path);
+    }
+    ring.checkRead(1, path);
+
+    // The writer has claimed the bytes a lap past the reader's next record, and is part way through writing over it.
+    ring.header_pm->reservePos_m = size + TEST_RING_SIZE + 8;
+    ring.checkNothingToRead();
+
+    // The writer finishes, and the reader picks up after the events it missed.
+    ring.header_pm->reservePos_m = ring.header_pm->writePos_m;
+    ring.publish(6, path);
+    ring.checkRead(6, path);
+    CHECK(ring.reader_m.getNumLost() == 4);
+}
+
+//-----------------------------------------------------------------------------
+// A reader knows that the writer has gone once it closes the ring, or if its process has exited without closing it, or if its pid now belongs to a process that started later.
+
+static void testWriterGone()
+{
+    {
+        TestRing_t ring;
+        ring.checkNothingToRead();
+        ring.ring_m.close();
+        ShmRingEvent_t event;
+        CHECK(ring.reader_m.read(event, 0) == ShmRingReader_t::READ_CLOSED);
+    }
+
+    {
+        TestRing_t ring;
+        pid_t child = fork();
+        if (child == 0) {
+            _exit(0);
+        }
+        CHECK(child > 0 && waitpid(child, NULL, 0) == child);
+        ring.header_pm->writerPid_m = child;
+        ShmRingEvent_t event;
+        CHECK(ring.reader_m.read(event, 0) == ShmRingReader_t::READ_CLOSED);
+    }
+
+    {
+        TestRing_t ring;
+        ring.header_pm->writerStartUsec_m = getShmRingProcessStartUsec(getpid()) + 1;
+        ShmRingEvent_t event;
+        CHECK(ring.reader_m.read(event, 0) == ShmRingReader_t::READ_CLOSED);
+    }
+}
+
+//-----------------------------------------------------------------------------
+
+void runShmRingTests()
+{
+    testWraparound();
+    testLapped();
+    testOverrunMidCopy();
+    testWriterGone();
+}
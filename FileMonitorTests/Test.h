@@ -0,0 +1,51 @@
+#ifndef __INC_Test_H
+#define __INC_Test_H
+
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include <vector>
+
+// Checks a condition, reporting the check and counting it as failed if it doesn't hold. The test run carries on after a failed check.
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            reportCheckFailure(__FILE__, __LINE__, #cond); \
+        } \
+    } while (0)
+
+// Reports a failed check.
+void reportCheckFailure(char const * file, int line, char const * expr);
+
+// Returns the number of failed checks so far.
+int getNumCheckFailures();
+
+// Appends an event in the kernel's byte layout to a buffer, with one or two paths, e.g. the source and destination of a rename, followed by an inode, a mode, a uid and a gid argument, and the end marker.
+void appendTestEvent(std::vector<char> & buf, int32_t type, pid_t pid, char const * path, char const * path2 = NULL);
+
+// The test suites.
+void runEventReaderTests();
+void runJournalTests();
+void runPathFilterTests();
+void runProcNameCacheTests();
+void runShmRingTests();
+
+#endif // __INC_Test_H
@@ -0,0 +1,39 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+
+#include "Test.h"
+
+//-----------------------------------------------------------------------------
+
+int main()
+{
+    runEventReaderTests();
+    runJournalTests();
+    runPathFilterTests();
+    runProcNameCacheTests();
+    runShmRingTests();
+
+    int numFailures = getNumCheckFailures();
+    if (numFailures != 0) {
+        fprintf(stderr, "%d checks failed\n", numFailures);
+        return 1;
+    }
+    printf("All tests passed\n");
+    return 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * Copyright 2008-2016 Douglas Patriarche
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "fsevents.h"
+#include "Test.h"
+
+// The number of failed checks.
+static int numCheckFailures_s = 0;
+
+//-----------------------------------------------------------------------------
+
+void reportCheckFailure(char const * file, int line, char const * expr)
+{
+    fprintf(stderr, "FAILED: %s:%d: %s\n", file, line, expr);
+    numCheckFailures_s += 1;
+}
+
+//-----------------------------------------------------------------------------
+
+int getNumCheckFailures()
+{
+    return numCheckFailures_s;
+}
+
+//-----------------------------------------------------------------------------
+// Append an event argument.
+
+static void appendArg(std::vector<char> & buf, uint16_t type, void const * data, uint16_t len)
+{
+    buf.insert(buf.end(), (char const *) &type, (char const *) &type + sizeof(type));
+    buf.insert(buf.end(), (char const *) &len, (char const *) &len + sizeof(len));
+    buf.insert(buf.end(), (char const *) data, (char const *) data + len);
+}
+
+//-----------------------------------------------------------------------------
+
+void appendTestEvent(std::vector<char> & buf, int32_t type, pid_t pid, char const * path, char const * path2)
+{
+    buf.insert(buf.end(), (char const *) &type, (char const *) &type + sizeof(type));
+    buf.insert(buf.end(), (char const *) &pid, (char const *) &pid + sizeof(pid));
+
+    appendArg(buf, FSE_ARG_STRING, path, (uint16_t) (strlen(path) + 1));
+    if (path2 != NULL) {
+        appendArg(buf, FSE_ARG_STRING, path2, (uint16_t) (strlen(path2) + 1));
+    }
+
+    uint64_t inode = 1000 + buf.size();
+    int32_t mode = 0100644;
+    uint32_t uid = 501;
+    uint32_t gid = 20;
+    appendArg(buf, FSE_ARG_INO, &inode, sizeof(inode));
+    appendArg(buf, FSE_ARG_MODE, &mode, sizeof(mode));
+    appendArg(buf, FSE_ARG_UID, &uid, sizeof(uid));
+    appendArg(buf, FSE_ARG_GID, &gid, sizeof(gid));
+
+    uint16_t done = FSE_ARG_DONE;
+    buf.insert(buf.end(), (char const *) &done, (char const *) &done + sizeof(done));
+}